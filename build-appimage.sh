@@ -9,7 +9,7 @@ fi
 
 set -e
 
-libs="libnopoll libspice-client-glib libspice-client-gtk libssl libcrypto libjpeg libusbredir \
+libs="libspice-client-glib libspice-client-gtk libssl libcrypto libjpeg libusbredir \
       libcups libflexvdi-spice-client libpulse libva libgstreamer-1 libffi $*"
 libs=$(for lib in $libs; do echo -n "-e $lib "; done)
 if ldd "$BIN" | grep -q libva; then
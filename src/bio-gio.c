@@ -19,6 +19,7 @@
 
 #include <string.h>
 #include <glib.h>
+#include <openssl/ssl.h>
 
 #include "spice-util.h"
 #include "bio-gio.h"
@@ -184,3 +185,34 @@ BIO* bio_new_giostream(GIOStream *stream)
     BIO_set_data(bio, stream);
     return bio;
 }
+
+G_GNUC_INTERNAL
+BIO* bio_new_ktls_socket(GSocketConnection *conn, SSL *ssl)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    GSocket *sock = g_socket_connection_get_socket(conn);
+
+    /* a proxy may still be in the way, keep going through its stream */
+    if (G_IS_TCP_WRAPPER_CONNECTION(conn) ||
+        g_socket_get_protocol(sock) != G_SOCKET_PROTOCOL_TCP)
+        return NULL;
+
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    return BIO_new_socket(g_socket_get_fd(sock), BIO_NOCLOSE);
+#else
+    return NULL;
+#endif
+}
+
+G_GNUC_INTERNAL
+gboolean bio_get_ktls(BIO *bio, gboolean *send, gboolean *recv)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    *send = BIO_get_ktls_send(bio) > 0;
+    *recv = BIO_get_ktls_recv(bio) > 0;
+    return TRUE;
+#else
+    *send = *recv = FALSE;
+    return FALSE;
+#endif
+}
@@ -19,12 +19,24 @@
 # define BIO_GIO_H_
 
 #include <openssl/bio.h>
+#include <openssl/ssl.h>
 #include <gio/gio.h>
 
 G_BEGIN_DECLS
 
 BIO* bio_new_giostream(GIOStream *stream);
 
+/* A BIO on the socket of @conn itself, rather than on its stream, so that
+ * OpenSSL can hand the record encryption of @ssl over to the kernel (kTLS)
+ * once the handshake is done, if the kernel and the negotiated cipher
+ * allow it. Returns NULL when OpenSSL has no kTLS support or when @conn is
+ * not a plain TCP connection. */
+BIO* bio_new_ktls_socket(GSocketConnection *conn, SSL *ssl);
+
+/* Whether the kernel encrypts what is sent and decrypts what is received
+ * through @bio, returns FALSE when OpenSSL has no kTLS support */
+gboolean bio_get_ktls(BIO *bio, gboolean *send, gboolean *recv);
+
 G_END_DECLS
 
 #endif /* !BIO_GIO_H_ */
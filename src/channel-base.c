@@ -49,6 +49,11 @@ spice_channel_handle_ping(SpiceChannel *channel, SpiceMsgIn *in)
 
     c->marshallers->msgc_pong(pong->marshaller, ping);
     spice_msg_out_send_internal(pong);
+
+    /* the timestamp is the server monotonic time, in nanoseconds */
+    spice_session_net_add_delay(c->session, SPICE_NET_CLOCK_PING,
+                                g_get_monotonic_time() - (gint64)(ping->timestamp / 1000));
+    spice_channel_sample_rtt(channel);
 }
 
 /* coroutine context */
@@ -0,0 +1,31 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_CURSOR_CHANNEL_PRIV_H__
+#define __SPICE_CLIENT_CURSOR_CHANNEL_PRIV_H__
+
+#include <glib.h>
+#include "common/messages.h"
+
+G_BEGIN_DECLS
+
+gboolean spice_cursor_convert(const SpiceCursorHeader *hdr, const guint8 *data,
+                              guint32 *dest);
+
+G_END_DECLS
+
+#endif
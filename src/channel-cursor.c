@@ -23,6 +23,7 @@
 #include "spice-channel-priv.h"
 #include "spice-channel-cache.h"
 #include "spice-marshal.h"
+#include "channel-cursor-priv.h"
 
 /**
  * SECTION:channel-cursor
@@ -285,26 +286,26 @@ static void spice_cursor_channel_class_init(SpiceCursorChannelClass *klass)
 /* ------------------------------------------------------------------ */
 
 #ifdef DEBUG_CURSOR
-static void print_cursor(display_cursor *cursor, const guint8 *data)
+static void print_cursor(const SpiceCursorHeader *hdr, const guint8 *data)
 {
     int x, y, bpl;
     const guint8 *xor, *and;
 
-    bpl = (cursor->hdr.width + 7) / 8;
+    bpl = (hdr->width + 7) / 8;
     and = data;
-    xor = and + bpl * cursor->hdr.height;
+    xor = and + bpl * hdr->height;
 
-    printf("data (%d x %d):\n", cursor->hdr.width, cursor->hdr.height);
-    for (y = 0 ; y < cursor->hdr.height; ++y) {
-        for (x = 0 ; x < cursor->hdr.width / 8; x++) {
+    printf("data (%d x %d):\n", hdr->width, hdr->height);
+    for (y = 0 ; y < hdr->height; ++y) {
+        for (x = 0 ; x < hdr->width / 8; x++) {
             printf("%02X", and[x]);
         }
         and += bpl;
         printf("\n");
     }
     printf("xor:\n");
-    for (y = 0 ; y < cursor->hdr.height; ++y) {
-        for (x = 0 ; x < cursor->hdr.width / 8; ++x) {
+    for (y = 0 ; y < hdr->height; ++y) {
+        for (x = 0 ; x < hdr->width / 8; ++x) {
             printf("%02X", xor[x]);
         }
         xor += bpl;
@@ -313,20 +314,18 @@ static void print_cursor(display_cursor *cursor, const guint8 *data)
 }
 #endif
 
-static void mono_cursor(display_cursor *cursor, const guint8 *data)
+static void mono_cursor(const SpiceCursorHeader *hdr, const guint8 *data, guint32 *dest)
 {
-    int bpl = (cursor->hdr.width + 7) / 8;
+    int bpl = (hdr->width + 7) / 8;
     const guint8 *xor, *and;
-    guint8 *dest;
-    dest = (uint8_t *)cursor->data;
 
 #ifdef DEBUG_CURSOR
-    print_cursor(cursor, data);
+    print_cursor(hdr, data);
 #endif
     and = data;
-    xor = and + bpl * cursor->hdr.height;
-    spice_mono_edge_highlight(cursor->hdr.width, cursor->hdr.height,
-                              and, xor, dest);
+    xor = and + bpl * hdr->height;
+    spice_mono_edge_highlight(hdr->width, hdr->height,
+                              and, xor, (guint8 *)dest);
 }
 
 static guint8 get_pix_mask(const guint8 *data, gint offset, gint pix_index)
@@ -339,6 +338,79 @@ static guint32 get_pix_hack(gint pix_index, gint width)
     return (((pix_index % width) ^ (pix_index / width)) & 1) ? 0xc0303030 : 0x30505050;
 }
 
+/* Converts the cursor @data, of the type and size given by @hdr, to the
+ * RGBA pixels of @dest. Returns %FALSE if the type is not supported. */
+G_GNUC_INTERNAL
+gboolean spice_cursor_convert(const SpiceCursorHeader *hdr, const guint8 *data,
+                              guint32 *dest)
+{
+    size_t size = 4u * hdr->width * hdr->height;
+    guint32 i, pix_mask, pix;
+    guint8 *rgba;
+    guint8 val;
+    guint32 palette[16];
+
+    switch (hdr->type) {
+    case SPICE_CURSOR_TYPE_MONO:
+        mono_cursor(hdr, data, dest);
+        break;
+    case SPICE_CURSOR_TYPE_ALPHA:
+        memcpy(dest, data, size);
+        break;
+    case SPICE_CURSOR_TYPE_COLOR32:
+        memcpy(dest, data, size);
+        for (i = 0; i < hdr->width * hdr->height; i++) {
+            pix_mask = get_pix_mask(data, size, i);
+            if (pix_mask && dest[i] == 0xffffff) {
+                dest[i] = get_pix_hack(i, hdr->width);
+            } else {
+                dest[i] |= (pix_mask ? 0 : 0xff000000);
+            }
+        }
+        break;
+    case SPICE_CURSOR_TYPE_COLOR16:
+        size /= 2u;
+        for (i = 0; i < hdr->width * hdr->height; i++) {
+            pix_mask = get_pix_mask(data, size, i);
+            pix = *(SPICE_UNALIGNED_CAST(guint16 *, data) + i);
+            if (pix_mask && pix == 0x7fff) {
+                dest[i] = get_pix_hack(i, hdr->width);
+            } else {
+                dest[i] = ((pix & 0x1f) << 3) | ((pix & 0x3e0) << 6) |
+                    ((pix & 0x7c00) << 9) | (pix_mask ? 0 : 0xff000000);
+            }
+        }
+        break;
+    case SPICE_CURSOR_TYPE_COLOR4:
+        size = ((unsigned int)(SPICE_ALIGN(hdr->width, 2) / 2)) * hdr->height;
+        memcpy(palette, data + size, sizeof(palette));
+        for (i = 0; i < hdr->width * hdr->height; i++) {
+            pix_mask = get_pix_mask(data, size + (sizeof(uint32_t) << 4), i);
+            int idx = (i & 1) ? (data[i >> 1] & 0x0f) : ((data[i >> 1] & 0xf0) >> 4);
+            pix = palette[idx];
+            if (pix_mask && pix == 0xffffff) {
+                dest[i] = get_pix_hack(i, hdr->width);
+            } else {
+                dest[i] = pix | (pix_mask ? 0 : 0xff000000);
+            }
+        }
+
+        break;
+    default:
+        return FALSE;
+    }
+
+    rgba = (guint8*)dest;
+    for (i = 0; i < hdr->width * hdr->height; i++) {
+        val = rgba[0];
+        rgba[0] = rgba[2];
+        rgba[2] = val;
+        rgba += 4;
+    }
+
+    return TRUE;
+}
+
 static display_cursor * display_cursor_ref(display_cursor *cursor)
 {
     g_return_val_if_fail(cursor != NULL, NULL);
@@ -381,11 +453,6 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
     SpiceCursorHeader *hdr = &scursor->header;
     display_cursor *cursor;
     size_t size;
-    guint32 i, pix_mask, pix;
-    const guint8* data;
-    guint8 *rgba;
-    guint8 val;
-    guint32 palette[16];
 
     CHANNEL_DEBUG(channel, "%s: flags %x, size %u", __FUNCTION__,
                   scursor->flags, scursor->data_size);
@@ -422,70 +489,13 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
     cursor->hdr = *hdr;
     cursor->default_cursor = FALSE;
     cursor->refcount = 1;
-    data = scursor->data;
 
-    switch (hdr->type) {
-    case SPICE_CURSOR_TYPE_MONO:
-        mono_cursor(cursor, data);
-        break;
-    case SPICE_CURSOR_TYPE_ALPHA:
-        memcpy(cursor->data, data, size);
-        break;
-    case SPICE_CURSOR_TYPE_COLOR32:
-        memcpy(cursor->data, data, size);
-        for (i = 0; i < hdr->width * hdr->height; i++) {
-            pix_mask = get_pix_mask(data, size, i);
-            if (pix_mask && cursor->data[i] == 0xffffff) {
-                cursor->data[i] = get_pix_hack(i, hdr->width);
-            } else {
-                cursor->data[i] |= (pix_mask ? 0 : 0xff000000);
-            }
-        }
-        break;
-    case SPICE_CURSOR_TYPE_COLOR16:
-        size /= 2u;
-        for (i = 0; i < hdr->width * hdr->height; i++) {
-            pix_mask = get_pix_mask(data, size, i);
-            pix = *(SPICE_UNALIGNED_CAST(guint16 *, data) + i);
-            if (pix_mask && pix == 0x7fff) {
-                cursor->data[i] = get_pix_hack(i, hdr->width);
-            } else {
-                cursor->data[i] |= ((pix & 0x1f) << 3) | ((pix & 0x3e0) << 6) |
-                    ((pix & 0x7c00) << 9) | (pix_mask ? 0 : 0xff000000);
-            }
-        }
-        break;
-    case SPICE_CURSOR_TYPE_COLOR4:
-        size = ((unsigned int)(SPICE_ALIGN(hdr->width, 2) / 2)) * hdr->height;
-        memcpy(palette, data + size, sizeof(palette));
-        for (i = 0; i < hdr->width * hdr->height; i++) {
-            pix_mask = get_pix_mask(data, size + (sizeof(uint32_t) << 4), i);
-            int idx = (i & 1) ? (data[i >> 1] & 0x0f) : ((data[i >> 1] & 0xf0) >> 4);
-            pix = palette[idx];
-            if (pix_mask && pix == 0xffffff) {
-                cursor->data[i] = get_pix_hack(i, hdr->width);
-            } else {
-                cursor->data[i] = pix | (pix_mask ? 0 : 0xff000000);
-            }
-        }
-
-        break;
-    default:
+    if (!spice_cursor_convert(hdr, scursor->data, cursor->data)) {
         g_warning("%s: unimplemented cursor type %d", __FUNCTION__,
                   hdr->type);
         cursor->default_cursor = TRUE;
-        goto cache_add;
-    }
-
-    rgba = (guint8*)cursor->data;
-    for (i = 0; i < hdr->width * hdr->height; i++) {
-        val = rgba[0];
-        rgba[0] = rgba[2];
-        rgba[2] = val;
-        rgba += 4;
     }
 
-cache_add:
     if (scursor->flags & SPICE_CURSOR_FLAGS_CACHE_ME) {
         cache_add(c->cursors, hdr->unique, display_cursor_ref(cursor));
     }
@@ -578,8 +588,9 @@ static void cursor_handle_move(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_return_if_fail(c->init_done == TRUE);
 
-    g_coroutine_signal_emit(channel, signals[SPICE_CURSOR_MOVE], 0,
-                            move->position.x, move->position.y);
+    g_coroutine_signal_emit_batched(channel, signals[SPICE_CURSOR_MOVE], 0,
+                                    NULL, NULL,
+                                    move->position.x, move->position.y);
 }
 
 /* coroutine context */
@@ -44,6 +44,7 @@ typedef struct SpiceGstDecoder {
     /* ---------- Decoding and display queues ---------- */
 
     uint32_t last_mm_time;
+    gint64 last_sample_time;
 
     GMutex queues_mutex;
     GQueue *decoding_queue;
@@ -76,6 +77,7 @@ typedef enum {
 
 typedef struct SpiceGstFrame {
     GstClockTime timestamp;
+    gint64 queue_time;
     SpiceFrame *frame;
     GstSample *sample;
 } SpiceGstFrame;
@@ -84,6 +86,7 @@ static SpiceGstFrame *create_gst_frame(GstBuffer *buffer, SpiceFrame *frame)
 {
     SpiceGstFrame *gstframe = g_new(SpiceGstFrame, 1);
     gstframe->timestamp = GST_BUFFER_PTS(buffer);
+    gstframe->queue_time = g_get_monotonic_time();
     gstframe->frame = frame;
     gstframe->sample = NULL;
     return gstframe;
@@ -164,27 +167,29 @@ static gboolean display_frame(gpointer video_decoder)
 /* main loop or GStreamer streaming thread */
 static void schedule_frame(SpiceGstDecoder *decoder)
 {
-    guint32 now = stream_get_time(decoder->base.stream);
     g_mutex_lock(&decoder->queues_mutex);
 
     while (!decoder->timer_id) {
         SpiceGstFrame *gstframe = g_queue_peek_head(decoder->display_queue);
+        gint32 delay;
+
         if (!gstframe) {
             break;
         }
 
-        if (spice_mmtime_diff(now, gstframe->frame->mm_time) < 0) {
-            decoder->timer_id = g_timeout_add(gstframe->frame->mm_time - now,
-                                              display_frame, decoder);
+        delay = stream_get_frame_delay(decoder->base.stream, gstframe->frame, TRUE);
+        if (delay > 0) {
+            decoder->timer_id = spice_timeout_add(stream_get_main_context(decoder->base.stream),
+                                                  delay, display_frame, decoder);
         } else if (g_queue_get_length(decoder->display_queue) == 1) {
             /* Still attempt to display the least out of date frame so the
              * video is not completely frozen for an extended period of time.
              */
-            decoder->timer_id = g_timeout_add(0, display_frame, decoder);
+            decoder->timer_id = spice_timeout_add(stream_get_main_context(decoder->base.stream),
+                                                  0, display_frame, decoder);
         } else {
-            SPICE_DEBUG("%s: rendering too late by %u ms (ts: %u, mmtime: %u), dropping",
-                        __FUNCTION__, now - gstframe->frame->mm_time,
-                        gstframe->frame->mm_time, now);
+            SPICE_DEBUG("%s: rendering too late by %d ms (ts: %u), dropping",
+                        __FUNCTION__, -delay, gstframe->frame->mm_time);
             stream_dropped_frame_on_playback(decoder->base.stream);
             g_queue_pop_head(decoder->display_queue);
             free_gst_frame(gstframe);
@@ -223,6 +228,15 @@ static GstFlowReturn new_sample(GstAppSink *gstappsink, gpointer video_decoder)
         while (l) {
             gstframe = l->data;
             if (gstframe->timestamp == GST_BUFFER_PTS(buffer)) {
+                /* The pipeline handles one frame at a time so only count
+                 * the time since the previous one came out of it.
+                 */
+                gint64 now = g_get_monotonic_time();
+                gint64 start = MAX(gstframe->queue_time, decoder->last_sample_time);
+
+                stream_add_decode_time(decoder->base.stream, now - start);
+                decoder->last_sample_time = now;
+
                 /* The frame is now ready for display */
                 gstframe->sample = sample;
                 g_queue_push_tail(decoder->display_queue, gstframe);
@@ -440,7 +454,7 @@ static void spice_gst_decoder_reschedule(VideoDecoder *video_decoder)
 {
     SpiceGstDecoder *decoder = (SpiceGstDecoder*)video_decoder;
     if (decoder->timer_id != 0) {
-        g_source_remove(decoder->timer_id);
+        spice_source_remove(stream_get_main_context(decoder->base.stream), decoder->timer_id);
         decoder->timer_id = 0;
     }
     schedule_frame(decoder);
@@ -461,7 +475,7 @@ static void spice_gst_decoder_destroy(VideoDecoder *video_decoder)
      * scheduled display_frame() call and drop the queued frames.
      */
     if (decoder->timer_id) {
-        g_source_remove(decoder->timer_id);
+        spice_source_remove(stream_get_main_context(decoder->base.stream), decoder->timer_id);
     }
     g_mutex_clear(&decoder->queues_mutex);
     SpiceGstFrame *gstframe;
@@ -526,14 +540,20 @@ static gboolean spice_gst_decoder_queue_frame(VideoDecoder *video_decoder,
     }
     decoder->last_mm_time = frame->mm_time;
 
-    if (latency < 0 &&
-        decoder->base.codec_type == SPICE_VIDEO_CODEC_TYPE_MJPEG) {
+    if (decoder->base.codec_type == SPICE_VIDEO_CODEC_TYPE_MJPEG) {
+        guint queued;
+
+        g_mutex_lock(&decoder->queues_mutex);
+        queued = g_queue_get_length(decoder->decoding_queue);
+        g_mutex_unlock(&decoder->queues_mutex);
+
         /* Dropping MJPEG frames has no impact on those that follow and
-         * saves CPU so do it.
+         * saves CPU so skip those that would be late anyway.
          */
-        SPICE_DEBUG("dropping a late MJPEG frame");
-        frame->free(frame);
-        return TRUE;
+        if (stream_should_skip_frame(decoder->base.stream, frame, queued)) {
+            frame->free(frame);
+            return TRUE;
+        }
     }
 
     if (decoder->pipeline == NULL) {
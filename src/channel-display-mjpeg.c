@@ -96,6 +96,7 @@ static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
     JDIMENSION width, height;
     uint8_t *dest;
     uint8_t *lines[4];
+    gint64 start = g_get_monotonic_time();
 
     jpeg_read_header(&decoder->mjpeg_cinfo, 1);
     width = decoder->mjpeg_cinfo.image_width;
@@ -173,6 +174,7 @@ static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
         dest = &(decoder->out_frame[decoder->mjpeg_cinfo.output_scanline * width * 4]);
     }
     jpeg_finish_decompress(&decoder->mjpeg_cinfo);
+    stream_add_decode_time(decoder->base.stream, g_get_monotonic_time() - start);
 
     /* Display the frame and dispose of it */
     stream_display_frame(decoder->base.stream, decoder->cur_frame,
@@ -196,21 +198,25 @@ static void mjpeg_decoder_schedule(MJpegDecoder *decoder)
         return;
     }
 
-    guint32 time = stream_get_time(decoder->base.stream);
     SpiceFrame *frame = decoder->cur_frame;
     decoder->cur_frame = NULL;
     do {
         if (frame) {
-            if (spice_mmtime_diff(time, frame->mm_time) <= 0) {
-                guint32 d = frame->mm_time - time;
+            /* Start decoding early enough for the frame to be displayed on
+             * time. Still decode the least out of date frame so the video
+             * is not completely frozen for an extended period of time.
+             */
+            gint32 delay = stream_get_frame_delay(decoder->base.stream, frame, FALSE);
+            if (delay >= 0 || g_queue_is_empty(decoder->msgq)) {
                 decoder->cur_frame = frame;
-                decoder->timer_id = g_timeout_add(d, mjpeg_decoder_decode_frame, decoder);
+                decoder->timer_id = spice_timeout_add(stream_get_main_context(decoder->base.stream),
+                                                      MAX(delay, 0), mjpeg_decoder_decode_frame,
+                                                      decoder);
                 break;
             }
 
-            SPICE_DEBUG("%s: rendering too late by %u ms (ts: %u, mmtime: %u), dropping ",
-                        __FUNCTION__, time - frame->mm_time,
-                        frame->mm_time, time);
+            SPICE_DEBUG("%s: rendering too late by %d ms (ts: %u), dropping ",
+                        __FUNCTION__, -delay, frame->mm_time);
             stream_dropped_frame_on_playback(decoder->base.stream);
             free_spice_frame(frame);
         }
@@ -228,7 +234,7 @@ static void _msg_in_unref_func(gpointer data, gpointer user_data)
 static void mjpeg_decoder_drop_queue(MJpegDecoder *decoder)
 {
     if (decoder->timer_id != 0) {
-        g_source_remove(decoder->timer_id);
+        spice_source_remove(stream_get_main_context(decoder->base.stream), decoder->timer_id);
         decoder->timer_id = 0;
     }
     if (decoder->cur_frame) {
@@ -242,7 +248,7 @@ static void mjpeg_decoder_drop_queue(MJpegDecoder *decoder)
 /* ---------- VideoDecoder's public API ---------- */
 
 static gboolean mjpeg_decoder_queue_frame(VideoDecoder *video_decoder,
-                                          SpiceFrame *frame, int32_t latency)
+                                          SpiceFrame *frame, int32_t latency G_GNUC_UNUSED)
 {
     MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
     SpiceFrame *last_frame;
@@ -262,9 +268,12 @@ static gboolean mjpeg_decoder_queue_frame(VideoDecoder *video_decoder,
     }
 
     /* Dropped MJPEG frames don't impact the ones that come after.
-     * So drop late frames as early as possible to save on processing time.
+     * So skip the frames that would be late as early as possible to save on
+     * processing time.
      */
-    if (latency < 0) {
+    if (stream_should_skip_frame(decoder->base.stream, frame,
+                                 g_queue_get_length(decoder->msgq) + (decoder->cur_frame ? 1 : 0))) {
+        frame->free(frame);
         return TRUE;
     }
 
@@ -280,7 +289,7 @@ static void mjpeg_decoder_reschedule(VideoDecoder *video_decoder)
 
     SPICE_DEBUG("%s", __FUNCTION__);
     if (decoder->timer_id != 0) {
-        g_source_remove(decoder->timer_id);
+        spice_source_remove(stream_get_main_context(decoder->base.stream), decoder->timer_id);
         decoder->timer_id = 0;
     }
     mjpeg_decoder_schedule(decoder);
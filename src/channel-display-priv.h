@@ -136,6 +136,11 @@ struct display_stream {
 
     uint32_t             playback_sync_drops_seq_len;
 
+    /* decoding cost, shared by the video decoders to schedule the frames */
+    gint                 decode_time;       /* moving average, in us */
+    uint32_t             num_skipped_frames;
+    uint32_t             skip_seq_len;
+
     /* playback quality report to server */
     gboolean report_is_active;
     uint32_t report_id;
@@ -146,6 +151,8 @@ struct display_stream {
     uint32_t report_num_frames;
     uint32_t report_num_drops;
     uint32_t report_drops_seq_len;
+    guint    report_start_bandwidth;
+    guint    report_num_playback_drops;
 };
 
 static const struct {
@@ -189,7 +196,13 @@ static const struct {
 G_STATIC_ASSERT(G_N_ELEMENTS(gst_opts) <= SPICE_VIDEO_CODEC_TYPE_ENUM_END);
 
 guint32 stream_get_time(display_stream *st);
+GMainContext *stream_get_main_context(display_stream *st);
 void stream_dropped_frame_on_playback(display_stream *st);
+/* Frame skipping and dropping policy shared by the video decoders */
+void stream_add_decode_time(display_stream *st, gint64 duration);
+guint32 stream_get_decode_time(display_stream *st);
+gboolean stream_should_skip_frame(display_stream *st, SpiceFrame *frame, guint queued);
+gint32 stream_get_frame_delay(display_stream *st, SpiceFrame *frame, gboolean decoded);
 #define SPICE_UNKNOWN_STRIDE 0
 void stream_display_frame(display_stream *st, SpiceFrame *frame, uint32_t width, uint32_t height, int stride, uint8_t* data);
 gint64 get_stream_id_by_stream(SpiceChannel *channel, display_stream *st);
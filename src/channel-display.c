@@ -27,6 +27,7 @@
 #include "spice-marshal.h"
 #include "spice-channel-priv.h"
 #include "spice-session-priv.h"
+#include "spice-memory-manager-priv.h"
 #include "channel-display-priv.h"
 #include "decode.h"
 
@@ -71,6 +72,9 @@ struct _SpiceDisplayChannelPrivate {
     guint                       monitors_max;
     gboolean                    enable_adaptive_streaming;
     SpiceGlScanout scanout;
+    /* changed areas of the primary, since spice_display_channel_take_damage() */
+    gboolean                    damage_tracking;
+    pixman_region32_t           damage;
 };
 
 G_DEFINE_TYPE(SpiceDisplayChannel, spice_display_channel, SPICE_TYPE_CHANNEL)
@@ -109,6 +113,8 @@ static void destroy_canvas(display_surface *surface);
 static void destroy_display_stream(display_stream *st, int id);
 static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data);
 static SpiceGlScanout* spice_gl_scanout_copy(const SpiceGlScanout *scanout);
+static void add_damage(SpiceDisplayChannelPrivate *c, gint x, gint y, gint w, gint h);
+static void reset_damage(SpiceDisplayChannelPrivate *c);
 
 G_DEFINE_BOXED_TYPE(SpiceGlScanout, spice_gl_scanout,
                     (GBoxedCopyFunc)spice_gl_scanout_copy,
@@ -148,7 +154,8 @@ static void spice_display_channel_dispose(GObject *object)
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(object)->priv;
 
     if (c->mark_false_event_id != 0) {
-        g_source_remove(c->mark_false_event_id);
+        spice_source_remove(spice_channel_get_main_context(SPICE_CHANNEL(object)),
+                            c->mark_false_event_id);
         c->mark_false_event_id = 0;
     }
 
@@ -170,6 +177,7 @@ static void spice_display_channel_finalize(GObject *object)
     g_hash_table_unref(c->surfaces);
     clear_streams(SPICE_CHANNEL(object));
     g_clear_pointer(&c->palettes, cache_free);
+    pixman_region32_fini(&c->damage);
 
     if (G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize(object);
@@ -517,6 +525,146 @@ gboolean spice_display_channel_get_primary(SpiceChannel *channel, guint32 surfac
     return TRUE;
 }
 
+/**
+ * spice_display_channel_take_damage:
+ * @channel: a #SpiceDisplayChannel
+ * @primary: (out) (optional): a #SpiceDisplayPrimary
+ *
+ * Retrieves the areas of the primary surface that changed since the
+ * previous call, and forgets about them. The first call starts tracking
+ * the changes and returns the whole primary surface, as it does after
+ * the primary surface is replaced.
+ *
+ * This lets a client without a widget, like a recorder, only read the
+ * pixels that changed, with spice_display_channel_copy_primary() or
+ * from @primary's data.
+ *
+ * Returns: (transfer full) (element-type SpiceDisplayRect) (nullable): the
+ * changed rectangles, which may be empty, or %NULL if there is no
+ * primary surface.
+ *
+ * Since: 0.35
+ */
+GArray *spice_display_channel_take_damage(SpiceDisplayChannel *channel,
+                                          SpiceDisplayPrimary *primary)
+{
+    SpiceDisplayChannelPrivate *c;
+    pixman_box32_t *boxes;
+    GArray *rects;
+    int i, n;
+
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), NULL);
+
+    c = channel->priv;
+    if (c->primary == NULL)
+        return NULL;
+
+    if (!c->damage_tracking) {
+        c->damage_tracking = TRUE;
+        reset_damage(c);
+    }
+
+    if (primary != NULL &&
+        !spice_display_channel_get_primary(SPICE_CHANNEL(channel),
+                                           c->primary->surface_id, primary))
+        return NULL;
+
+    boxes = pixman_region32_rectangles(&c->damage, &n);
+    rects = g_array_sized_new(FALSE, FALSE, sizeof(SpiceDisplayRect), n);
+    for (i = 0; i < n; i++) {
+        SpiceDisplayRect rect = {
+            .x = boxes[i].x1,
+            .y = boxes[i].y1,
+            .width = boxes[i].x2 - boxes[i].x1,
+            .height = boxes[i].y2 - boxes[i].y1,
+        };
+        g_array_append_val(rects, rect);
+    }
+    pixman_region32_clear(&c->damage);
+
+    return rects;
+}
+
+/**
+ * spice_display_channel_copy_primary:
+ * @channel: a #SpiceDisplayChannel
+ * @rect: (nullable): the area to copy, or %NULL for the whole surface
+ * @format: the pixel layout of @dest
+ * @dest: (array): the buffer to copy to
+ * @dest_stride: the distance in bytes between the rows of @dest
+ *
+ * Copies @rect from the primary surface to the same position of @dest,
+ * which must be large enough to hold the whole primary surface, with
+ * the layout @format. Only 32 bits primary surfaces are supported.
+ *
+ * Returns: %TRUE if the pixels were copied.
+ *
+ * Since: 0.35
+ */
+gboolean spice_display_channel_copy_primary(SpiceDisplayChannel *channel,
+                                            const SpiceDisplayRect *rect,
+                                            SpiceDisplayBufferFormat format,
+                                            guint8 *dest, gint dest_stride)
+{
+    SpiceDisplayChannelPrivate *c;
+    display_surface *primary;
+    gint x, y, width, height, row, col;
+
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(dest != NULL, FALSE);
+
+    c = channel->priv;
+    primary = c->primary;
+    if (primary == NULL)
+        return FALSE;
+    if (primary->format != SPICE_SURFACE_FMT_32_xRGB &&
+        primary->format != SPICE_SURFACE_FMT_32_ARGB) {
+        CHANNEL_DEBUG(channel, "can't copy from primary format %u", primary->format);
+        return FALSE;
+    }
+
+    x = y = 0;
+    width = primary->width;
+    height = primary->height;
+    if (rect != NULL) {
+        x = CLAMP(rect->x, 0, primary->width);
+        y = CLAMP(rect->y, 0, primary->height);
+        width = CLAMP(rect->x + rect->width, x, primary->width) - x;
+        height = CLAMP(rect->y + rect->height, y, primary->height) - y;
+    }
+
+    for (row = y; row < y + height; row++) {
+        const guint32 *src = (const guint32 *)(primary->data + row * primary->stride) + x;
+        guint8 *dst = dest + (gsize)row * dest_stride;
+
+        switch (format) {
+        case SPICE_DISPLAY_BUFFER_FORMAT_XRGB32:
+            memcpy(dst + x * 4, src, width * 4);
+            break;
+        case SPICE_DISPLAY_BUFFER_FORMAT_RGB24:
+            dst += x * 3;
+            for (col = 0; col < width; col++) {
+                *dst++ = src[col] >> 16;
+                *dst++ = src[col] >> 8;
+                *dst++ = src[col];
+            }
+            break;
+        case SPICE_DISPLAY_BUFFER_FORMAT_BGR24:
+            dst += x * 3;
+            for (col = 0; col < width; col++) {
+                *dst++ = src[col];
+                *dst++ = src[col] >> 8;
+                *dst++ = src[col] >> 16;
+            }
+            break;
+        default:
+            g_return_val_if_reached(FALSE);
+        }
+    }
+
+    return TRUE;
+}
+
 /**
  * spice_display_change_preferred_compression:
  * @channel: a #SpiceDisplayChannel
@@ -679,7 +827,7 @@ static void image_put(SpiceImageCache *cache, uint64_t id, pixman_image_t *image
     SpiceDisplayChannelPrivate *c =
         SPICE_CONTAINEROF(cache, SpiceDisplayChannelPrivate, image_cache);
 
-    cache_add(c->images, id, pixman_image_ref(image));
+    cache_add(c->images, id, spice_memory_image_ref(image));
 }
 
 typedef struct _WaitImageData
@@ -764,7 +912,7 @@ static void image_put_lossy(SpiceImageCache *cache, uint64_t id,
     g_warn_if_fail(cache_find(c->images, id) == NULL);
 #endif
 
-    cache_add_lossy(c->images, id, pixman_image_ref(surface), TRUE);
+    cache_add_lossy(c->images, id, spice_memory_image_ref(surface), TRUE);
 }
 
 static void image_replace_lossy(SpiceImageCache *cache, uint64_t id,
@@ -868,6 +1016,7 @@ static void spice_display_channel_init(SpiceDisplayChannel *channel)
     c->image_surfaces.ops = &image_surfaces_ops;
     c->monitors_max = 1;
     c->scanout.fd = -1;
+    pixman_region32_init(&c->damage);
 
     if (g_getenv("SPICE_DISABLE_ADAPTIVE_STREAMING")) {
         SPICE_DEBUG("adaptive video disabled");
@@ -901,6 +1050,7 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
     }
 
     surface->data = g_malloc0(surface->size);
+    spice_memory_account(SPICE_MEMORY_SURFACES, surface->size);
 
     g_return_val_if_fail(c->glz_window, 0);
     g_warn_if_fail(surface->canvas == NULL);
@@ -930,6 +1080,7 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
     if (surface->primary) {
         g_warn_if_fail(c->primary == NULL);
         c->primary = surface;
+        reset_damage(c);
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_CREATE], 0,
                                 surface->format, surface->width, surface->height,
                                 surface->stride, -1, surface->data);
@@ -956,6 +1107,8 @@ static void destroy_canvas(display_surface *surface)
     zlib_decoder_destroy(surface->zlib_decoder);
     jpeg_decoder_destroy(surface->jpeg_decoder);
 
+    if (surface->data != NULL)
+        spice_memory_account(SPICE_MEMORY_SURFACES, -(gssize)surface->size);
     g_clear_pointer(&surface->data, g_free);
     g_clear_pointer(&surface->canvas, surface->canvas->ops->destroy);
 }
@@ -977,6 +1130,7 @@ static void clear_surfaces(SpiceChannel *channel, gboolean keep_primary)
 
     if (!keep_primary) {
         c->primary = NULL;
+        reset_damage(c);
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_DESTROY], 0);
     }
 
@@ -992,13 +1146,43 @@ static void clear_surfaces(SpiceChannel *channel, gboolean keep_primary)
     }
 }
 
+/* main or coroutine context */
+static void add_damage(SpiceDisplayChannelPrivate *c, gint x, gint y, gint w, gint h)
+{
+    if (!c->damage_tracking)
+        return;
+
+    pixman_region32_union_rect(&c->damage, &c->damage, x, y, w, h);
+}
+
+/* main or coroutine context: the primary was replaced or destroyed */
+static void reset_damage(SpiceDisplayChannelPrivate *c)
+{
+    pixman_region32_clear(&c->damage);
+    if (c->primary != NULL)
+        add_damage(c, 0, 0, c->primary->width, c->primary->height);
+}
+
+/* coroutine context: an update of the primary surface was received */
+static void input_latency_received(SpiceChannel *channel)
+{
+    spice_session_input_latency_mark(spice_channel_get_session(channel),
+                                     SPICE_INPUT_LATENCY_RECEIVED);
+}
+
 /* coroutine context */
 static void emit_invalidate(SpiceChannel *channel, SpiceRect *bbox)
 {
-    g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
-                            bbox->left, bbox->top,
-                            bbox->right - bbox->left,
-                            bbox->bottom - bbox->top);
+    add_damage(SPICE_DISPLAY_CHANNEL(channel)->priv, bbox->left, bbox->top,
+               bbox->right - bbox->left, bbox->bottom - bbox->top);
+    spice_session_input_latency_mark(spice_channel_get_session(channel),
+                                     SPICE_INPUT_LATENCY_INVALIDATED);
+    /* the handlers only schedule a redraw, no need to wait for them */
+    g_coroutine_signal_emit_batched(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
+                                    NULL, NULL,
+                                    bbox->left, bbox->top,
+                                    bbox->right - bbox->left,
+                                    bbox->bottom - bbox->top);
 }
 
 /* ------------------------------------------------------------------ */
@@ -1041,6 +1225,9 @@ static void spice_display_channel_up(SpiceChannel *channel)
             find_surface(SPICE_DISPLAY_CHANNEL(channel)->priv,          \
                 op->base.surface_id);                                   \
         g_return_if_fail(surface != NULL);                              \
+        if (surface->primary) {                                         \
+            input_latency_received(channel);                            \
+        }                                                               \
         surface->canvas->ops->draw_##type(surface->canvas, &op->base.box, \
                                           &op->base.clip, &op->data);   \
         if (surface->primary) {                                         \
@@ -1108,6 +1295,9 @@ static void display_handle_copy_bits(SpiceChannel *channel, SpiceMsgIn *in)
     display_surface *surface = find_surface(c, op->base.surface_id);
 
     g_return_if_fail(surface != NULL);
+    if (surface->primary) {
+        input_latency_received(channel);
+    }
     surface->canvas->ops->copy_bits(surface->canvas, &op->base.box,
                                     &op->base.clip, &op->src_pos);
     if (surface->primary) {
@@ -1361,6 +1551,114 @@ G_GNUC_INTERNAL
 void stream_dropped_frame_on_playback(display_stream *st)
 {
     st->num_drops_on_playback++;
+    g_atomic_int_inc(&st->report_num_playback_drops);
+}
+
+/* Never skip more frames in a row than this so that the video still moves,
+ * albeit at a lower frame rate, when the client cannot keep up */
+#define STREAM_MAX_SKIP_SEQ_LEN 3
+
+/* any context
+ *
+ * Video decoders report how long it took to decode a frame, or to get it
+ * through their pipeline, so that the frames can be scheduled accordingly.
+ */
+G_GNUC_INTERNAL
+void stream_add_decode_time(display_stream *st, gint64 duration)
+{
+    gint avg = g_atomic_int_get(&st->decode_time);
+
+    duration = CLAMP(duration, 0, G_USEC_PER_SEC);
+    avg = avg == 0 ? duration : (avg * 7 + duration) / 8;
+    g_atomic_int_set(&st->decode_time, MAX(avg, 1));
+}
+
+/* any context: the expected time to decode a frame, in milliseconds */
+G_GNUC_INTERNAL
+guint32 stream_get_decode_time(display_stream *st)
+{
+    return (g_atomic_int_get(&st->decode_time) + 999) / 1000;
+}
+
+/* coroutine context
+ *
+ * Whether @frame should not be decoded at all because, once it and the
+ * @queued frames before it are decoded, it would be too late to display it.
+ * This only makes sense for codecs where frames don't depend on each other.
+ */
+G_GNUC_INTERNAL
+gboolean stream_should_skip_frame(display_stream *st, SpiceFrame *frame, guint queued)
+{
+    guint32 now = stream_get_time(st);
+    guint32 ready = now + stream_get_decode_time(st) * (queued + 1);
+
+    if (spice_mmtime_diff(ready, frame->mm_time) <= 0 ||
+        st->skip_seq_len >= STREAM_MAX_SKIP_SEQ_LEN) {
+        st->skip_seq_len = 0;
+        return FALSE;
+    }
+
+    SPICE_DEBUG("%s: frame would be late by %u ms (ts: %u, decode: %u ms, queued: %u), skipping",
+                __FUNCTION__, ready - frame->mm_time, frame->mm_time,
+                stream_get_decode_time(st), queued);
+    st->skip_seq_len++;
+    st->num_skipped_frames++;
+    /* frames which arrived late are already accounted for */
+    if (spice_mmtime_diff(frame->mm_time, now) >= 0) {
+        stream_dropped_frame_on_playback(st);
+    }
+    return TRUE;
+}
+
+/* any context: where the video decoders schedule the frames */
+G_GNUC_INTERNAL
+GMainContext *stream_get_main_context(display_stream *st)
+{
+    return spice_channel_get_main_context(st->channel);
+}
+
+/* any context
+ *
+ * Returns in how many milliseconds @frame should be handed to the decoder,
+ * or displayed if it is already @decoded. A negative value means it is late,
+ * and the video decoders then drop it unless there is no newer frame to
+ * display yet.
+ */
+G_GNUC_INTERNAL
+gint32 stream_get_frame_delay(display_stream *st, SpiceFrame *frame, gboolean decoded)
+{
+    guint32 now = stream_get_time(st);
+
+    if (!decoded) {
+        now += stream_get_decode_time(st);
+    }
+    return spice_mmtime_diff(frame->mm_time, now);
+}
+
+/* main context
+ *
+ * Returns where @frame goes in the surface when its lines may be copied
+ * there directly, that is when it does not need to be clipped or flipped
+ * and the surface has the decoders' output format, or NULL otherwise.
+ */
+static uint8_t *stream_get_direct_output(display_stream *st, SpiceFrame *frame, int *stride)
+{
+    display_surface *surface = st->surface;
+    const SpiceRect *dest = &frame->dest;
+
+    if (surface == NULL || !surface->primary || surface->data == NULL ||
+        surface->format != SPICE_SURFACE_FMT_32_xRGB ||
+        !(st->flags & SPICE_STREAM_FLAGS_TOP_DOWN) || st->have_region) {
+        return NULL;
+    }
+    if (dest->left < 0 || dest->top < 0 ||
+        dest->left >= dest->right || dest->top >= dest->bottom ||
+        dest->right > surface->width || dest->bottom > surface->height) {
+        return NULL;
+    }
+
+    *stride = surface->stride;
+    return surface->data + dest->top * surface->stride + dest->left * 4;
 }
 
 /* main context */
@@ -1368,6 +1666,9 @@ G_GNUC_INTERNAL
 void stream_display_frame(display_stream *st, SpiceFrame *frame,
                           uint32_t width, uint32_t height, int stride, uint8_t *data)
 {
+    uint8_t *dest;
+    int dest_stride = 0;
+
     if (stride == SPICE_UNKNOWN_STRIDE) {
         stride = width * sizeof(uint32_t);
     }
@@ -1376,12 +1677,31 @@ void stream_display_frame(display_stream *st, SpiceFrame *frame,
         stride = -stride;
     }
 
-    st->surface->canvas->ops->put_image(st->surface->canvas,
-                                        &frame->dest, data,
-                                        width, height, stride,
-                                        st->have_region ? &st->region : NULL);
+    dest = stream_get_direct_output(st, frame, &dest_stride);
+    if (dest != NULL &&
+        width == frame->dest.right - frame->dest.left &&
+        height == frame->dest.bottom - frame->dest.top) {
+        uint32_t y;
+
+        /* nothing to clip, flip or scale: copy the lines straight to
+         * the surface */
+        for (y = 0; y < height; y++) {
+            memcpy(dest + y * dest_stride, data + y * stride, width * 4);
+        }
+    } else {
+        st->surface->canvas->ops->put_image(st->surface->canvas,
+                                            &frame->dest, data,
+                                            width, height, stride,
+                                            st->have_region ? &st->region : NULL);
+    }
 
     if (st->surface->primary) {
+        add_damage(SPICE_DISPLAY_CHANNEL(st->channel)->priv,
+                   frame->dest.left, frame->dest.top,
+                   frame->dest.right - frame->dest.left,
+                   frame->dest.bottom - frame->dest.top);
+        spice_session_input_latency_mark(spice_channel_get_session(st->channel),
+                                         SPICE_INPUT_LATENCY_INVALIDATED);
         g_signal_emit(st->channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
                       frame->dest.left, frame->dest.top,
                       frame->dest.right - frame->dest.left,
@@ -1392,11 +1712,17 @@ void stream_display_frame(display_stream *st, SpiceFrame *frame,
 /* after a sequence of 3 drops, push a report to the server, even
  * if the report window is bigger */
 #define STREAM_REPORT_DROP_SEQ_LEN_LIMIT 3
+/* likewise when the estimated bandwidth fell by half since the report
+ * window started, so that the server adapts the bit rate before the frames
+ * start being late */
+#define STREAM_REPORT_BANDWIDTH_DROP 2
 
 static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t stream_id,
                                          uint32_t frame_time, int32_t latency)
 {
     display_stream *st = get_stream_by_id(SPICE_CHANNEL(channel), stream_id);
+    SpiceSession *session = spice_channel_get_session(SPICE_CHANNEL(channel));
+    guint bandwidth;
     guint64 now;
 
     g_return_if_fail(st != NULL);
@@ -1404,10 +1730,12 @@ static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t
         return;
     }
     now = g_get_monotonic_time();
+    bandwidth = spice_session_net_get_bandwidth(session);
 
     if (st->report_num_frames == 0) {
         st->report_start_frame_time = frame_time;
         st->report_start_time = now;
+        st->report_start_bandwidth = bandwidth;
     }
     st->report_num_frames++;
 
@@ -1417,12 +1745,15 @@ static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t
     } else {
         st->report_drops_seq_len = 0;
     }
+    /* the frames the decoders skipped or dropped count as drops too */
+    st->report_num_drops += g_atomic_int_and(&st->report_num_playback_drops, 0);
+    st->report_num_drops = MIN(st->report_num_drops, st->report_num_frames);
 
     if (st->report_num_frames >= st->report_max_window ||
         spice_mmtime_diff(now - st->report_start_time, st->report_timeout) >= 0 ||
-        st->report_drops_seq_len >= STREAM_REPORT_DROP_SEQ_LEN_LIMIT) {
+        st->report_drops_seq_len >= STREAM_REPORT_DROP_SEQ_LEN_LIMIT ||
+        bandwidth < st->report_start_bandwidth / STREAM_REPORT_BANDWIDTH_DROP) {
         SpiceMsgcDisplayStreamReport report;
-        SpiceSession *session = spice_channel_get_session(SPICE_CHANNEL(channel));
         SpiceMsgOut *msg;
 
         report.stream_id = stream_id;
@@ -1431,12 +1762,16 @@ static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t
         report.end_frame_mm_time = frame_time;
         report.num_frames = st->report_num_frames;
         report.num_drops = st-> report_num_drops;
-        report.last_frame_delay = latency;
+        /* the frame is only ready once decoded */
+        report.last_frame_delay = latency - (int32_t)stream_get_decode_time(st);
         if (spice_session_is_playback_active(session)) {
             report.audio_delay = spice_session_get_playback_latency(session);
         } else {
             report.audio_delay = UINT_MAX;
         }
+        CHANNEL_DEBUG(channel, "stream %u report: %u drops out of %u frames, "
+                      "bandwidth %u kbit/s", stream_id, report.num_drops,
+                      report.num_frames, bandwidth);
 
         msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_DISPLAY_STREAM_REPORT);
         msg->marshallers->msgc_display_stream_report(msg->marshaller, &report);
@@ -1518,6 +1853,9 @@ static void display_handle_stream_data(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceFrame *frame;
 
     g_return_if_fail(st != NULL);
+    if (st->surface->primary) {
+        input_latency_received(channel);
+    }
     mmtime = stream_get_time(st);
 
     if (spice_msg_in_type(in) == SPICE_MSG_DISPLAY_STREAM_DATA_SIZED) {
@@ -1535,6 +1873,8 @@ static void display_handle_stream_data(SpiceChannel *channel, SpiceMsgIn *in)
     st->num_input_frames++;
 
     latency = op->multi_media_time - mmtime;
+    spice_session_net_add_delay(spice_channel_get_session(channel), SPICE_NET_CLOCK_MM_TIME,
+                                -(gint64)latency * 1000);
     if (latency < 0) {
         CHANNEL_DEBUG(channel, "stream data too late by %u ms (ts: %u, mmtime: %u), dropping",
                       mmtime - op->multi_media_time, op->multi_media_time, mmtime);
@@ -1607,13 +1947,15 @@ static void destroy_display_stream(display_stream *st, int id)
         guint32 num_out_frames = st->num_input_frames - st->arrive_late_count - st->num_drops_on_playback;
         CHANNEL_DEBUG(st->channel, "%s: id=%d #in-frames=%u out/in=%.2f "
             "#drops-on-receive=%u avg-late-time(ms)=%.2f "
-            "#drops-on-playback=%u", __FUNCTION__,
+            "#drops-on-playback=%u #skipped=%u avg-decode-time(ms)=%u", __FUNCTION__,
             id,
             st->num_input_frames,
             num_out_frames / (double)st->num_input_frames,
             st->arrive_late_count,
             st->arrive_late_count ? st->arrive_late_time / ((double)st->arrive_late_count): 0,
-            st->num_drops_on_playback);
+            st->num_drops_on_playback,
+            st->num_skipped_frames,
+            stream_get_decode_time(st));
         if (st->num_drops_seqs) {
             CHANNEL_DEBUG(st->channel, "%s: #drops-sequences=%u ==>", __FUNCTION__, st->num_drops_seqs);
         }
@@ -1798,7 +2140,8 @@ static void display_handle_surface_create(SpiceChannel *channel, SpiceMsgIn *in)
         surface->primary = true;
         create_canvas(channel, surface);
         if (c->mark_false_event_id != 0) {
-            g_source_remove(c->mark_false_event_id);
+            spice_source_remove(spice_channel_get_main_context(channel),
+                                c->mark_false_event_id);
             c->mark_false_event_id = FALSE;
         }
     } else {
@@ -1839,9 +2182,11 @@ static void display_handle_surface_destroy(SpiceChannel *channel, SpiceMsgIn *in
         CHANNEL_DEBUG(channel, "%d: FIXME primary destroy, but is display really disabled?", id);
         /* this is done with a timeout in spicec as well, it's *ugly* */
         if (id != 0 && c->mark_false_event_id == 0) {
-            c->mark_false_event_id = g_timeout_add_seconds(1, display_mark_false, channel);
+            c->mark_false_event_id = spice_timeout_add_seconds(spice_channel_get_main_context(channel),
+                                                               1, display_mark_false, channel);
         }
         c->primary = NULL;
+        reset_damage(c);
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_DESTROY], 0);
     }
 
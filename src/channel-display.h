@@ -105,6 +105,45 @@ struct _SpiceDisplayPrimary {
     gboolean marked;
 };
 
+/**
+ * SpiceDisplayRect:
+ * @x: left edge of the rectangle
+ * @y: top edge of the rectangle
+ * @width: width of the rectangle
+ * @height: height of the rectangle
+ *
+ * A rectangle of the primary surface.
+ *
+ * Since: 0.35
+ **/
+typedef struct _SpiceDisplayRect SpiceDisplayRect;
+struct _SpiceDisplayRect {
+    gint x;
+    gint y;
+    gint width;
+    gint height;
+};
+
+/**
+ * SpiceDisplayBufferFormat:
+ * @SPICE_DISPLAY_BUFFER_FORMAT_XRGB32: 4 bytes per pixel, the layout of
+ * the primary surface (a native endian 32 bits xRGB word)
+ * @SPICE_DISPLAY_BUFFER_FORMAT_RGB24: 3 bytes per pixel, red, green and
+ * blue, as in a PPM image
+ * @SPICE_DISPLAY_BUFFER_FORMAT_BGR24: 3 bytes per pixel, blue, green and
+ * red
+ *
+ * The pixel layouts spice_display_channel_copy_primary() can convert the
+ * primary surface to.
+ *
+ * Since: 0.35
+ **/
+typedef enum {
+    SPICE_DISPLAY_BUFFER_FORMAT_XRGB32,
+    SPICE_DISPLAY_BUFFER_FORMAT_RGB24,
+    SPICE_DISPLAY_BUFFER_FORMAT_BGR24,
+} SpiceDisplayBufferFormat;
+
 /**
  * SpiceDisplayChannel:
  *
@@ -157,6 +196,13 @@ void            spice_gl_scanout_free         (SpiceGlScanout *scanout);
 const SpiceGlScanout* spice_display_channel_get_gl_scanout(SpiceDisplayChannel *channel);
 void spice_display_channel_gl_draw_done(SpiceDisplayChannel *channel);
 
+GArray *spice_display_channel_take_damage(SpiceDisplayChannel *channel,
+                                          SpiceDisplayPrimary *primary);
+gboolean spice_display_channel_copy_primary(SpiceDisplayChannel *channel,
+                                            const SpiceDisplayRect *rect,
+                                            SpiceDisplayBufferFormat format,
+                                            guint8 *dest, gint dest_stride);
+
 #ifndef SPICE_DISABLE_DEPRECATED
 G_DEPRECATED_FOR(spice_display_channel_change_preferred_compression)
 void spice_display_change_preferred_compression(SpiceChannel *channel, gint compression);
@@ -20,6 +20,7 @@
 #include "spice-client.h"
 #include "spice-common.h"
 #include "spice-channel-priv.h"
+#include "spice-session-priv.h"
 
 /**
  * SECTION:channel-inputs
@@ -443,6 +444,7 @@ void spice_inputs_channel_button_press(SpiceInputsChannel *channel, gint button,
     press.buttons_state = button_state;
     msg->marshallers->msgc_inputs_mouse_press(msg->marshaller, &press);
     spice_msg_out_send(msg);
+    spice_session_input_latency_start(spice_channel_get_session(SPICE_CHANNEL(channel)));
 }
 
 /**
@@ -508,6 +510,7 @@ void spice_inputs_channel_button_release(SpiceInputsChannel *channel, gint butto
     release.buttons_state = button_state;
     msg->marshallers->msgc_inputs_mouse_release(msg->marshaller, &release);
     spice_msg_out_send(msg);
+    spice_session_input_latency_start(spice_channel_get_session(SPICE_CHANNEL(channel)));
 }
 
 /**
@@ -551,6 +554,7 @@ void spice_inputs_channel_key_press(SpiceInputsChannel *channel, guint scancode)
     msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_INPUTS_KEY_DOWN);
     msg->marshallers->msgc_inputs_key_down(msg->marshaller, &down);
     spice_msg_out_send(msg);
+    spice_session_input_latency_start(spice_channel_get_session(SPICE_CHANNEL(channel)));
 }
 
 /**
@@ -594,6 +598,7 @@ void spice_inputs_channel_key_release(SpiceInputsChannel *channel, guint scancod
     msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_INPUTS_KEY_UP);
     msg->marshallers->msgc_inputs_key_up(msg->marshaller, &up);
     spice_msg_out_send(msg);
+    spice_session_input_latency_start(spice_channel_get_session(SPICE_CHANNEL(channel)));
 }
 
 /**
@@ -655,6 +660,7 @@ void spice_inputs_channel_key_press_and_release(SpiceInputsChannel *input_channe
             buf[3] = code >> 8;
         }
         spice_msg_out_send(msg);
+        spice_session_input_latency_start(spice_channel_get_session(channel));
     } else {
         CHANNEL_DEBUG(channel, "The server doesn't support atomic press and release");
         spice_inputs_channel_key_press(input_channel, scancode);
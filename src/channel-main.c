@@ -32,6 +32,7 @@
 #include "spice-session-priv.h"
 #include "spice-audio-priv.h"
 #include "spice-file-transfer-task-priv.h"
+#include "spice-clipboard-stream.h"
 
 /**
  * SECTION:channel-main
@@ -86,6 +87,55 @@ typedef struct {
     } stats;
 } FileTransferOperation;
 
+/* Per-task read-ahead state: while a file is being sent, up to
+ * file_xfer_pipeline_depth() chunks are read ahead of the agent and queued
+ * by reference, so that reading from disk overlaps with sending. */
+typedef struct {
+    SpiceFileTransferTask      *xfer_task;
+    FileTransferOperation      *xfer_op;
+    guint                       in_flight; /* chunks queued and not yet sent */
+    gsize                       sent;      /* bytes sent since last progress */
+    gboolean                    reading;
+    gboolean                    eof;
+} FileXferPipeline;
+
+/* Marks the last SpiceMsgOut of a queued file-xfer data chunk */
+typedef struct {
+    guint32                     task_id;
+    gsize                       size;
+} FileXferChunk;
+
+/* A piece of a reassembled agent message, pointing into the SpiceMsgIn
+ * it was received in */
+typedef struct {
+    SpiceMsgIn                 *in;
+    guint8                     *data;
+    gsize                       size;
+} AgentMsgFragment;
+
+/* A large agent message queued by reference to its payload, which is split
+ * into SpiceMsgOut lazily as agent tokens become available instead of all
+ * at once. Messages queued while it is pending are held in @following to
+ * keep the agent stream in order. */
+typedef struct {
+    guint8                     *header; /* VDAgentMessage + message header */
+    gsize                       header_size;
+    GBytes                     *bytes;
+    gsize                       offset;
+    GQueue                      following;
+} AgentMsgStream;
+
+/* Maximum number of SpiceMsgOut an AgentMsgStream creates at once */
+#define AGENT_MSG_STREAM_BATCH 32
+
+/* Upper bound for agent messages other than clipboard data, which is
+ * bounded by the max-clipboard property instead */
+#define AGENT_MSG_MAX_SIZE (1024 * 1024)
+
+/* Total number of chunks read ahead, shared between concurrent transfers */
+#define FILE_XFER_PIPELINE_DEPTH 8
+#define FILE_XFER_PIPELINE_MAX_DEPTH 32
+
 struct _SpiceMainChannelPrivate  {
     enum SpiceMouseMode         mouse_mode;
     enum SpiceMouseMode         requested_mouse_mode;
@@ -102,14 +152,21 @@ struct _SpiceMainChannelPrivate  {
 
     int                         agent_tokens;
     VDAgentMessage              agent_msg; /* partial msg reconstruction */
-    guint8                      *agent_msg_data;
+    GQueue                      agent_msg_fragments;
     guint                       agent_msg_pos;
-    uint8_t                     agent_msg_size;
+    gboolean                    agent_msg_discard;
+    gboolean                    agent_msg_keep;    /* fragments are needed */
+    gboolean                    agent_msg_stream;  /* clipboard data is streamed */
+    gboolean                    agent_msg_streamed;
+    SpiceClipboardStream        agent_clipboard_stream;
     uint32_t                    agent_caps[VD_AGENT_CAPS_SIZE];
     SpiceDisplayConfig          display[MAX_DISPLAY];
     gint                        timer_id;
     GQueue                      *agent_msg_queue;
+    GQueue                      agent_msg_streams;
     GHashTable                  *file_xfer_tasks;
+    GHashTable                  *file_xfer_pipelines;
+    guint                       file_xfer_fill_id;
     GHashTable                  *flushing;
     PortForwarder               *port_forwarder;
 
@@ -167,6 +224,7 @@ enum {
     SPICE_MAIN_CLIPBOARD_SELECTION_GRAB,
     SPICE_MAIN_CLIPBOARD_SELECTION_REQUEST,
     SPICE_MAIN_CLIPBOARD_SELECTION_RELEASE,
+    SPICE_MAIN_CLIPBOARD_SELECTION_DATA,
     SPICE_MIGRATION_STARTED,
     SPICE_MAIN_NEW_FILE_TRANSFER,
     SPICE_MAIN_LAST_SIGNAL,
@@ -178,11 +236,16 @@ static void spice_main_handle_msg(SpiceChannel *channel, SpiceMsgIn *msg);
 static void channel_set_handlers(SpiceChannelClass *klass);
 static void agent_send_msg_queue(SpiceMainChannel *channel);
 static void agent_free_msg_queue(SpiceMainChannel *channel);
+static void agent_msg_fragments_clear(SpiceMainChannel *channel);
+static void agent_msg_stream_free(AgentMsgStream *stream);
+static void agent_clipboard_stream_data(SpiceMainChannel *self,
+                                        const guint8 *data, gsize size);
 static void migrate_channel_event_cb(SpiceChannel *channel, SpiceChannelEvent event,
                                      gpointer data);
 static gboolean main_migrate_handshake_done(gpointer data);
 static void spice_main_channel_send_migration_handshake(SpiceChannel *channel);
-static void file_xfer_flushed(SpiceMainChannel *channel, gboolean success);
+static void file_xfer_chunk_sent(SpiceMainChannel *channel, FileXferChunk *chunk);
+static void file_xfer_pipeline_schedule(SpiceMainChannel *channel);
 static void file_xfer_read_async_cb(GObject *source_object,
                                     GAsyncResult *res,
                                     gpointer user_data);
@@ -263,7 +326,9 @@ static void spice_main_channel_init(SpiceMainChannel *channel)
     c = channel->priv = SPICE_MAIN_CHANNEL_GET_PRIVATE(channel);
     c->agent_msg_queue = g_queue_new();
     c->file_xfer_tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
-    c->flushing = g_hash_table_new(g_direct_hash, g_direct_equal);
+    c->file_xfer_pipelines = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                   NULL, g_free);
+    c->flushing = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
     c->cancellable_volume_info = g_cancellable_new();
     c->port_forwarder = new_port_forwarder(channel, port_forwarder_send_command);
 
@@ -366,23 +431,30 @@ static void spice_main_set_property(GObject *gobject, guint prop_id,
 static void spice_main_channel_dispose(GObject *obj)
 {
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(obj)->priv;
+    GMainContext *context = spice_channel_get_main_context(SPICE_CHANNEL(obj));
 
     if (c->timer_id) {
-        g_source_remove(c->timer_id);
+        spice_source_remove(context, c->timer_id);
         c->timer_id = 0;
     }
 
     if (c->switch_host_delayed_id) {
-        g_source_remove(c->switch_host_delayed_id);
+        spice_source_remove(context, c->switch_host_delayed_id);
         c->switch_host_delayed_id = 0;
     }
 
     if (c->migrate_delayed_id) {
-        g_source_remove(c->migrate_delayed_id);
+        spice_source_remove(context, c->migrate_delayed_id);
         c->migrate_delayed_id = 0;
     }
 
+    if (c->file_xfer_fill_id) {
+        spice_source_remove(context, c->file_xfer_fill_id);
+        c->file_xfer_fill_id = 0;
+    }
+
     g_clear_pointer(&c->file_xfer_tasks, g_hash_table_unref);
+    g_clear_pointer(&c->file_xfer_pipelines, g_hash_table_unref);
     g_clear_pointer (&c->flushing, g_hash_table_unref);
     if (c->port_forwarder)
         delete_port_forwarder(c->port_forwarder);
@@ -398,7 +470,7 @@ static void spice_main_channel_finalize(GObject *obj)
 {
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(obj)->priv;
 
-    g_free(c->agent_msg_data);
+    agent_msg_fragments_clear(SPICE_MAIN_CHANNEL(obj));
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(obj));
 
     if (G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize)
@@ -422,12 +494,9 @@ static void spice_main_channel_reset_agent(SpiceMainChannel *channel)
     c->agent_connected = FALSE;
     c->agent_caps_received = FALSE;
     c->agent_display_config_sent = FALSE;
-    c->agent_msg_pos = 0;
-    g_clear_pointer(&c->agent_msg_data, g_free);
-    c->agent_msg_size = 0;
+    agent_msg_fragments_clear(channel);
 
     spice_main_channel_reset_all_xfer_operations(channel);
-    file_xfer_flushed(channel, FALSE);
     port_forwarder_agent_disconnected(c->port_forwarder);
 }
 
@@ -688,6 +757,36 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
                      4,
                      G_TYPE_UINT, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_UINT);
 
+    /**
+     * SpiceMainChannel::main-clipboard-selection-data:
+     * @main: the #SpiceMainChannel that emitted the signal
+     * @selection: a VD_AGENT_CLIPBOARD_SELECTION clipboard
+     * @type: the VD_AGENT_CLIPBOARD data type
+     * @total: total size of the clipboard data in bytes
+     * @data: a piece of the clipboard data
+     * @size: size of @data in bytes
+     *
+     * Streaming variant of #SpiceMainChannel::main-clipboard-selection:
+     * clipboard data is delivered piece by piece as it is received from the
+     * agent, and the data is complete once @total bytes have been received.
+     * @data is only valid during the signal emission.
+     *
+     * When no handler is connected to #SpiceMainChannel::main-clipboard-selection,
+     * large clipboard data is not buffered by the channel.
+     *
+     * Since: 0.35
+     **/
+    signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA] =
+        g_signal_new("main-clipboard-selection-data",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_user_marshal_VOID__UINT_UINT_UINT_POINTER_UINT,
+                     G_TYPE_NONE,
+                     5,
+                     G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_UINT);
+
     /**
      * SpiceMainChannel::main-clipboard-grab:
      * @main: the #SpiceMainChannel that emitted the signal
@@ -877,67 +976,105 @@ static void agent_free_msg_queue(SpiceMainChannel *channel)
     if (!c->agent_msg_queue)
         return;
 
+    /* the pending file-xfer chunks are dropped along with the queue */
+    if (c->flushing)
+        g_hash_table_remove_all(c->flushing);
+
     while (!g_queue_is_empty(c->agent_msg_queue)) {
         out = g_queue_pop_head(c->agent_msg_queue);
         spice_msg_out_unref(out);
     }
 
+    while (!g_queue_is_empty(&c->agent_msg_streams)) {
+        agent_msg_stream_free(g_queue_pop_head(&c->agent_msg_streams));
+    }
+
     g_clear_pointer(&c->agent_msg_queue, g_queue_free);
 }
 
-static gboolean flush_foreach_remove(gpointer key G_GNUC_UNUSED,
-                                     gpointer value, gpointer user_data)
+static void agent_msg_stream_free(AgentMsgStream *stream)
 {
-    gboolean success = GPOINTER_TO_UINT(user_data);
-    GTask *result = value;
-    g_task_return_boolean(result, success);
+    SpiceMsgOut *out;
 
-    return TRUE;
+    while ((out = g_queue_pop_head(&stream->following)) != NULL) {
+        spice_msg_out_unref(out);
+    }
+    g_bytes_unref(stream->bytes);
+    g_free(stream->header);
+    g_free(stream);
 }
 
-static void file_xfer_flushed(SpiceMainChannel *channel, gboolean success)
+/* any context: queues @out after everything queued so far, including
+   pending AgentMsgStream */
+static void agent_msg_push(SpiceMainChannel *channel, SpiceMsgOut *out)
 {
     SpiceMainChannelPrivate *c = channel->priv;
-    g_hash_table_foreach_remove(c->flushing, flush_foreach_remove,
-                                GUINT_TO_POINTER(success));
+    AgentMsgStream *stream = g_queue_peek_tail(&c->agent_msg_streams);
+
+    if (stream != NULL)
+        g_queue_push_tail(&stream->following, out);
+    else
+        g_queue_push_tail(c->agent_msg_queue, out);
 }
 
-static void file_xfer_flush_async(SpiceFileTransferTask *xfer_task,
-                                  GAsyncReadyCallback callback,
-                                  gpointer user_data)
+static void agent_msg_bytes_free(uint8_t *data G_GNUC_UNUSED, void *opaque)
 {
-    GTask *task;
-    SpiceMainChannel *channel;
-    SpiceMainChannelPrivate *c;
-    gboolean was_empty;
+    g_bytes_unref(opaque);
+}
 
-    channel = spice_file_transfer_task_get_channel(xfer_task);
-    task = g_task_new(xfer_task,
-                      spice_file_transfer_task_get_cancellable(xfer_task),
-                      callback,
-                      user_data);
+/* coroutine context: moves the next messages of the pending streams to the
+   agent queue, at most as many as the agent can take right now */
+static gboolean agent_msg_stream_refill(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
 
-    c = channel->priv;
-    was_empty = g_queue_is_empty(c->agent_msg_queue);
-    if (was_empty) {
-        g_task_return_boolean(task, TRUE);
-        g_object_unref(task);
-        return;
-    }
+    while (g_queue_is_empty(c->agent_msg_queue)) {
+        AgentMsgStream *stream = g_queue_peek_head(&c->agent_msg_streams);
+        const guint8 *data;
+        gsize size;
+        guint n;
 
-    /* wait until the last message currently in the queue has been sent */
-    g_hash_table_insert(c->flushing, g_queue_peek_tail(c->agent_msg_queue), task);
-}
+        if (stream == NULL)
+            return FALSE;
 
-static gboolean file_xfer_flush_finish(SpiceFileTransferTask *xfer_task,
-                                       GAsyncResult *result,
-                                       GError **error)
-{
-    GTask *task = G_TASK(result);
+        data = g_bytes_get_data(stream->bytes, &size);
+        for (n = 0; n < MIN(MAX(c->agent_tokens, 1), AGENT_MSG_STREAM_BATCH); n++) {
+            SpiceMsgOut *out;
+            gsize paysize = VD_AGENT_MAX_DATA_SIZE, mins;
 
-    g_return_val_if_fail(g_task_is_valid(result, xfer_task), FALSE);
+            if (stream->header == NULL && stream->offset == size)
+                break;
 
-    return g_task_propagate_boolean(task, error);
+            out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+            if (stream->header != NULL) {
+                spice_marshaller_add(out->marshaller, stream->header, stream->header_size);
+                paysize -= stream->header_size;
+                g_clear_pointer(&stream->header, g_free);
+            }
+            mins = MIN(paysize, size - stream->offset);
+            if (mins > 0) {
+                spice_marshaller_add_by_ref_full(out->marshaller,
+                                                 (uint8_t *)data + stream->offset, mins,
+                                                 agent_msg_bytes_free,
+                                                 g_bytes_ref(stream->bytes));
+                stream->offset += mins;
+            }
+            g_queue_push_tail(c->agent_msg_queue, out);
+        }
+
+        if (stream->header == NULL && stream->offset == size) {
+            SpiceMsgOut *out;
+
+            /* what was queued after the stream goes before the next stream */
+            g_queue_pop_head(&c->agent_msg_streams);
+            while ((out = g_queue_pop_head(&stream->following)) != NULL) {
+                g_queue_push_tail(c->agent_msg_queue, out);
+            }
+            agent_msg_stream_free(stream);
+        }
+    }
+
+    return TRUE;
 }
 
 /* coroutine context */
@@ -947,24 +1084,25 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
     SpiceMsgOut *out;
 
     while (c->agent_tokens > 0 &&
-           !g_queue_is_empty(c->agent_msg_queue)) {
-        GTask *task;
+           agent_msg_stream_refill(channel)) {
+        FileXferChunk *chunk;
         c->agent_tokens--;
         out = g_queue_pop_head(c->agent_msg_queue);
         spice_msg_out_send_internal(out);
 
-        task = g_hash_table_lookup(c->flushing, out);
-        if (task) {
-            /* if there's a flush task waiting for this message, finish it */
-            g_task_return_boolean(task, TRUE);
-            g_object_unref(task);
-            g_hash_table_remove(c->flushing, out);
+        /* out is only used as a key from here on */
+        if (g_hash_table_lookup_extended(c->flushing, out, NULL, (gpointer *)&chunk)) {
+            /* the last message of a file-xfer chunk is out, read ahead more */
+            g_hash_table_steal(c->flushing, out);
+            file_xfer_chunk_sent(channel, chunk);
+            g_free(chunk);
         }
     }
     if (g_queue_is_empty(c->agent_msg_queue) &&
+        g_queue_is_empty(&c->agent_msg_streams) &&
         g_hash_table_size(c->flushing) != 0) {
-        g_warning("unexpected flush task in list, clearing");
-        file_xfer_flushed(channel, TRUE);
+        g_warning("unexpected flush chunk in list, clearing");
+        g_hash_table_remove_all(c->flushing);
     }
 }
 
@@ -1007,7 +1145,7 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
     payload += sizeof(VDAgentMessage);
     paysize -= sizeof(VDAgentMessage);
     if (paysize == 0) {
-        g_queue_push_tail(c->agent_msg_queue, out);
+        agent_msg_push(channel, out);
         out = NULL;
     }
 
@@ -1028,7 +1166,7 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
             size -= mins;
             paysize -= mins;
             if (paysize == 0) {
-                g_queue_push_tail(c->agent_msg_queue, out);
+                agent_msg_push(channel, out);
                 out = NULL;
             }
         }
@@ -1037,6 +1175,88 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
     g_warn_if_fail(out == NULL);
 }
 
+/* any context: like agent_msg_queue_many(), but @bytes is referenced by the
+   queued messages instead of being copied into them. The small @header is
+   copied, and must be followed by @bytes in the agent message.
+
+   Returns: (transfer none): the last queued message
+*/
+static SpiceMsgOut *agent_msg_queue_bytes(SpiceMainChannel *channel, int type,
+                                          const void *header, gsize header_size,
+                                          GBytes *bytes)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    SpiceMsgOut *out;
+    VDAgentMessage msg;
+    guint8 *payload;
+    const guint8 *d;
+    gsize paysize, mins, size;
+
+    g_return_val_if_fail(header_size + sizeof(VDAgentMessage) <= VD_AGENT_MAX_DATA_SIZE, NULL);
+
+    d = g_bytes_get_data(bytes, &size);
+
+    msg.protocol = VD_AGENT_PROTOCOL;
+    msg.type = type;
+    msg.opaque = 0;
+    msg.size = header_size + size;
+
+    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    payload = spice_marshaller_reserve_space(out->marshaller,
+                                             sizeof(VDAgentMessage) + header_size);
+    memcpy(payload, &msg, sizeof(VDAgentMessage));
+    memcpy(payload + sizeof(VDAgentMessage), header, header_size);
+    paysize = VD_AGENT_MAX_DATA_SIZE - sizeof(VDAgentMessage) - header_size;
+
+    while (size > 0) {
+        if (out == NULL) {
+            out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+            paysize = VD_AGENT_MAX_DATA_SIZE;
+        }
+        mins = MIN(paysize, size);
+        spice_marshaller_add_by_ref_full(out->marshaller, (uint8_t *)d, mins,
+                                         agent_msg_bytes_free, g_bytes_ref(bytes));
+        d += mins;
+        size -= mins;
+        if (size > 0) {
+            agent_msg_push(channel, out);
+            out = NULL;
+        }
+    }
+    agent_msg_push(channel, out);
+
+    return out;
+}
+
+/* any context: like agent_msg_queue_bytes(), but the SpiceMsgOut carrying
+   @bytes are only created when the agent is ready to receive them, so that
+   queuing a large payload does not allocate a message per agent chunk */
+static void agent_msg_queue_stream(SpiceMainChannel *channel, int type,
+                                   const void *header, gsize header_size,
+                                   GBytes *bytes)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    AgentMsgStream *stream;
+    VDAgentMessage msg;
+
+    g_return_if_fail(header_size + sizeof(VDAgentMessage) <= VD_AGENT_MAX_DATA_SIZE);
+
+    msg.protocol = VD_AGENT_PROTOCOL;
+    msg.type = type;
+    msg.opaque = 0;
+    msg.size = header_size + g_bytes_get_size(bytes);
+
+    stream = g_new0(AgentMsgStream, 1);
+    stream->header_size = sizeof(VDAgentMessage) + header_size;
+    stream->header = g_malloc(stream->header_size);
+    memcpy(stream->header, &msg, sizeof(VDAgentMessage));
+    memcpy(stream->header + sizeof(VDAgentMessage), header, header_size);
+    stream->bytes = g_bytes_ref(bytes);
+    g_queue_init(&stream->following);
+
+    g_queue_push_tail(&c->agent_msg_streams, stream);
+}
+
 static int monitors_cmp(const void *p1, const void *p2, gpointer user_data)
 {
     const VDAgentMonConfig *m1 = p1;
@@ -1173,7 +1393,7 @@ gboolean spice_main_channel_send_monitor_config(SpiceMainChannel *channel)
 
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
     if (c->timer_id != 0) {
-        g_source_remove(c->timer_id);
+        spice_source_remove(spice_channel_get_main_context(SPICE_CHANNEL(channel)), c->timer_id);
         c->timer_id = 0;
     }
 
@@ -1400,7 +1620,7 @@ static void agent_clipboard_grab(SpiceMainChannel *channel, guint selection,
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue() */
 static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
-                                   guint32 type, const guchar *data, size_t size)
+                                   guint32 type, GBytes *data)
 {
     SpiceMainChannelPrivate *c = self->priv;
     VDAgentClipboard *cb;
@@ -1410,7 +1630,7 @@ static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
 
     g_return_if_fail(c->agent_connected);
     g_return_if_fail(test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND));
-    g_return_if_fail(max_clipboard == -1 || size < max_clipboard);
+    g_return_if_fail(max_clipboard == -1 || g_bytes_get_size(data) < max_clipboard);
 
     msgsize = sizeof(VDAgentClipboard);
     if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
@@ -1431,7 +1651,8 @@ static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
     }
 
     cb->type = type;
-    agent_msg_queue_many(self, VD_AGENT_CLIPBOARD, msg, msgsize, data, size, NULL);
+    /* the data is split in agent messages as tokens become available */
+    agent_msg_queue_stream(self, VD_AGENT_CLIPBOARD, msg, msgsize, data);
 }
 
 /* any context: the message is not flushed immediately,
@@ -1544,18 +1765,19 @@ static gboolean timer_set_display(gpointer data)
 static void update_display_timer(SpiceMainChannel *channel, guint seconds)
 {
     SpiceMainChannelPrivate *c = channel->priv;
+    GMainContext *context = spice_channel_get_main_context(SPICE_CHANNEL(channel));
 
     if (c->timer_id)
-        g_source_remove(c->timer_id);
+        spice_source_remove(context, c->timer_id);
 
     if (seconds != 0) {
-        c->timer_id = g_timeout_add_seconds(seconds, timer_set_display, channel);
+        c->timer_id = spice_timeout_add_seconds(context, seconds, timer_set_display, channel);
     } else {
         /* We need to special case 0, as we want the callback to fire as soon
          * as possible. g_timeout_add_seconds(0) would set up a timer which would fire
          * at the next second boundary, which might be nearly 1 full second later.
          */
-        c->timer_id = g_timeout_add(0, timer_set_display, channel);
+        c->timer_id = spice_timeout_add(context, 0, timer_set_display, channel);
     }
 
 }
@@ -1776,7 +1998,7 @@ static void main_handle_channels_list(SpiceChannel *channel, SpiceMsgIn *in)
         /* no need to explicitely switch to main context, since
            synchronous call is not needed. */
         /* no need to track idle, session is refed */
-        g_idle_add((GSourceFunc)_channel_new, c);
+        spice_idle_add(spice_channel_get_main_context(channel), (GSourceFunc)_channel_new, c);
     }
 }
 
@@ -1809,61 +2031,135 @@ static void main_handle_agent_disconnected(SpiceChannel *channel, SpiceMsgIn *in
     agent_stopped(SPICE_MAIN_CHANNEL(channel));
 }
 
-static void file_xfer_data_flushed_cb(GObject *source_object,
-                                      GAsyncResult *res,
-                                      gpointer user_data)
+/* Number of chunks each transfer may have read ahead of the agent. The
+ * window is shared among the running transfers so that they all progress
+ * at a similar pace, and it grows when the agent hands out enough tokens to
+ * absorb more data than the default window. */
+static guint file_xfer_pipeline_depth(SpiceMainChannel *channel)
 {
-    SpiceFileTransferTask *xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
-    GError *error = NULL;
+    SpiceMainChannelPrivate *c = channel->priv;
+    guint n = MAX(g_hash_table_size(c->file_xfer_pipelines), 1);
+    guint depth = FILE_XFER_PIPELINE_DEPTH;
+    guint token_depth = c->agent_tokens * VD_AGENT_MAX_DATA_SIZE / FILE_XFER_CHUNK_SIZE;
 
-    file_xfer_flush_finish(xfer_task, res, &error);
-    if (error) {
-        spice_file_transfer_task_completed(xfer_task, error);
+    depth = CLAMP(token_depth, depth, FILE_XFER_PIPELINE_MAX_DEPTH);
+    return MAX(depth / n, 1);
+}
+
+static void file_xfer_pipeline_fill(SpiceMainChannel *channel, FileXferPipeline *pipe)
+{
+    if (pipe->reading || pipe->eof ||
+        spice_file_transfer_task_is_completed(pipe->xfer_task))
+        return;
+
+    if (pipe->in_flight >= file_xfer_pipeline_depth(channel))
         return;
+
+    pipe->reading = TRUE;
+    spice_file_transfer_task_read_async(pipe->xfer_task, file_xfer_read_async_cb, pipe->xfer_op);
+}
+
+/* main context */
+static gboolean file_xfer_pipeline_fill_all(gpointer user_data)
+{
+    SpiceMainChannel *channel = user_data;
+    SpiceMainChannelPrivate *c = channel->priv;
+    GHashTableIter iter;
+    gpointer value;
+
+    c->file_xfer_fill_id = 0;
+
+    g_hash_table_iter_init(&iter, c->file_xfer_pipelines);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        FileXferPipeline *pipe = value;
+
+        if (pipe->sent > 0) {
+            pipe->xfer_op->stats.total_sent += pipe->sent;
+            spice_file_transfer_task_add_sent_bytes(pipe->xfer_task, pipe->sent);
+            pipe->sent = 0;
+            file_transfer_operation_send_progress(pipe->xfer_task);
+        }
+        file_xfer_pipeline_fill(channel, pipe);
     }
 
-    /* task might be completed while on idle */
-    if (!spice_file_transfer_task_is_completed(xfer_task)) {
-        file_transfer_operation_send_progress(xfer_task);
-        /* Read more data */
-        spice_file_transfer_task_read_async(xfer_task, file_xfer_read_async_cb, user_data);
+    return G_SOURCE_REMOVE;
+}
+
+/* any context: refilling is done from the main context, where the
+ * SpiceFileTransferTask streams live, once per batch of sent chunks */
+static void file_xfer_pipeline_schedule(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+
+    if (c->file_xfer_fill_id != 0)
+        return;
+
+    c->file_xfer_fill_id = spice_idle_add(spice_channel_get_main_context(SPICE_CHANNEL(channel)),
+                                          file_xfer_pipeline_fill_all, channel);
+}
+
+/* coroutine context */
+static void file_xfer_chunk_sent(SpiceMainChannel *channel, FileXferChunk *chunk)
+{
+    FileXferPipeline *pipe;
+
+    pipe = g_hash_table_lookup(channel->priv->file_xfer_pipelines,
+                               GUINT_TO_POINTER(chunk->task_id));
+    if (pipe == NULL) {
+        /* the task was completed while the chunk was queued */
+        return;
     }
+
+    g_warn_if_fail(pipe->in_flight > 0);
+    pipe->in_flight--;
+    pipe->sent += chunk->size;
+    file_xfer_pipeline_schedule(channel);
 }
 
 static void file_xfer_queue_msg_to_agent(SpiceMainChannel *channel,
                                          guint32 task_id,
-                                         gchar *buffer,
-                                         gint data_size)
+                                         GBytes *bytes)
 {
     VDAgentFileXferDataMessage msg;
+    FileXferChunk *chunk;
+    SpiceMsgOut *out;
 
     g_return_if_fail(channel != NULL);
 
     msg.id = task_id;
-    msg.size = data_size;
-    agent_msg_queue_many(channel, VD_AGENT_FILE_XFER_DATA,
-                         &msg, sizeof(msg),
-                         buffer, data_size, NULL);
+    msg.size = g_bytes_get_size(bytes);
+    out = agent_msg_queue_bytes(channel, VD_AGENT_FILE_XFER_DATA,
+                                &msg, sizeof(msg), bytes);
+
+    chunk = g_new0(FileXferChunk, 1);
+    chunk->task_id = task_id;
+    chunk->size = msg.size;
+    g_hash_table_insert(channel->priv->flushing, out, chunk);
+
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
 
 /* main context */
 static void file_xfer_read_async_cb(GObject *source_object,
                                     GAsyncResult *res,
-                                    gpointer user_data)
+                                    gpointer user_data G_GNUC_UNUSED)
 {
-    FileTransferOperation *xfer_op;
+    FileXferPipeline *pipe;
     SpiceFileTransferTask *xfer_task;
     SpiceMainChannel *channel;
+    guint32 task_id;
     gssize count;
-    char *buffer;
+    GBytes *bytes = NULL;
     GError *error = NULL;
 
     xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
-    xfer_op = user_data;
-
     channel = spice_file_transfer_task_get_channel(xfer_task);
-    count = spice_file_transfer_task_read_finish(xfer_task, res, &buffer, &error);
+    task_id = spice_file_transfer_task_get_id(xfer_task);
+    pipe = g_hash_table_lookup(channel->priv->file_xfer_pipelines, GUINT_TO_POINTER(task_id));
+    if (pipe != NULL)
+        pipe->reading = FALSE;
+
+    count = spice_file_transfer_task_read_finish(xfer_task, res, &bytes, &error);
     if (count < 0) {
         spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
         spice_file_transfer_task_completed(xfer_task, error);
@@ -1875,19 +2171,32 @@ static void file_xfer_read_async_cb(GObject *source_object,
          * as it will cause https://bugs.freedesktop.org/show_bug.cgi?id=97227.
          * Only when file has 0 bytes of size is when we should send 0 bytes to
          * agent, see: https://bugzilla.redhat.com/show_bug.cgi?id=1135099 */
+        if (pipe != NULL)
+            pipe->eof = TRUE;
+        g_bytes_unref(bytes);
         return;
     }
 
-    file_xfer_queue_msg_to_agent(channel, spice_file_transfer_task_get_id(xfer_task), buffer, count);
-    if (count == 0 || spice_file_transfer_task_is_completed(xfer_task)) {
-        /* on EOF just wait for VD_AGENT_FILE_XFER_STATUS from agent
-         * in case the task was completed, nothing to do. */
+    file_xfer_queue_msg_to_agent(channel, task_id, bytes);
+    g_bytes_unref(bytes);
+    if (pipe == NULL)
         return;
-    }
 
-    xfer_op->stats.total_sent += count;
+    /* the queued chunk is accounted until it is sent, see file_xfer_chunk_sent() */
+    pipe->in_flight++;
+    if (count == 0) {
+        /* the empty file was sent, just wait for VD_AGENT_FILE_XFER_STATUS
+         * from agent */
+        pipe->eof = TRUE;
+        return;
+    }
+    if (spice_file_transfer_task_is_completed(xfer_task)) {
+        /* in case the task was completed, nothing to do. */
+        return;
+    }
 
-    file_xfer_flush_async(xfer_task, file_xfer_data_flushed_cb, xfer_op);
+    /* read the next chunk while this one is being sent */
+    file_xfer_pipeline_fill(channel, pipe);
 }
 
 /* coroutine context */
@@ -1905,10 +2214,24 @@ static void main_agent_handle_xfer_status(SpiceMainChannel *channel,
     xfer_op = g_hash_table_lookup(channel->priv->file_xfer_tasks, GUINT_TO_POINTER(msg->id));
 
     switch (msg->result) {
-    case VD_AGENT_FILE_XFER_STATUS_CAN_SEND_DATA:
+    case VD_AGENT_FILE_XFER_STATUS_CAN_SEND_DATA: {
+        FileXferPipeline *pipe;
+
         g_return_if_fail(spice_file_transfer_task_is_completed(xfer_task) == FALSE);
-        spice_file_transfer_task_read_async(xfer_task, file_xfer_read_async_cb, xfer_op);
+        pipe = g_hash_table_lookup(channel->priv->file_xfer_pipelines,
+                                   GUINT_TO_POINTER(msg->id));
+        if (pipe == NULL) {
+            pipe = g_new0(FileXferPipeline, 1);
+            pipe->xfer_task = xfer_task;
+            pipe->xfer_op = xfer_op;
+            g_hash_table_insert(channel->priv->file_xfer_pipelines,
+                                GUINT_TO_POINTER(msg->id), pipe);
+        }
+        /* the reads are started from the main context, see
+         * file_xfer_pipeline_schedule() */
+        file_xfer_pipeline_schedule(channel);
         return;
+    }
     case VD_AGENT_FILE_XFER_STATUS_CANCELLED:
         error = g_error_new_literal(SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
                                     _("The spice agent cancelled the file transfer"));
@@ -1984,11 +2307,12 @@ static void spice_main_set_max_clipboard(SpiceMainChannel *self, gint max)
 
 /* coroutine context */
 static void main_agent_handle_msg(SpiceChannel *channel,
-                                  VDAgentMessage *msg, gpointer payload)
+                                  VDAgentMessage *msg, GBytes *bytes)
 {
     SpiceMainChannel *self = SPICE_MAIN_CHANNEL(channel);
     SpiceMainChannelPrivate *c = self->priv;
     guint8 selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+    gpointer payload = bytes ? (gpointer)g_bytes_get_data(bytes, NULL) : NULL;
 
     g_return_if_fail(msg->protocol == VD_AGENT_PROTOCOL);
 
@@ -2050,6 +2374,15 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     case VD_AGENT_CLIPBOARD:
     {
         VDAgentClipboard *cb = payload;
+        guint size = msg->size - sizeof(VDAgentClipboard);
+
+        /* unless it was streamed as it arrived, see main_handle_agent_data_msg() */
+        if (!c->agent_msg_streamed &&
+            g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA],
+                                         0, FALSE))
+            g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0,
+                                    selection, cb->type, size, cb->data, size);
+
         g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION], 0, selection,
                                 cb->type, cb->data, msg->size - sizeof(VDAgentClipboard));
 
@@ -2102,7 +2435,8 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     case VD_AGENT_PORT_FORWARD_DATA:
     case VD_AGENT_PORT_FORWARD_ACK:
     case VD_AGENT_PORT_FORWARD_CLOSE:
-        port_forwarder_handle_message(c->port_forwarder, msg->type, payload);
+        /* the forwarded data is queued by reference to @bytes */
+        port_forwarder_handle_message(c->port_forwarder, msg->type, bytes);
         break;
     default:
         g_warning("unhandled agent message type: %u (%s), size %u",
@@ -2110,10 +2444,83 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     }
 }
 
+static void agent_msg_fragment_free(AgentMsgFragment *fragment)
+{
+    spice_msg_in_unref(fragment->in);
+    g_free(fragment);
+}
+
+/* main or coroutine context */
+static void agent_msg_fragments_clear(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    AgentMsgFragment *fragment;
+
+    while ((fragment = g_queue_pop_head(&c->agent_msg_fragments)) != NULL) {
+        agent_msg_fragment_free(fragment);
+    }
+    c->agent_msg_pos = 0;
+    c->agent_msg_discard = FALSE;
+}
+
+/* coroutine context: emits main-clipboard-selection-data for a piece of a
+ * VD_AGENT_CLIPBOARD message, once the selection and type are known */
+static void agent_clipboard_stream_data(SpiceMainChannel *self,
+                                        const guint8 *data, gsize size)
+{
+    SpiceClipboardStream *stream = &self->priv->agent_clipboard_stream;
+    guint selection, type, total;
+
+    if (!spice_clipboard_stream_feed(stream, &data, &size))
+        return;
+
+    spice_clipboard_stream_get_header(stream, &selection, &type, &total);
+    g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0,
+                            selection, type, total, data, size);
+}
+
+/* Copies the payload held by the fragments into a single buffer. Fragments
+ * are released as they are copied so that the payload is not held twice. */
+static guint8 *agent_msg_fragments_linearize(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    AgentMsgFragment *fragment;
+    guint8 *data, *pos;
+
+    data = pos = g_malloc(c->agent_msg.size);
+    while ((fragment = g_queue_pop_head(&c->agent_msg_fragments)) != NULL) {
+        memcpy(pos, fragment->data, fragment->size);
+        pos += fragment->size;
+        agent_msg_fragment_free(fragment);
+    }
+    g_warn_if_fail(pos == data + c->agent_msg.size);
+
+    return data;
+}
+
+/* Checks the size announced in the agent message header before any of the
+ * payload is received, oversized messages are dropped as they arrive. */
+static gboolean agent_msg_size_is_valid(SpiceMainChannel *channel, VDAgentMessage *msg)
+{
+    gint max_clipboard;
+
+    if (msg->type != VD_AGENT_CLIPBOARD)
+        return msg->size <= AGENT_MSG_MAX_SIZE;
+
+    max_clipboard = spice_main_get_max_clipboard(channel);
+    if (max_clipboard < 0)
+        return TRUE;
+
+    /* allow for the selection and VDAgentClipboard headers */
+    return msg->size <= (guint64)max_clipboard + 4 + sizeof(VDAgentClipboard);
+}
+
 /* coroutine context */
-static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guchar** msg_pos)
+static void main_handle_agent_data_msg(SpiceChannel* channel, SpiceMsgIn *in,
+                                       int* msg_size, guchar** msg_pos)
 {
-    SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
+    SpiceMainChannel *self = SPICE_MAIN_CHANNEL(channel);
+    SpiceMainChannelPrivate *c = self->priv;
     int n;
 
     if (c->agent_msg_pos < sizeof(VDAgentMessage)) {
@@ -2125,24 +2532,78 @@ static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guc
         if (c->agent_msg_pos == sizeof(VDAgentMessage)) {
             SPICE_DEBUG("agent msg start: msg_size=%u, protocol=%u, type=%u",
                         c->agent_msg.size, c->agent_msg.protocol, c->agent_msg.type);
-            g_return_if_fail(c->agent_msg_data == NULL);
-            c->agent_msg_data = g_malloc0(c->agent_msg.size);
+            g_return_if_fail(g_queue_is_empty(&c->agent_msg_fragments));
+            if (!agent_msg_size_is_valid(self, &c->agent_msg)) {
+                g_warning("discarding agent message type %u (%s) of size %u",
+                          c->agent_msg.type, NAME(agent_msg_types, c->agent_msg.type),
+                          c->agent_msg.size);
+                c->agent_msg_discard = TRUE;
+            }
+            /* clipboard data is passed on as it arrives to the streaming
+             * handlers, and only kept around for the other ones */
+            c->agent_msg_stream = c->agent_msg.type == VD_AGENT_CLIPBOARD &&
+                g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA],
+                                             0, FALSE);
+            c->agent_msg_keep = !c->agent_msg_stream ||
+                g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION],
+                                             0, FALSE) ||
+                g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD], 0, FALSE);
+            spice_clipboard_stream_init(&c->agent_clipboard_stream, c->agent_msg.size,
+                                        test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION));
         }
     }
 
     if (c->agent_msg_pos >= sizeof(VDAgentMessage)) {
         n = MIN(sizeof(VDAgentMessage) + c->agent_msg.size - c->agent_msg_pos, *msg_size);
-        memcpy(c->agent_msg_data + c->agent_msg_pos - sizeof(VDAgentMessage), *msg_pos, n);
+        if (n > 0 && !c->agent_msg_discard && c->agent_msg_stream) {
+            agent_clipboard_stream_data(self, *msg_pos, n);
+        }
+        if (n > 0 && !c->agent_msg_discard && c->agent_msg_keep) {
+            AgentMsgFragment *fragment = g_new(AgentMsgFragment, 1);
+
+            /* keep a reference on the message rather than copying the data */
+            spice_msg_in_ref(in);
+            fragment->in = in;
+            fragment->data = *msg_pos;
+            fragment->size = n;
+            g_queue_push_tail(&c->agent_msg_fragments, fragment);
+        }
         c->agent_msg_pos += n;
         *msg_size -= n;
         *msg_pos += n;
     }
 
     if (c->agent_msg_pos == sizeof(VDAgentMessage) + c->agent_msg.size) {
-        main_agent_handle_msg(channel, &c->agent_msg, c->agent_msg_data);
-        g_free(c->agent_msg_data);
-        c->agent_msg_data = NULL;
+        c->agent_msg_streamed = c->agent_msg_stream;
+        if (c->agent_msg_discard || !c->agent_msg_keep) {
+            agent_msg_fragments_clear(self);
+        } else if (g_queue_get_length(&c->agent_msg_fragments) <= 1) {
+            /* the payload was received in one piece, no copy needed */
+            AgentMsgFragment *fragment = g_queue_pop_head(&c->agent_msg_fragments);
+            GBytes *bytes = NULL;
+
+            if (fragment) {
+                guint8 *data;
+                int len;
+
+                data = spice_msg_in_raw(fragment->in, &len);
+                bytes = spice_msg_in_bytes(fragment->in, fragment->data - data,
+                                           fragment->size);
+                agent_msg_fragment_free(fragment);
+            }
+            main_agent_handle_msg(channel, &c->agent_msg, bytes);
+            g_clear_pointer(&bytes, g_bytes_unref);
+        } else {
+            GBytes *bytes = g_bytes_new_take(agent_msg_fragments_linearize(self),
+                                             c->agent_msg.size);
+
+            main_agent_handle_msg(channel, &c->agent_msg, bytes);
+            g_bytes_unref(bytes);
+        }
         c->agent_msg_pos = 0;
+        c->agent_msg_discard = FALSE;
+        c->agent_msg_stream = FALSE;
+        c->agent_msg_streamed = FALSE;
     }
 }
 
@@ -2164,14 +2625,17 @@ static void main_handle_agent_data(SpiceChannel *channel, SpiceMsgIn *in)
         msg_size = msg->size;
 
         if (msg_size + sizeof(VDAgentMessage) == len) {
-            main_agent_handle_msg(channel, msg, msg->data);
+            GBytes *bytes = spice_msg_in_bytes(in, sizeof(VDAgentMessage), msg_size);
+
+            main_agent_handle_msg(channel, msg, bytes);
+            g_bytes_unref(bytes);
             return;
         }
     }
 
     data = spice_msg_in_raw(in, &len);
     while (len > 0) {
-        main_handle_agent_data_msg(channel, &len, &data);
+        main_handle_agent_data_msg(channel, in, &len, &data);
     }
 }
 
@@ -2211,7 +2675,8 @@ static void spice_main_channel_send_migration_handshake(SpiceChannel *channel)
 
     if (!spice_channel_test_capability(channel, SPICE_MAIN_CAP_SEAMLESS_MIGRATE)) {
         c->migrate_data->do_seamless = false;
-        g_idle_add(main_migrate_handshake_done, c->migrate_data);
+        spice_idle_add(spice_channel_get_main_context(channel),
+                       main_migrate_handshake_done, c->migrate_data);
     } else {
         SpiceMsgcMainMigrateDstDoSeamless msg_data;
         SpiceMsgOut *msg_out;
@@ -2408,7 +2873,7 @@ static void main_migrate_connect(SpiceChannel *channel,
     main_priv->migrate_data = &mig;
 
     /* no need to track idle, call is sync for this coroutine */
-    g_idle_add(migrate_connect, &mig);
+    spice_idle_add(spice_channel_get_main_context(channel), migrate_connect, &mig);
 
     /* switch to main loop and wait for connections */
     coroutine_yield(NULL);
@@ -2457,7 +2922,8 @@ static void main_handle_migrate_dst_seamless_ack(SpiceChannel *channel, SpiceMsg
 
     g_return_if_fail(c->state == SPICE_CHANNEL_STATE_MIGRATION_HANDSHAKE);
     main_priv->migrate_data->do_seamless = true;
-    g_idle_add(main_migrate_handshake_done, main_priv->migrate_data);
+    spice_idle_add(spice_channel_get_main_context(channel), main_migrate_handshake_done,
+                   main_priv->migrate_data);
 }
 
 static void main_handle_migrate_dst_seamless_nack(SpiceChannel *channel, SpiceMsgIn *in)
@@ -2467,7 +2933,8 @@ static void main_handle_migrate_dst_seamless_nack(SpiceChannel *channel, SpiceMs
 
     g_return_if_fail(c->state == SPICE_CHANNEL_STATE_MIGRATION_HANDSHAKE);
     main_priv->migrate_data->do_seamless = false;
-    g_idle_add(main_migrate_handshake_done, main_priv->migrate_data);
+    spice_idle_add(spice_channel_get_main_context(channel), main_migrate_handshake_done,
+                   main_priv->migrate_data);
 }
 
 /* main context */
@@ -2494,7 +2961,8 @@ static void main_handle_migrate_end(SpiceChannel *channel, SpiceMsgIn *in)
     g_return_if_fail(c->migrate_delayed_id == 0);
     g_return_if_fail(spice_channel_test_capability(channel, SPICE_MAIN_CAP_SEMI_SEAMLESS_MIGRATE));
 
-    c->migrate_delayed_id = g_idle_add(migrate_delayed, channel);
+    c->migrate_delayed_id = spice_idle_add(spice_channel_get_main_context(channel),
+                                           migrate_delayed, channel);
 }
 
 /* main context */
@@ -2536,7 +3004,8 @@ static void main_handle_migrate_switch_host(SpiceChannel *channel, SpiceMsgIn *i
 
     if (c->switch_host_delayed_id != 0) {
         g_warning("Switching host already in progress, aborting it");
-        g_warn_if_fail(g_source_remove(c->switch_host_delayed_id));
+        g_warn_if_fail(spice_source_remove(spice_channel_get_main_context(channel),
+                                           c->switch_host_delayed_id));
         c->switch_host_delayed_id = 0;
     }
 
@@ -2549,7 +3018,8 @@ static void main_handle_migrate_switch_host(SpiceChannel *channel, SpiceMsgIn *i
     spice_session_set_port(session, mig->port, FALSE);
     spice_session_set_port(session, mig->sport, TRUE);
 
-    c->switch_host_delayed_id = g_idle_add(switch_host_delayed, channel);
+    c->switch_host_delayed_id = spice_idle_add(spice_channel_get_main_context(channel),
+                                               switch_host_delayed, channel);
 }
 
 /* coroutine context */
@@ -2800,9 +3270,10 @@ void spice_main_channel_clipboard_selection_grab(SpiceMainChannel *channel, guin
     g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
 
     agent_clipboard_grab(channel, selection, types, ntypes);
-    g_timeout_add_full(G_PRIORITY_HIGH, 0,
-                       spice_channel_wakeup1,
-                       SPICE_CHANNEL(channel), NULL);
+    spice_timeout_add_full(spice_channel_get_main_context(SPICE_CHANNEL(channel)),
+                           G_PRIORITY_HIGH, 0,
+                           spice_channel_wakeup1,
+                           SPICE_CHANNEL(channel), NULL);
 }
 
 /**
@@ -2856,9 +3327,10 @@ void spice_main_channel_clipboard_selection_release(SpiceMainChannel *channel, g
         return;
 
     agent_clipboard_release(channel, selection);
-    g_timeout_add_full(G_PRIORITY_HIGH, 0,
-                       spice_channel_wakeup1,
-                       SPICE_CHANNEL(channel), NULL);
+    spice_timeout_add_full(spice_channel_get_main_context(SPICE_CHANNEL(channel)),
+                           G_PRIORITY_HIGH, 0,
+                           spice_channel_wakeup1,
+                           SPICE_CHANNEL(channel), NULL);
 }
 
 /**
@@ -2912,14 +3384,44 @@ void spice_main_clipboard_selection_notify(SpiceMainChannel *channel, guint sele
  **/
 void spice_main_channel_clipboard_selection_notify(SpiceMainChannel *channel, guint selection,
                                            guint32 type, const guchar *data, size_t size)
+{
+    GBytes *bytes;
+
+    g_return_if_fail(channel != NULL);
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+
+    bytes = g_bytes_new(data, size);
+    spice_main_channel_clipboard_selection_notify_bytes(channel, selection, type, bytes);
+    g_bytes_unref(bytes);
+}
+
+/**
+ * spice_main_channel_clipboard_selection_notify_bytes:
+ * @channel: a #SpiceMainChannel
+ * @selection: one of the clipboard #VD_AGENT_CLIPBOARD_SELECTION_*
+ * @type: a #VD_AGENT_CLIPBOARD type
+ * @data: clipboard data
+ *
+ * Send the clipboard data to the guest. Unlike
+ * spice_main_channel_clipboard_selection_notify(), @data is not copied: a
+ * reference is kept until it has been sent, and it is handed to the agent
+ * piece by piece as the agent is ready to receive it.
+ *
+ * Since: 0.35
+ **/
+void spice_main_channel_clipboard_selection_notify_bytes(SpiceMainChannel *channel,
+                                                         guint selection,
+                                                         guint32 type, GBytes *data)
 {
     g_return_if_fail(channel != NULL);
     g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(data != NULL);
 
-    agent_clipboard_notify(channel, selection, type, data, size);
-    g_timeout_add_full(G_PRIORITY_HIGH, 0,
-                       spice_channel_wakeup1,
-                       SPICE_CHANNEL(channel), NULL);
+    agent_clipboard_notify(channel, selection, type, data);
+    spice_timeout_add_full(spice_channel_get_main_context(SPICE_CHANNEL(channel)),
+                           G_PRIORITY_HIGH, 0,
+                           spice_channel_wakeup1,
+                           SPICE_CHANNEL(channel), NULL);
 }
 
 /**
@@ -3241,6 +3743,9 @@ static void file_transfer_operation_task_finished(SpiceFileTransferTask *xfer_ta
         xfer_op->stats.succeed++;
     }
 
+    /* Stop reading ahead, already queued chunks are still sent */
+    g_hash_table_remove(channel->priv->file_xfer_pipelines, GUINT_TO_POINTER(task_id));
+
     /* Remove and free SpiceFileTransferTask */
     g_hash_table_remove(xfer_op->xfer_task, GUINT_TO_POINTER(task_id));
 
@@ -82,6 +82,8 @@ void spice_main_channel_clipboard_selection_grab(SpiceMainChannel *channel, guin
 void spice_main_channel_clipboard_selection_release(SpiceMainChannel *channel, guint selection);
 void spice_main_channel_clipboard_selection_notify(SpiceMainChannel *channel, guint selection,
                                                    guint32 type, const guchar *data, size_t size);
+void spice_main_channel_clipboard_selection_notify_bytes(SpiceMainChannel *channel, guint selection,
+                                                         guint32 type, GBytes *data);
 void spice_main_channel_clipboard_selection_request(SpiceMainChannel *channel, guint selection,
                                                     guint32 type);
 
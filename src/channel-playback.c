@@ -25,6 +25,7 @@
 #include "spice-marshal.h"
 
 #include "common/snd_codec.h"
+#include "spice-audio-worker.h"
 #include "channel-playback-priv.h"
 
 /**
@@ -51,7 +52,7 @@
 
 struct _SpicePlaybackChannelPrivate {
     int                         mode;
-    SndCodec                    codec;
+    SpiceAudioWorker            *worker;
     guint32                     frame_count;
     guint32                     last_time;
     guint8                      nchannels;
@@ -85,6 +86,7 @@ enum {
 
 static guint signals[SPICE_PLAYBACK_LAST_SIGNAL];
 static void channel_set_handlers(SpiceChannelClass *klass);
+static void playback_job_done(SpiceAudioJob *job, gpointer user_data);
 
 /* ------------------------------------------------------------------ */
 
@@ -113,7 +115,7 @@ static void spice_playback_channel_finalize(GObject *obj)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(obj)->priv;
 
-    snd_codec_destroy(&c->codec);
+    g_clear_pointer(&c->worker, spice_audio_worker_free);
 
     g_clear_pointer(&c->volume, g_free);
 
@@ -171,7 +173,10 @@ static void spice_playback_channel_reset(SpiceChannel *channel, gboolean migrati
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
 
-    snd_codec_destroy(&c->codec);
+    if (c->worker != NULL) {
+        spice_audio_worker_drop_pending(c->worker);
+        spice_audio_worker_push(c->worker, spice_audio_job_new(SPICE_AUDIO_JOB_CODEC));
+    }
     g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
     c->is_active = FALSE;
 
@@ -302,11 +307,63 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
 
 /* ------------------------------------------------------------------ */
 
+/* The playback signals are emitted once the worker thread went through
+ * the data received before them, so that they keep their order */
+enum {
+    PLAYBACK_JOB_START = 1,
+    PLAYBACK_JOB_DATA,
+    PLAYBACK_JOB_STOP,
+};
+
+/* main context */
+static void playback_job_done(SpiceAudioJob *job, gpointer user_data)
+{
+    SpiceChannel *channel = user_data;
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    switch (job->tag) {
+    case PLAYBACK_JOB_START:
+        c->frame_count = 0;
+        g_signal_emit(channel, signals[SPICE_PLAYBACK_START], 0,
+                      job->format, job->channels, job->frequency);
+        break;
+    case PLAYBACK_JOB_DATA:
+        if (job->out == NULL) {
+            g_warning("snd_codec_decode() error");
+            break;
+        }
+        g_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0,
+                      g_bytes_get_data(job->out, NULL),
+                      (gint)g_bytes_get_size(job->out));
+
+        if ((c->frame_count++ % 100) == 0) {
+            g_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
+        }
+        break;
+    case PLAYBACK_JOB_STOP:
+        g_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
+        break;
+    }
+}
+
+/* coroutine context */
+static SpiceAudioWorker *playback_get_worker(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    if (c->worker == NULL)
+        c->worker = spice_audio_worker_new("spice-playback", SND_CODEC_DECODE,
+                                           spice_channel_get_main_context(channel),
+                                           playback_job_done, channel);
+    return c->worker;
+}
+
 /* coroutine context */
 static void playback_handle_data(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
     SpiceMsgPlaybackPacket *packet = spice_msg_in_parsed(in);
+    SpiceAudioJob *job;
 
 #ifdef DEBUG
     CHANNEL_DEBUG(channel, "%s: time %u data %p size %d", __FUNCTION__,
@@ -318,26 +375,12 @@ static void playback_handle_data(SpiceChannel *channel, SpiceMsgIn *in)
 
     c->last_time = packet->time;
 
-    uint8_t *data = packet->data;
-    int n = packet->data_size;
-    uint8_t pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
-
-    if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        n = sizeof(pcm);
-        data = pcm;
-
-        if (snd_codec_decode(c->codec, packet->data, packet->data_size,
-                    pcm, &n) != SND_CODEC_OK) {
-            g_warning("snd_codec_decode() error");
-            return;
-        }
-    }
-
-    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0, data, n);
-
-    if ((c->frame_count++ % 100) == 0) {
-        g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
-    }
+    /* decoded, or passed through in raw mode, by the worker thread */
+    job = spice_audio_job_new(SPICE_AUDIO_JOB_DATA);
+    job->tag = PLAYBACK_JOB_DATA;
+    job->time = packet->time;
+    job->in = g_bytes_new(packet->data, packet->data_size);
+    spice_audio_worker_push(playback_get_worker(channel), job);
 }
 
 /* coroutine context */
@@ -366,33 +409,39 @@ static void playback_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
     SpiceMsgPlaybackStart *start = spice_msg_in_parsed(in);
+    SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_CODEC);
 
     CHANNEL_DEBUG(channel, "%s: fmt %u channels %u freq %u time %u mode %s", __FUNCTION__,
                   start->format, start->channels, start->frequency, start->time,
                   spice_audio_data_mode_to_string(c->mode));
 
-    c->frame_count = 0;
     c->last_time = start->time;
     c->is_active = TRUE;
     c->min_latency = SPICE_PLAYBACK_DEFAULT_LATENCY_MS;
-    snd_codec_destroy(&c->codec);
 
+    /* the decoder is handed over to the worker thread, that owns it */
     if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        if (snd_codec_create(&c->codec, c->mode, start->frequency, SND_CODEC_DECODE) != SND_CODEC_OK) {
+        if (snd_codec_create(&job->codec, c->mode, start->frequency, SND_CODEC_DECODE) != SND_CODEC_OK) {
             g_warning("create decoder failed");
+            spice_audio_job_free(job);
             return;
         }
     }
-    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_START], 0,
-                            start->format, start->channels, start->frequency);
+    job->tag = PLAYBACK_JOB_START;
+    job->format = start->format;
+    job->channels = start->channels;
+    job->frequency = start->frequency;
+    spice_audio_worker_push(playback_get_worker(channel), job);
 }
 
 /* coroutine context */
 static void playback_handle_stop(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_MARK);
 
-    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
+    job->tag = PLAYBACK_JOB_STOP;
+    spice_audio_worker_push(playback_get_worker(channel), job);
     c->is_active = FALSE;
 }
 
@@ -21,6 +21,7 @@
 #include "spice-common.h"
 #include "spice-channel-priv.h"
 #include "spice-marshal.h"
+#include "spice-util-priv.h"
 
 /**
  * SECTION:channel-port
@@ -49,15 +50,27 @@
  * receiving data via the signal SpicePortChannel::port-data, or
  * sending data via spice_port_write_async().
  *
+ * The signal SpicePortChannel::port-data-bytes delivers the same data
+ * in a #GBytes, that may be kept without copying it. The writes queued
+ * during a main loop iteration are sent together, in as few messages
+ * as possible.
+ *
  * Since: 0.15
  */
 
 #define SPICE_PORT_CHANNEL_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_PORT_CHANNEL, SpicePortChannelPrivate))
 
+/* Queued writes are sent in messages of up to this size, a larger write
+ * is sent alone */
+#define PORT_WRITE_BATCH_SIZE (64 * 1024)
+
 struct _SpicePortChannelPrivate {
     gchar *name;
     gboolean opened;
+
+    GQueue write_queue; /* GTask, with the GBytes to write as task data */
+    guint write_flush_id;
 };
 
 G_DEFINE_TYPE(SpicePortChannel, spice_port_channel, SPICE_TYPE_CHANNEL)
@@ -72,12 +85,14 @@ enum {
 /* Signals */
 enum {
     SPICE_PORT_DATA,
+    SPICE_PORT_DATA_BYTES,
     SPICE_PORT_EVENT,
     LAST_SIGNAL,
 };
 
 static guint signals[LAST_SIGNAL];
 static void channel_set_handlers(SpiceChannelClass *klass);
+static void port_write_queue_clear(SpicePortChannel *self);
 
 static void spice_port_channel_init(SpicePortChannel *channel)
 {
@@ -109,6 +124,9 @@ static void spice_port_channel_finalize(GObject *object)
     SpicePortChannelPrivate *c = SPICE_PORT_CHANNEL(object)->priv;
 
     g_free(c->name);
+    if (c->write_flush_id != 0)
+        spice_source_remove(spice_channel_get_main_context(SPICE_CHANNEL(object)),
+                            c->write_flush_id);
 
     if (G_OBJECT_CLASS(spice_port_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_port_channel_parent_class)->finalize(object);
@@ -120,6 +138,7 @@ static void spice_port_channel_reset(SpiceChannel *channel, gboolean migrating)
 
     g_clear_pointer(&c->name, g_free);
     c->opened = FALSE;
+    port_write_queue_clear(SPICE_PORT_CHANNEL(channel));
 
     SPICE_CHANNEL_CLASS(spice_port_channel_parent_class)->channel_reset(channel, migrating);
 }
@@ -170,6 +189,28 @@ static void spice_port_channel_class_init(SpicePortChannelClass *klass)
                      2,
                      G_TYPE_POINTER, G_TYPE_INT);
 
+    /**
+     * SpicePortChannel::port-data-bytes:
+     * @channel: the channel that emitted the signal
+     * @bytes: the data received
+     *
+     * The #SpicePortChannel::port-data-bytes signal is emitted when
+     * new port data is received, like #SpicePortChannel::port-data.
+     * @bytes refers to the received message, a reference can be kept
+     * instead of copying the data.
+     *
+     * Since: 0.35
+     **/
+    signals[SPICE_PORT_DATA_BYTES] =
+        g_signal_new("port-data-bytes",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__BOXED,
+                     G_TYPE_NONE,
+                     1,
+                     G_TYPE_BYTES);
 
     /**
      * SpicePortChannel::port-event:
@@ -258,7 +299,109 @@ static void port_handle_msg(SpiceChannel *channel, SpiceMsgIn *in)
     buf = spice_msg_in_raw(in, &size);
     CHANNEL_DEBUG(channel, "port %p got %d %p", channel, size, buf);
     port_set_opened(self, true);
-    g_coroutine_signal_emit(channel, signals[SPICE_PORT_DATA], 0, buf, size);
+    /* @buf belongs to @in, keep it until the signal was emitted */
+    spice_msg_in_ref(in);
+    g_coroutine_signal_emit_batched(channel, signals[SPICE_PORT_DATA], 0,
+                                    in, (GDestroyNotify)spice_msg_in_unref,
+                                    buf, size);
+
+    if (g_signal_has_handler_pending(channel, signals[SPICE_PORT_DATA_BYTES], 0, FALSE)) {
+        GBytes *bytes = spice_msg_in_bytes(in, 0, size);
+
+        /* the signal holds its own reference on @bytes */
+        g_coroutine_signal_emit_batched(channel, signals[SPICE_PORT_DATA_BYTES], 0,
+                                        NULL, NULL, bytes);
+        g_bytes_unref(bytes);
+    }
+}
+
+static void port_write_task_free_cb(uint8_t *data G_GNUC_UNUSED, void *user_data)
+{
+    GTask *task = user_data;
+    GBytes *bytes = g_task_get_task_data(task);
+
+    g_task_return_int(task, g_bytes_get_size(bytes));
+    g_object_unref(task);
+}
+
+/* main context */
+static gboolean port_write_flush(gpointer user_data)
+{
+    SpicePortChannel *self = user_data;
+    SpicePortChannelPrivate *c = self->priv;
+    GTask *task;
+
+    c->write_flush_id = 0;
+
+    while (!g_queue_is_empty(&c->write_queue)) {
+        SpiceMsgOut *msg = spice_msg_out_new(SPICE_CHANNEL(self), SPICE_MSGC_SPICEVMC_DATA);
+        gsize size = 0;
+
+        while ((task = g_queue_peek_head(&c->write_queue)) != NULL) {
+            GBytes *bytes = g_task_get_task_data(task);
+            gsize count;
+            gconstpointer data = g_bytes_get_data(bytes, &count);
+
+            if (size > 0 && size + count > PORT_WRITE_BATCH_SIZE)
+                break;
+
+            g_queue_pop_head(&c->write_queue);
+            /* the task completes once the message was written */
+            spice_marshaller_add_by_ref_full(msg->marshaller, (uint8_t *)data, count,
+                                             port_write_task_free_cb, task);
+            size += count;
+        }
+        spice_msg_out_send(msg);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/* main context */
+static void port_write_queue_clear(SpicePortChannel *self)
+{
+    SpicePortChannelPrivate *c = self->priv;
+    GTask *task;
+
+    if (c->write_flush_id != 0) {
+        spice_source_remove(spice_channel_get_main_context(SPICE_CHANNEL(self)),
+                            c->write_flush_id);
+        c->write_flush_id = 0;
+    }
+
+    while ((task = g_queue_pop_head(&c->write_queue)) != NULL) {
+        g_task_return_new_error(task, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                "The port was closed");
+        g_object_unref(task);
+    }
+}
+
+/* main context */
+static void port_write_queue(SpicePortChannel *self, GBytes *bytes,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data, gpointer source_tag)
+{
+    SpicePortChannelPrivate *c = self->priv;
+    GTask *task;
+
+    if (!c->opened) {
+        g_task_report_new_error(self, callback,
+            user_data, source_tag,
+            SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+            "The port is not opened");
+        return;
+    }
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, source_tag);
+    g_task_set_task_data(task, g_bytes_ref(bytes), (GDestroyNotify)g_bytes_unref);
+    g_queue_push_tail(&c->write_queue, task);
+
+    /* the writes queued until the main loop runs again share messages */
+    if (c->write_flush_id == 0)
+        c->write_flush_id = spice_idle_add(spice_channel_get_main_context(SPICE_CHANNEL(self)),
+                                           port_write_flush, self);
 }
 
 /**
@@ -311,22 +454,48 @@ void spice_port_channel_write_async(SpicePortChannel *self,
                                     GAsyncReadyCallback callback,
                                     gpointer user_data)
 {
-    SpicePortChannelPrivate *c;
+    GBytes *bytes;
 
     g_return_if_fail(SPICE_IS_PORT_CHANNEL(self));
     g_return_if_fail(buffer != NULL);
-    c = self->priv;
 
-    if (!c->opened) {
-        g_task_report_new_error(self, callback,
-            user_data, spice_port_channel_write_async,
-            SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
-            "The port is not opened");
-        return;
-    }
+    /* @buffer is owned by the caller until @callback is called */
+    bytes = g_bytes_new_static(buffer, count);
+    port_write_queue(self, bytes, cancellable, callback, user_data,
+                     spice_port_channel_write_async);
+    g_bytes_unref(bytes);
+}
 
-    spice_vmc_write_async(SPICE_CHANNEL(self), buffer, count,
-                          cancellable, callback, user_data);
+/**
+ * spice_port_channel_write_bytes_async:
+ * @port: A #SpicePortChannel
+ * @bytes: the data to write
+ * @cancellable: (allow-none): optional GCancellable object, NULL to ignore
+ * @callback: (scope async): callback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Request an asynchronous write of @bytes into the @port, keeping a
+ * reference on them until they are sent. When the operation is
+ * finished @callback will be called. You can then call
+ * spice_port_channel_write_finish() to get the result of the
+ * operation.
+ *
+ * Several writes may be pending at once, the ones requested before
+ * the main loop runs again are sent together.
+ *
+ * Since: 0.35
+ **/
+void spice_port_channel_write_bytes_async(SpicePortChannel *self,
+                                          GBytes *bytes,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+    g_return_if_fail(SPICE_IS_PORT_CHANNEL(self));
+    g_return_if_fail(bytes != NULL);
+
+    port_write_queue(self, bytes, cancellable, callback, user_data,
+                     spice_port_channel_write_bytes_async);
 }
 
 /**
@@ -355,7 +524,9 @@ gssize spice_port_write_finish(SpicePortChannel *self,
  * @error: a #GError location to store the error occurring, or %NULL
  * to ignore
  *
- * Finishes a port write operation.
+ * Finishes a port write operation, started with
+ * spice_port_channel_write_async() or
+ * spice_port_channel_write_bytes_async().
  *
  * Returns: a #gssize containing the number of bytes written to the stream.
  * Since: 0.35
@@ -392,7 +563,7 @@ void spice_port_event(SpicePortChannel *self, guint8 event)
  * @port: a #SpicePortChannel
  * @event: a SPICE_PORT_EVENT value
  *
- * Send an event to the port.
+ * Send an event to the port, after the data written before it.
  *
  * Note: The values SPICE_PORT_EVENT_CLOSED and
  * SPICE_PORT_EVENT_OPENED are managed by the channel connection
@@ -402,12 +573,21 @@ void spice_port_event(SpicePortChannel *self, guint8 event)
  **/
 void spice_port_channel_event(SpicePortChannel *self, guint8 event)
 {
+    SpicePortChannelPrivate *c;
     SpiceMsgcPortEvent e;
     SpiceMsgOut *msg;
 
     g_return_if_fail(SPICE_IS_PORT_CHANNEL(self));
     g_return_if_fail(event > SPICE_PORT_EVENT_CLOSED);
 
+    /* the data written before the event is sent before it */
+    c = self->priv;
+    if (c->write_flush_id != 0) {
+        spice_source_remove(spice_channel_get_main_context(SPICE_CHANNEL(self)),
+                            c->write_flush_id);
+        port_write_flush(self);
+    }
+
     msg = spice_msg_out_new(SPICE_CHANNEL(self), SPICE_MSGC_PORT_EVENT);
     e.event = event;
     msg->marshallers->msgc_port_event(msg->marshaller, &e);
@@ -71,6 +71,11 @@ void spice_port_channel_write_async(SpicePortChannel *port,
                                     GCancellable *cancellable,
                                     GAsyncReadyCallback callback,
                                     gpointer user_data);
+void spice_port_channel_write_bytes_async(SpicePortChannel *port,
+                                          GBytes *bytes,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
 gssize spice_port_channel_write_finish(SpicePortChannel *port,
                                        GAsyncResult *result, GError **error);
 void spice_port_channel_event(SpicePortChannel *port, guint8 event);
@@ -25,6 +25,7 @@
 #include "spice-session-priv.h"
 
 #include "common/snd_codec.h"
+#include "spice-audio-worker.h"
 
 /**
  * SECTION:channel-record
@@ -53,7 +54,7 @@
 struct _SpiceRecordChannelPrivate {
     int                         mode;
     gboolean                    started;
-    SndCodec                    codec;
+    SpiceAudioWorker            *worker;
     gsize                       frame_bytes;
     guint8                      *last_frame;
     gsize                       last_frame_current;
@@ -110,7 +111,7 @@ static void spice_record_channel_finalize(GObject *obj)
 
     g_clear_pointer(&c->last_frame, g_free);
 
-    snd_codec_destroy(&c->codec);
+    g_clear_pointer(&c->worker, spice_audio_worker_free);
 
     g_clear_pointer(&c->volume, g_free);
 
@@ -169,7 +170,10 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_STOP], 0);
     c->started = FALSE;
 
-    snd_codec_destroy(&c->codec);
+    if (c->worker != NULL) {
+        spice_audio_worker_drop_pending(c->worker);
+        spice_audio_worker_push(c->worker, spice_audio_job_new(SPICE_AUDIO_JOB_CODEC));
+    }
 
     SPICE_CHANNEL_CLASS(spice_record_channel_parent_class)->channel_reset(channel, migrating);
 }
@@ -304,6 +308,39 @@ static void spice_record_start_mark(SpiceRecordChannel *channel, uint32_t time)
     spice_msg_out_send(msg);
 }
 
+/* main context */
+static void spice_record_send_packet(SpiceRecordChannel *channel, uint32_t time,
+                                     gconstpointer data, gsize size)
+{
+    SpiceMsgcRecordPacket p = {0, };
+    SpiceMsgOut *msg;
+
+    p.time = time;
+
+    msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
+    msg->marshallers->msgc_record_data(msg->marshaller, &p);
+    spice_marshaller_add(msg->marshaller, data, size);
+    spice_msg_out_send(msg);
+}
+
+/* main context */
+static void record_job_done(SpiceAudioJob *job, gpointer user_data)
+{
+    SpiceRecordChannel *channel = user_data;
+
+    if (job->type != SPICE_AUDIO_JOB_DATA)
+        return;
+
+    if (job->out == NULL) {
+        g_warning("encode failed");
+        return;
+    }
+
+    spice_record_send_packet(channel, job->time,
+                             g_bytes_get_data(job->out, NULL),
+                             g_bytes_get_size(job->out));
+}
+
 /**
  * spice_record_send_data:
  * @channel: a #SpiceRecordChannel
@@ -336,7 +373,6 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
                                     gsize bytes, uint32_t time)
 {
     SpiceRecordChannelPrivate *rc;
-    SpiceMsgcRecordPacket p = {0, };
 
     g_return_if_fail(SPICE_IS_RECORD_CHANNEL(channel));
     rc = channel->priv;
@@ -347,23 +383,15 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
 
     g_return_if_fail(spice_channel_get_read_only(SPICE_CHANNEL(channel)) == FALSE);
 
-    uint8_t *encode_buf = NULL;
-
     if (!rc->started) {
         spice_record_mode(channel, time, rc->mode, NULL, 0);
         spice_record_start_mark(channel, time);
         rc->started = TRUE;
     }
 
-    if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW)
-        encode_buf = g_alloca(SND_CODEC_MAX_COMPRESSED_BYTES);
-
-    p.time = time;
-
     while (bytes > 0) {
         gsize n;
         int frame_size;
-        SpiceMsgOut *msg;
         uint8_t *frame;
 
         if (rc->last_frame_current > 0) {
@@ -391,19 +419,15 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
         }
 
         if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-            int len = SND_CODEC_MAX_COMPRESSED_BYTES;
-            if (snd_codec_encode(rc->codec, frame, frame_size, encode_buf, &len) != SND_CODEC_OK) {
-                g_warning("encode failed");
-                return;
-            }
-            frame = encode_buf;
-            frame_size = len;
-        }
+            /* encoded by the worker thread, and sent from record_job_done() */
+            SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_DATA);
 
-        msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
-        msg->marshallers->msgc_record_data(msg->marshaller, &p);
-        spice_marshaller_add(msg->marshaller, frame, frame_size);
-        spice_msg_out_send(msg);
+            job->time = time;
+            job->in = g_bytes_new(frame, frame_size);
+            spice_audio_worker_push(rc->worker, job);
+        } else {
+            spice_record_send_packet(channel, time, frame, frame_size);
+        }
 
         if (rc->last_frame_current == rc->frame_bytes)
             rc->last_frame_current = 0;
@@ -421,6 +445,7 @@ static void record_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceRecordChannelPrivate *c = SPICE_RECORD_CHANNEL(channel)->priv;
     SpiceMsgRecordStart *start = spice_msg_in_parsed(in);
     int frame_size = SND_CODEC_MAX_FRAME_SIZE;
+    SpiceAudioJob *job;
 
     c->mode = spice_record_desired_mode(channel, start->frequency);
 
@@ -430,15 +455,25 @@ static void record_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_return_if_fail(start->format == SPICE_AUDIO_FMT_S16);
 
-    snd_codec_destroy(&c->codec);
+    if (c->worker == NULL)
+        c->worker = spice_audio_worker_new("spice-record", SND_CODEC_ENCODE,
+                                           spice_channel_get_main_context(channel),
+                                           record_job_done, channel);
+    /* the frames of the previous recording are not sent anymore */
+    spice_audio_worker_drop_pending(c->worker);
 
+    /* the encoder is handed over to the worker thread, that owns it */
+    job = spice_audio_job_new(SPICE_AUDIO_JOB_CODEC);
     if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        if (snd_codec_create(&c->codec, c->mode, start->frequency, SND_CODEC_ENCODE) != SND_CODEC_OK) {
+        if (snd_codec_create(&job->codec, c->mode, start->frequency, SND_CODEC_ENCODE) != SND_CODEC_OK) {
             g_warning("Failed to create encoder");
+            spice_audio_job_free(job);
+            g_clear_pointer(&c->last_frame, g_free);
             return;
         }
-        frame_size = snd_codec_frame_size(c->codec);
+        frame_size = snd_codec_frame_size(job->codec);
     }
+    spice_audio_worker_push(c->worker, job);
 
     g_free(c->last_frame);
     c->frame_bytes = frame_size * 16 * start->channels / 8;
@@ -456,6 +491,8 @@ static void record_handle_stop(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_STOP], 0);
     rc->started = FALSE;
+    if (rc->worker != NULL)
+        spice_audio_worker_drop_pending(rc->worker);
 }
 
 /* coroutine context */
@@ -28,6 +28,7 @@
 #include "smartcard-manager.h"
 #include "smartcard-manager-priv.h"
 #include "spice-session-priv.h"
+#include "spice-smartcard-queue.h"
 
 /**
  * SECTION:channel-smartcard
@@ -53,10 +54,12 @@
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_SMARTCARD_CHANNEL, SpiceSmartcardChannelPrivate))
 
 struct _SpiceSmartcardChannelMessage {
+    SpiceSmartcardQueueItem item;
 #ifdef USE_SMARTCARD
     VSCMsgType message_type;
 #endif
     SpiceMsgOut *message;
+    gint64 queued_time;
 };
 typedef struct _SpiceSmartcardChannelMessage SpiceSmartcardChannelMessage;
 
@@ -77,19 +80,28 @@ struct _SpiceSmartcardChannelPrivate {
      * by the spice server */
     GHashTable *pending_card_insertions;
 
-    /* next commands to be sent to the spice server. This is needed since
-     * we have to wait for a command answer before sending the next one
+    /* commands waiting to be sent to the spice server, since some of them
+     * have to wait for the answers of the previous ones, and commands being
+     * processed by the server (ie sent but not answered yet)
      */
-    GQueue *message_queue;
+    SpiceSmartcardQueue queue;
 
-    /* message that is currently being processed by the spice server (ie last
-     * message that was sent to the server)
-     */
-    SpiceSmartcardChannelMessage *in_flight_message;
+    guint64 message_wait_time;
+    guint acked_messages;
 };
 
+/* how many commands may wait for their answer at the same time */
+#define SMARTCARD_MAX_IN_FLIGHT 8
+
 G_DEFINE_TYPE(SpiceSmartcardChannel, spice_smartcard_channel, SPICE_TYPE_CHANNEL)
 
+/* Properties */
+enum {
+    PROP_0,
+    PROP_MESSAGE_WAIT_TIME,
+    PROP_ACKED_MESSAGES,
+};
+
 enum {
 
     SPICE_SMARTCARD_LAST_SIGNAL,
@@ -117,7 +129,7 @@ static void spice_smartcard_channel_init(SpiceSmartcardChannel *channel)
 
     channel->priv = SPICE_SMARTCARD_CHANNEL_GET_PRIVATE(channel);
     priv = channel->priv;
-    priv->message_queue = g_queue_new();
+    spice_smartcard_queue_init(&priv->queue, SMARTCARD_MAX_IN_FLIGHT);
 
 #ifdef USE_SMARTCARD
     priv->pending_card_insertions =
@@ -163,12 +175,7 @@ static void spice_smartcard_channel_finalize(GObject *obj)
 
     g_clear_pointer(&c->pending_card_insertions, g_hash_table_destroy);
     g_clear_pointer(&c->pending_reader_removals, g_hash_table_destroy);
-    if (c->message_queue != NULL) {
-        g_queue_foreach(c->message_queue, (GFunc)smartcard_message_free, NULL);
-        g_queue_free(c->message_queue);
-        c->message_queue = NULL;
-    }
-    g_clear_pointer(&c->in_flight_message, smartcard_message_free);
+    spice_smartcard_queue_clear(&c->queue, (GDestroyNotify)smartcard_message_free);
     g_clear_pointer(&c->pending_reader_additions, g_list_free);
 
     if (G_OBJECT_CLASS(spice_smartcard_channel_parent_class)->finalize)
@@ -183,17 +190,32 @@ static void spice_smartcard_channel_reset(SpiceChannel *channel, gboolean migrat
     g_hash_table_remove_all(c->pending_card_insertions);
     g_hash_table_remove_all(c->pending_reader_removals);
 
-    if (c->message_queue != NULL) {
-        g_queue_foreach(c->message_queue, (GFunc)smartcard_message_free, NULL);
-        g_queue_clear(c->message_queue);
-    }
-
-    g_clear_pointer(&c->in_flight_message, smartcard_message_free);
+    spice_smartcard_queue_clear(&c->queue, (GDestroyNotify)smartcard_message_free);
     g_clear_pointer(&c->pending_reader_additions, g_list_free);
 
     SPICE_CHANNEL_CLASS(spice_smartcard_channel_parent_class)->channel_reset(channel, migrating);
 }
 
+static void spice_smartcard_channel_get_property(GObject    *object,
+                                                guint       prop_id,
+                                                GValue     *value,
+                                                GParamSpec *pspec)
+{
+    SpiceSmartcardChannelPrivate *c = SPICE_SMARTCARD_CHANNEL(object)->priv;
+
+    switch (prop_id) {
+    case PROP_MESSAGE_WAIT_TIME:
+        g_value_set_uint64(value, c->message_wait_time);
+        break;
+    case PROP_ACKED_MESSAGES:
+        g_value_set_uint(value, c->acked_messages);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
 static void channel_set_handlers(SpiceChannelClass *klass)
 {
     static const spice_msg_handler handlers[] = {
@@ -209,10 +231,44 @@ static void spice_smartcard_channel_class_init(SpiceSmartcardChannelClass *klass
 
     gobject_class->finalize     = spice_smartcard_channel_finalize;
     gobject_class->constructed  = spice_smartcard_channel_constructed;
+    gobject_class->get_property = spice_smartcard_channel_get_property;
 
     channel_class->channel_up   = spice_smartcard_channel_up;
     channel_class->channel_reset = spice_smartcard_channel_reset;
 
+    /**
+     * SpiceSmartcardChannel:message-wait-time:
+     *
+     * The total time, in microseconds, that the commands sent to the
+     * server waited for their answer, including the time they were
+     * queued behind other commands.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_MESSAGE_WAIT_TIME,
+         g_param_spec_uint64("message-wait-time",
+                             "Message wait time",
+                             "Total time waiting for the answers, in microseconds",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSmartcardChannel:acked-messages:
+     *
+     * The number of commands answered by the server, for
+     * #SpiceSmartcardChannel:message-wait-time.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_ACKED_MESSAGES,
+         g_param_spec_uint("acked-messages",
+                           "Acked messages",
+                           "Number of commands answered by the server",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
     g_type_class_add_private(klass, sizeof(SpiceSmartcardChannelPrivate));
     channel_set_handlers(SPICE_CHANNEL_CLASS(klass));
 }
@@ -281,34 +337,55 @@ spice_channel_drop_pending_reader_removal(SpiceSmartcardChannel *channel,
 }
 
 static SpiceSmartcardChannelMessage *
-smartcard_message_new(VSCMsgType msg_type, SpiceMsgOut *msg_out)
+smartcard_message_new(VSCMsgType msg_type, guint32 reader_id, SpiceMsgOut *msg_out)
 {
     SpiceSmartcardChannelMessage *message;
 
     message = g_new0(SpiceSmartcardChannelMessage, 1);
     message->message = msg_out;
     message->message_type = msg_type;
+    message->item.reader_id = reader_id;
+    /* The answer to VSC_ReaderAdd carries the id of the new reader, and is
+     * only told apart from the answers to the other commands by its order.
+     * The other commands don't depend on each other's answers, and are
+     * sent without waiting, so that a series of them costs a single round
+     * trip. */
+    message->item.alone = (msg_type == VSC_ReaderAdd);
+    message->queued_time = g_get_monotonic_time();
 
     return message;
 }
 
-/* Indicates that handling of the message that is currently in flight has
- * been completed. If needed, sends the next queued command to the server. */
+/* Sends the queued commands that don't have to wait for an answer */
 static void
-smartcard_message_complete_in_flight(SpiceSmartcardChannel *channel)
+smartcard_message_send_queued(SpiceSmartcardChannel *channel)
 {
-    g_return_if_fail(channel->priv->in_flight_message != NULL);
+    SpiceSmartcardChannelMessage *message;
 
-    smartcard_message_free(channel->priv->in_flight_message);
-    channel->priv->in_flight_message = g_queue_pop_head(channel->priv->message_queue);
-    if (channel->priv->in_flight_message != NULL) {
-        spice_msg_out_send(channel->priv->in_flight_message->message);
-        channel->priv->in_flight_message->message = NULL;
+    while ((message = (SpiceSmartcardChannelMessage *)
+                spice_smartcard_queue_pop_sendable(&channel->priv->queue)) != NULL) {
+        spice_msg_out_send(message->message);
+        message->message = NULL;
     }
 }
 
+/* Indicates that handling of the in flight @message has been completed. If
+ * possible, sends the next queued commands to the server. */
+static void
+smartcard_message_complete_in_flight(SpiceSmartcardChannel *channel,
+                                     SpiceSmartcardChannelMessage *message)
+{
+    SpiceSmartcardChannelPrivate *priv = channel->priv;
+
+    priv->message_wait_time += g_get_monotonic_time() - message->queued_time;
+    priv->acked_messages++;
+    smartcard_message_free(message);
+
+    smartcard_message_send_queued(channel);
+}
+
 static void smartcard_message_send(SpiceSmartcardChannel *channel,
-                                   VSCMsgType msg_type,
+                                   VSCMsgType msg_type, guint32 reader_id,
                                    SpiceMsgOut *msg_out, gboolean queue)
 {
     SpiceSmartcardChannelMessage *message;
@@ -323,15 +400,9 @@ static void smartcard_message_send(SpiceSmartcardChannel *channel,
         return;
     }
 
-    message = smartcard_message_new(msg_type, msg_out);
-    if (channel->priv->in_flight_message == NULL) {
-        g_return_if_fail(g_queue_is_empty(channel->priv->message_queue));
-        channel->priv->in_flight_message = message;
-        spice_msg_out_send(channel->priv->in_flight_message->message);
-        channel->priv->in_flight_message->message = NULL;
-    } else {
-        g_queue_push_tail(channel->priv->message_queue, message);
-    }
+    message = smartcard_message_new(msg_type, reader_id, msg_out);
+    spice_smartcard_queue_push(&channel->priv->queue, &message->item);
+    smartcard_message_send_queued(channel);
 }
 
 static void
@@ -358,7 +429,7 @@ send_msg_generic_with_data(SpiceSmartcardChannel *channel, VReader *reader,
         spice_marshaller_add(msg_out->marshaller, data, data_len);
     }
 
-    smartcard_message_send(channel, msg_type, msg_out, serialize_msg);
+    smartcard_message_send(channel, msg_type, header.reader_id, msg_out, serialize_msg);
 }
 
 static void send_msg_generic(SpiceSmartcardChannel *channel, VReader *reader,
@@ -494,14 +565,17 @@ static void handle_smartcard_msg(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceSmartcardChannel *smartcard_channel = SPICE_SMARTCARD_CHANNEL(channel);
     SpiceSmartcardChannelPrivate *priv = smartcard_channel->priv;
     SpiceMsgSmartcard *msg = spice_msg_in_parsed(in);
+    SpiceSmartcardChannelMessage *in_flight;
     VReader *reader;
 
     CHANNEL_DEBUG(channel, "handle msg %u", msg->type);
     switch (msg->type) {
         case VSC_Error:
-            g_return_if_fail(priv->in_flight_message != NULL);
-            CHANNEL_DEBUG(channel, "in flight %u", priv->in_flight_message->message_type);
-            switch (priv->in_flight_message->message_type) {
+            in_flight = (SpiceSmartcardChannelMessage *)
+                spice_smartcard_queue_answered(&priv->queue, msg->reader_id);
+            g_return_if_fail(in_flight != NULL);
+            CHANNEL_DEBUG(channel, "in flight %u", in_flight->message_type);
+            switch (in_flight->message_type) {
                 case VSC_ReaderAdd:
                     g_return_if_fail(priv->pending_reader_additions != NULL);
                     reader = priv->pending_reader_additions->data;
@@ -529,10 +603,10 @@ static void handle_smartcard_msg(SpiceChannel *channel, SpiceMsgIn *in)
                 case VSC_ReaderRemove:
                     break;
                 default:
-                    g_warning("Unexpected message: %u", priv->in_flight_message->message_type);
+                    g_warning("Unexpected message: %u", in_flight->message_type);
                     break;
             }
-            smartcard_message_complete_in_flight(smartcard_channel);
+            smartcard_message_complete_in_flight(smartcard_channel, in_flight);
 
             break;
 
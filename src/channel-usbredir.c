@@ -24,15 +24,13 @@
 #ifdef USE_USBREDIR
 #include <glib/gi18n-lib.h>
 #include <usbredirhost.h>
-#ifdef USE_LZ4
-#include <lz4.h>
-#endif
 #ifdef USE_POLKIT
 #include "usb-acl-helper.h"
 #endif
 #include "channel-usbredir-priv.h"
 #include "usb-device-manager-priv.h"
 #include "usbutil.h"
+#include "vmc-compressor.h"
 #endif
 
 #include "common/log.h"
@@ -55,7 +53,6 @@
 
 #ifdef USE_USBREDIR
 
-#define COMPRESS_THRESHOLD 1000
 #define SPICE_USBREDIR_CHANNEL_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_USBREDIR_CHANNEL, SpiceUsbredirChannelPrivate))
 
@@ -85,6 +82,7 @@ struct _SpiceUsbredirChannelPrivate {
 #endif
     GMutex device_connect_mutex;
     SpiceUsbDeviceManager *usb_device_manager;
+    SpiceVmcCompressor *compressor;
 };
 
 static void channel_set_handlers(SpiceChannelClass *klass);
@@ -117,6 +115,7 @@ static void spice_usbredir_channel_init(SpiceUsbredirChannel *channel)
 #ifdef USE_USBREDIR
     channel->priv = SPICE_USBREDIR_CHANNEL_GET_PRIVATE(channel);
     g_mutex_init(&channel->priv->device_connect_mutex);
+    channel->priv->compressor = spice_vmc_compressor_new();
 #endif
 }
 
@@ -233,6 +232,8 @@ static void spice_usbredir_channel_finalize(GObject *obj)
         usbredirhost_close(channel->priv->host);
 #ifdef USE_USBREDIR
     g_mutex_clear(&channel->priv->device_connect_mutex);
+    /* compressed messages still being sent keep their own reference */
+    spice_vmc_compressor_unref(channel->priv->compressor);
 #endif
 
     /* Chain up to the parent class */
@@ -667,8 +668,8 @@ static int try_write_compress_LZ4(SpiceUsbredirChannel *channel, uint8_t *data,
 {
     SpiceChannelPrivate *c;
     SpiceMsgOut *msg_out_compressed;
-    int bound, compressed_data_count;
-    uint8_t *compressed_buf;
+    int compressed_data_count;
+    gpointer compressed_buf;
     SpiceMsgCompressedData compressed_data_msg = {
         .type = SPICE_DATA_COMPRESSION_TYPE_LZ4,
         .uncompressed_size = count
@@ -679,10 +680,6 @@ static int try_write_compress_LZ4(SpiceUsbredirChannel *channel, uint8_t *data,
         /* AF_LOCAL socket - data will not be compressed */
         return FALSE;
     }
-    if (count <= COMPRESS_THRESHOLD) {
-        /* Not enough data to compress */
-        return FALSE;
-    }
     if (!spice_channel_test_capability(SPICE_CHANNEL(channel),
                                        SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4)) {
         /* No server compression capability - data will not be compressed */
@@ -692,35 +689,24 @@ static int try_write_compress_LZ4(SpiceUsbredirChannel *channel, uint8_t *data,
         /* Don't compress - one of the device endpoints is isochronous */
         return FALSE;
     }
-    bound = LZ4_compressBound(count);
-    if (bound == 0) {
-        /* Invalid bound - data will not be compressed */
+    if (!spice_vmc_compressor_compress(channel->priv->compressor, data, count,
+                                       &compressed_data_msg.compressed_data,
+                                       &compressed_data_count, &compressed_buf)) {
+        /* Too small, or not shrinking lately - data will not be compressed */
         return FALSE;
     }
 
-    compressed_buf = g_malloc(bound);
-    compressed_data_count = LZ4_compress_default((char*)data,
-                                                 (char*)compressed_buf,
-                                                 count,
-                                                 bound);
-    if (compressed_data_count > 0 && compressed_data_count < count) {
-        compressed_data_msg.compressed_data = compressed_buf;
-        msg_out_compressed = spice_msg_out_new(SPICE_CHANNEL(channel),
-                                               SPICE_MSGC_SPICEVMC_COMPRESSED_DATA);
-        msg_out_compressed->marshallers->msg_SpiceMsgCompressedData(msg_out_compressed->marshaller,
-                                                                    &compressed_data_msg);
-        spice_marshaller_add_by_ref_full(msg_out_compressed->marshaller,
-                                         compressed_data_msg.compressed_data,
-                                         compressed_data_count,
-                                         (spice_marshaller_item_free_func)g_free,
-                                         channel);
-        spice_msg_out_send(msg_out_compressed);
-        return TRUE;
-    }
-
-    /* if not - free & fallback to sending the message uncompressed */
-    g_free(compressed_buf);
-    return FALSE;
+    msg_out_compressed = spice_msg_out_new(SPICE_CHANNEL(channel),
+                                           SPICE_MSGC_SPICEVMC_COMPRESSED_DATA);
+    msg_out_compressed->marshallers->msg_SpiceMsgCompressedData(msg_out_compressed->marshaller,
+                                                                &compressed_data_msg);
+    spice_marshaller_add_by_ref_full(msg_out_compressed->marshaller,
+                                     compressed_data_msg.compressed_data,
+                                     compressed_data_count,
+                                     spice_vmc_compressor_release,
+                                     compressed_buf);
+    spice_msg_out_send(msg_out_compressed);
+    return TRUE;
 }
 #endif
 
@@ -825,13 +811,15 @@ static void spice_usbredir_channel_up(SpiceChannel *c)
     usbredirhost_write_guest_data(priv->host);
 }
 
-static int try_handle_compressed_msg(SpiceMsgCompressedData *compressed_data_msg,
+/* The decompressed data is valid until the next message */
+static int try_handle_compressed_msg(SpiceUsbredirChannel *channel,
+                                     SpiceMsgCompressedData *compressed_data_msg,
                                      uint8_t **buf,
                                      int *size) {
-    int decompressed_size = 0;
-    char *decompressed = NULL;
+    const uint8_t *decompressed = NULL;
 
-    if (compressed_data_msg->uncompressed_size == 0) {
+    if (compressed_data_msg->uncompressed_size == 0 ||
+        compressed_data_msg->uncompressed_size > G_MAXINT) {
         spice_warning("Invalid uncompressed_size");
         return FALSE;
     }
@@ -839,28 +827,23 @@ static int try_handle_compressed_msg(SpiceMsgCompressedData *compressed_data_msg
     switch (compressed_data_msg->type) {
 #ifdef USE_LZ4
     case SPICE_DATA_COMPRESSION_TYPE_LZ4:
-        decompressed = g_malloc(compressed_data_msg->uncompressed_size);
-        decompressed_size = LZ4_decompress_safe ((char*)compressed_data_msg->compressed_data,
-                                                 decompressed,
-                                                 compressed_data_msg->compressed_size,
-                                                 compressed_data_msg->uncompressed_size);
+        decompressed = spice_vmc_compressor_decompress(channel->priv->compressor,
+                                                       compressed_data_msg->compressed_data,
+                                                       compressed_data_msg->compressed_size,
+                                                       compressed_data_msg->uncompressed_size);
         break;
 #endif
     default:
         spice_warning("Unknown Compression Type");
         return FALSE;
     }
-    if (decompressed_size != compressed_data_msg->uncompressed_size) {
-        spice_warning("Decompress Error decompressed_size=%d expected=%u",
-                      decompressed_size, compressed_data_msg->uncompressed_size);
-        g_free(decompressed);
+    if (decompressed == NULL) {
         return FALSE;
     }
 
-    *size = decompressed_size;
+    *size = compressed_data_msg->uncompressed_size;
     *buf = (uint8_t*)decompressed;
     return TRUE;
-
 }
 
 static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
@@ -877,7 +860,7 @@ static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
 
     if (spice_msg_in_type(in) == SPICE_MSG_SPICEVMC_COMPRESSED_DATA) {
         SpiceMsgCompressedData *compressed_data_msg = spice_msg_in_parsed(in);
-        if (try_handle_compressed_msg(compressed_data_msg, &buf, &size)) {
+        if (try_handle_compressed_msg(channel, compressed_data_msg, &buf, &size)) {
             priv->read_buf_size = size;
             priv->read_buf = buf;
         } else {
@@ -932,7 +915,7 @@ static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
         err_data.spice_device = g_boxed_copy(spice_usb_device_get_type(), spice_device);
         err_data.error = err;
         spice_usbredir_channel_unlock(channel);
-        g_idle_add(device_error, &err_data);
+        spice_idle_add(spice_channel_get_main_context(c), device_error, &err_data);
         coroutine_yield(NULL);
 
         g_boxed_free(spice_usb_device_get_type(), err_data.spice_device);
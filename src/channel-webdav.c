@@ -69,6 +69,7 @@ G_DEFINE_TYPE(SpiceWebdavChannel, spice_webdav_channel, SPICE_TYPE_PORT_CHANNEL)
 static void spice_webdav_handle_msg(SpiceChannel *channel, SpiceMsgIn *msg);
 
 struct _OutputQueue {
+    SpiceChannel *channel; /* owns the queue */
     GOutputStream *output;
     gboolean flushing;
     guint idle_id;
@@ -83,10 +84,11 @@ typedef struct _OutputQueueElem {
     gpointer user_data;
 } OutputQueueElem;
 
-static OutputQueue* output_queue_new(GOutputStream *output)
+static OutputQueue* output_queue_new(SpiceChannel *channel, GOutputStream *output)
 {
     OutputQueue *queue = g_new0(OutputQueue, 1);
 
+    queue->channel = channel;
     queue->output = g_object_ref(output);
     queue->queue = g_queue_new();
 
@@ -101,7 +103,7 @@ static void output_queue_free(OutputQueue *queue)
     g_queue_free_full(queue->queue, g_free);
     g_clear_object(&queue->output);
     if (queue->idle_id)
-        g_source_remove(queue->idle_id);
+        spice_source_remove(spice_channel_get_main_context(queue->channel), queue->idle_id);
     g_free(queue);
 }
 
@@ -124,7 +126,8 @@ static void output_queue_flush_cb(GObject *source_object,
     g_clear_error(&error);
 
     if (!q->idle_id)
-        q->idle_id = g_idle_add(output_queue_idle, q);
+        q->idle_id = spice_idle_add(spice_channel_get_main_context(q->channel),
+                                    output_queue_idle, q);
 
     g_free(e);
 }
@@ -179,7 +182,8 @@ static void output_queue_push(OutputQueue *q, const guint8 *buf, gsize size,
     g_queue_push_tail(q->queue, e);
 
     if (!q->idle_id && !q->flushing)
-        q->idle_id = g_idle_add(output_queue_idle, q);
+        q->idle_id = spice_idle_add(spice_channel_get_main_context(q->channel),
+                                    output_queue_idle, q);
 }
 
 typedef struct Client
@@ -541,7 +545,7 @@ static void spice_webdav_channel_init(SpiceWebdavChannel *channel)
     c->demux.buf = g_malloc0(MAX_MUX_SIZE);
 
     GOutputStream *ostream = g_io_stream_get_output_stream(G_IO_STREAM(c->stream));
-    c->queue = output_queue_new(ostream);
+    c->queue = output_queue_new(SPICE_CHANNEL(channel), ostream);
 }
 
 static void spice_webdav_channel_finalize(GObject *object)
@@ -52,11 +52,26 @@ struct coroutine
 #else
 	GThread *thread;
 	gboolean runnable;
+	struct coroutine_group *group;
 #endif
 };
 
+/* Stacks of exited coroutines are pooled for reuse, with the ucontext
+ * implementation only */
+struct coroutine_stack_stats
+{
+	unsigned int allocated; /* stacks that had to be mapped */
+	unsigned int reused;    /* stacks taken from the pool */
+	unsigned int pooled;    /* stacks currently waiting in the pool */
+};
+
 void coroutine_init(struct coroutine *co);
 
+void coroutine_stack_get_stats(struct coroutine_stack_stats *stats);
+
+/* how many bytes of its stack @co used at most, 0 if unknown */
+size_t coroutine_stack_used(struct coroutine *co);
+
 void coroutine_system_stop(void);
 
 int coroutine_release(struct coroutine *co);
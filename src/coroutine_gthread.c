@@ -23,11 +23,20 @@
 #include "coroutine.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static GCond *run_cond;
-static GMutex *run_lock;
-static struct coroutine *current;
-static struct coroutine leader;
+/* A thread running a main loop and the coroutines it created: only one
+ * of them runs at a time, but the groups of different threads are
+ * independent */
+struct coroutine_group
+{
+	GMutex run_lock;
+	GCond run_cond;
+	struct coroutine leader;
+};
+
+static __thread struct coroutine_group *group;
+static __thread struct coroutine *current;
 
 #if 0
 #define CO_DEBUG(OP) fprintf(stderr, "%s %p %s %d\n", OP, g_thread_self(), __FUNCTION__, __LINE__)
@@ -37,38 +46,36 @@ static struct coroutine leader;
 
 static void coroutine_system_init(void)
 {
-	if (!g_thread_supported()) {
-	        CO_DEBUG("INIT");
-		g_thread_init(NULL);
-	}
-
-
-	run_cond = g_cond_new();
-	run_lock = g_mutex_new();
+	group = g_new0(struct coroutine_group, 1);
+	g_mutex_init(&group->run_lock);
+	g_cond_init(&group->run_cond);
 	CO_DEBUG("LOCK");
-	g_mutex_lock(run_lock);
+	g_mutex_lock(&group->run_lock);
 
 	/* The thread that creates the first coroutine is the system coroutine
 	 * so let's fill out a structure for it */
-	leader.entry = NULL;
-	leader.release = NULL;
-	leader.stack_size = 0;
-	leader.exited = 0;
-	leader.thread = g_thread_self();
-	leader.runnable = TRUE; /* we're the one running right now */
-	leader.caller = NULL;
-	leader.data = NULL;
-
-	current = &leader;
+	group->leader.entry = NULL;
+	group->leader.release = NULL;
+	group->leader.stack_size = 0;
+	group->leader.exited = 0;
+	group->leader.thread = g_thread_self();
+	group->leader.runnable = TRUE; /* we're the one running right now */
+	group->leader.caller = NULL;
+	group->leader.data = NULL;
+	group->leader.group = group;
+
+	current = &group->leader;
 }
 
 void coroutine_system_stop(void)
 {
-	if (run_cond) {
-		g_mutex_free(run_lock);
-		g_cond_free(run_cond);
-		run_lock = NULL;
-		run_cond = NULL;
+	if (group) {
+		g_mutex_unlock(&group->run_lock);
+		g_mutex_clear(&group->run_lock);
+		g_cond_clear(&group->run_cond);
+		g_free(group);
+		group = NULL;
+		current = NULL;
 	}
 }
 
@@ -76,16 +83,16 @@ static gpointer coroutine_thread(gpointer opaque)
 {
 	struct coroutine *co = opaque;
 	CO_DEBUG("LOCK");
-	g_mutex_lock(run_lock);
+	g_mutex_lock(&co->group->run_lock);
 	while (!co->runnable) {
 		CO_DEBUG("WAIT");
-		g_cond_wait(run_cond, run_lock);
+		g_cond_wait(&co->group->run_cond, &co->group->run_lock);
 	}
 
 	CO_DEBUG("RUNNABLE");
 	current = co;
 	if (co->caller == NULL) {
-		g_mutex_unlock(run_lock);
+		g_mutex_unlock(&co->group->run_lock);
 		return NULL;
 	}
 	co->data = co->entry(co->data);
@@ -98,9 +105,9 @@ static gpointer coroutine_thread(gpointer opaque)
 		printf("CAN'T NOTIFY CALLER!\n");
 	}
 	CO_DEBUG("BROADCAST");
-	g_cond_broadcast(run_cond);
+	g_cond_broadcast(&co->group->run_cond);
 	CO_DEBUG("UNLOCK");
-	g_mutex_unlock(run_lock);
+	g_mutex_unlock(&co->group->run_lock);
 
 	return NULL;
 }
@@ -109,8 +116,10 @@ void coroutine_init(struct coroutine *co)
 {
 	GError *err = NULL;
 
-	if (run_cond == NULL)
-		coroutine_system_init();
+	co->group = coroutine_self()->group;
+	co->exited = 0;
+	co->runnable = FALSE;
+	co->caller = NULL;
 
 	CO_DEBUG("NEW");
 	co->thread = g_thread_create_full(coroutine_thread, co, co->stack_size,
@@ -119,10 +128,6 @@ void coroutine_init(struct coroutine *co)
 					  &err);
 	if (err != NULL)
 		g_error("g_thread_create_full() failed: %s", err->message);
-
-	co->exited = 0;
-	co->runnable = FALSE;
-	co->caller = NULL;
 }
 
 int coroutine_release(struct coroutine *co G_GNUC_UNUSED)
@@ -132,19 +137,21 @@ int coroutine_release(struct coroutine *co G_GNUC_UNUSED)
 
 void *coroutine_swap(struct coroutine *from, struct coroutine *to, void *arg)
 {
+	struct coroutine_group *g = from->group;
+
 	from->runnable = FALSE;
 	to->runnable = TRUE;
 	to->data = arg;
 	to->caller = from;
 	CO_DEBUG("BROADCAST");
-	g_cond_broadcast(run_cond);
+	g_cond_broadcast(&g->run_cond);
 	CO_DEBUG("UNLOCK");
-	g_mutex_unlock(run_lock);
+	g_mutex_unlock(&g->run_lock);
 	CO_DEBUG("LOCK");
-	g_mutex_lock(run_lock);
+	g_mutex_lock(&g->run_lock);
 	while (!from->runnable) {
 	        CO_DEBUG("WAIT");
-		g_cond_wait(run_cond, run_lock);
+		g_cond_wait(&g->run_cond, &g->run_lock);
 	}
 	current = from;
 	to->caller = NULL;
@@ -155,7 +162,7 @@ void *coroutine_swap(struct coroutine *from, struct coroutine *to, void *arg)
 
 struct coroutine *coroutine_self(void)
 {
-	if (run_cond == NULL)
+	if (current == NULL)
 		coroutine_system_init();
 
 	return current;
@@ -183,7 +190,17 @@ void *coroutine_yield(void *arg)
 	return coroutine_swap(coroutine_self(), to, arg);
 }
 
+void coroutine_stack_get_stats(struct coroutine_stack_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+size_t coroutine_stack_used(struct coroutine *co G_GNUC_UNUSED)
+{
+	return 0;
+}
+
 gboolean coroutine_is_main(struct coroutine *co)
 {
-    return (co == &leader);
+    return (co == &co->group->leader);
 }
@@ -29,12 +29,167 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "coroutine.h"
 
 #ifndef MAP_ANONYMOUS
 # define MAP_ANONYMOUS MAP_ANON
 #endif
 
+/*
+ * Stacks are expensive to set up: mapping 16MB and faulting in its pages
+ * again for each channel adds up when reconnecting or migrating. The
+ * stacks of the coroutines that exited are kept in a pool shared by all
+ * threads, and reused by the next coroutine asking for the same size.
+ *
+ * Each stack has a guard page below it, so that an overflow crashes
+ * instead of silently corrupting the memory next to it. The pages of a
+ * pooled stack are given back to the system, except for the top
+ * STACK_WARM_SIZE bytes that most coroutines never go past.
+ */
+#define STACK_POOL_MAX 16
+#define STACK_WARM_SIZE (256 << 10)
+
+static GMutex stack_pool_lock;
+static GSList *stack_pool;
+static struct coroutine_stack_stats stack_stats;
+
+static size_t stack_guard_size(void)
+{
+	static size_t page_size;
+
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	return page_size;
+}
+
+static char *stack_map(size_t size)
+{
+	size_t guard = stack_guard_size();
+	char *base;
+
+	base = mmap(0, size + guard,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		g_error("mmap(%" G_GSIZE_FORMAT ") failed: %s",
+			size + guard, g_strerror(errno));
+
+	/* stacks grow down */
+	if (mprotect(base, guard, PROT_NONE) != 0)
+		g_error("mprotect() failed: %s", g_strerror(errno));
+
+	return base + guard;
+}
+
+static void stack_unmap(char *stack, size_t size)
+{
+	size_t guard = stack_guard_size();
+
+	munmap(stack - guard, size + guard);
+}
+
+struct pooled_stack {
+	char *stack;
+	size_t size;
+};
+
+static char *stack_pool_get(size_t size)
+{
+	GSList *l;
+
+	g_mutex_lock(&stack_pool_lock);
+	for (l = stack_pool; l != NULL; l = l->next) {
+		struct pooled_stack *pooled = l->data;
+
+		if (pooled->size == size) {
+			char *stack = pooled->stack;
+
+			stack_pool = g_slist_delete_link(stack_pool, l);
+			stack_stats.pooled--;
+			stack_stats.reused++;
+			g_mutex_unlock(&stack_pool_lock);
+			g_free(pooled);
+			return stack;
+		}
+	}
+	stack_stats.allocated++;
+	g_mutex_unlock(&stack_pool_lock);
+
+	return stack_map(size);
+}
+
+static void stack_pool_put(char *stack, size_t size)
+{
+	struct pooled_stack *pooled, *oldest = NULL;
+
+#ifdef MADV_DONTNEED
+	if (size > STACK_WARM_SIZE)
+		madvise(stack, size - STACK_WARM_SIZE, MADV_DONTNEED);
+#endif
+	pooled = g_new(struct pooled_stack, 1);
+	pooled->stack = stack;
+	pooled->size = size;
+
+	g_mutex_lock(&stack_pool_lock);
+	stack_pool = g_slist_prepend(stack_pool, pooled);
+	if (stack_stats.pooled < STACK_POOL_MAX) {
+		stack_stats.pooled++;
+	} else {
+		/* the least recently used stack makes room */
+		GSList *last = g_slist_last(stack_pool);
+
+		oldest = last->data;
+		stack_pool = g_slist_delete_link(stack_pool, last);
+	}
+	g_mutex_unlock(&stack_pool_lock);
+
+	if (oldest != NULL) {
+		stack_unmap(oldest->stack, oldest->size);
+		g_free(oldest);
+	}
+}
+
+void coroutine_stack_get_stats(struct coroutine_stack_stats *stats)
+{
+	g_mutex_lock(&stack_pool_lock);
+	*stats = stack_stats;
+	g_mutex_unlock(&stack_pool_lock);
+}
+
+/* Approximates how deep @co went into its stack by looking for the lowest
+ * page that was ever touched, rounded to a page. Stacks are reused, so it
+ * can't be less than what the top of the stack kept from its last use */
+size_t coroutine_stack_used(struct coroutine *co)
+{
+#ifdef HAVE_MINCORE
+	size_t page_size = stack_guard_size();
+	size_t n_pages = co->cc.stack_size / page_size;
+	size_t i, used = 0;
+	unsigned char *vec;
+
+	if (co->cc.stack == NULL)
+		return 0;
+
+	vec = g_malloc(n_pages);
+	if (mincore(co->cc.stack, n_pages * page_size, (void *)vec) == 0) {
+		for (i = 0; i < n_pages; i++) {
+			if (vec[i] & 1) {
+				used = (n_pages - i) * page_size;
+				break;
+			}
+		}
+	}
+	g_free(vec);
+
+	return used;
+#else
+	return 0;
+#endif
+}
+
 int coroutine_release(struct coroutine *co)
 {
 	return cc_release(&co->cc);
@@ -50,7 +205,8 @@ static int _coroutine_release(struct continuation *cc)
 			return ret;
 	}
 
-	munmap(co->cc.stack, co->cc.stack_size);
+	stack_pool_put(co->cc.stack, co->cc.stack_size);
+	co->cc.stack = NULL;
 
 	co->caller = NULL;
 
@@ -69,13 +225,7 @@ void coroutine_init(struct coroutine *co)
 		co->stack_size = 16 << 20;
 
 	co->cc.stack_size = co->stack_size;
-	co->cc.stack = mmap(0, co->stack_size,
-			    PROT_READ | PROT_WRITE,
-			    MAP_PRIVATE | MAP_ANONYMOUS,
-			    -1, 0);
-	if (co->cc.stack == MAP_FAILED)
-		g_error("mmap(%" G_GSIZE_FORMAT ") failed: %s",
-			co->stack_size, g_strerror(errno));
+	co->cc.stack = stack_pool_get(co->stack_size);
 
 	co->cc.entry = coroutine_trampoline;
 	co->cc.release = _coroutine_release;
@@ -84,13 +234,9 @@ void coroutine_init(struct coroutine *co)
 	cc_init(&co->cc);
 }
 
-#if 0
+/* Each thread running a main loop has its own coroutines */
 static __thread struct coroutine leader;
 static __thread struct coroutine *current;
-#else
-static struct coroutine leader;
-static struct coroutine *current;
-#endif
 
 struct coroutine *coroutine_self(void)
 {
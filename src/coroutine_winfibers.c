@@ -20,13 +20,15 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 
 #include "coroutine.h"
 
-static struct coroutine leader = { 0, };
-static struct coroutine *current = NULL;
-static struct coroutine *caller = NULL;
+/* Each thread running a main loop has its own fibers */
+static __thread struct coroutine leader = { 0, };
+static __thread struct coroutine *current = NULL;
+static __thread struct coroutine *caller = NULL;
 
 int coroutine_release(struct coroutine *co)
 {
@@ -61,9 +63,10 @@ void coroutine_init(struct coroutine *co)
 	}
 
 	co->exited = 0;
-	co->fiber = CreateFiber(0, &coroutine_trampoline, co);
+	/* reserve the requested stack size, the default is 1MB */
+	co->fiber = CreateFiberEx(0, co->stack_size, 0, &coroutine_trampoline, co);
 	if (co->fiber == NULL)
-		g_error("CreateFiber() failed");
+		g_error("CreateFiberEx() failed");
 
 	co->ret = 0;
 }
@@ -113,6 +116,16 @@ void *coroutine_yield(void *arg)
 	return coroutine_swap(coroutine_self(), to, arg);
 }
 
+void coroutine_stack_get_stats(struct coroutine_stack_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+size_t coroutine_stack_used(struct coroutine *co G_GNUC_UNUSED)
+{
+	return 0;
+}
+
 gboolean coroutine_is_main(struct coroutine *co)
 {
     return (co == &leader);
@@ -26,6 +26,7 @@
 #include "gio-coroutine.h"
 #include "spice-util.h"
 #include "decode.h"
+#include "spice-memory-manager-priv.h"
 
 #include "common/canvas_utils.h"
 
@@ -62,6 +63,7 @@ static struct glz_image *glz_image_new(struct glz_image_hdr *hdr,
     if (!img->hdr.top_down) {
         img->data = img->data - img->hdr.width * (img->hdr.height - 1) * 4;
     }
+    spice_memory_account(SPICE_MEMORY_GLZ_WINDOWS, img->hdr.gross_pixels * 4);
     return img;
 }
 
@@ -70,6 +72,7 @@ static void glz_image_destroy(struct glz_image *img)
     if (img == NULL)
         return;
 
+    spice_memory_account(SPICE_MEMORY_GLZ_WINDOWS, -(gssize)img->hdr.gross_pixels * 4);
     pixman_image_unref(img->surface);
     g_free(img);
 }
@@ -411,15 +414,17 @@ void glz_decoder_window_clear(SpiceGlzDecoderWindow *w)
     g_return_if_fail(w->nimages == 0 || w->images != NULL);
 
     for (i = 0; i < w->nimages; i++) {
-        if (w->images[i]) {
-            glz_image_destroy(w->images[i]);
-        }
+        g_clear_pointer(&w->images[i], glz_image_destroy);
     }
 
-    w->nimages = 16;
-    g_free(w->images);
-    w->images = g_new0(struct glz_image*, w->nimages);
+    /* the slots are kept, the window of the next connection is likely to
+     * be as large, but its image ids start over */
+    if (w->images == NULL) {
+        w->nimages = 16;
+        w->images = g_new0(struct glz_image*, w->nimages);
+    }
     w->tail_gap = 0;
+    w->oldest = 0;
 }
 
 SpiceGlzDecoderWindow *glz_decoder_window_new(void)
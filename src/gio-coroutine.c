@@ -20,7 +20,10 @@
 */
 #include "config.h"
 
+#include <gobject/gvaluecollector.h>
+
 #include "gio-coroutine.h"
+#include "spice-util-priv.h"
 
 typedef struct _GConditionWaitSource
 {
@@ -35,6 +38,7 @@ GCoroutine* g_coroutine_self(void)
     return (GCoroutine*)coroutine_self();
 }
 
+#ifdef G_OS_WIN32
 /* Main loop helper functions */
 static gboolean g_io_wait_helper(GSocket *sock G_GNUC_UNUSED,
 				 GIOCondition cond,
@@ -58,19 +62,127 @@ GIOCondition g_coroutine_socket_wait(GCoroutine *self,
 
     src = g_socket_create_source(sock, cond | G_IO_HUP | G_IO_ERR | G_IO_NVAL, NULL);
     g_source_set_callback(src, (GSourceFunc)g_io_wait_helper, self, NULL);
-    self->wait_id = g_source_attach(src, NULL);
+    self->wait_id = g_source_attach(src, self->context);
     ret = coroutine_yield(NULL);
     g_source_unref(src);
 
     if (ret != NULL)
         val = *ret;
     else
-        g_source_remove(self->wait_id);
+        spice_source_remove(self->context, self->wait_id);
+
+    self->wait_id = 0;
+    return val;
+}
+
+void g_coroutine_clear(GCoroutine *self G_GNUC_UNUSED)
+{
+}
+#else
+/*
+ * The socket waits of a coroutine all go through a single source, attached
+ * on the first wait and kept until g_coroutine_clear(). A wait only updates
+ * the fd and events it polls in place, so that busy channels waiting
+ * thousands of times per second don't allocate, attach and destroy a
+ * GSocketSource each time. Between waits, the fd is -1 and poll() ignores
+ * it. The context copies the fd and events on each iteration, they are
+ * only changed from its dispatches, between iterations.
+ */
+typedef struct _GCoroutinePollSource
+{
+    GSource src;
+    GCoroutine *self;
+    GPollFD pollfd;
+} GCoroutinePollSource;
+
+static gboolean g_coroutine_poll_prepare(GSource *src G_GNUC_UNUSED, gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean g_coroutine_poll_check(GSource *src)
+{
+    GCoroutinePollSource *psrc = (GCoroutinePollSource *)src;
+
+    return psrc->pollfd.fd >= 0 && (psrc->pollfd.revents & psrc->pollfd.events) != 0;
+}
+
+static gboolean g_coroutine_poll_dispatch(GSource *src,
+                                          GSourceFunc cb G_GNUC_UNUSED,
+                                          gpointer data G_GNUC_UNUSED)
+{
+    GCoroutinePollSource *psrc = (GCoroutinePollSource *)src;
+    /* the coroutine may have been woken up by an earlier source */
+    GIOCondition cond = psrc->pollfd.revents & psrc->pollfd.events;
+
+    if (psrc->pollfd.fd >= 0 && cond != 0)
+        coroutine_yieldto(&psrc->self->coroutine, &cond);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs pollFuncs = {
+    .prepare = g_coroutine_poll_prepare,
+    .check = g_coroutine_poll_check,
+    .dispatch = g_coroutine_poll_dispatch,
+};
 
+GIOCondition g_coroutine_socket_wait(GCoroutine *self,
+                                     GSocket *sock,
+                                     GIOCondition cond)
+{
+    GCoroutinePollSource *psrc;
+    GIOCondition *ret, val = 0;
+
+    g_return_val_if_fail(self != NULL, 0);
+    g_return_val_if_fail(self->wait_id == 0, 0);
+    g_return_val_if_fail(sock != NULL, 0);
+
+    if (self->poll_source == NULL) {
+        self->poll_source = g_source_new(&pollFuncs, sizeof(GCoroutinePollSource));
+        psrc = (GCoroutinePollSource *)self->poll_source;
+        psrc->self = self;
+        psrc->pollfd.fd = -1;
+        g_source_add_poll(self->poll_source, &psrc->pollfd);
+        /* the coroutine waits again from the dispatch, blocking the source
+         * meanwhile would remove and add its poll each time. It is not
+         * dispatched recursively, as coroutines don't iterate the context. */
+        g_source_set_can_recurse(self->poll_source, TRUE);
+        g_source_attach(self->poll_source, self->context);
+    }
+
+    psrc = (GCoroutinePollSource *)self->poll_source;
+    psrc->pollfd.fd = g_socket_get_fd(sock);
+    psrc->pollfd.events = cond | G_IO_HUP | G_IO_ERR | G_IO_NVAL;
+    psrc->pollfd.revents = 0;
+    self->wait_id = g_source_get_id(self->poll_source);
+    ret = coroutine_yield(NULL);
+
+    if (ret != NULL)
+        val = *ret;
+
+    psrc->pollfd.fd = -1;
+    psrc->pollfd.events = 0;
+    psrc->pollfd.revents = 0;
     self->wait_id = 0;
     return val;
 }
 
+/* Destroys the source the socket waits of @self went through */
+void g_coroutine_clear(GCoroutine *self)
+{
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(self->wait_id == 0);
+
+    if (self->poll_source == NULL)
+        return;
+
+    g_source_destroy(self->poll_source);
+    g_clear_pointer(&self->poll_source, g_source_unref);
+}
+#endif
+
 void g_coroutine_condition_cancel(GCoroutine *coroutine)
 {
     g_return_if_fail(coroutine != NULL);
@@ -78,7 +190,7 @@ void g_coroutine_condition_cancel(GCoroutine *coroutine)
     if (coroutine->condition_id == 0)
         return;
 
-    g_source_remove(coroutine->condition_id);
+    spice_source_remove(coroutine->context, coroutine->condition_id);
     coroutine->condition_id = 0;
 }
 
@@ -169,7 +281,7 @@ gboolean g_coroutine_condition_wait(GCoroutine *self, GConditionWaitFunc func, g
     vsrc->data = data;
     vsrc->self = self;
 
-    self->condition_id = g_source_attach(src, NULL);
+    self->condition_id = g_source_attach(src, self->context);
     g_source_set_callback(src, g_condition_wait_helper, self, NULL);
     coroutine_yield(NULL);
     g_source_unref(src);
@@ -222,8 +334,12 @@ g_coroutine_signal_emit(gpointer instance, guint signal_id,
     if (coroutine_self_is_main()) {
         g_signal_emit_valist(instance, signal_id, detail, data.var_args);
     } else {
+        GCoroutine *self = g_coroutine_self();
+
+        /* after the batched signals emitted so far */
+        g_coroutine_signal_batch_end(self);
         g_object_ref(instance);
-        g_idle_add(emit_main_context, &data);
+        spice_idle_add(self->context, emit_main_context, &data);
         coroutine_yield(NULL);
         g_warn_if_fail(data.notified);
         g_object_unref(instance);
@@ -254,13 +370,16 @@ void g_coroutine_object_notify(GObject *object,
     if (coroutine_self_is_main()) {
         g_object_notify(object, property_name);
     } else {
+        GCoroutine *self = g_coroutine_self();
+
+        g_coroutine_signal_batch_end(self);
 
         data.instance = g_object_ref(object);
         data.caller = coroutine_self();
         data.propname = (gpointer)property_name;
         data.notified = FALSE;
 
-        g_idle_add(notify_main_context, &data);
+        spice_idle_add(self->context, notify_main_context, &data);
 
         /* This switches to the system coroutine context, lets
          * the idle function run to dispatch the signal, and
@@ -273,3 +392,174 @@ void g_coroutine_object_notify(GObject *object,
         g_object_unref(object);
     }
 }
+
+
+/*
+ * Batched signal emission
+ *
+ * g_coroutine_signal_emit() switches to the main context and back for each
+ * signal. When the coroutine doesn't need to wait for the handlers, it can
+ * use g_coroutine_signal_emit_batched() instead: the signal arguments are
+ * collected and the signal is queued, and the main context then emits all
+ * the signals queued meanwhile at once, from a single idle source.
+ *
+ * The signals are emitted in the order they were queued, and before any
+ * signal later emitted with g_coroutine_signal_emit() or
+ * g_coroutine_object_notify() from the same coroutine, since those end the
+ * current batch and idle sources are dispatched in the order they were
+ * added.
+ */
+
+/* Past this many signals, the next ones go in a new batch */
+#define SIGNAL_BATCH_MAX_SIZE 256
+
+typedef struct
+{
+    guint signal_id;
+    GQuark detail;
+    guint n_values;
+    GValue *values; /* the instance followed by the signal parameters */
+    gpointer data;
+    GDestroyNotify destroy;
+} SignalEmission;
+
+struct _GCoroutineSignalBatch
+{
+    gint ref;
+    gboolean dispatched;
+    GArray *emissions;
+};
+
+static void signal_emission_clear(gpointer data)
+{
+    SignalEmission *emission = data;
+    guint i;
+
+    for (i = 0; i < emission->n_values; i++) {
+        g_value_unset(&emission->values[i]);
+    }
+    g_free(emission->values);
+    if (emission->destroy != NULL) {
+        emission->destroy(emission->data);
+    }
+}
+
+static void signal_batch_unref(GCoroutineSignalBatch *batch)
+{
+    if (g_atomic_int_dec_and_test(&batch->ref)) {
+        g_array_unref(batch->emissions);
+        g_free(batch);
+    }
+}
+
+/* main context */
+static gboolean signal_batch_dispatch(gpointer opaque)
+{
+    GCoroutineSignalBatch *batch = opaque;
+    guint i;
+
+    /* no more signals can be added from now on */
+    batch->dispatched = TRUE;
+
+    for (i = 0; i < batch->emissions->len; i++) {
+        SignalEmission *emission = &g_array_index(batch->emissions, SignalEmission, i);
+
+        g_signal_emitv(emission->values, emission->signal_id, emission->detail, NULL);
+    }
+    g_array_set_size(batch->emissions, 0);
+
+    signal_batch_unref(batch);
+    return FALSE;
+}
+
+/* coroutine context */
+void g_coroutine_signal_batch_end(GCoroutine *coroutine)
+{
+    g_return_if_fail(coroutine != NULL);
+
+    g_clear_pointer(&coroutine->signal_batch, signal_batch_unref);
+}
+
+/* coroutine context */
+static GCoroutineSignalBatch *g_coroutine_get_signal_batch(GCoroutine *coroutine)
+{
+    GCoroutineSignalBatch *batch = coroutine->signal_batch;
+
+    if (batch != NULL && !batch->dispatched &&
+        batch->emissions->len < SIGNAL_BATCH_MAX_SIZE) {
+        return batch;
+    }
+    g_coroutine_signal_batch_end(coroutine);
+
+    batch = g_new0(GCoroutineSignalBatch, 1);
+    batch->ref = 2; /* the coroutine and the idle source */
+    batch->emissions = g_array_sized_new(FALSE, FALSE, sizeof(SignalEmission), 16);
+    g_array_set_clear_func(batch->emissions, signal_emission_clear);
+    spice_idle_add(coroutine->context, signal_batch_dispatch, batch);
+    coroutine->signal_batch = batch;
+
+    return batch;
+}
+
+/* coroutine -> main context
+ *
+ * Like g_coroutine_signal_emit() but doesn't wait for the signal to be
+ * emitted. The arguments are copied like GValues are, so pointer arguments
+ * must remain valid until then: @data is kept until the signal was emitted
+ * and then released with @destroy, if not %NULL.
+ */
+void
+g_coroutine_signal_emit_batched(gpointer instance, guint signal_id,
+                                GQuark detail, gpointer data,
+                                GDestroyNotify destroy, ...)
+{
+    GCoroutineSignalBatch *batch;
+    SignalEmission emission;
+    GSignalQuery query;
+    va_list var_args;
+    guint i;
+
+    va_start(var_args, destroy);
+
+    if (coroutine_self_is_main()) {
+        g_signal_emit_valist(instance, signal_id, detail, var_args);
+        va_end(var_args);
+        if (destroy != NULL) {
+            destroy(data);
+        }
+        return;
+    }
+
+    g_signal_query(signal_id, &query);
+    g_return_if_fail(query.signal_id != 0);
+
+    emission.signal_id = signal_id;
+    emission.detail = detail;
+    emission.n_values = query.n_params + 1;
+    emission.values = g_new0(GValue, emission.n_values);
+    emission.data = data;
+    emission.destroy = destroy;
+
+    g_value_init(&emission.values[0], G_TYPE_FROM_INSTANCE(instance));
+    g_value_set_instance(&emission.values[0], instance);
+    for (i = 0; i < query.n_params; i++) {
+        gchar *error = NULL;
+
+        /* always copy, the signal is emitted after we return */
+        G_VALUE_COLLECT_INIT(&emission.values[i + 1],
+                             query.param_types[i] & ~G_SIGNAL_TYPE_STATIC_SCOPE,
+                             var_args, 0, &error);
+        if (error != NULL) {
+            g_critical("%s: %s", G_STRFUNC, error);
+            g_free(error);
+            emission.n_values = i + 1;
+            signal_emission_clear(&emission);
+            va_end(var_args);
+            return;
+        }
+    }
+    va_end(var_args);
+
+    batch = g_coroutine_get_signal_batch(g_coroutine_self());
+    g_array_append_val(batch->emissions, emission);
+}
@@ -27,12 +27,17 @@
 G_BEGIN_DECLS
 
 typedef struct _GCoroutine GCoroutine;
+typedef struct _GCoroutineSignalBatch GCoroutineSignalBatch;
 
 struct _GCoroutine
 {
     struct coroutine coroutine;
     guint wait_id;
     guint condition_id;
+    GSource *poll_source; /* where the socket waits go through */
+    GCoroutineSignalBatch *signal_batch;
+    /* where the coroutine is resumed from, NULL for the default context */
+    GMainContext *context;
 };
 
 /*
@@ -50,6 +55,7 @@ typedef void (*GSignalEmitMainFunc)(GObject *object, int signum, gpointer params
 
 GCoroutine*  g_coroutine_self           (void);
 void         g_coroutine_wakeup         (GCoroutine *coroutine);
+void         g_coroutine_clear          (GCoroutine *coroutine);
 GIOCondition g_coroutine_socket_wait    (GCoroutine *coroutine,
                                          GSocket *sock, GIOCondition cond);
 gboolean     g_coroutine_condition_wait (GCoroutine *coroutine,
@@ -61,6 +67,11 @@ void         g_coroutine_signal_emit (gpointer instance, guint signal_id,
 
 void         g_coroutine_object_notify(GObject *object, const gchar *property_name);
 
+void         g_coroutine_signal_emit_batched(gpointer instance, guint signal_id,
+                                             GQuark detail, gpointer data,
+                                             GDestroyNotify destroy, ...);
+void         g_coroutine_signal_batch_end(GCoroutine *coroutine);
+
 G_END_DECLS
 
 #endif /* __GIO_COROUTINE_H__ */
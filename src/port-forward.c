@@ -487,9 +487,11 @@ static void handle_accepted(PortForwarder *pf, VDAgentPortForwardAcceptedMessage
     }
 }
 
-static void handle_data(PortForwarder *pf, VDAgentPortForwardDataMessage *msg)
+static void handle_data(PortForwarder *pf, VDAgentPortForwardDataMessage *msg,
+                        GBytes *bytes)
 {
     Connection *conn = g_hash_table_lookup(pf->connections, GUINT_TO_POINTER(msg->id));
+    gsize offset = G_STRUCT_OFFSET(VDAgentPortForwardDataMessage, data);
     GBytes *chunk;
     GOutputStream *stream;
 
@@ -498,8 +500,11 @@ static void handle_data(PortForwarder *pf, VDAgentPortForwardDataMessage *msg)
         SPICE_DEBUG("Connection %u does not exist.", msg->id);
     } else if (conn->connecting) {
         g_warning("Connection %u is still not connected!", conn->id);
+    } else if (offset + msg->size > g_bytes_get_size(bytes)) {
+        g_warning("Invalid data size %u on connection %u", msg->size, conn->id);
     } else {
-        chunk = g_bytes_new(msg->data, msg->size);
+        /* no copy, keeps a reference on the received message */
+        chunk = g_bytes_new_from_bytes(bytes, offset, msg->size);
         g_queue_push_tail(conn->write_buffer, chunk);
         if (g_queue_get_length(conn->write_buffer) == 1) {
             conn->refs++;
@@ -548,14 +553,19 @@ static void handle_ack(PortForwarder *pf, VDAgentPortForwardAckMessage *msg)
     }
 }
 
-void port_forwarder_handle_message(PortForwarder* pf, guint32 command, gpointer msg)
+void port_forwarder_handle_message(PortForwarder* pf, guint32 command, GBytes *bytes)
 {
+    gpointer msg;
+
+    g_return_if_fail(bytes != NULL);
+    msg = (gpointer)g_bytes_get_data(bytes, NULL);
+
     switch (command) {
         case VD_AGENT_PORT_FORWARD_ACCEPTED:
             handle_accepted(pf, (VDAgentPortForwardAcceptedMessage *)msg);
             break;
         case VD_AGENT_PORT_FORWARD_DATA:
-            handle_data(pf, (VDAgentPortForwardDataMessage *)msg);
+            handle_data(pf, (VDAgentPortForwardDataMessage *)msg, bytes);
             break;
         case VD_AGENT_PORT_FORWARD_CLOSE:
             handle_close(pf, (VDAgentPortForwardCloseMessage *)msg);
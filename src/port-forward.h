@@ -45,8 +45,9 @@ gboolean port_forwarder_associate_local(PortForwarder *pf, const gchar *bind_add
 gboolean port_forwarder_disassociate_local(PortForwarder *pf, guint16 lport);
 
 /*
- * Handle a message received from the agent.
+ * Handle a message received from the agent. The data to forward is
+ * queued by reference to @msg.
  */
-void port_forwarder_handle_message(PortForwarder *pf, guint32 command, gpointer msg);
+void port_forwarder_handle_message(PortForwarder *pf, guint32 command, GBytes *msg);
 
 #endif /* __PORT_FORWARD_H */
@@ -0,0 +1,231 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <spice/macros.h>
+
+#include "spice-audio-worker.h"
+
+struct SpiceAudioWorker {
+    GThread *thread;
+    GMainContext *worker_context;
+    GMainLoop *loop;
+
+    SpiceXmitQueue jobs;    /* to the worker thread */
+    SpiceXmitQueue done;    /* back to the main context */
+
+    /* worker thread */
+    SndCodec codec;
+    int purpose;
+
+    /* main context */
+    guint generation;
+    SpiceAudioJobDone done_func;
+    gpointer user_data;
+};
+
+/* worker thread */
+static void audio_worker_run(SpiceAudioWorker *worker, SpiceAudioJob *job)
+{
+    guint8 *out;
+    int out_size;
+    int rc;
+
+    switch (job->type) {
+    case SPICE_AUDIO_JOB_CODEC:
+        snd_codec_destroy(&worker->codec);
+        worker->codec = job->codec;
+        job->codec = NULL;
+        break;
+    case SPICE_AUDIO_JOB_DATA:
+        if (worker->codec == NULL) {
+            job->out = g_bytes_ref(job->in);
+            break;
+        }
+
+        if (worker->purpose == SND_CODEC_DECODE) {
+            out_size = SND_CODEC_MAX_FRAME_SIZE * 2 * 2;
+            out = g_malloc(out_size);
+            rc = snd_codec_decode(worker->codec,
+                                  (guint8 *)g_bytes_get_data(job->in, NULL),
+                                  g_bytes_get_size(job->in), out, &out_size);
+        } else {
+            out_size = SND_CODEC_MAX_COMPRESSED_BYTES;
+            out = g_malloc(out_size);
+            rc = snd_codec_encode(worker->codec,
+                                  (guint8 *)g_bytes_get_data(job->in, NULL),
+                                  g_bytes_get_size(job->in), out, &out_size);
+        }
+        if (rc == SND_CODEC_OK) {
+            job->out = g_bytes_new_take(out, out_size);
+        } else {
+            g_free(out);
+        }
+        break;
+    case SPICE_AUDIO_JOB_MARK:
+        break;
+    }
+}
+
+/* worker thread */
+static gboolean audio_worker_jobs_cb(gpointer user_data)
+{
+    SpiceAudioWorker *worker = user_data;
+    SpiceXmitLink *link = spice_xmit_queue_pop_all(&worker->jobs);
+
+    while (link != NULL) {
+        SpiceAudioJob *job = SPICE_CONTAINEROF(link, SpiceAudioJob, link);
+
+        link = link->next;
+        audio_worker_run(worker, job);
+        spice_xmit_queue_push(&worker->done, &job->link);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* main context */
+static gboolean audio_worker_done_cb(gpointer user_data)
+{
+    SpiceAudioWorker *worker = user_data;
+    SpiceXmitLink *link = spice_xmit_queue_pop_all(&worker->done);
+
+    while (link != NULL) {
+        SpiceAudioJob *job = SPICE_CONTAINEROF(link, SpiceAudioJob, link);
+
+        link = link->next;
+        if (job->generation == worker->generation)
+            worker->done_func(job, worker->user_data);
+        spice_audio_job_free(job);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gpointer audio_worker_thread(gpointer user_data)
+{
+    SpiceAudioWorker *worker = user_data;
+
+    g_main_context_push_thread_default(worker->worker_context);
+    g_main_loop_run(worker->loop);
+    g_main_context_pop_thread_default(worker->worker_context);
+
+    return NULL;
+}
+
+static gboolean audio_worker_quit_cb(gpointer user_data)
+{
+    SpiceAudioWorker *worker = user_data;
+
+    g_main_loop_quit(worker->loop);
+    return G_SOURCE_REMOVE;
+}
+
+/* main context: @done is called from @context, with the codec output of
+ * @purpose, SND_CODEC_DECODE or SND_CODEC_ENCODE */
+G_GNUC_INTERNAL
+SpiceAudioWorker *spice_audio_worker_new(const gchar *name, int purpose,
+                                         GMainContext *context,
+                                         SpiceAudioJobDone done,
+                                         gpointer user_data)
+{
+    SpiceAudioWorker *worker = g_new0(SpiceAudioWorker, 1);
+
+    worker->purpose = purpose;
+    worker->done_func = done;
+    worker->user_data = user_data;
+    worker->worker_context = g_main_context_new();
+    worker->loop = g_main_loop_new(worker->worker_context, FALSE);
+    spice_xmit_queue_init(&worker->jobs, worker->worker_context,
+                          audio_worker_jobs_cb, worker);
+    spice_xmit_queue_init(&worker->done, context,
+                          audio_worker_done_cb, worker);
+    worker->thread = g_thread_new(name, audio_worker_thread, worker);
+
+    return worker;
+}
+
+static void audio_worker_free_jobs(SpiceXmitLink *link)
+{
+    while (link != NULL) {
+        SpiceAudioJob *job = SPICE_CONTAINEROF(link, SpiceAudioJob, link);
+
+        link = link->next;
+        spice_audio_job_free(job);
+    }
+}
+
+/* main context: the pending jobs are dropped */
+G_GNUC_INTERNAL
+void spice_audio_worker_free(SpiceAudioWorker *worker)
+{
+    GSource *quit;
+
+    if (worker == NULL)
+        return;
+
+    /* dispatched by the worker loop, even if it is not running yet */
+    quit = g_idle_source_new();
+    g_source_set_callback(quit, audio_worker_quit_cb, worker, NULL);
+    g_source_attach(quit, worker->worker_context);
+    g_source_unref(quit);
+    g_thread_join(worker->thread);
+
+    audio_worker_free_jobs(spice_xmit_queue_close(&worker->jobs));
+    audio_worker_free_jobs(spice_xmit_queue_close(&worker->done));
+    spice_xmit_queue_destroy(&worker->jobs);
+    spice_xmit_queue_destroy(&worker->done);
+    snd_codec_destroy(&worker->codec);
+    g_main_loop_unref(worker->loop);
+    g_main_context_unref(worker->worker_context);
+    g_free(worker);
+}
+
+G_GNUC_INTERNAL
+SpiceAudioJob *spice_audio_job_new(SpiceAudioJobType type)
+{
+    SpiceAudioJob *job = g_slice_new0(SpiceAudioJob);
+
+    job->type = type;
+    return job;
+}
+
+G_GNUC_INTERNAL
+void spice_audio_job_free(SpiceAudioJob *job)
+{
+    snd_codec_destroy(&job->codec);
+    g_clear_pointer(&job->in, g_bytes_unref);
+    g_clear_pointer(&job->out, g_bytes_unref);
+    g_slice_free(SpiceAudioJob, job);
+}
+
+/* main context: takes @job */
+G_GNUC_INTERNAL
+void spice_audio_worker_push(SpiceAudioWorker *worker, SpiceAudioJob *job)
+{
+    job->generation = worker->generation;
+    spice_xmit_queue_push(&worker->jobs, &job->link);
+}
+
+/* main context: the jobs pushed so far won't be reported as done, the
+ * codec changes they carry still apply */
+G_GNUC_INTERNAL
+void spice_audio_worker_drop_pending(SpiceAudioWorker *worker)
+{
+    worker->generation++;
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_AUDIO_WORKER_H__
+#define __SPICE_AUDIO_WORKER_H__
+
+#include <glib.h>
+
+#include "common/snd_codec.h"
+#include "spice-xmit-queue.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    /* hands @codec over to the worker, replacing its current codec, NULL
+     * passes the data through as is */
+    SPICE_AUDIO_JOB_CODEC,
+    /* decodes or encodes @in into @out, that is NULL on failure */
+    SPICE_AUDIO_JOB_DATA,
+    /* nothing to do, it comes back after the jobs pushed before it */
+    SPICE_AUDIO_JOB_MARK,
+} SpiceAudioJobType;
+
+typedef struct SpiceAudioJob {
+    SpiceXmitLink link;
+    SpiceAudioJobType type;
+    guint generation;
+
+    SndCodec codec;
+    GBytes *in;
+    GBytes *out;
+
+    /* for the caller, untouched by the worker */
+    guint tag;
+    guint32 time;
+    guint32 format;
+    guint32 channels;
+    guint32 frequency;
+} SpiceAudioJob;
+
+/* main context: called for each job done, in the order they were pushed */
+typedef void (*SpiceAudioJobDone)(SpiceAudioJob *job, gpointer user_data);
+
+/* A thread owning the codec of an audio channel. Jobs are handed to it and
+ * back through lock-free queues, so that the channel and the main loop
+ * never wait for the codec, and the codec never waits for the main loop. */
+typedef struct SpiceAudioWorker SpiceAudioWorker;
+
+SpiceAudioWorker *spice_audio_worker_new(const gchar *name, int purpose,
+                                         GMainContext *context,
+                                         SpiceAudioJobDone done,
+                                         gpointer user_data);
+void spice_audio_worker_free(SpiceAudioWorker *worker);
+
+SpiceAudioJob *spice_audio_job_new(SpiceAudioJobType type);
+void spice_audio_job_free(SpiceAudioJob *job);
+
+void spice_audio_worker_push(SpiceAudioWorker *worker, SpiceAudioJob *job);
+void spice_audio_worker_drop_pending(SpiceAudioWorker *worker);
+
+G_END_DECLS
+
+#endif /* __SPICE_AUDIO_WORKER_H__ */
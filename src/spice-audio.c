@@ -239,7 +239,7 @@ SpiceAudio *spice_audio_new_priv(SpiceSession *session, GMainContext *context,
     SpiceAudio *self = NULL;
 
     if (context == NULL)
-        context = g_main_context_default();
+        context = spice_session_get_main_context(session);
     if (name == NULL)
         name = g_get_application_name();
 
@@ -264,7 +264,7 @@ SpiceAudio *spice_audio_new_priv(SpiceSession *session, GMainContext *context,
  * spice_audio_new:
  * @session: the #SpiceSession to connect to
  * @context: (allow-none): a #GMainContext to attach to (or %NULL for
- * default).
+ * the #SpiceSession:main-context of @session).
  * @name: (allow-none): a name for the audio channels (or %NULL for
  * application name).
  *
@@ -20,18 +20,19 @@
 
 #include "config.h"
 
-#include <nopoll.h>
 #include <openssl/ssl.h>
 #include <gio/gio.h>
 
 #if HAVE_SASL
-#include <sasl/sasl.h>
+#include "spice-sasl-layer.h"
 #endif
 
 #include "spice-channel.h"
 #include "spice-util-priv.h"
 #include "coroutine.h"
 #include "gio-coroutine.h"
+#include "spice-websocket.h"
+#include "spice-xmit-queue.h"
 
 #include "common/client_marshallers.h"
 #include "common/client_demarshallers.h"
@@ -47,6 +48,7 @@ G_BEGIN_DECLS
 #define spice_mmtime_diff(t1, t2)       ((int32_t) ((t1)-(t2)))
 
 struct _SpiceMsgOut {
+    SpiceXmitLink         link;
     int                   refcount;
     SpiceChannel          *channel;
     SpiceMessageMarshallers *marshallers;
@@ -93,10 +95,7 @@ struct _SpiceChannelPrivate {
     GOutputStream               *out;
 
 #if HAVE_SASL
-    sasl_conn_t                 *sasl_conn;
-    const char                  *sasl_decoded;
-    unsigned int                sasl_decoded_length;
-    unsigned int                sasl_decoded_offset;
+    SpiceSaslLayer              *sasl;
 #endif
 
     gboolean                    use_mini_header;
@@ -108,13 +107,9 @@ struct _SpiceChannelPrivate {
     GCoroutine                  coroutine;
     int                         fd;
     gboolean                    has_error;
-    gboolean                    error_was_ping;
     guint                       connect_delayed_id;
 
-    GQueue                      xmit_queue;
-    gboolean                    xmit_queue_blocked;
-    GMutex                      xmit_queue_lock;
-    guint                       xmit_queue_wakeup_id;
+    SpiceXmitQueue              xmit_queue;
     guint64                     xmit_queue_size;
 
     char                        name[16];
@@ -126,8 +121,7 @@ struct _SpiceChannelPrivate {
     guint                       channel_watch;
     int                         tls;
     int                         ws;
-    noPollConn                  *np_conn;
-    noPollCtx                   *np_ctx;
+    SpiceWebSocket              *websocket;
 
     int                         channel_id;
     int                         channel_type;
@@ -145,6 +139,8 @@ struct _SpiceChannelPrivate {
     GArray                      *remote_common_caps;
 
     gsize                       total_read_bytes;
+    guint                       read_waits;
+    gsize                       stack_high_water;
     uint64_t                    last_message_serial;
     GSList                      *flushing;
 
@@ -162,6 +158,7 @@ void spice_msg_in_unref(SpiceMsgIn *in);
 int spice_msg_in_type(SpiceMsgIn *in);
 void *spice_msg_in_parsed(SpiceMsgIn *in);
 void *spice_msg_in_raw(SpiceMsgIn *in, int *len);
+GBytes *spice_msg_in_bytes(SpiceMsgIn *in, gsize offset, gsize size);
 void spice_msg_in_hexdump(SpiceMsgIn *in);
 
 SpiceMsgOut *spice_msg_out_new(SpiceChannel *channel, int type);
@@ -176,8 +173,10 @@ uint32_t spice_header_get_msg_size(uint8_t *header, gboolean is_mini_header);
 
 void spice_channel_up(SpiceChannel *channel);
 void spice_channel_wakeup(SpiceChannel *channel, gboolean cancel);
+void spice_channel_sample_rtt(SpiceChannel *channel);
 
 SpiceSession* spice_channel_get_session(SpiceChannel *channel);
+GMainContext *spice_channel_get_main_context(SpiceChannel *channel);
 enum spice_channel_state spice_channel_get_state(SpiceChannel *channel);
 guint64 spice_channel_get_queue_size (SpiceChannel *channel);
 
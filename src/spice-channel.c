@@ -23,12 +23,12 @@
 
 #include "spice-channel-priv.h"
 #include "spice-session-priv.h"
+#include "spice-util-priv.h"
 #include "spice-marshal.h"
 #include "bio-gio.h"
 
 #include <glib/gi18n.h>
 
-#include <nopoll.h>
 #include <openssl/rsa.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>
@@ -87,6 +87,7 @@ enum {
     PROP_CHANNEL_TYPE,
     PROP_CHANNEL_ID,
     PROP_TOTAL_READ_BYTES,
+    PROP_COROUTINE_STACK_USED,
 };
 
 /* Signals */
@@ -104,6 +105,7 @@ static guint signals[SPICE_CHANNEL_LAST_SIGNAL];
 
 static void spice_channel_iterate_write(SpiceChannel *channel);
 static void spice_channel_iterate_read(SpiceChannel *channel);
+static gboolean spice_channel_idle_wakeup(gpointer user_data);
 
 #ifdef FUSIONDATA_DEV
 /* add by yhoon17, 20180327 : */
@@ -134,8 +136,6 @@ static void spice_channel_init(SpiceChannel *channel)
 #if HAVE_SASL
     spice_channel_set_common_capability(channel, SPICE_COMMON_CAP_AUTH_SASL);
 #endif
-    g_queue_init(&c->xmit_queue);
-    STATIC_MUTEX_INIT(c->xmit_queue_lock);
 }
 
 static void spice_channel_constructed(GObject *gobject)
@@ -153,6 +153,11 @@ static void spice_channel_constructed(GObject *gobject)
     if (disabled && strstr(disabled, desc))
         c->disable_channel_msg = TRUE;
 
+    /* the coroutine runs from the main context of the session */
+    c->coroutine.context = g_main_context_ref(spice_session_get_main_context(c->session));
+    spice_xmit_queue_init(&c->xmit_queue, c->coroutine.context,
+                          spice_channel_idle_wakeup, channel);
+
     spice_session_channel_new(c->session, channel);
 
     /* Chain up to the parent class */
@@ -188,9 +193,11 @@ static void spice_channel_finalize(GObject *gobject)
 
     CHANNEL_DEBUG(channel, "%s %p", __FUNCTION__, gobject);
 
-    g_idle_remove_by_data(gobject);
+    spice_idle_remove_by_data(c->coroutine.context, gobject);
 
-    STATIC_MUTEX_CLEAR(c->xmit_queue_lock);
+    spice_xmit_queue_destroy(&c->xmit_queue);
+    g_coroutine_clear(&c->coroutine);
+    g_clear_pointer(&c->coroutine.context, g_main_context_unref);
 
     if (c->caps)
         g_array_free(c->caps, TRUE);
@@ -230,6 +237,9 @@ static void spice_channel_get_property(GObject    *gobject,
     case PROP_TOTAL_READ_BYTES:
         g_value_set_ulong(value, c->total_read_bytes);
         break;
+    case PROP_COROUTINE_STACK_USED:
+        g_value_set_uint(value, c->stack_high_water >> 10);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -332,6 +342,26 @@ static void spice_channel_class_init(SpiceChannelClass *klass)
                             G_PARAM_READABLE |
                             G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceChannel:coroutine-stack-used:
+     *
+     * The most stack the coroutine of the channel used over its
+     * connections, in kilobytes, or 0 until its first connection ended or
+     * when it can't be measured. It is updated when the coroutine exits,
+     * without notification, and helps choosing
+     * #SpiceSession:coroutine-stack-size.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_COROUTINE_STACK_USED,
+         g_param_spec_uint("coroutine-stack-used",
+                           "Coroutine stack used",
+                           "Coroutine stack high-water mark in kilobytes",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceChannel::channel-event:
      * @channel: the channel that emitted the signal
@@ -527,7 +557,8 @@ void spice_msg_in_ref(SpiceMsgIn *in)
 {
     g_return_if_fail(in != NULL);
 
-    in->refcount++;
+    /* atomic, the data may be held by a GBytes, see spice_msg_in_bytes() */
+    g_atomic_int_inc(&in->refcount);
 }
 
 G_GNUC_INTERNAL
@@ -535,8 +566,7 @@ void spice_msg_in_unref(SpiceMsgIn *in)
 {
     g_return_if_fail(in != NULL);
 
-    in->refcount--;
-    if (in->refcount > 0)
+    if (!g_atomic_int_dec_and_test(&in->refcount))
         return;
     if (in->parsed)
         in->pfree(in->parsed);
@@ -574,6 +604,21 @@ void *spice_msg_in_raw(SpiceMsgIn *in, int *len)
     return in->data;
 }
 
+/*
+ * Returns a #GBytes for @size bytes of the raw message data at @offset,
+ * which keeps a reference on @in rather than copying them.
+ */
+G_GNUC_INTERNAL
+GBytes *spice_msg_in_bytes(SpiceMsgIn *in, gsize offset, gsize size)
+{
+    g_return_val_if_fail(in != NULL, NULL);
+    g_return_val_if_fail(offset + size <= (gsize)in->dpos, NULL);
+
+    spice_msg_in_ref(in);
+    return g_bytes_new_with_free_func(in->data + offset, size,
+                                      (GDestroyNotify)spice_msg_in_unref, in);
+}
+
 static void hexdump(const char *prefix, unsigned char *data, int len)
 {
     int i;
@@ -693,29 +738,10 @@ void spice_msg_out_unref(SpiceMsgOut *out)
 static gboolean spice_channel_idle_wakeup(gpointer user_data)
 {
     SpiceChannel *channel = SPICE_CHANNEL(user_data);
-    SpiceChannelPrivate *c = channel->priv;
-
-    /*
-     * Note:
-     *
-     * - This must be done before the wakeup as that may eventually
-     *   call channel_reset() which checks this.
-     * - The lock calls are really necessary, this fixes the following race:
-     *   1) usb-event-thread calls spice_msg_out_send()
-     *   2) spice_msg_out_send calls g_timeout_add_full(...)
-     *   3) we run, set xmit_queue_wakeup_id to 0
-     *   4) spice_msg_out_send stores the result of g_timeout_add_full() in
-     *      xmit_queue_wakeup_id, overwriting the 0 we just stored
-     *   5) xmit_queue_wakeup_id now says there is a wakeup pending which is
-     *      false
-     */
-    STATIC_MUTEX_LOCK(c->xmit_queue_lock);
-    c->xmit_queue_wakeup_id = 0;
-    STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
 
     spice_channel_wakeup(channel, FALSE);
 
-    return FALSE;
+    return G_SOURCE_CONTINUE;
 }
 
 /* any context (system/co-routine/usb-event-thread) */
@@ -723,33 +749,16 @@ G_GNUC_INTERNAL
 void spice_msg_out_send(SpiceMsgOut *out)
 {
     SpiceChannelPrivate *c;
-    gboolean was_empty;
 
     g_return_if_fail(out != NULL);
     g_return_if_fail(out->channel != NULL);
     c = out->channel->priv;
 
-    STATIC_MUTEX_LOCK(c->xmit_queue_lock);
-    if (c->xmit_queue_blocked) {
+    /* wakes up the channel if the queue was empty, see spice-xmit-queue.c */
+    if (!spice_xmit_queue_push(&c->xmit_queue, &out->link)) {
         g_warning("message queue is blocked, dropping message");
-        goto end;
-    }
-
-    was_empty = g_queue_is_empty(&c->xmit_queue);
-    g_queue_push_tail(&c->xmit_queue, out);
-
-    /* One wakeup is enough to empty the entire queue -> only do a wakeup
-       if the queue was empty, and there isn't one pending already. */
-    if (was_empty && !c->xmit_queue_wakeup_id) {
-        c->xmit_queue_wakeup_id =
-            /* Use g_timeout_add_full so that can specify the priority */
-            g_timeout_add_full(G_PRIORITY_HIGH, 0,
-                               spice_channel_idle_wakeup,
-                               out->channel, NULL);
+        spice_msg_out_unref(out);
     }
-
-end:
-    STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
 }
 
 /* coroutine context */
@@ -763,12 +772,12 @@ void spice_msg_out_send_internal(SpiceMsgOut *out)
 
 /*
  * Write all 'data' of length 'datalen' bytes out to
- * the wire
+ * the socket, or the TLS session over it
  */
 /* coroutine context */
-static void spice_channel_flush_wire(SpiceChannel *channel,
-                                     const void *data,
-                                     size_t datalen)
+static void spice_channel_flush_wire_raw(SpiceChannel *channel,
+                                         const void *data,
+                                         size_t datalen)
 {
     SpiceChannelPrivate *c = channel->priv;
     const char *ptr = data;
@@ -784,18 +793,7 @@ static void spice_channel_flush_wire(SpiceChannel *channel,
         if (c->has_error) return;
 
         cond = 0;
-        if (c->ws) {
-            ret = nopoll_conn_send_binary(c->np_conn, ptr+offset, datalen-offset);
-            //CHANNEL_DEBUG(channel, "spice_channel_flush_wire() in ret=%d", ret);
-            if (ret < 0) {
-                if (errno == EAGAIN) {
-                    cond = G_IO_OUT;
-                } else {
-                    g_warning("Error writting to websocket: %s", strerror(errno));
-                }
-                ret = -1;
-            }
-        } else if (c->tls) {
+        if (c->tls) {
             ret = SSL_write(c->ssl, ptr+offset, datalen-offset);
             if (ret < 0) {
                 ret = SSL_get_error(c->ssl, ret);
@@ -839,31 +837,27 @@ static void spice_channel_flush_wire(SpiceChannel *channel,
     }
 }
 
-#if HAVE_SASL
 /*
- * Encode all buffered data, write all encrypted data out
- * to the wire
+ * Write all 'data' of length 'datalen' bytes out to
+ * the wire
  */
-static void spice_channel_flush_sasl(SpiceChannel *channel, const void *data, size_t len)
+/* coroutine context */
+static void spice_channel_flush_wire(SpiceChannel *channel,
+                                     const void *data,
+                                     size_t datalen)
 {
     SpiceChannelPrivate *c = channel->priv;
-    const char *output;
-    unsigned int outputlen;
-    int err;
 
-    err = sasl_encode(c->sasl_conn, data, len, &output, &outputlen);
-    if (err != SASL_OK) {
-        g_warning ("Failed to encode SASL data %s",
-                   sasl_errstring(err, NULL, NULL));
-        c->has_error = TRUE;
+    if (c->has_error) return;
+
+    if (c->websocket != NULL) {
+        if (!spice_websocket_write(c->websocket, data, datalen))
+            c->has_error = TRUE;
         return;
     }
 
-    //CHANNEL_DEBUG(channel, "Flush SASL %d: %p %d", len, output, outputlen);
-    //CHANNEL_DEBUG(channel, "spice_channel_flush_sasl len=%d", outputlen);
-    spice_channel_flush_wire(channel, output, outputlen);
+    spice_channel_flush_wire_raw(channel, data, datalen);
 }
-#endif
 
 /* coroutine context */
 static void spice_channel_write(SpiceChannel *channel, const void *data, size_t len)
@@ -871,9 +865,10 @@ static void spice_channel_write(SpiceChannel *channel, const void *data, size_t
 #if HAVE_SASL
     SpiceChannelPrivate *c = channel->priv;
 
-    if (c->sasl_conn)
-        spice_channel_flush_sasl(channel, data, len);
-    else
+    if (c->sasl) {
+        if (!c->has_error && !spice_sasl_layer_write(c->sasl, data, len))
+            c->has_error = TRUE;
+    } else
 #endif
 		//CHANNEL_DEBUG(channel, "spice_channel_write() in  len=%d", len);
 		//CHANNEL_DEBUG(channel, "spice_channel_write() in  data=%s", data);
@@ -917,11 +912,11 @@ static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
 }
 
 /*
- * Read at least 1 more byte of data straight off the wire
- * into the requested buffer.
+ * Read at least 1 more byte of data straight off the socket, or
+ * the TLS session over it, into the requested buffer.
  */
 /* coroutine context */
-static int spice_channel_read_wire(SpiceChannel *channel, void *data, size_t len)
+static int spice_channel_read_wire_raw(SpiceChannel *channel, void *data, size_t len)
 {
 
 //	CHANNEL_DEBUG(channel, "spice_channel_read_wire() in");
@@ -937,33 +932,7 @@ reread:
     if (c->has_error) return 0; /* has_error is set by disconnect(), return no error */
 
     cond = 0;
-    if (c->ws) {
-//		CHANNEL_DEBUG(channel, "spice_channel_read_wire() in reread: c->ws");
-        ret = nopoll_conn_read(c->np_conn, data, len, nopoll_false, 0);
-
-//        CHANNEL_DEBUG(channel, "spice_channel_read_wire() in reread: c->ws ret=%d", ret);
-//        CHANNEL_DEBUG(channel, "spice_channel_read_wire() in reread: c->ws data=%s", data);
-//        CHANNEL_DEBUG(channel, "spice_channel_read_wire() in reread: c->ws len=%d", len);
-
-
-        if (ret < 0) {
-            if (ret == -3) {
-                /* nopoll is telling us he got a WS PING, and we should ignore it */
-                c->error_was_ping = TRUE;
-            } else if (errno == EAGAIN
-#ifdef WIN32
-                    || errno == WSAEWOULDBLOCK
-#endif
-                ) {
-                cond = G_IO_IN;
-            }
-            ret = -1;
-        }
-#ifdef WIN32
-        // Reset socket state
-        g_socket_receive(c->sock, data, 0, NULL, NULL);
-#endif
-    } else if (c->tls) {
+    if (c->tls) {
 
 	//	CHANNEL_DEBUG(channel, "spice_channel_read_wire() in reread: c->tls");
 
@@ -1007,6 +976,7 @@ reread:
 
     if (ret == -1) {
         if (cond != 0) {
+            c->read_waits++;
             // TODO: should use g_pollable_input/output_stream_create_source() ?
             g_coroutine_socket_wait(&c->coroutine, c->sock, cond);
             goto reread;
@@ -1024,52 +994,64 @@ reread:
     return ret;
 }
 
-#if HAVE_SASL
 /*
- * Read at least 1 more byte of data out of the SASL decrypted
- * data buffer, into the internal read buffer
+ * Read at least 1 more byte of data straight off the wire
+ * into the requested buffer.
  */
-static int spice_channel_read_sasl(SpiceChannel *channel, void *data, size_t len)
+/* coroutine context */
+static int spice_channel_read_wire(SpiceChannel *channel, void *data, size_t len)
 {
     SpiceChannelPrivate *c = channel->priv;
+    gssize ret;
 
-    /* CHANNEL_DEBUG(channel, "Read %lu SASL %p size %d offset %d", len, c->sasl_decoded, */
-    /*             c->sasl_decoded_length, c->sasl_decoded_offset); */
+    if (c->websocket == NULL)
+        return spice_channel_read_wire_raw(channel, data, len);
 
-    if (c->sasl_decoded == NULL || c->sasl_decoded_length == 0) {
-        char encoded[8192]; /* should stay lower than maxbufsize */
-        int err, ret;
+    if (c->has_error) return 0; /* has_error is set by disconnect(), return no error */
 
-        g_warn_if_fail(c->sasl_decoded_offset == 0);
+    ret = spice_websocket_read(c->websocket, data, len);
+    if (ret <= 0) {
+        c->has_error = TRUE;
+        return 0;
+    }
 
-        ret = spice_channel_read_wire(channel, encoded, sizeof(encoded));
-        if (ret < 0)
-            return ret;
+    return ret;
+}
 
-        err = sasl_decode(c->sasl_conn, encoded, ret,
-                          &c->sasl_decoded, &c->sasl_decoded_length);
-        if (err != SASL_OK) {
-            g_warning("Failed to decode SASL data %s",
-                      sasl_errstring(err, NULL, NULL));
-            c->has_error = TRUE;
-            return -EINVAL;
-        }
-        c->sasl_decoded_offset = 0;
-    }
+/* coroutine context */
+static gssize websocket_io_read(gpointer user_data, void *data, gsize len)
+{
+    SpiceChannel *channel = user_data;
+    int ret = spice_channel_read_wire_raw(channel, data, len);
 
-    if (c->sasl_decoded_length == 0)
-        return 0;
+    return ret > 0 ? ret : 0;
+}
 
-    len = MIN(c->sasl_decoded_length - c->sasl_decoded_offset, len);
-    memcpy(data, c->sasl_decoded + c->sasl_decoded_offset, len);
-    c->sasl_decoded_offset += len;
+/* coroutine context */
+static gboolean websocket_io_write(gpointer user_data, const void *data, gsize len)
+{
+    SpiceChannel *channel = user_data;
 
-    if (c->sasl_decoded_offset == c->sasl_decoded_length) {
-        c->sasl_decoded_length = c->sasl_decoded_offset = 0;
-        c->sasl_decoded = NULL;
-    }
+    spice_channel_flush_wire_raw(channel, data, len);
 
-    return len;
+    return !channel->priv->has_error;
+}
+
+#if HAVE_SASL
+/* coroutine context */
+static gssize sasl_io_read(gpointer user_data, void *data, gsize len)
+{
+    return spice_channel_read_wire(user_data, data, len);
+}
+
+/* coroutine context */
+static gboolean sasl_io_write(gpointer user_data, const void *data, gsize len)
+{
+    SpiceChannel *channel = user_data;
+
+    spice_channel_flush_wire(channel, data, len);
+
+    return !channel->priv->has_error;
 }
 #endif
 
@@ -1087,9 +1069,11 @@ static int spice_channel_read(SpiceChannel *channel, void *data, size_t length)
         if (c->has_error) return 0; /* has_error is set by disconnect(), return no error */
 
 #if HAVE_SASL
-        if (c->sasl_conn)
-            ret = spice_channel_read_sasl(channel, data, len);
-        else
+        if (c->sasl) {
+            ret = spice_sasl_layer_read(c->sasl, data, len);
+            if (ret < 0)
+                c->has_error = TRUE;
+        } else
 #endif
             ret = spice_channel_read_wire(channel, data, len);
         if (ret < 0)
@@ -1565,7 +1549,7 @@ static gboolean spice_channel_perform_auth_sasl(SpiceChannel *channel)
     /* If we've got TLS, we don't care about SSF */
     secprops.min_ssf = c->ssl ? 0 : 56; /* Equiv to DES supported by all Kerberos */
     secprops.max_ssf = c->ssl ? 0 : 100000; /* Very strong ! AES == 256 */
-    secprops.maxbufsize = 100000;
+    secprops.maxbufsize = SPICE_SASL_MAX_BUFSIZE;
     /* If we're not TLS, then forbid any anonymous or trivially crackable auth */
     secprops.security_flags = c->ssl ? 0 :
         SASL_SEC_NOANONYMOUS | SASL_SEC_NOPLAINTEXT;
@@ -1784,11 +1768,14 @@ complete:
     CHANNEL_DEBUG(channel, "%s", "SASL authentication complete");
     spice_channel_read(channel, &len, sizeof(len));
     if (len == SPICE_LINK_ERR_OK) {
+        SpiceSaslLayerIO io = { sasl_io_read, sasl_io_write, channel };
+
         ret = TRUE;
         /* This must come *after* check-auth-result, because the former
-         * is defined to be sent unencrypted, and setting saslconn turns
-         * on the SSF layer encryption processing */
-        c->sasl_conn = saslconn;
+         * is defined to be sent unencrypted, and setting the security
+         * layer turns on the SSF layer encryption processing */
+        c->sasl = g_new(SpiceSaslLayer, 1);
+        spice_sasl_layer_init(c->sasl, saslconn, &io);
         goto cleanup;
     }
 
@@ -1921,6 +1908,27 @@ gboolean spice_channel_get_read_only(SpiceChannel *channel)
     return spice_session_get_read_only(channel->priv->session);
 }
 
+/*
+ * Feeds the session with the round trip time TCP measured on the channel
+ * socket, where it is available.
+ */
+/* coroutine context */
+G_GNUC_INTERNAL
+void spice_channel_sample_rtt(SpiceChannel *channel)
+{
+#if defined(HAVE_NETINET_IN_H) && defined(TCP_INFO)
+    SpiceChannelPrivate *c = channel->priv;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (c->sock == NULL || g_socket_get_family(c->sock) == G_SOCKET_FAMILY_UNIX)
+        return;
+
+    if (getsockopt(g_socket_get_fd(c->sock), IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        spice_session_net_add_rtt(c->session, info.tcpi_rtt);
+#endif
+}
+
 /* coroutine context */
 G_GNUC_INTERNAL
 void spice_channel_recv_msg(SpiceChannel *channel,
@@ -1937,24 +1945,26 @@ void spice_channel_recv_msg(SpiceChannel *channel,
     /* receive message */
     spice_channel_read(channel, in->header,
                        spice_header_get_header_size(c->use_mini_header));
-    if (c->has_error) {
-        if (c->error_was_ping) {
-            c->has_error = FALSE;
-            c->error_was_ping = FALSE;
-        }
+    if (c->has_error)
         goto end;
-    }
 
     msg_size = spice_header_get_msg_size(in->header, c->use_mini_header);
     /* FIXME: do not allow others to take ref on in, and use realloc here?
      * this would avoid malloc/free on each message?
      */
     in->data = g_malloc0(msg_size);
-    do {
-        c->has_error = FALSE;
-        c->error_was_ping = FALSE;
+    if (msg_size >= SPICE_NET_MIN_TRANSFER) {
+        guint waits = c->read_waits;
+        gint64 start = g_get_monotonic_time();
+
         spice_channel_read(channel, in->data, msg_size);
-    } while (c->has_error && c->error_was_ping);
+        /* when it was all buffered already, it's no bandwidth sample */
+        if (!c->has_error && c->read_waits != waits)
+            spice_session_net_add_transfer(c->session, msg_size,
+                                           g_get_monotonic_time() - start);
+    } else {
+        spice_channel_read(channel, in->data, msg_size);
+    }
     if (c->has_error)
         goto end;
     in->dpos = msg_size;
@@ -1994,6 +2004,7 @@ void spice_channel_recv_msg(SpiceChannel *channel,
             SpiceMsgOut *out = spice_msg_out_new(channel, SPICE_MSGC_ACK);
             spice_msg_out_send_internal(out);
             c->message_ack_count = c->message_ack_window;
+            spice_channel_sample_rtt(channel);
         }
     }
 
@@ -2233,31 +2244,31 @@ static void spice_channel_flushed(SpiceChannel *channel, gboolean success)
 static void spice_channel_iterate_write(SpiceChannel *channel)
 {
     SpiceChannelPrivate *c = channel->priv;
-    SpiceMsgOut *out;
-    int pending_bytes;
+    SpiceXmitLink *link;
 
-    do {
-        STATIC_MUTEX_LOCK(c->xmit_queue_lock);
-        out = g_queue_pop_head(&c->xmit_queue);
-        STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
-        if (out) {
-            spice_channel_write_msg(channel, out);
-            if (c->ws) {
-                while ((pending_bytes = nopoll_conn_complete_pending_write(c->np_conn) != 0)) {
-                    g_warning("Writing %d pending bytes", pending_bytes);
-                    if (pending_bytes < 0 && errno != EAGAIN
-#ifdef WIN32
-                        && WSAGetLastError() != WSAEWOULDBLOCK
+    /* messages queued while writing are picked up by the next round */
+    while ((link = spice_xmit_queue_pop_all(&c->xmit_queue)) != NULL) {
+#if HAVE_SASL
+        if (c->sasl)
+            spice_sasl_layer_begin_batch(c->sasl);
 #endif
-                    ) {
-                        c->has_error = TRUE;
-                        return;
-                    }
-                    g_coroutine_socket_wait(&c->coroutine, c->sock, G_IO_OUT);
-                }
+        while (link != NULL) {
+            SpiceMsgOut *out = SPICE_CONTAINEROF(link, SpiceMsgOut, link);
+
+            link = link->next;
+            if (c->has_error) {
+                spice_msg_out_unref(out);
+                continue;
             }
+            spice_channel_write_msg(channel, out);
         }
-    } while (out);
+#if HAVE_SASL
+        if (c->sasl && !spice_sasl_layer_end_batch(c->sasl))
+            c->has_error = TRUE;
+#endif
+        if (c->has_error)
+            return;
+    }
 
     spice_channel_flushed(channel, TRUE);
 }
@@ -2267,18 +2278,21 @@ static void spice_channel_iterate_read(SpiceChannel *channel)
 {
     SpiceChannelPrivate *c = channel->priv;
 
-    g_coroutine_socket_wait(&c->coroutine, c->sock, G_IO_IN);
+    /* the websocket may have read more frames than it returned */
+    if (c->websocket == NULL || !spice_websocket_pending(c->websocket))
+        g_coroutine_socket_wait(&c->coroutine, c->sock, G_IO_IN);
 
     /* treat all incoming data (block on message completion) */
     while (!c->has_error &&
            c->state != SPICE_CHANNEL_STATE_MIGRATING &&
-           g_pollable_input_stream_is_readable(G_POLLABLE_INPUT_STREAM(c->in))) {
+           ((c->websocket != NULL && spice_websocket_pending(c->websocket)) ||
+            g_pollable_input_stream_is_readable(G_POLLABLE_INPUT_STREAM(c->in)))) {
         do
             spice_channel_recv_msg(channel,
                                    (handler_msg_in)SPICE_CHANNEL_GET_CLASS(channel)->handle_msg, NULL);
 #if HAVE_SASL
             /* flush the sasl buffer too */
-        while (c->sasl_decoded != NULL);
+        while (c->sasl != NULL && spice_sasl_layer_pending(c->sasl));
 #else
         while (FALSE);
 #endif
@@ -2481,32 +2495,65 @@ const GError* spice_channel_get_error(SpiceChannel *self)
     return c->error;
 }
 
-static void nopoll_log_handler(noPollCtx *ctx, noPollDebugLevel level,
-                               const char *log_msg, noPollPtr user_data)
+/* The stack size can be tuned with SpiceSession:coroutine-stack-size or
+ * SPICE_COROUTINE_STACK_SIZE, in kilobytes, using the high-water marks of
+ * SpiceChannel:coroutine-stack-used */
+#define COROUTINE_STACK_SIZE_DEFAULT (16 << 20) /* 16Mb */
+/* the openssl and decoders need some room */
+#define COROUTINE_STACK_SIZE_MIN     (64 << 10)
+
+static gpointer getenv_stack_size(gpointer data G_GNUC_UNUSED)
 {
-	SPICE_DEBUG("nopoll_log_handler() in");
+    const gchar *str = g_getenv("SPICE_COROUTINE_STACK_SIZE");
+    guint64 size = COROUTINE_STACK_SIZE_DEFAULT;
 
+    if (str != NULL) {
+        guint64 kb = g_ascii_strtoull(str, NULL, 10);
 
-    GLogLevelFlags slevel;
-    if (level == NOPOLL_LEVEL_DEBUG) slevel = G_LOG_LEVEL_DEBUG;
-    else {
-        slevel = G_LOG_LEVEL_WARNING;
-#ifdef WIN32
-        if (WSAGetLastError() == WSAEWOULDBLOCK) return; // Ignore these errors
-#else
-        if (errno == EAGAIN) return; // Ignore these errors
-#endif
+        if (kb >= COROUTINE_STACK_SIZE_MIN / 1024 && kb <= G_MAXSIZE / 1024)
+            size = kb * 1024;
+        else
+            g_warning("invalid SPICE_COROUTINE_STACK_SIZE: %s", str);
     }
-    g_log("nopoll", slevel, "%s", log_msg);
+
+    return GSIZE_TO_POINTER(size);
+}
+
+static gsize spice_channel_stack_size(SpiceChannel *channel)
+{
+    static GOnce stack_size_once = G_ONCE_INIT;
+    gsize kb = spice_session_get_coroutine_stack_size(channel->priv->session);
+
+    if (kb != 0)
+        return MAX(kb * 1024, COROUTINE_STACK_SIZE_MIN);
+
+    g_once(&stack_size_once, getenv_stack_size, NULL);
+    return GPOINTER_TO_SIZE(stack_size_once.retval);
 }
 
-static noPollCtx * nopoll_get_context(void)
+G_LOCK_DEFINE_STATIC(stack_high_water);
+static gsize stack_high_water[SPICE_END_CHANNEL];
+
+/* coroutine context */
+static void spice_channel_update_stack_stats(SpiceChannel *channel)
 {
-	SPICE_DEBUG("nopoll_get_context() in");
+    SpiceChannelPrivate *c = channel->priv;
+    gsize used = coroutine_stack_used(&c->coroutine.coroutine);
+    gsize high_water;
+
+    if (used == 0 || c->channel_type >= SPICE_END_CHANNEL)
+        return;
+
+    c->stack_high_water = MAX(c->stack_high_water, used);
 
-    static noPollCtx *np_ctx = NULL;
-    if (!np_ctx) np_ctx = nopoll_ctx_new();
-    return np_ctx;
+    G_LOCK(stack_high_water);
+    high_water = stack_high_water[c->channel_type] =
+        MAX(stack_high_water[c->channel_type], used);
+    G_UNLOCK(stack_high_water);
+
+    CHANNEL_DEBUG(channel, "coroutine stack used: %" G_GSIZE_FORMAT
+                  "k, at most %" G_GSIZE_FORMAT "k for this channel type",
+                  used >> 10, high_water >> 10);
 }
 
 /* coroutine context */
@@ -2521,12 +2568,7 @@ static void *spice_channel_coroutine(void *data)
     /* When some other SSL/TLS version becomes obsolete, add it to this
      * variable. */
     long ssl_options = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3;
-    gchar wsportstr[32];
-    GSocketAddress *addr = NULL;
-    GInetSocketAddress *iaddr = NULL;
-    GInetAddress *host;
     char *ws_token = NULL;
-    noPollConnOpts *opts;
 
     CHANNEL_DEBUG(channel, "Started background coroutine %p", &c->coroutine);
 
@@ -2584,67 +2626,10 @@ reconnect:
 
     CHANNEL_DEBUG(channel, "reconnect in ws_token: %s", ws_token);
 
-	c->error_was_ping = FALSE;
 	c->tls = TRUE;
+    c->ws = ws_token != NULL;
 
-    if (ws_token != NULL) {
-        c->ws = TRUE;
-
-        CHANNEL_DEBUG(channel, "reconnect in ws_token != NULL in");
-
-        c->np_ctx = nopoll_get_context();
-        if (c->np_ctx == NULL) {
-            g_critical("Can't allocate noPoll context");
-            g_coroutine_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_ERROR_TLS);
-            goto cleanup;
-        }
-
-
-
-        nopoll_log_set_handler(c->np_ctx, nopoll_log_handler, NULL);
-        //nopoll_log_enable(c->np_ctx, nopoll_true);
-
-        CHANNEL_DEBUG(channel, "reconnect in ws_token != NULL in nopoll_log_set_handler()");
-
-        addr = g_socket_get_remote_address(c->sock, NULL);
-        if (!addr) {
-            g_critical("failed to get peer address");
-            goto cleanup;
-        }
-
-        iaddr = G_INET_SOCKET_ADDRESS(addr);
-        host = g_inet_socket_address_get_address(iaddr);
-        snprintf(&wsportstr[0], 32, "/?ver=2&token=%s", ws_token);
-        CHANNEL_DEBUG(channel, "reconnect in ws_token: %s", ws_token);
-
-		CHANNEL_DEBUG(channel, "reconnect in ws_token != NULL in  before nopoll_conn_opts_new()");
-
-        // TODO: Check server certificates
-        opts = nopoll_conn_opts_new();
-        nopoll_conn_opts_ssl_peer_verify(opts, nopoll_false);
-    /*    c->np_conn = nopoll_conn_tls_new_with_socket(c->np_ctx, opts, g_socket_get_fd(c->sock),
-                                                     g_inet_address_to_string(host), NULL,
-                                                     spice_session_get_host(c->session),
-                                                     &wsportstr[0], "binary", NULL);
-
-        if (nopoll_conn_is_ok(c->np_conn) != nopoll_true) {
-            g_critical("Can't connect to websocket");
-            g_coroutine_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_ERROR_TLS);
-            goto cleanup;
-        }
-
-        if (nopoll_conn_wait_until_connection_ready(c->np_conn, 100) == nopoll_false) {
-            g_critical("Time out waiting for websocket connection");
-            g_coroutine_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_ERROR_TLS);
-            goto cleanup;
-        }
-
-        if (nopoll_conn_is_ready(c->np_conn) != nopoll_true) {
-            g_critical("Websocket connection is NOT ready");
-            g_coroutine_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_ERROR_TLS);
-            goto cleanup;
-        }
-*/    } else if (c->tls) {
+    if (c->tls) {
 
 		CHANNEL_DEBUG(channel, "reconnect in c->tls -> SSL_CTX_new()");
 
@@ -2698,9 +2683,13 @@ reconnect:
             goto cleanup;
         }
 
-		CHANNEL_DEBUG(channel, "reconnect in bio_new_giostream()");
+		CHANNEL_DEBUG(channel, "reconnect in BIO setup");
 
-        BIO *bio = bio_new_giostream(G_IO_STREAM(c->conn));
+        BIO *bio = NULL;
+        if (!g_getenv("SPICE_DISABLE_KTLS"))
+            bio = bio_new_ktls_socket(c->conn, c->ssl);
+        if (bio == NULL)
+            bio = bio_new_giostream(G_IO_STREAM(c->conn));
         SSL_set_bio(c->ssl, bio, bio);
 
         {
@@ -2734,6 +2723,14 @@ ssl_reconnect:
                 goto cleanup;
             }
         }
+
+        {
+            gboolean ktls_send, ktls_recv;
+
+            if (bio_get_ktls(SSL_get_wbio(c->ssl), &ktls_send, &ktls_recv))
+                CHANNEL_DEBUG(channel, "%s, kTLS send: %d, receive: %d",
+                              SSL_get_cipher_name(c->ssl), ktls_send, ktls_recv);
+        }
     }
 
 connected:
@@ -2755,6 +2752,24 @@ connected:
                   strerror(errno));
     }
 
+    if (c->ws) {
+        SpiceWebSocketIO io = { websocket_io_read, websocket_io_write, channel };
+        gchar *path = g_strdup_printf("/?ver=2&token=%s", ws_token);
+        GError *error = NULL;
+
+        c->websocket = g_new(SpiceWebSocket, 1);
+        spice_websocket_init(c->websocket, &io);
+        if (!spice_websocket_handshake(c->websocket, spice_session_get_host(c->session),
+                                       path, &error)) {
+            g_warning("%s: %s", c->name, error->message);
+            g_clear_error(&error);
+            g_free(path);
+            c->event = SPICE_CHANNEL_ERROR_CONNECT;
+            goto cleanup;
+        }
+        g_free(path);
+    }
+
    // CHANNEL_DEBUG(channel, "connected in before spice_channel_send_link()");
 
     spice_channel_send_link(channel);
@@ -2770,8 +2785,11 @@ connected:
 
 cleanup:
     CHANNEL_DEBUG(channel, "Coroutine exit %s", c->name);
+    spice_channel_update_stack_stats(channel);
 
     spice_channel_reset(channel, FALSE);
+    /* the pending batched signals are still emitted */
+    g_coroutine_signal_batch_end(&c->coroutine);
 
     if (c->state == SPICE_CHANNEL_STATE_RECONNECTING ||
         c->state == SPICE_CHANNEL_STATE_SWITCHING) {
@@ -2779,7 +2797,7 @@ cleanup:
         channel_connect(channel, c->tls);
         g_object_unref(channel);
     } else
-        g_idle_add(spice_channel_delayed_unref, data);
+        spice_idle_add(c->coroutine.context, spice_channel_delayed_unref, data);
 
     /* Co-routine exits now - the SpiceChannel object may no longer exist,
        so don't do anything else now unless you like SEGVs */
@@ -2799,7 +2817,7 @@ static gboolean connect_delayed(gpointer data)
 
     co = &c->coroutine.coroutine;
 
-    co->stack_size = 16 << 20; /* 16Mb */
+    co->stack_size = spice_channel_stack_size(channel);
     co->entry = spice_channel_coroutine;
     co->release = NULL;
 
@@ -2839,13 +2857,13 @@ static gboolean channel_connect(SpiceChannel *channel, gboolean tls)
         }
     }
 
-    c->xmit_queue_blocked = FALSE;
+    spice_xmit_queue_open(&c->xmit_queue);
 
     g_return_val_if_fail(c->sock == NULL, FALSE);
     g_object_ref(G_OBJECT(channel)); /* Unref'd when co-routine exits */
 
     /* we connect in idle, to let previous coroutine exit, if present */
-    c->connect_delayed_id = g_idle_add(connect_delayed, channel);
+    c->connect_delayed_id = spice_idle_add(c->coroutine.context, connect_delayed, channel);
 
     return true;
 }
@@ -2922,21 +2940,26 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
 
     CHANNEL_DEBUG(channel, "channel reset");
     if (c->connect_delayed_id) {
-        g_source_remove(c->connect_delayed_id);
+        spice_source_remove(c->coroutine.context, c->connect_delayed_id);
         c->connect_delayed_id = 0;
     }
 
 #if HAVE_SASL
-    if (c->sasl_conn) {
-        sasl_dispose(&c->sasl_conn);
-        c->sasl_conn = NULL;
-        c->sasl_decoded_offset = c->sasl_decoded_length = 0;
+    if (c->sasl) {
+        spice_sasl_layer_clear(c->sasl);
+        g_clear_pointer(&c->sasl, g_free);
     }
 #endif
 
     spice_openssl_verify_free(c->sslverify);
     c->sslverify = NULL;
 
+    if (c->websocket) {
+        spice_websocket_clear(c->websocket);
+        g_clear_pointer(&c->websocket, g_free);
+    }
+    c->ws = FALSE;
+
     if (c->ssl) {
         SSL_free(c->ssl);
         c->ssl = NULL;
@@ -2962,16 +2985,14 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
     c->peer_msg = NULL;
     c->peer_pos = 0;
 
-    STATIC_MUTEX_LOCK(c->xmit_queue_lock);
-    c->xmit_queue_blocked = TRUE; /* Disallow queuing new messages */
-    gboolean was_empty = g_queue_is_empty(&c->xmit_queue);
-    g_queue_foreach(&c->xmit_queue, (GFunc)spice_msg_out_unref, NULL);
-    g_queue_clear(&c->xmit_queue);
-    if (c->xmit_queue_wakeup_id) {
-        g_source_remove(c->xmit_queue_wakeup_id);
-        c->xmit_queue_wakeup_id = 0;
+    /* Disallow queuing new messages */
+    SpiceXmitLink *link = spice_xmit_queue_close(&c->xmit_queue);
+    gboolean was_empty = link == NULL;
+    while (link != NULL) {
+        SpiceMsgOut *out = SPICE_CONTAINEROF(link, SpiceMsgOut, link);
+        link = link->next;
+        spice_msg_out_unref(out);
     }
-    STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
     spice_channel_flushed(channel, was_empty);
 
     g_array_set_size(c->remote_common_caps, 0);
@@ -3146,6 +3167,15 @@ SpiceSession* spice_channel_get_session(SpiceChannel *channel)
     return channel->priv->session;
 }
 
+/* The main context the channel runs from, also valid after dispose */
+G_GNUC_INTERNAL
+GMainContext *spice_channel_get_main_context(SpiceChannel *channel)
+{
+    g_return_val_if_fail(SPICE_IS_CHANNEL(channel), NULL);
+
+    return channel->priv->coroutine.context;
+}
+
 G_GNUC_INTERNAL
 enum spice_channel_state spice_channel_get_state(SpiceChannel *channel)
 {
@@ -3183,10 +3213,16 @@ void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap
     SWAP(ssl);
     SWAP(sslverify);
     SWAP(tls);
+    SWAP(ws);
+    SWAP(websocket);
+    /* the websocket reads and writes through its channel */
+    if (c->websocket)
+        c->websocket->io.user_data = channel;
+    if (s->websocket)
+        s->websocket->io.user_data = swap;
     SWAP(use_mini_header);
     if (swap_msgs) {
-        SWAP(xmit_queue);
-        SWAP(xmit_queue_blocked);
+        spice_xmit_queue_swap(&c->xmit_queue, &s->xmit_queue);
         SWAP(in_serial);
         SWAP(out_serial);
     }
@@ -3195,10 +3231,12 @@ void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap
     SWAP(remote_caps);
     SWAP(remote_common_caps);
 #if HAVE_SASL
-    SWAP(sasl_conn);
-    SWAP(sasl_decoded);
-    SWAP(sasl_decoded_length);
-    SWAP(sasl_decoded_offset);
+    SWAP(sasl);
+    /* the security layer reads and writes through its channel */
+    if (c->sasl)
+        c->sasl->io.user_data = channel;
+    if (s->sasl)
+        s->sasl->io.user_data = swap;
 #endif
 }
 
@@ -3281,9 +3319,7 @@ void spice_channel_flush_async(SpiceChannel *self, GCancellable *cancellable,
     simple = g_simple_async_result_new(G_OBJECT(self), callback, user_data,
                                        spice_channel_flush_async);
 
-    STATIC_MUTEX_LOCK(c->xmit_queue_lock);
-    was_empty = g_queue_is_empty(&c->xmit_queue);
-    STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
+    was_empty = spice_xmit_queue_is_empty(&c->xmit_queue);
     if (was_empty) {
         g_simple_async_result_set_op_res_gboolean(simple, TRUE);
         g_simple_async_result_complete_in_idle(simple);
@@ -48,6 +48,7 @@
 #include "channel-webdav.h"
 
 #include "smartcard-manager.h"
+#include "spice-memory-manager.h"
 #include "usb-device-manager.h"
 #include "spice-audio.h"
 #include "spice-file-transfer-task.h"
@@ -0,0 +1,82 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "spice-clipboard-stream.h"
+
+/* @size is the size of the whole message, @has_selection whether it starts
+ * with the selection, see VD_AGENT_CAP_CLIPBOARD_SELECTION */
+G_GNUC_INTERNAL void
+spice_clipboard_stream_init(SpiceClipboardStream *stream, guint32 size,
+                            gboolean has_selection)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->size = size;
+    stream->header_size = sizeof(VDAgentClipboard);
+    if (has_selection)
+        stream->header_size += 4;
+}
+
+/*
+ * Takes the header out of the next piece of the message, in @data and
+ * @size. Returns TRUE when the rest of the piece is clipboard data to pass
+ * on: never before the header is complete, and only once for empty data.
+ */
+G_GNUC_INTERNAL gboolean
+spice_clipboard_stream_feed(SpiceClipboardStream *stream,
+                            const guint8 **data, gsize *size)
+{
+    if (stream->size < stream->header_size)
+        return FALSE;
+
+    if (stream->header_pos < stream->header_size) {
+        gsize n = MIN(stream->header_size - stream->header_pos, *size);
+
+        memcpy(stream->header + stream->header_pos, *data, n);
+        stream->header_pos += n;
+        *data += n;
+        *size -= n;
+        if (stream->header_pos < stream->header_size)
+            return FALSE;
+        /* empty clipboard data is reported once, with the header */
+        if (*size == 0 && stream->size > stream->header_size)
+            return FALSE;
+    } else if (*size == 0) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* only valid once spice_clipboard_stream_feed() returned TRUE */
+G_GNUC_INTERNAL void
+spice_clipboard_stream_get_header(SpiceClipboardStream *stream, guint *selection,
+                                  guint *type, guint *total)
+{
+    VDAgentClipboard *cb = (VDAgentClipboard *)stream->header;
+
+    *selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+    if (stream->header_size > sizeof(VDAgentClipboard)) {
+        *selection = stream->header[0];
+        cb = (VDAgentClipboard *)(stream->header + 4);
+    }
+    *type = cb->type;
+    *total = stream->size - stream->header_size;
+}
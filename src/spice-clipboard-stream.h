@@ -0,0 +1,44 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIPBOARD_STREAM_H__
+#define __SPICE_CLIPBOARD_STREAM_H__
+
+#include <glib.h>
+#include <spice/vd_agent.h>
+
+G_BEGIN_DECLS
+
+/* The header of a VD_AGENT_CLIPBOARD message received piece by piece, which
+ * is put together before its data is passed on */
+typedef struct SpiceClipboardStream {
+    guint8 header[4 + sizeof(VDAgentClipboard)];
+    guint header_size;
+    guint header_pos;
+    guint32 size;
+} SpiceClipboardStream;
+
+void spice_clipboard_stream_init(SpiceClipboardStream *stream, guint32 size,
+                                 gboolean has_selection);
+gboolean spice_clipboard_stream_feed(SpiceClipboardStream *stream,
+                                     const guint8 **data, gsize *size);
+void spice_clipboard_stream_get_header(SpiceClipboardStream *stream, guint *selection,
+                                       guint *type, guint *total);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIPBOARD_STREAM_H__ */
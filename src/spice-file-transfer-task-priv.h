@@ -29,6 +29,8 @@
 
 G_BEGIN_DECLS
 
+#define FILE_XFER_CHUNK_SIZE (VD_AGENT_MAX_DATA_SIZE * 32)
+
 void spice_file_transfer_task_completed(SpiceFileTransferTask *self, GError *error);
 guint32 spice_file_transfer_task_get_id(SpiceFileTransferTask *self);
 SpiceMainChannel *spice_file_transfer_task_get_channel(SpiceFileTransferTask *self);
@@ -48,8 +50,10 @@ void spice_file_transfer_task_read_async(SpiceFileTransferTask *self,
                                          gpointer userdata);
 gssize spice_file_transfer_task_read_finish(SpiceFileTransferTask *self,
                                             GAsyncResult *result,
-                                            char **buffer,
+                                            GBytes **bytes,
                                             GError **error);
+void spice_file_transfer_task_add_sent_bytes(SpiceFileTransferTask *self,
+                                             gsize count);
 gboolean spice_file_transfer_task_is_completed(SpiceFileTransferTask *self);
 
 G_END_DECLS
@@ -53,9 +53,13 @@ struct _SpiceFileTransferTask
     gpointer                       user_data;
     char                           *buffer;
     uint64_t                       read_bytes;
+    uint64_t                       sent_bytes;
     uint64_t                       file_size;
     gint64                         start_time;
     gint64                         last_update;
+    gint64                         speed_time;
+    uint64_t                       speed_bytes;
+    guint64                        transfer_speed;
     GError                         *error;
 };
 
@@ -66,7 +70,8 @@ struct _SpiceFileTransferTaskClass
 
 G_DEFINE_TYPE(SpiceFileTransferTask, spice_file_transfer_task, G_TYPE_OBJECT)
 
-#define FILE_XFER_CHUNK_SIZE (VD_AGENT_MAX_DATA_SIZE * 32)
+/* interval over which the transfer-speed property is averaged */
+#define FILE_XFER_SPEED_INTERVAL (G_TIME_SPAN_SECOND / 2)
 
 enum {
     PROP_TASK_ID = 1,
@@ -76,6 +81,7 @@ enum {
     PROP_TASK_TOTAL_BYTES,
     PROP_TASK_TRANSFERRED_BYTES,
     PROP_TASK_PROGRESS,
+    PROP_TASK_TRANSFER_SPEED,
 };
 
 enum {
@@ -226,6 +232,12 @@ static void spice_file_transfer_task_read_stream_cb(GObject *source_object,
         return;
     }
 
+    /* The buffer now belongs to the GTask: the caller queues it to the agent
+     * by reference while the next chunk is read into a fresh buffer */
+    g_task_set_task_data(task,
+                         g_bytes_new_take(g_steal_pointer(&self->buffer), nbytes),
+                         (GDestroyNotify)g_bytes_unref);
+
     self->read_bytes += nbytes;
 
     if (spice_util_get_debug()) {
@@ -449,6 +461,8 @@ void spice_file_transfer_task_read_async(SpiceFileTransferTask *self,
     }
 
     self->pending = TRUE;
+    if (self->buffer == NULL)
+        self->buffer = g_malloc(FILE_XFER_CHUNK_SIZE);
     g_input_stream_read_async(G_INPUT_STREAM(self->file_stream),
                               self->buffer,
                               FILE_XFER_CHUNK_SIZE,
@@ -458,10 +472,12 @@ void spice_file_transfer_task_read_async(SpiceFileTransferTask *self,
                               task);
 }
 
+/* On success, @bytes holds a new reference to the data that was read, which
+ * stays valid after further reads are issued on @self. */
 G_GNUC_INTERNAL
 gssize spice_file_transfer_task_read_finish(SpiceFileTransferTask *self,
                                             GAsyncResult *result,
-                                            char **buffer,
+                                            GBytes **bytes,
                                             GError **error)
 {
     gssize nbytes;
@@ -470,12 +486,46 @@ gssize spice_file_transfer_task_read_finish(SpiceFileTransferTask *self,
     g_return_val_if_fail(self != NULL, -1);
 
     nbytes = g_task_propagate_int(task, error);
-    if (nbytes >= 0 && buffer != NULL)
-        *buffer = self->buffer;
+    if (nbytes >= 0 && bytes != NULL) {
+        GBytes *data = g_task_get_task_data(task);
+        *bytes = data ? g_bytes_ref(data) : g_bytes_new_static("", 0);
+    }
 
     return nbytes;
 }
 
+/* Called by the channel once @count bytes of this task left the agent
+ * message queue, this is what transfer-speed is computed from. */
+G_GNUC_INTERNAL
+void spice_file_transfer_task_add_sent_bytes(SpiceFileTransferTask *self,
+                                             gsize count)
+{
+    gint64 now, elapsed;
+
+    g_return_if_fail(self != NULL);
+
+    now = g_get_monotonic_time();
+    if (self->speed_time == 0)
+        self->speed_time = now;
+
+    self->sent_bytes += count;
+    self->speed_bytes += count;
+
+    elapsed = now - self->speed_time;
+    if (elapsed < FILE_XFER_SPEED_INTERVAL)
+        return;
+
+    /* exponential moving average, weighting the last interval by half */
+    if (self->transfer_speed == 0)
+        self->transfer_speed = self->speed_bytes * G_TIME_SPAN_SECOND / elapsed;
+    else
+        self->transfer_speed = (self->transfer_speed +
+                                self->speed_bytes * G_TIME_SPAN_SECOND / elapsed) / 2;
+    self->speed_time = now;
+    self->speed_bytes = 0;
+    g_object_notify(G_OBJECT(self), "transfer-speed");
+}
+
 G_GNUC_INTERNAL
 gboolean spice_file_transfer_task_is_completed(SpiceFileTransferTask *self)
 {
@@ -579,6 +629,24 @@ guint64 spice_file_transfer_task_get_transferred_bytes(SpiceFileTransferTask *se
     return self->read_bytes;
 }
 
+/**
+ * spice_file_transfer_task_get_transfer_speed:
+ * @self: a file transfer task
+ *
+ * Gets the current throughput of the file transfer, that is the rate at
+ * which data is handed over to the guest agent, averaged over the last
+ * half second.
+ *
+ * Returns: The transfer speed in bytes per second
+ *
+ * Since: 0.35
+ **/
+guint64 spice_file_transfer_task_get_transfer_speed(SpiceFileTransferTask *self)
+{
+    g_return_val_if_fail(SPICE_IS_FILE_TRANSFER_TASK(self), 0);
+    return self->transfer_speed;
+}
+
 /*******************************************************************************
  * GObject
  ******************************************************************************/
@@ -608,6 +676,9 @@ spice_file_transfer_task_get_property(GObject *object,
         case PROP_TASK_PROGRESS:
             g_value_set_double(value, spice_file_transfer_task_get_progress(self));
             break;
+        case PROP_TASK_TRANSFER_SPEED:
+            g_value_set_uint64(value, spice_file_transfer_task_get_transfer_speed(self));
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
     }
@@ -797,6 +868,21 @@ spice_file_transfer_task_class_init(SpiceFileTransferTaskClass *klass)
                                                         G_PARAM_READABLE |
                                                         G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceFileTransferTask:transfer-speed:
+     *
+     * The current throughput of the file transfer, in bytes per second.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property(object_class, PROP_TASK_TRANSFER_SPEED,
+                                    g_param_spec_uint64("transfer-speed",
+                                                        "Transfer speed",
+                                                        "The throughput of the transfer in bytes/s",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceFileTransferTask::finished:
      * @task: the file transfer task that emitted the signal
@@ -819,5 +905,4 @@ spice_file_transfer_task_class_init(SpiceFileTransferTaskClass *klass)
 static void
 spice_file_transfer_task_init(SpiceFileTransferTask *self)
 {
-    self->buffer = g_malloc0(FILE_XFER_CHUNK_SIZE);
 }
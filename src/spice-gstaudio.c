@@ -26,6 +26,8 @@
 #include "spice-common.h"
 #include "spice-session.h"
 #include "spice-util.h"
+#include "spice-util-priv.h"
+#include "spice-audio-priv.h"
 
 #define SPICE_GSTAUDIO_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_GSTAUDIO, SpiceGstaudioPrivate))
@@ -256,7 +258,7 @@ static void playback_stop(SpiceGstaudio *gstaudio)
     if (p->playback.pipe)
         gst_element_set_state(p->playback.pipe, GST_STATE_READY);
     if (p->mmtime_id != 0) {
-        g_source_remove(p->mmtime_id);
+        spice_source_remove(SPICE_AUDIO(gstaudio)->priv->main_context, p->mmtime_id);
         p->mmtime_id = 0;
     }
 }
@@ -333,7 +335,8 @@ cleanup:
 
     if (!p->playback.fake && p->mmtime_id == 0) {
         update_mmtime_timeout_cb(gstaudio);
-        p->mmtime_id = g_timeout_add_seconds(1, update_mmtime_timeout_cb, gstaudio);
+        p->mmtime_id = spice_timeout_add_seconds(SPICE_AUDIO(gstaudio)->priv->main_context, 1,
+                                                  update_mmtime_timeout_cb, gstaudio);
     }
 }
 
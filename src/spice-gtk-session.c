@@ -46,6 +46,9 @@
 #include "spice-channel-priv.h"
 
 #define CLIPBOARD_LAST (VD_AGENT_CLIPBOARD_SELECTION_SECONDARY + 1)
+/* gtk+ only takes the clipboard data whole, so the data from the guest
+ * which is put together is bounded even when max-clipboard sets no limit */
+#define CLIPBOARD_GUEST_MAX_SIZE (512 * 1024 * 1024)
 
 struct _SpiceGtkSessionPrivate {
     SpiceSession            *session;
@@ -743,39 +746,91 @@ typedef struct
     GtkSelectionData *selection_data;
     guint info;
     guint selection;
+    GByteArray *data;
+    gboolean discarded;
 } RunInfo;
 
+static gboolean clipboard_guest_size_fits(SpiceGtkSession *self, guint total)
+{
+    int max_clipboard;
+
+    g_object_get(self->priv->main, "max-clipboard", &max_clipboard, NULL);
+    if (max_clipboard == -1 || max_clipboard > CLIPBOARD_GUEST_MAX_SIZE)
+        max_clipboard = CLIPBOARD_GUEST_MAX_SIZE;
+    if (total > (guint)max_clipboard) {
+        g_warning("discarded clipboard from the guest of size %u (max: %d)",
+                  total, max_clipboard);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Drops the CR of CRLF line endings, in place */
+static gsize clipboard_dos2unix_inplace(guint8 *data, gsize size)
+{
+    gsize i, j;
+
+    for (i = 0, j = 0; i < size; i++) {
+        if (data[i] == '\r' && i + 1 < size && data[i + 1] == '\n')
+            continue;
+        data[j++] = data[i];
+    }
+
+    return j;
+}
+
 static void clipboard_got_from_guest(SpiceMainChannel *main, guint selection,
-                                     guint type, const guchar *data, guint size,
+                                     guint type, guint total,
+                                     const guchar *data, guint size,
                                      gpointer user_data)
 {
     RunInfo *ri = user_data;
     SpiceGtkSessionPrivate *s = ri->self->priv;
-    gchar *conv = NULL;
+    guint8 *buf;
+    gsize len;
 
     g_return_if_fail(selection == ri->selection);
 
+    if (ri->discarded)
+        return;
+
+    /* the data is received piece by piece, gtk+ only takes it whole */
+    if (ri->data == NULL) {
+        if (!clipboard_guest_size_fits(ri->self, total)) {
+            /* the selection data is left unset, the request fails */
+            ri->discarded = TRUE;
+            if (g_main_loop_is_running(ri->loop))
+                g_main_loop_quit(ri->loop);
+            return;
+        }
+        ri->data = g_byte_array_sized_new(total);
+    }
+    g_byte_array_append(ri->data, data, size);
+    if (ri->data->len < total)
+        return;
+
     SPICE_DEBUG("clipboard got data");
 
+    buf = ri->data->data;
+    len = ri->data->len;
     if (atom2agent[ri->info].vdagent == VD_AGENT_CLIPBOARD_UTF8_TEXT) {
         /* on windows, gtk+ would already convert to LF endings, but
            not on unix */
         if (spice_main_channel_agent_test_capability(s->main, VD_AGENT_CAP_GUEST_LINEEND_CRLF)) {
-            conv = spice_dos2unix((gchar*)data, size);
-            size = strlen(conv);
+            len = clipboard_dos2unix_inplace(buf, len);
         }
 
-        gtk_selection_data_set_text(ri->selection_data, conv ?: (gchar*)data, size);
+        gtk_selection_data_set_text(ri->selection_data, (gchar*)buf, len);
     } else {
         gtk_selection_data_set(ri->selection_data,
             gdk_atom_intern_static_string(atom2agent[ri->info].xatom),
-            8, data, size);
+            8, buf, len);
     }
+    g_clear_pointer(&ri->data, g_byte_array_unref);
 
     if (g_main_loop_is_running (ri->loop))
         g_main_loop_quit (ri->loop);
-
-    g_free(conv);
 }
 
 static void clipboard_agent_connected(RunInfo *ri)
@@ -813,7 +868,7 @@ static void clipboard_get(GtkClipboard *clipboard,
     ri.selection = selection;
     ri.self = self;
 
-    clipboard_handler = g_signal_connect(s->main, "main-clipboard-selection",
+    clipboard_handler = g_signal_connect(s->main, "main-clipboard-selection-data",
                                          G_CALLBACK(clipboard_got_from_guest),
                                          &ri);
     agent_handler = g_signal_connect_swapped(s->main, "notify::agent-connected",
@@ -842,6 +897,7 @@ static void clipboard_get(GtkClipboard *clipboard,
 
 cleanup:
     g_clear_pointer(&ri.loop, g_main_loop_unref);
+    g_clear_pointer(&ri.data, g_byte_array_unref);
     g_signal_handler_disconnect(s->main, clipboard_handler);
     g_signal_handler_disconnect(s->main, agent_handler);
 }
@@ -967,7 +1023,7 @@ static void clipboard_received_text_cb(GtkClipboard *clipboard,
     char *conv = NULL;
     int len = 0;
     int selection;
-    const guchar *data = NULL;
+    GBytes *data = NULL;
 
     if (self == NULL)
         return;
@@ -995,12 +1051,18 @@ static void clipboard_received_text_cb(GtkClipboard *clipboard,
         goto notify_agent;
     }
 
-    data = (const guchar *) (conv != NULL ? conv : text);
+    /* the converted text is handed over to the channel without a copy */
+    if (conv != NULL)
+        data = g_bytes_new_take(g_steal_pointer(&conv), len);
+    else
+        data = g_bytes_new(text, len);
 notify_agent:
-    spice_main_channel_clipboard_selection_notify(self->priv->main, selection,
-                                                  VD_AGENT_CLIPBOARD_UTF8_TEXT,
-                                                  data,
-                                                  (data != NULL) ? len : 0);
+    if (data == NULL)
+        data = g_bytes_new_static("", 0);
+    spice_main_channel_clipboard_selection_notify_bytes(self->priv->main, selection,
+                                                        VD_AGENT_CLIPBOARD_UTF8_TEXT,
+                                                        data);
+    g_bytes_unref(data);
     g_free(conv);
 }
 
@@ -1047,13 +1109,18 @@ static void clipboard_received_cb(GtkClipboard *clipboard,
     }
 
     const guchar *data = gtk_selection_data_get_data(selection_data);
+    GBytes *bytes;
 
     /* text should be handled through clipboard_received_text_cb(), not
      * clipboard_received_cb().
      */
     g_warn_if_fail(type != VD_AGENT_CLIPBOARD_UTF8_TEXT);
 
-    spice_main_channel_clipboard_selection_notify(s->main, selection, type, data, len);
+    /* the selection data is only valid during this callback, this is the
+     * only copy made, the channel then sends it as the agent accepts it */
+    bytes = g_bytes_new(data, len);
+    spice_main_channel_clipboard_selection_notify_bytes(s->main, selection, type, bytes);
+    g_bytes_unref(bytes);
 }
 
 static gboolean clipboard_request(SpiceMainChannel *main, guint selection,
@@ -0,0 +1,46 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_MEMORY_MANAGER_PRIV_H__
+#define __SPICE_MEMORY_MANAGER_PRIV_H__
+
+#include <pixman.h>
+
+#include "spice-memory-manager.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    SPICE_MEMORY_IMAGES,
+    SPICE_MEMORY_GLZ_WINDOWS,
+    SPICE_MEMORY_SURFACES,
+    SPICE_MEMORY_LAST,
+} SpiceMemoryKind;
+
+/* any thread */
+void spice_memory_account(SpiceMemoryKind kind, gssize bytes);
+pixman_image_t *spice_memory_image_ref(pixman_image_t *image);
+void spice_memory_image_unref(pixman_image_t *image);
+
+void spice_memory_session_added(void);
+void spice_memory_session_removed(void);
+gsize spice_memory_reserve(gsize wanted, gsize min);
+void spice_memory_release(gsize reserved);
+
+G_END_DECLS
+
+#endif /* __SPICE_MEMORY_MANAGER_PRIV_H__ */
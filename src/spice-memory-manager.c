@@ -0,0 +1,422 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <glib-object.h>
+
+#include "spice-client.h"
+#include "spice-memory-manager-priv.h"
+
+/**
+ * SECTION:spice-memory-manager
+ * @short_description: memory budget of the sessions
+ * @title: Spice Memory Manager
+ * @section_id:
+ * @see_also: #SpiceSession
+ * @stability: Stable
+ * @include: spice-client.h
+ *
+ * #SpiceMemoryManager accounts for the memory held by the display
+ * surfaces, the images caches and the GLZ windows of all the sessions of
+ * the process, and shares #SpiceMemoryManager:limit between them.
+ *
+ * The images cache and the GLZ window of a session are filled by the
+ * server, and it evicts their content to keep them within the sizes the
+ * client told it when the display channels connected: they can't shrink
+ * until the session connects again. So when there is a limit, the caches
+ * of each session are sized each time it connects, to an equal share of
+ * what the surfaces leave of the limit. The limit is shared between the
+ * existing sessions, or between #SpiceMemoryManager:expected-sessions if
+ * there are to be more: an application creating its sessions one after
+ * another should set it, so that the first ones don't take the share of
+ * the next ones until they connect again.
+ *
+ * The explicit #SpiceSession:cache-size and
+ * #SpiceSession:glz-window-size are left as they are, but count too.
+ * Along with the minimum size of the GLZ windows and the surfaces, which
+ * are not limited, they can take the usage over the limit, which is
+ * then warned about.
+ *
+ * The limit can also be set, in megabytes, with the SPICE_MEMORY_LIMIT
+ * environment variable.
+ */
+
+/* ------------------------------------------------------------------ */
+/* gobject glue                                                       */
+
+G_DEFINE_TYPE(SpiceMemoryManager, spice_memory_manager, G_TYPE_OBJECT)
+
+/* Properties */
+enum {
+    PROP_0,
+    PROP_LIMIT,
+    PROP_SURFACES,
+    PROP_IMAGES,
+    PROP_GLZ_WINDOWS,
+    PROP_SESSIONS,
+    PROP_EXPECTED_SESSIONS,
+};
+
+/* The accounting is process-wide and done from the session threads,
+ * whether the manager was created or not */
+static gsize memory_usage[SPICE_MEMORY_LAST]; /* atomic */
+
+static GMutex memory_lock;
+static guint64 memory_limit;
+static guint memory_sessions;
+static guint memory_expected_sessions;
+static guint memory_sized; /* sessions holding a reservation */
+static guint64 memory_reserved;
+static gboolean memory_over_limit;
+
+static guint64 memory_get_limit(void)
+{
+    static gsize initialized = 0;
+    guint64 limit;
+
+    if (g_once_init_enter(&initialized)) {
+        const gchar *env = g_getenv("SPICE_MEMORY_LIMIT");
+
+        if (env != NULL) {
+            g_mutex_lock(&memory_lock);
+            memory_limit = g_ascii_strtoull(env, NULL, 10) * 1024 * 1024;
+            g_mutex_unlock(&memory_lock);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+
+    g_mutex_lock(&memory_lock);
+    limit = memory_limit;
+    g_mutex_unlock(&memory_lock);
+
+    return limit;
+}
+
+/* called with memory_lock held */
+static void memory_check_limit(void)
+{
+    guint64 surfaces = (gsize)g_atomic_pointer_get(&memory_usage[SPICE_MEMORY_SURFACES]);
+    gboolean over = memory_limit != 0 && surfaces + memory_reserved > memory_limit;
+
+    if (over && !memory_over_limit)
+        g_warning("memory limit exceeded: %" G_GUINT64_FORMAT "k of surfaces and %"
+                  G_GUINT64_FORMAT "k of caches for %u sessions, limit %" G_GUINT64_FORMAT "k",
+                  surfaces >> 10, memory_reserved >> 10, memory_sized, memory_limit >> 10);
+    memory_over_limit = over;
+}
+
+static void spice_memory_manager_init(SpiceMemoryManager *manager)
+{
+}
+
+static void spice_memory_manager_get_property(GObject    *gobject,
+                                              guint       prop_id,
+                                              GValue     *value,
+                                              GParamSpec *pspec)
+{
+    switch (prop_id) {
+    case PROP_LIMIT:
+        g_value_set_uint64(value, memory_get_limit());
+        break;
+    case PROP_SURFACES:
+        g_value_set_uint64(value, (gsize)g_atomic_pointer_get(&memory_usage[SPICE_MEMORY_SURFACES]));
+        break;
+    case PROP_IMAGES:
+        g_value_set_uint64(value, (gsize)g_atomic_pointer_get(&memory_usage[SPICE_MEMORY_IMAGES]));
+        break;
+    case PROP_GLZ_WINDOWS:
+        g_value_set_uint64(value, (gsize)g_atomic_pointer_get(&memory_usage[SPICE_MEMORY_GLZ_WINDOWS]));
+        break;
+    case PROP_SESSIONS:
+        g_mutex_lock(&memory_lock);
+        g_value_set_uint(value, memory_sessions);
+        g_mutex_unlock(&memory_lock);
+        break;
+    case PROP_EXPECTED_SESSIONS:
+        g_mutex_lock(&memory_lock);
+        g_value_set_uint(value, memory_expected_sessions);
+        g_mutex_unlock(&memory_lock);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
+}
+
+static void spice_memory_manager_set_property(GObject      *gobject,
+                                              guint         prop_id,
+                                              const GValue *value,
+                                              GParamSpec   *pspec)
+{
+    switch (prop_id) {
+    case PROP_LIMIT:
+        memory_get_limit();
+        g_mutex_lock(&memory_lock);
+        memory_limit = g_value_get_uint64(value);
+        memory_check_limit();
+        g_mutex_unlock(&memory_lock);
+        break;
+    case PROP_EXPECTED_SESSIONS:
+        g_mutex_lock(&memory_lock);
+        memory_expected_sessions = g_value_get_uint(value);
+        g_mutex_unlock(&memory_lock);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
+}
+
+static void spice_memory_manager_class_init(SpiceMemoryManagerClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->get_property = spice_memory_manager_get_property;
+    gobject_class->set_property = spice_memory_manager_set_property;
+
+    /**
+     * SpiceMemoryManager:limit:
+     *
+     * How many bytes the surfaces, images caches and GLZ windows of all
+     * the sessions should use at most, or 0 for no limit. It applies to
+     * the sessions connecting after it is set, and to the others when they
+     * connect again.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_LIMIT,
+         g_param_spec_uint64("limit",
+                             "Limit",
+                             "Memory limit in bytes",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READWRITE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMemoryManager:surfaces:
+     *
+     * How many bytes the display surfaces of all the sessions use. Like
+     * the other usage properties, it is not notified.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_SURFACES,
+         g_param_spec_uint64("surfaces",
+                             "Surfaces",
+                             "Memory used by the surfaces",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMemoryManager:images:
+     *
+     * How many bytes the images caches of all the sessions use.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_IMAGES,
+         g_param_spec_uint64("images",
+                             "Images",
+                             "Memory used by the images caches",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMemoryManager:glz-windows:
+     *
+     * How many bytes the GLZ windows of all the sessions use.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_GLZ_WINDOWS,
+         g_param_spec_uint64("glz-windows",
+                             "GLZ windows",
+                             "Memory used by the GLZ windows",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMemoryManager:sessions:
+     *
+     * How many sessions share the limit.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_SESSIONS,
+         g_param_spec_uint("sessions",
+                           "Sessions",
+                           "Number of sessions",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMemoryManager:expected-sessions:
+     *
+     * How many sessions the limit is to be shared between, when more
+     * sessions are going to be created than #SpiceMemoryManager:sessions,
+     * or 0 to share it between the existing sessions only. Like the limit,
+     * it applies to the sessions connecting after it is set.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_EXPECTED_SESSIONS,
+         g_param_spec_uint("expected-sessions",
+                           "Expected sessions",
+                           "Number of sessions to share the limit between",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS));
+}
+
+/* ------------------------------------------------------------------ */
+/* private api                                                        */
+
+static SpiceMemoryManager *spice_memory_manager_new(void)
+{
+    return g_object_new(SPICE_TYPE_MEMORY_MANAGER, NULL);
+}
+
+G_GNUC_INTERNAL
+void spice_memory_account(SpiceMemoryKind kind, gssize bytes)
+{
+    g_return_if_fail(kind < SPICE_MEMORY_LAST);
+
+    g_atomic_pointer_add(&memory_usage[kind], bytes);
+
+    if (kind == SPICE_MEMORY_SURFACES && memory_get_limit() != 0) {
+        g_mutex_lock(&memory_lock);
+        memory_check_limit();
+        g_mutex_unlock(&memory_lock);
+    }
+}
+
+static gssize memory_image_size(pixman_image_t *image)
+{
+    return ABS(pixman_image_get_stride(image)) * pixman_image_get_height(image);
+}
+
+/* adds a reference to @image, accounted as cached */
+G_GNUC_INTERNAL
+pixman_image_t *spice_memory_image_ref(pixman_image_t *image)
+{
+    spice_memory_account(SPICE_MEMORY_IMAGES, memory_image_size(image));
+    return pixman_image_ref(image);
+}
+
+/* drops a reference from spice_memory_image_ref() */
+G_GNUC_INTERNAL
+void spice_memory_image_unref(pixman_image_t *image)
+{
+    spice_memory_account(SPICE_MEMORY_IMAGES, -memory_image_size(image));
+    pixman_image_unref(image);
+}
+
+G_GNUC_INTERNAL
+void spice_memory_session_added(void)
+{
+    g_mutex_lock(&memory_lock);
+    memory_sessions++;
+    g_mutex_unlock(&memory_lock);
+}
+
+G_GNUC_INTERNAL
+void spice_memory_session_removed(void)
+{
+    g_mutex_lock(&memory_lock);
+    g_warn_if_fail(memory_sessions > 0);
+    memory_sessions--;
+    g_mutex_unlock(&memory_lock);
+}
+
+/* Reserves up to @wanted bytes of caches for a session, and at least @min:
+ * its equal share of what the surfaces leave of the limit, as far as the
+ * other sessions left it available. Returns the reserved size, to be
+ * released with spice_memory_release(). */
+G_GNUC_INTERNAL
+gsize spice_memory_reserve(gsize wanted, gsize min)
+{
+    guint64 limit = memory_get_limit();
+    guint64 surfaces = (gsize)g_atomic_pointer_get(&memory_usage[SPICE_MEMORY_SURFACES]);
+    guint64 budget = wanted;
+
+    g_return_val_if_fail(wanted > 0 && min <= wanted, 0);
+
+    g_mutex_lock(&memory_lock);
+    if (limit != 0) {
+        guint64 available = limit > surfaces + memory_reserved ?
+                            limit - surfaces - memory_reserved : 0;
+        guint sharing = MAX(MAX(memory_sessions, memory_expected_sessions), 1);
+        guint64 share = limit > surfaces ? (limit - surfaces) / sharing : 0;
+
+        budget = CLAMP(MIN(share, available), min, wanted);
+    }
+    memory_reserved += budget;
+    memory_sized++;
+    memory_check_limit();
+    g_mutex_unlock(&memory_lock);
+
+    return budget;
+}
+
+/* releases a reservation from spice_memory_reserve(), if any */
+G_GNUC_INTERNAL
+void spice_memory_release(gsize reserved)
+{
+    if (reserved == 0)
+        return;
+
+    g_mutex_lock(&memory_lock);
+    g_warn_if_fail(memory_reserved >= reserved && memory_sized > 0);
+    memory_reserved -= reserved;
+    memory_sized--;
+    memory_check_limit();
+    g_mutex_unlock(&memory_lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* public api                                                         */
+
+/**
+ * spice_memory_manager_get:
+ *
+ * #SpiceMemoryManager is a singleton, use this function to get a pointer
+ * to it. A new #SpiceMemoryManager instance will be created the first
+ * time this function is called.
+ *
+ * Returns: (transfer none): a weak reference to the #SpiceMemoryManager
+ *
+ * Since: 0.35
+ */
+SpiceMemoryManager *spice_memory_manager_get(void)
+{
+    static GOnce manager_singleton_once = G_ONCE_INIT;
+
+    return g_once(&manager_singleton_once,
+                  (GThreadFunc)spice_memory_manager_new,
+                  NULL);
+}
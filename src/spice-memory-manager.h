@@ -0,0 +1,79 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_MEMORY_MANAGER_H__
+#define __SPICE_MEMORY_MANAGER_H__
+
+#if !defined(__SPICE_CLIENT_H_INSIDE__) && !defined(SPICE_COMPILATION)
+#warning "Only <spice-client.h> can be included directly"
+#endif
+
+#include "spice-types.h"
+#include "spice-util.h"
+
+G_BEGIN_DECLS
+
+#define SPICE_TYPE_MEMORY_MANAGER            (spice_memory_manager_get_type ())
+#define SPICE_MEMORY_MANAGER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), SPICE_TYPE_MEMORY_MANAGER, SpiceMemoryManager))
+#define SPICE_MEMORY_MANAGER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), SPICE_TYPE_MEMORY_MANAGER, SpiceMemoryManagerClass))
+#define SPICE_IS_MEMORY_MANAGER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), SPICE_TYPE_MEMORY_MANAGER))
+#define SPICE_IS_MEMORY_MANAGER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), SPICE_TYPE_MEMORY_MANAGER))
+#define SPICE_MEMORY_MANAGER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), SPICE_TYPE_MEMORY_MANAGER, SpiceMemoryManagerClass))
+
+typedef struct _SpiceMemoryManager SpiceMemoryManager;
+typedef struct _SpiceMemoryManagerClass SpiceMemoryManagerClass;
+typedef struct _SpiceMemoryManagerPrivate SpiceMemoryManagerPrivate;
+
+/**
+ * SpiceMemoryManager:
+ *
+ * The #SpiceMemoryManager struct is opaque and should not be accessed directly.
+ */
+struct _SpiceMemoryManager
+{
+    GObject parent;
+
+    /*< private >*/
+    SpiceMemoryManagerPrivate *priv;
+    /* Do not add fields to this struct */
+};
+
+/**
+ * SpiceMemoryManagerClass:
+ * @parent_class: Parent class.
+ *
+ * Class structure for #SpiceMemoryManager.
+ */
+struct _SpiceMemoryManagerClass
+{
+    GObjectClass parent_class;
+
+    /*< private >*/
+    /*
+     * If adding fields to this struct, remove corresponding
+     * amount of padding to avoid changing overall struct size
+     */
+    gchar _spice_reserved[SPICE_RESERVED_PADDING];
+};
+
+GType spice_memory_manager_get_type(void);
+
+SpiceMemoryManager *spice_memory_manager_get(void);
+
+G_END_DECLS
+
+#endif /* __SPICE_MEMORY_MANAGER_H__ */
@@ -0,0 +1,165 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "spice-net-estimator.h"
+
+/* shorter transfers are mostly the time to wake up the reader */
+#define NET_MIN_TRANSFER_DURATION 1000
+/* a larger delay change is a clock reset, not jitter */
+#define NET_MAX_DELAY_CHANGE (10 * G_USEC_PER_SEC)
+/* an estimate is reported once it changed by more than 1/8, at most once
+ * per interval */
+#define NET_REPORT_INTERVAL G_USEC_PER_SEC
+#define NET_REPORT_CHANGE 8
+
+#define NET_N_ESTIMATES 3
+
+typedef struct {
+    gboolean valid;
+    gint64 delay;
+} NetClock;
+
+typedef struct {
+    guint reported;
+    gint64 report_time;
+} NetReport;
+
+struct SpiceNetEstimator {
+    gdouble bandwidth;      /* bytes per second */
+    gdouble rtt;
+    gdouble jitter;
+    NetClock clocks[SPICE_NET_CLOCK_LAST];
+    NetReport reports[NET_N_ESTIMATES];
+};
+
+/* the same smoothing as the TCP round trip time, RFC 6298 */
+static void net_smooth(gdouble *estimate, gdouble sample, gdouble gain)
+{
+    if (*estimate == 0) {
+        *estimate = sample;
+    } else {
+        *estimate += (sample - *estimate) * gain;
+    }
+}
+
+G_GNUC_INTERNAL
+SpiceNetEstimator *spice_net_estimator_new(void)
+{
+    return g_new0(SpiceNetEstimator, 1);
+}
+
+G_GNUC_INTERNAL
+void spice_net_estimator_free(SpiceNetEstimator *estimator)
+{
+    g_free(estimator);
+}
+
+/* @bytes were received back to back in @duration, while waiting for the
+ * network. */
+G_GNUC_INTERNAL
+void spice_net_estimator_add_transfer(SpiceNetEstimator *estimator,
+                                      gsize bytes, gint64 duration)
+{
+    if (bytes < SPICE_NET_MIN_TRANSFER || duration < NET_MIN_TRANSFER_DURATION)
+        return;
+
+    net_smooth(&estimator->bandwidth, bytes * (gdouble)G_USEC_PER_SEC / duration, 1 / 8.);
+}
+
+G_GNUC_INTERNAL
+void spice_net_estimator_add_rtt(SpiceNetEstimator *estimator, gint64 rtt)
+{
+    if (rtt <= 0)
+        return;
+
+    net_smooth(&estimator->rtt, rtt, 1 / 8.);
+}
+
+/* @delay is the arrival time of a message minus the time @clock stamped
+ * it with, the jitter is how much it varies, as in RFC 3550 */
+G_GNUC_INTERNAL
+void spice_net_estimator_add_delay(SpiceNetEstimator *estimator,
+                                   SpiceNetClock clock, gint64 delay)
+{
+    NetClock *c;
+    gint64 change;
+
+    g_return_if_fail(clock < SPICE_NET_CLOCK_LAST);
+
+    c = &estimator->clocks[clock];
+    change = ABS(delay - c->delay);
+    if (c->valid && change < NET_MAX_DELAY_CHANGE) {
+        estimator->jitter += (change - estimator->jitter) / 16;
+    }
+    c->valid = TRUE;
+    c->delay = delay;
+}
+
+G_GNUC_INTERNAL
+guint spice_net_estimator_get_bandwidth(SpiceNetEstimator *estimator)
+{
+    return MIN(estimator->bandwidth * 8 / 1000, G_MAXUINT);
+}
+
+G_GNUC_INTERNAL
+guint spice_net_estimator_get_rtt(SpiceNetEstimator *estimator)
+{
+    return MIN(estimator->rtt, G_MAXUINT);
+}
+
+G_GNUC_INTERNAL
+guint spice_net_estimator_get_jitter(SpiceNetEstimator *estimator)
+{
+    return MIN(estimator->jitter, G_MAXUINT);
+}
+
+/* Returns the estimates that changed noticeably since they were last
+ * returned, so that they are not reported on every sample. */
+G_GNUC_INTERNAL
+SpiceNetEstimate spice_net_estimator_update(SpiceNetEstimator *estimator,
+                                            gint64 now)
+{
+    guint current[NET_N_ESTIMATES] = {
+        spice_net_estimator_get_bandwidth(estimator),
+        spice_net_estimator_get_rtt(estimator),
+        spice_net_estimator_get_jitter(estimator),
+    };
+    SpiceNetEstimate changed = 0;
+    guint i;
+
+    for (i = 0; i < NET_N_ESTIMATES; i++) {
+        NetReport *report = &estimator->reports[i];
+        guint diff = current[i] > report->reported ?
+            current[i] - report->reported : report->reported - current[i];
+
+        if (diff == 0)
+            continue;
+        /* the first estimate is reported right away */
+        if (report->reported != 0 &&
+            (now - report->report_time < NET_REPORT_INTERVAL ||
+             diff <= report->reported / NET_REPORT_CHANGE))
+            continue;
+
+        report->reported = current[i];
+        report->report_time = now;
+        changed |= 1 << i;
+    }
+
+    return changed;
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_NET_ESTIMATOR_H__
+#define __SPICE_NET_ESTIMATOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the transfers smaller than this are not bandwidth samples */
+#define SPICE_NET_MIN_TRANSFER (16 * 1024)
+
+/* The server clocks the delay samples are measured against. The delays of
+ * a clock are only compared with each other, so its offset from the local
+ * clock doesn't matter. */
+typedef enum {
+    SPICE_NET_CLOCK_PING,       /* server monotonic time of the pings */
+    SPICE_NET_CLOCK_MM_TIME,    /* multimedia time of the stream frames */
+    SPICE_NET_CLOCK_LAST,
+} SpiceNetClock;
+
+/* the estimates returned by spice_net_estimator_update() */
+typedef enum {
+    SPICE_NET_BANDWIDTH = 1 << 0,
+    SPICE_NET_RTT = 1 << 1,
+    SPICE_NET_JITTER = 1 << 2,
+} SpiceNetEstimate;
+
+/* Running estimates of the bandwidth, round trip time and jitter of a
+ * session, smoothed over their last samples. The times are in
+ * microseconds, the bandwidth in kilobits per second, 0 until known. */
+typedef struct SpiceNetEstimator SpiceNetEstimator;
+
+SpiceNetEstimator *spice_net_estimator_new(void);
+void spice_net_estimator_free(SpiceNetEstimator *estimator);
+
+void spice_net_estimator_add_transfer(SpiceNetEstimator *estimator,
+                                      gsize bytes, gint64 duration);
+void spice_net_estimator_add_rtt(SpiceNetEstimator *estimator, gint64 rtt);
+void spice_net_estimator_add_delay(SpiceNetEstimator *estimator,
+                                   SpiceNetClock clock, gint64 delay);
+
+guint spice_net_estimator_get_bandwidth(SpiceNetEstimator *estimator);
+guint spice_net_estimator_get_rtt(SpiceNetEstimator *estimator);
+guint spice_net_estimator_get_jitter(SpiceNetEstimator *estimator);
+
+SpiceNetEstimate spice_net_estimator_update(SpiceNetEstimator *estimator,
+                                            gint64 now);
+
+G_END_DECLS
+
+#endif /* __SPICE_NET_ESTIMATOR_H__ */
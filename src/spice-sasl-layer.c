@@ -0,0 +1,180 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#if HAVE_SASL
+#include <errno.h>
+#include <string.h>
+
+#include "spice-sasl-layer.h"
+
+/*
+ * The connection is handed over once the authentication is complete, with
+ * the security properties it negotiated: from then on, all the data goes
+ * through sasl_encode() and sasl_decode().
+ *
+ * A single read asks the transport for as much as a whole packet of the
+ * server, the data that sasl_decode() returns is then served from its
+ * buffer until it is used up.
+ *
+ * While batching, the written data is put together and encoded in packets
+ * of up to SPICE_SASL_BATCH_SIZE bytes, rather than in as many packets and
+ * writes as there are messages.
+ */
+
+G_GNUC_INTERNAL void
+spice_sasl_layer_init(SpiceSaslLayer *layer, sasl_conn_t *conn,
+                      const SpiceSaslLayerIO *io)
+{
+    memset(layer, 0, sizeof(*layer));
+    layer->io = *io;
+    layer->conn = conn;
+}
+
+/* disposes the connection it was given */
+G_GNUC_INTERNAL void
+spice_sasl_layer_clear(SpiceSaslLayer *layer)
+{
+    if (layer->conn)
+        sasl_dispose(&layer->conn);
+    layer->conn = NULL;
+    layer->decoded = NULL;
+    layer->decoded_length = layer->decoded_offset = 0;
+    g_clear_pointer(&layer->encoded, g_free);
+    g_clear_pointer(&layer->pending, g_byte_array_unref);
+    layer->batching = FALSE;
+}
+
+/*
+ * Read at least 1 more byte of data out of the SASL decrypted
+ * data buffer, returns 0 on EOF or a negative errno on error
+ */
+G_GNUC_INTERNAL gssize
+spice_sasl_layer_read(SpiceSaslLayer *layer, void *data, gsize len)
+{
+    /* a packet may arrive in several reads, and only decode once whole */
+    while (layer->decoded_length == 0) {
+        gssize ret;
+        int err;
+
+        g_warn_if_fail(layer->decoded_offset == 0);
+
+        if (layer->encoded == NULL)
+            layer->encoded = g_malloc(SPICE_SASL_MAX_BUFSIZE);
+        ret = layer->io.read(layer->io.user_data, layer->encoded, SPICE_SASL_MAX_BUFSIZE);
+        if (ret <= 0)
+            return ret;
+
+        err = sasl_decode(layer->conn, layer->encoded, ret,
+                          &layer->decoded, &layer->decoded_length);
+        if (err != SASL_OK) {
+            g_warning("Failed to decode SASL data %s",
+                      sasl_errstring(err, NULL, NULL));
+            layer->decoded = NULL;
+            layer->decoded_length = 0;
+            return -EINVAL;
+        }
+        layer->decoded_offset = 0;
+    }
+
+    len = MIN(layer->decoded_length - layer->decoded_offset, len);
+    memcpy(data, layer->decoded + layer->decoded_offset, len);
+    layer->decoded_offset += len;
+
+    if (layer->decoded_offset == layer->decoded_length) {
+        layer->decoded_length = layer->decoded_offset = 0;
+        layer->decoded = NULL;
+    }
+
+    return len;
+}
+
+/* whether decoded data is left to read, without reading the transport */
+G_GNUC_INTERNAL gboolean
+spice_sasl_layer_pending(SpiceSaslLayer *layer)
+{
+    return layer->decoded != NULL;
+}
+
+/* encodes @data and writes it out to the transport */
+static gboolean sasl_layer_flush(SpiceSaslLayer *layer, const void *data, gsize len)
+{
+    const char *output;
+    unsigned int outputlen;
+    int err;
+
+    if (len == 0)
+        return TRUE;
+
+    err = sasl_encode(layer->conn, data, len, &output, &outputlen);
+    if (err != SASL_OK) {
+        g_warning("Failed to encode SASL data %s",
+                  sasl_errstring(err, NULL, NULL));
+        return FALSE;
+    }
+
+    return layer->io.write(layer->io.user_data, output, outputlen);
+}
+
+static gboolean sasl_layer_flush_pending(SpiceSaslLayer *layer)
+{
+    gboolean ret;
+
+    if (layer->pending == NULL)
+        return TRUE;
+
+    ret = sasl_layer_flush(layer, layer->pending->data, layer->pending->len);
+    g_byte_array_set_size(layer->pending, 0);
+
+    return ret;
+}
+
+/* returns FALSE on error */
+G_GNUC_INTERNAL gboolean
+spice_sasl_layer_write(SpiceSaslLayer *layer, const void *data, gsize len)
+{
+    if (!layer->batching)
+        return sasl_layer_flush(layer, data, len);
+
+    if (layer->pending == NULL)
+        layer->pending = g_byte_array_sized_new(SPICE_SASL_BATCH_SIZE);
+    if (layer->pending->len + len > SPICE_SASL_BATCH_SIZE &&
+        !sasl_layer_flush_pending(layer))
+        return FALSE;
+    if (len >= SPICE_SASL_BATCH_SIZE)
+        return sasl_layer_flush(layer, data, len);
+
+    g_byte_array_append(layer->pending, data, len);
+    return TRUE;
+}
+
+G_GNUC_INTERNAL void
+spice_sasl_layer_begin_batch(SpiceSaslLayer *layer)
+{
+    layer->batching = TRUE;
+}
+
+/* writes out what was batched, returns FALSE on error */
+G_GNUC_INTERNAL gboolean
+spice_sasl_layer_end_batch(SpiceSaslLayer *layer)
+{
+    layer->batching = FALSE;
+
+    return sasl_layer_flush_pending(layer);
+}
+#endif
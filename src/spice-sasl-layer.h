@@ -0,0 +1,69 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_SASL_LAYER_H__
+#define __SPICE_SASL_LAYER_H__
+
+#include <glib.h>
+#include <sasl/sasl.h>
+
+G_BEGIN_DECLS
+
+/* The transport below the security layer, in coroutine context: @read
+ * returns at least 1 byte, waiting for it if needed, 0 on EOF or a negative
+ * errno on error, @write writes all of @data and returns FALSE on error. */
+typedef struct SpiceSaslLayerIO {
+    gssize (*read)(gpointer user_data, void *data, gsize len);
+    gboolean (*write)(gpointer user_data, const void *data, gsize len);
+    gpointer user_data;
+} SpiceSaslLayerIO;
+
+/* the largest security layer packet the server may send */
+#define SPICE_SASL_MAX_BUFSIZE 100000
+/* how much data written in a batch is encoded together */
+#define SPICE_SASL_BATCH_SIZE (64 * 1024)
+
+/* The SASL security layer, once the authentication is complete */
+typedef struct SpiceSaslLayer {
+    SpiceSaslLayerIO io;
+    sasl_conn_t *conn;
+
+    /* data read from the transport, and what it decoded to */
+    char *encoded;
+    const char *decoded;
+    unsigned int decoded_length;
+    unsigned int decoded_offset;
+
+    /* data written in a batch, not encoded yet */
+    GByteArray *pending;
+    gboolean batching;
+} SpiceSaslLayer;
+
+void spice_sasl_layer_init(SpiceSaslLayer *layer, sasl_conn_t *conn,
+                           const SpiceSaslLayerIO *io);
+void spice_sasl_layer_clear(SpiceSaslLayer *layer);
+
+gssize spice_sasl_layer_read(SpiceSaslLayer *layer, void *data, gsize len);
+gboolean spice_sasl_layer_write(SpiceSaslLayer *layer, const void *data, gsize len);
+gboolean spice_sasl_layer_pending(SpiceSaslLayer *layer);
+
+void spice_sasl_layer_begin_batch(SpiceSaslLayer *layer);
+gboolean spice_sasl_layer_end_batch(SpiceSaslLayer *layer);
+
+G_END_DECLS
+
+#endif /* __SPICE_SASL_LAYER_H__ */
@@ -34,6 +34,7 @@ typedef struct _PhodavServer PhodavServer;
 #include "spice-gtk-session.h"
 #include "spice-channel-cache.h"
 #include "decode.h"
+#include "spice-net-estimator.h"
 
 G_BEGIN_DECLS
 
@@ -96,6 +97,14 @@ const guint8* spice_session_get_webdav_magic(SpiceSession *session);
 PhodavServer *spice_session_get_webdav_server(SpiceSession *session);
 PhodavServer* channel_webdav_server_new(SpiceSession *session);
 guint spice_session_get_n_display_channels(SpiceSession *session);
+GMainContext *spice_session_get_main_context(SpiceSession *session);
+guint spice_session_get_coroutine_stack_size(SpiceSession *session);
+void spice_session_input_latency_start(SpiceSession *session);
+void spice_session_input_latency_mark(SpiceSession *session, SpiceInputLatencyStage stage);
+void spice_session_net_add_transfer(SpiceSession *session, gsize bytes, gint64 duration);
+void spice_session_net_add_rtt(SpiceSession *session, gint64 rtt);
+void spice_session_net_add_delay(SpiceSession *session, SpiceNetClock clock, gint64 delay);
+guint spice_session_net_get_bandwidth(SpiceSession *session);
 void spice_session_set_main_channel(SpiceSession *session, SpiceChannel *channel);
 gboolean spice_session_set_migration_session(SpiceSession *session, SpiceSession *mig_session);
 SpiceAudio *spice_audio_get(SpiceSession *session, GMainContext *context);
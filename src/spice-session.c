@@ -33,6 +33,8 @@
 #include "spice-uri-priv.h"
 #include "channel-playback-priv.h"
 #include "spice-audio-priv.h"
+#include "spice-memory-manager-priv.h"
+#include "spice-marshal.h"
 
 struct channel {
     SpiceChannel      *channel;
@@ -112,6 +114,9 @@ struct _SpiceSessionPrivate {
     SpiceGlzDecoderWindow *glz_window;
     int               images_cache_size;
     int               glz_window_size;
+    gboolean          images_cache_size_fixed;
+    gboolean          glz_window_size_fixed;
+    gsize             caches_reserved; /* from the memory budget */
     uint32_t          pci_ram_size;
     uint32_t          n_display_channels;
     guint8            uuid[16];
@@ -129,6 +134,24 @@ struct _SpiceSessionPrivate {
     GStrv             redirected_lports;
 
     gint inactivity_timeout;
+
+    /* where the channels attach their sources */
+    GMainContext      *main_context;
+
+    /* input latency histograms, and the input being measured */
+    GMutex            input_latency_lock;
+    gboolean          input_latency_tracking;
+    gint64            input_time;
+    SpiceInputLatencyStage input_latency_stage;
+    guint             input_latency[SPICE_INPUT_LATENCY_PAINTED + 1][SPICE_INPUT_LATENCY_BUCKETS];
+
+    /* network estimates, fed by the channels, and the last ones notified */
+    SpiceNetEstimator *net_estimator;
+    guint             bandwidth;
+    guint             round_trip_time;
+    guint             jitter;
+
+    guint             coroutine_stack_size;
 };
 
 
@@ -214,6 +237,12 @@ enum {
     PROP_REDIR_RPORTS,
     PROP_REDIR_LPORTS,
     PROP_INACTIVITY_TIMEOUT,
+    PROP_MAIN_CONTEXT,
+    PROP_INPUT_LATENCY_TRACKING,
+    PROP_BANDWIDTH,
+    PROP_ROUND_TRIP_TIME,
+    PROP_JITTER,
+    PROP_COROUTINE_STACK_SIZE,
 };
 
 /* signals */
@@ -221,6 +250,7 @@ enum {
     SPICE_SESSION_CHANNEL_NEW,
     SPICE_SESSION_CHANNEL_DESTROY,
     SPICE_SESSION_MM_TIME_RESET,
+    SPICE_SESSION_INPUT_LATENCY,
     SPICE_SESSION_LAST_SIGNAL,
 };
 
@@ -301,7 +331,11 @@ static void spice_session_init(SpiceSession *session)
     g_free(channels);
 
     ring_init(&s->channels);
-    s->images = cache_image_new((GDestroyNotify)pixman_image_unref);
+    s->main_context = g_main_context_ref_thread_default();
+    g_mutex_init(&s->input_latency_lock);
+    s->net_estimator = spice_net_estimator_new();
+    spice_memory_session_added();
+    s->images = cache_image_new((GDestroyNotify)spice_memory_image_unref);
     s->glz_window = glz_decoder_window_new();
     update_proxy(session, NULL);
 
@@ -392,9 +426,14 @@ spice_session_finalize(GObject *gobject)
 
     g_clear_pointer(&s->images, cache_free);
     glz_decoder_window_destroy(s->glz_window);
+    spice_memory_release(s->caches_reserved);
+    spice_memory_session_removed();
 
     g_clear_pointer(&s->pubkey, g_byte_array_unref);
     g_clear_pointer(&s->ca, g_byte_array_unref);
+    g_clear_pointer(&s->main_context, g_main_context_unref);
+    g_mutex_clear(&s->input_latency_lock);
+    spice_net_estimator_free(s->net_estimator);
 
     /* Chain up to the parent class */
     if (G_OBJECT_CLASS(spice_session_parent_class)->finalize)
@@ -730,6 +769,24 @@ static void spice_session_get_property(GObject    *gobject,
     case PROP_INACTIVITY_TIMEOUT:
         g_value_set_int(value, s->inactivity_timeout);
         break;
+    case PROP_MAIN_CONTEXT:
+        g_value_set_boxed(value, s->main_context);
+        break;
+    case PROP_INPUT_LATENCY_TRACKING:
+        g_value_set_boolean(value, g_atomic_int_get(&s->input_latency_tracking));
+        break;
+    case PROP_BANDWIDTH:
+        g_value_set_uint(value, g_atomic_int_get(&s->bandwidth));
+        break;
+    case PROP_ROUND_TRIP_TIME:
+        g_value_set_uint(value, g_atomic_int_get(&s->round_trip_time));
+        break;
+    case PROP_JITTER:
+        g_value_set_uint(value, g_atomic_int_get(&s->jitter));
+        break;
+    case PROP_COROUTINE_STACK_SIZE:
+        g_value_set_uint(value, s->coroutine_stack_size);
+        break;
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
 	break;
@@ -853,9 +910,11 @@ static void spice_session_set_property(GObject      *gobject,
         break;
     case PROP_CACHE_SIZE:
         s->images_cache_size = g_value_get_int(value);
+        s->images_cache_size_fixed = s->images_cache_size != 0;
         break;
     case PROP_GLZ_WINDOW_SIZE:
         s->glz_window_size = g_value_get_int(value);
+        s->glz_window_size_fixed = s->glz_window_size != 0;
         break;
     case PROP_CA:
         g_clear_pointer(&s->ca, g_byte_array_unref);
@@ -884,6 +943,24 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_INACTIVITY_TIMEOUT:
         s->inactivity_timeout = g_value_get_int(value);
         break;
+    case PROP_MAIN_CONTEXT:
+        if (g_value_get_boxed(value) != NULL) {
+            g_main_context_unref(s->main_context);
+            s->main_context = g_value_dup_boxed(value);
+        }
+        break;
+    case PROP_INPUT_LATENCY_TRACKING:
+        g_mutex_lock(&s->input_latency_lock);
+        if (g_value_get_boolean(value) && !s->input_latency_tracking) {
+            memset(s->input_latency, 0, sizeof(s->input_latency));
+            s->input_time = 0;
+        }
+        g_atomic_int_set(&s->input_latency_tracking, g_value_get_boolean(value));
+        g_mutex_unlock(&s->input_latency_lock);
+        break;
+    case PROP_COROUTINE_STACK_SIZE:
+        s->coroutine_stack_size = g_value_get_uint(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -1415,6 +1492,29 @@ static void spice_session_class_init(SpiceSessionClass *klass)
                      G_TYPE_NONE,
                      0);
 
+    /**
+     * SpiceSession::input-latency:
+     * @session: the session that emitted the signal
+     * @stage: the #SpiceInputLatencyStage reached
+     * @latency: the time elapsed since the key or button event, in microseconds
+     *
+     * The #SpiceSession::input-latency signal is emitted when the display
+     * update following a key or button event reaches each of its stages,
+     * while #SpiceSession:input-latency-tracking is enabled.
+     *
+     * Since: 0.35
+     **/
+    signals[SPICE_SESSION_INPUT_LATENCY] =
+        g_signal_new("input-latency",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_FIRST,
+                     0, NULL, NULL,
+                     g_cclosure_user_marshal_VOID__ENUM_INT64,
+                     G_TYPE_NONE,
+                     2,
+                     SPICE_TYPE_INPUT_LATENCY_STAGE,
+                     G_TYPE_INT64);
+
     /**
      * SpiceSession:read-only:
      *
@@ -1579,6 +1679,136 @@ static void spice_session_class_init(SpiceSessionClass *klass)
                           G_PARAM_READWRITE |
                           G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceSession:main-context:
+     *
+     * The #GMainContext the channels of the session attach their sources
+     * to, and from which they run. It defaults to the thread-default
+     * main context when the session is created.
+     *
+     * Sessions using different main contexts can be run from different
+     * threads: each thread should make the context of its sessions its
+     * thread-default context, see g_main_context_push_thread_default(), and
+     * iterate it. The objects of a session must only be used from its
+     * thread.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_MAIN_CONTEXT,
+         g_param_spec_boxed("main-context",
+                            "Main context",
+                            "GMainContext to run the session from",
+                            G_TYPE_MAIN_CONTEXT,
+                            G_PARAM_READWRITE |
+                            G_PARAM_CONSTRUCT_ONLY |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:input-latency-tracking:
+     *
+     * Whether to measure the time from the key and button events sent to
+     * the server until the display updates following them are received,
+     * emitted and painted. Enabling it resets the histograms returned by
+     * spice_session_get_input_latency().
+     *
+     * A single event is measured at a time: the events sent until the
+     * update following it is painted, or for up to 2 seconds when there
+     * is none, are not measured.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_INPUT_LATENCY_TRACKING,
+         g_param_spec_boolean("input-latency-tracking",
+                              "Input latency tracking",
+                              "Whether to measure the input latency",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:bandwidth:
+     *
+     * An estimate of the bandwidth from the server, in kilobits per
+     * second, or 0 until known. It is measured on the large messages the
+     * channels receive, so it is what a single channel gets when several
+     * of them are busy.
+     *
+     * Like #SpiceSession:round-trip-time and #SpiceSession:jitter, it is
+     * smoothed, and notified at most once per second, when it changed
+     * by more than an eighth.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_BANDWIDTH,
+         g_param_spec_uint("bandwidth",
+                           "Bandwidth",
+                           "Estimated bandwidth in kbit/s",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:round-trip-time:
+     *
+     * An estimate of the round trip time to the server, in microseconds,
+     * or 0 until known. It is the one TCP measures, so it is only known
+     * on systems exposing it, and it is the round trip time to the proxy
+     * when there is one.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_ROUND_TRIP_TIME,
+         g_param_spec_uint("round-trip-time",
+                           "Round trip time",
+                           "Estimated round trip time in microseconds",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:jitter:
+     *
+     * An estimate of how much the time taken by the messages from the
+     * server varies, in microseconds. It is measured on the timestamped
+     * messages: the pings and the video stream frames.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_JITTER,
+         g_param_spec_uint("jitter",
+                           "Jitter",
+                           "Estimated jitter in microseconds",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:coroutine-stack-size:
+     *
+     * The size of the stacks of the coroutines running the channels, in
+     * kilobytes, or 0 for the SPICE_COROUTINE_STACK_SIZE environment
+     * variable, or else the default of 16 megabytes. It applies to the
+     * channels connecting after it is set.
+     *
+     * #SpiceChannel:coroutine-stack-used tells how much of it the channels
+     * actually use.
+     *
+     * Since: 0.35
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_COROUTINE_STACK_SIZE,
+         g_param_spec_uint("coroutine-stack-size",
+                           "Coroutine stack size",
+                           "Channel coroutine stack size in kilobytes",
+                           0, G_MAXUINT / 1024, 0,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS));
+
     g_type_class_add_private(klass, sizeof(SpiceSessionPrivate));
 }
 
@@ -1614,6 +1844,7 @@ SpiceSession *spice_session_new_from_session(SpiceSession *session)
     copy = SPICE_SESSION(g_object_new(SPICE_TYPE_SESSION,
                                       "host", NULL,
                                       "ca-file", NULL,
+                                      "main-context", s->main_context,
                                       NULL));
     c = copy->priv;
     g_clear_object(&c->proxy);
@@ -1746,6 +1977,8 @@ gboolean spice_session_get_client_provided_socket(SpiceSession *session)
     return s->client_provided_sockets;
 }
 
+/* The server the session switches or migrates to has its own image cache
+ * and GLZ dictionary, and never refers to the images of the previous one */
 static void cache_clear_all(SpiceSession *self)
 {
     SpiceSessionPrivate *s = self->priv;
@@ -1889,7 +2122,7 @@ end:
 
     s->migrate_wait_init = FALSE;
     if (s->after_main_init) {
-        g_source_remove(s->after_main_init);
+        spice_source_remove(s->main_context, s->after_main_init);
         s->after_main_init = 0;
     }
 
@@ -1915,7 +2148,7 @@ void spice_session_channel_migrate(SpiceSession *session, SpiceChannel *channel)
     c = spice_session_lookup_channel(s->migration, id, type);
     g_return_if_fail(c != NULL);
 
-    if (!g_queue_is_empty(&c->priv->xmit_queue) && s->full_migration) {
+    if (!spice_xmit_queue_is_empty(&c->priv->xmit_queue) && s->full_migration) {
         CHANNEL_DEBUG(channel, "mig channel xmit queue is not empty. type %s", c->priv->name);
     }
     spice_channel_swap(channel, c, !s->full_migration);
@@ -1964,7 +2197,7 @@ gboolean spice_session_migrate_after_main_init(SpiceSession *self)
     g_return_val_if_fail(s->after_main_init == 0, FALSE);
 
     s->migrate_wait_init = FALSE;
-    s->after_main_init = g_idle_add(after_main_init, self);
+    s->after_main_init = spice_idle_add(s->main_context, after_main_init, self);
 
     return TRUE;
 }
@@ -2058,7 +2291,8 @@ void spice_session_disconnect(SpiceSession *session)
         return;
 
     g_object_ref(session);
-    s->disconnecting = g_idle_add((GSourceFunc)session_disconnect_idle, session);
+    s->disconnecting = spice_idle_add(s->main_context,
+                                      (GSourceFunc)session_disconnect_idle, session);
 }
 
 /**
@@ -2206,9 +2440,8 @@ static void proxy_lookup_ready(GObject *source_object, GAsyncResult *result,
 }
 
 /* main context */
-static gboolean open_host_idle_cb(gpointer data)
+static gboolean open_host_start(spice_open_host *open_host)
 {
-    spice_open_host *open_host = data;
     SpiceSessionPrivate *s;
 
     g_return_val_if_fail(open_host != NULL, FALSE);
@@ -2263,6 +2496,20 @@ static gboolean open_host_idle_cb(gpointer data)
     return FALSE;
 }
 
+/* main context */
+static gboolean open_host_idle_cb(gpointer data)
+{
+    spice_open_host *open_host = data;
+    GMainContext *context = spice_session_get_main_context(open_host->session);
+
+    /* so that the asynchronous operations complete in the session context */
+    g_main_context_push_thread_default(context);
+    open_host_start(open_host);
+    g_main_context_pop_thread_default(context);
+
+    return FALSE;
+}
+
 #define SOCKET_TIMEOUT 10
 
 /* coroutine context */
@@ -2320,7 +2567,7 @@ GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceC
     g_socket_client_set_enable_proxy(open_host.client, s->proxy != NULL);
     g_socket_client_set_timeout(open_host.client, SOCKET_TIMEOUT);
 
-    g_idle_add(open_host_idle_cb, &open_host);
+    spice_idle_add(s->main_context, open_host_idle_cb, &open_host);
     /* switch to main loop and wait for connection */
     coroutine_yield(NULL);
 
@@ -2613,18 +2860,48 @@ void spice_session_set_caches_hints(SpiceSession *session,
 
     SpiceSessionPrivate *s = session->priv;
 
+    gsize fixed = 0, min, wanted;
+    gboolean images_fixed = s->images_cache_size_fixed;
+    gboolean glz_fixed = s->glz_window_size_fixed;
+
     s->pci_ram_size = pci_ram_size;
     s->n_display_channels = n_display_channels;
 
-    /* TODO: when setting cache and window size, we should consider the client's
-     *       available memory and the number of display channels */
-    if (s->images_cache_size == 0) {
+    /* sized again on each connection, to fit what is left of the budget */
+    spice_memory_release(s->caches_reserved);
+    s->caches_reserved = 0;
+
+    if (!images_fixed) {
         s->images_cache_size = IMAGES_CACHE_SIZE_DEFAULT;
+    } else {
+        fixed += s->images_cache_size;
     }
 
-    if (s->glz_window_size == 0) {
+    if (!glz_fixed) {
         s->glz_window_size = MIN(MAX_GLZ_WINDOW_SIZE_DEFAULT, pci_ram_size / 2);
         s->glz_window_size = MAX(MIN_GLZ_WINDOW_SIZE_DEFAULT, s->glz_window_size);
+    } else {
+        fixed += s->glz_window_size;
+    }
+
+    /* the sizes not set explicitly shrink to fit in the memory budget */
+    wanted = s->images_cache_size + s->glz_window_size;
+    min = fixed + (glz_fixed ? 0 : MIN_GLZ_WINDOW_SIZE_DEFAULT);
+    s->caches_reserved = spice_memory_reserve(wanted, min);
+    if (s->caches_reserved < wanted) {
+        guint64 budget = s->caches_reserved - fixed;
+
+        if (!glz_fixed && images_fixed) {
+            s->glz_window_size = budget;
+        } else if (!glz_fixed) {
+            s->glz_window_size = MAX(MIN_GLZ_WINDOW_SIZE_DEFAULT,
+                                     s->glz_window_size * budget / (wanted - fixed));
+            budget -= s->glz_window_size;
+        }
+        if (!images_fixed)
+            s->images_cache_size = budget;
+        SPICE_DEBUG("memory budget: images cache %d, glz window %d (bytes)",
+                    s->images_cache_size, s->glz_window_size);
     }
 }
 
@@ -2636,6 +2913,22 @@ guint spice_session_get_n_display_channels(SpiceSession *session)
     return session->priv->n_display_channels;
 }
 
+G_GNUC_INTERNAL
+GMainContext *spice_session_get_main_context(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+
+    return session->priv->main_context;
+}
+
+G_GNUC_INTERNAL
+guint spice_session_get_coroutine_stack_size(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), 0);
+
+    return session->priv->coroutine_stack_size;
+}
+
 G_GNUC_INTERNAL
 void spice_session_set_uuid(SpiceSession *session, guint8 uuid[16])
 {
@@ -2761,7 +3054,8 @@ SpiceURI *spice_session_get_proxy_uri(SpiceSession *session)
 /**
  * spice_audio_get:
  * @session: the #SpiceSession to connect to
- * @context: (allow-none): a #GMainContext to attach to (or %NULL for default).
+ * @context: (allow-none): a #GMainContext to attach to (or %NULL for
+ * #SpiceSession:main-context).
  *
  * Gets the #SpiceAudio associated with the passed in #SpiceSession.
  * A new #SpiceAudio instance will be created the first time this
@@ -2906,6 +3200,126 @@ gboolean spice_session_is_for_migration(SpiceSession *session)
     return session->priv->for_migration;
 }
 
+/* an input without display update after that long is no longer measured */
+#define INPUT_LATENCY_TIMEOUT (2 * G_USEC_PER_SEC)
+
+static guint input_latency_bucket(gint64 latency)
+{
+    gint64 ms = latency / 1000;
+    guint bucket = 0;
+
+    while (ms > 0 && bucket < SPICE_INPUT_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/* main context: a key or button event was sent */
+G_GNUC_INTERNAL
+void spice_session_input_latency_start(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+    gint64 now;
+
+    if (!g_atomic_int_get(&s->input_latency_tracking))
+        return;
+
+    now = g_get_monotonic_time();
+    g_mutex_lock(&s->input_latency_lock);
+    if (s->input_time == 0 || now - s->input_time > INPUT_LATENCY_TIMEOUT) {
+        s->input_time = now;
+        s->input_latency_stage = SPICE_INPUT_LATENCY_RECEIVED;
+    }
+    g_mutex_unlock(&s->input_latency_lock);
+}
+
+/* main or coroutine context: the display update reached @stage */
+G_GNUC_INTERNAL
+void spice_session_input_latency_mark(SpiceSession *session, SpiceInputLatencyStage stage)
+{
+    SpiceSessionPrivate *s = session->priv;
+    gint64 latency = -1;
+
+    if (!g_atomic_int_get(&s->input_latency_tracking))
+        return;
+
+    g_mutex_lock(&s->input_latency_lock);
+    if (s->input_time != 0 && s->input_latency_stage == stage) {
+        latency = g_get_monotonic_time() - s->input_time;
+        if (latency > INPUT_LATENCY_TIMEOUT) {
+            latency = -1;
+            s->input_time = 0;
+        } else {
+            s->input_latency[stage][input_latency_bucket(latency)]++;
+            if (stage == SPICE_INPUT_LATENCY_PAINTED)
+                s->input_time = 0;
+            else
+                s->input_latency_stage = stage + 1;
+        }
+    }
+    g_mutex_unlock(&s->input_latency_lock);
+
+    if (latency < 0)
+        return;
+
+    if (coroutine_self_is_main())
+        g_signal_emit(session, signals[SPICE_SESSION_INPUT_LATENCY], 0, stage, latency);
+    else
+        g_coroutine_signal_emit_batched(session, signals[SPICE_SESSION_INPUT_LATENCY], 0,
+                                        NULL, NULL, stage, latency);
+}
+
+/**
+ * spice_session_input_latency_painted:
+ * @session: a Spice session
+ *
+ * Tells @session the display damage was painted, for the measurements of
+ * #SpiceSession:input-latency-tracking. The #SpiceDisplay widget already
+ * calls it, other display implementations should call it after painting
+ * the damage emitted with #SpiceDisplayChannel::display-invalidate.
+ *
+ * Since: 0.35
+ **/
+void spice_session_input_latency_painted(SpiceSession *session)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_PAINTED);
+}
+
+/**
+ * spice_session_get_input_latency:
+ * @session: a Spice session
+ * @stage: a #SpiceInputLatencyStage
+ *
+ * Gets the histogram of the input latencies measured at @stage, since
+ * #SpiceSession:input-latency-tracking was enabled. See
+ * #SPICE_INPUT_LATENCY_BUCKETS for the ranges of its buckets.
+ *
+ * Returns: (transfer full) (element-type guint): an array of
+ * #SPICE_INPUT_LATENCY_BUCKETS counts, free it with g_array_unref()
+ *
+ * Since: 0.35
+ **/
+GArray *spice_session_get_input_latency(SpiceSession *session, SpiceInputLatencyStage stage)
+{
+    SpiceSessionPrivate *s;
+    GArray *histogram;
+
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+    g_return_val_if_fail(stage <= SPICE_INPUT_LATENCY_PAINTED, NULL);
+
+    s = session->priv;
+    histogram = g_array_sized_new(FALSE, FALSE, sizeof(guint), SPICE_INPUT_LATENCY_BUCKETS);
+    g_mutex_lock(&s->input_latency_lock);
+    g_array_append_vals(histogram, s->input_latency[stage], SPICE_INPUT_LATENCY_BUCKETS);
+    g_mutex_unlock(&s->input_latency_lock);
+
+    return histogram;
+}
+
 G_GNUC_INTERNAL
 void spice_session_set_main_channel(SpiceSession *session, SpiceChannel *channel)
 {
@@ -2927,3 +3341,64 @@ gboolean spice_session_set_migration_session(SpiceSession *session, SpiceSession
 
     return TRUE;
 }
+
+/* coroutine context */
+static void session_net_update(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+    SpiceNetEstimate changed;
+
+    changed = spice_net_estimator_update(s->net_estimator, g_get_monotonic_time());
+    if (changed & SPICE_NET_BANDWIDTH) {
+        g_atomic_int_set(&s->bandwidth, spice_net_estimator_get_bandwidth(s->net_estimator));
+        g_coroutine_object_notify(G_OBJECT(session), "bandwidth");
+    }
+    if (changed & SPICE_NET_RTT) {
+        g_atomic_int_set(&s->round_trip_time, spice_net_estimator_get_rtt(s->net_estimator));
+        g_coroutine_object_notify(G_OBJECT(session), "round-trip-time");
+    }
+    if (changed & SPICE_NET_JITTER) {
+        g_atomic_int_set(&s->jitter, spice_net_estimator_get_jitter(s->net_estimator));
+        g_coroutine_object_notify(G_OBJECT(session), "jitter");
+    }
+}
+
+/* coroutine context: @bytes were received in @duration, see
+ * spice_net_estimator_add_transfer() */
+G_GNUC_INTERNAL
+void spice_session_net_add_transfer(SpiceSession *session, gsize bytes, gint64 duration)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    spice_net_estimator_add_transfer(session->priv->net_estimator, bytes, duration);
+    session_net_update(session);
+}
+
+/* coroutine context */
+G_GNUC_INTERNAL
+void spice_session_net_add_rtt(SpiceSession *session, gint64 rtt)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    spice_net_estimator_add_rtt(session->priv->net_estimator, rtt);
+    session_net_update(session);
+}
+
+/* coroutine context: see spice_net_estimator_add_delay() */
+G_GNUC_INTERNAL
+void spice_session_net_add_delay(SpiceSession *session, SpiceNetClock clock, gint64 delay)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    spice_net_estimator_add_delay(session->priv->net_estimator, clock, delay);
+    session_net_update(session);
+}
+
+/* the current estimate, in kbit/s, not only the last notified one */
+G_GNUC_INTERNAL
+guint spice_session_net_get_bandwidth(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), 0);
+
+    return spice_net_estimator_get_bandwidth(session->priv->net_estimator);
+}
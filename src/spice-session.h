@@ -67,6 +67,35 @@ typedef enum {
     SPICE_SESSION_MIGRATION_CONNECTING,
 } SpiceSessionMigration;
 
+/**
+ * SpiceInputLatencyStage:
+ * @SPICE_INPUT_LATENCY_RECEIVED: the first drawing or video frame was received
+ * @SPICE_INPUT_LATENCY_INVALIDATED: the first damage was emitted, with
+ * #SpiceDisplayChannel::display-invalidate
+ * @SPICE_INPUT_LATENCY_PAINTED: the display widget painted the damage
+ *
+ * The stages of the display update following a key or button event, at
+ * which the input latency is measured.
+ *
+ * Since: 0.35
+ **/
+typedef enum {
+    SPICE_INPUT_LATENCY_RECEIVED,
+    SPICE_INPUT_LATENCY_INVALIDATED,
+    SPICE_INPUT_LATENCY_PAINTED,
+} SpiceInputLatencyStage;
+
+/**
+ * SPICE_INPUT_LATENCY_BUCKETS:
+ *
+ * The number of buckets of the input latency histograms: the first one
+ * counts the latencies under 1ms, the bucket i those from 2^(i-1) to
+ * 2^i ms, and the last one all the higher latencies.
+ *
+ * Since: 0.35
+ **/
+#define SPICE_INPUT_LATENCY_BUCKETS 12
+
 /**
  * SpiceSession:
  *
@@ -114,6 +143,8 @@ gboolean spice_session_has_channel_type(SpiceSession *session, gint type);
 gboolean spice_session_get_read_only(SpiceSession *session);
 SpiceURI *spice_session_get_proxy_uri(SpiceSession *session);
 gboolean spice_session_is_for_migration(SpiceSession *session);
+GArray *spice_session_get_input_latency(SpiceSession *session, SpiceInputLatencyStage stage);
+void spice_session_input_latency_painted(SpiceSession *session);
 
 G_END_DECLS
 
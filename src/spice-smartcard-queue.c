@@ -0,0 +1,86 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "spice-smartcard-queue.h"
+
+G_GNUC_INTERNAL void
+spice_smartcard_queue_init(SpiceSmartcardQueue *queue, guint max_in_flight)
+{
+    g_queue_init(&queue->waiting);
+    g_queue_init(&queue->in_flight);
+    queue->max_in_flight = MAX(max_in_flight, 1);
+}
+
+/* drops the commands waiting to be sent and for their answer */
+G_GNUC_INTERNAL void
+spice_smartcard_queue_clear(SpiceSmartcardQueue *queue, GDestroyNotify free_func)
+{
+    SpiceSmartcardQueueItem *item;
+
+    while ((item = g_queue_pop_head(&queue->in_flight)) != NULL)
+        free_func(item);
+    while ((item = g_queue_pop_head(&queue->waiting)) != NULL)
+        free_func(item);
+}
+
+G_GNUC_INTERNAL void
+spice_smartcard_queue_push(SpiceSmartcardQueue *queue, SpiceSmartcardQueueItem *item)
+{
+    g_queue_push_tail(&queue->waiting, item);
+}
+
+/* Returns the next command to send, now counted as in flight, or NULL when
+ * it has to wait for answers */
+G_GNUC_INTERNAL SpiceSmartcardQueueItem *
+spice_smartcard_queue_pop_sendable(SpiceSmartcardQueue *queue)
+{
+    SpiceSmartcardQueueItem *item = g_queue_peek_head(&queue->waiting);
+    SpiceSmartcardQueueItem *last = g_queue_peek_tail(&queue->in_flight);
+
+    if (item == NULL)
+        return NULL;
+
+    if (last != NULL &&
+        (item->alone || last->alone ||
+         g_queue_get_length(&queue->in_flight) >= queue->max_in_flight))
+        return NULL;
+
+    g_queue_pop_head(&queue->waiting);
+    g_queue_push_tail(&queue->in_flight, item);
+    return item;
+}
+
+/* Returns the in flight command an answer for @reader_id is for, no longer
+ * in flight, or NULL when there is none */
+G_GNUC_INTERNAL SpiceSmartcardQueueItem *
+spice_smartcard_queue_answered(SpiceSmartcardQueue *queue, guint32 reader_id)
+{
+    GList *l;
+
+    for (l = queue->in_flight.head; l != NULL; l = l->next) {
+        SpiceSmartcardQueueItem *item = l->data;
+
+        if (item->reader_id == reader_id) {
+            g_queue_delete_link(&queue->in_flight, l);
+            return item;
+        }
+    }
+
+    return g_queue_pop_head(&queue->in_flight);
+}
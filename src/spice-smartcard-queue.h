@@ -0,0 +1,55 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_SMARTCARD_QUEUE_H__
+#define __SPICE_SMARTCARD_QUEUE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct SpiceSmartcardQueueItem SpiceSmartcardQueueItem;
+
+struct SpiceSmartcardQueueItem {
+    guint32 reader_id;
+    /* its answer is only told apart from the others by its order */
+    gboolean alone;
+};
+
+/* The commands sent to the smartcard devices of the server, waiting to be
+ * sent or for their answer. Items embed a SpiceSmartcardQueueItem. The
+ * commands are sent in order, without waiting for the answers to the
+ * previous ones, up to a number of them, except for the commands sent
+ * alone. The answers are matched to the oldest command in flight for
+ * their reader, or to the oldest command when none is for that reader. */
+typedef struct SpiceSmartcardQueue {
+    GQueue waiting;
+    GQueue in_flight; /* oldest first */
+    guint max_in_flight;
+} SpiceSmartcardQueue;
+
+void spice_smartcard_queue_init(SpiceSmartcardQueue *queue, guint max_in_flight);
+void spice_smartcard_queue_clear(SpiceSmartcardQueue *queue, GDestroyNotify free_func);
+
+void spice_smartcard_queue_push(SpiceSmartcardQueue *queue, SpiceSmartcardQueueItem *item);
+SpiceSmartcardQueueItem *spice_smartcard_queue_pop_sendable(SpiceSmartcardQueue *queue);
+SpiceSmartcardQueueItem *spice_smartcard_queue_answered(SpiceSmartcardQueue *queue,
+                                                        guint32 reader_id);
+
+G_END_DECLS
+
+#endif /* __SPICE_SMARTCARD_QUEUE_H__ */
@@ -33,6 +33,16 @@ gchar* spice_dos2unix(const gchar *str, gssize len);
 void spice_mono_edge_highlight(unsigned width, unsigned hight,
                                const guint8 *and, const guint8 *xor, guint8 *dest);
 
+guint spice_idle_add(GMainContext *context, GSourceFunc function, gpointer data);
+guint spice_timeout_add(GMainContext *context, guint interval,
+                        GSourceFunc function, gpointer data);
+guint spice_timeout_add_seconds(GMainContext *context, guint interval,
+                                GSourceFunc function, gpointer data);
+guint spice_timeout_add_full(GMainContext *context, gint priority, guint interval,
+                             GSourceFunc function, gpointer data, GDestroyNotify notify);
+gboolean spice_source_remove(GMainContext *context, guint id);
+gboolean spice_idle_remove_by_data(GMainContext *context, gpointer data);
+
 G_END_DECLS
 
 #endif /* SPICE_UTIL_PRIV_H */
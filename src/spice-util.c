@@ -476,3 +476,84 @@ void spice_mono_edge_highlight(unsigned width, unsigned height,
         xor += bpl;
     }
 }
+
+/*
+ * Like g_idle_add() and friends, but attaching the source to @context, the
+ * main context of the session, instead of the global default context.
+ * NULL means the global default context.
+ */
+static guint spice_source_attach(GSource *source, GMainContext *context, gint priority,
+                                 GSourceFunc function, gpointer data,
+                                 GDestroyNotify notify)
+{
+    guint id;
+
+    g_source_set_priority(source, priority);
+    g_source_set_callback(source, function, data, notify);
+    id = g_source_attach(source, context);
+    g_source_unref(source);
+
+    return id;
+}
+
+G_GNUC_INTERNAL
+guint spice_idle_add(GMainContext *context, GSourceFunc function, gpointer data)
+{
+    return spice_source_attach(g_idle_source_new(), context, G_PRIORITY_DEFAULT_IDLE,
+                               function, data, NULL);
+}
+
+G_GNUC_INTERNAL
+guint spice_timeout_add_full(GMainContext *context, gint priority, guint interval,
+                             GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+    return spice_source_attach(g_timeout_source_new(interval), context, priority,
+                               function, data, notify);
+}
+
+G_GNUC_INTERNAL
+guint spice_timeout_add(GMainContext *context, guint interval,
+                        GSourceFunc function, gpointer data)
+{
+    return spice_timeout_add_full(context, G_PRIORITY_DEFAULT, interval, function, data, NULL);
+}
+
+G_GNUC_INTERNAL
+guint spice_timeout_add_seconds(GMainContext *context, guint interval,
+                                GSourceFunc function, gpointer data)
+{
+    return spice_source_attach(g_timeout_source_new_seconds(interval), context,
+                               G_PRIORITY_DEFAULT, function, data, NULL);
+}
+
+/* Like g_source_remove(), for a source attached to @context */
+G_GNUC_INTERNAL
+gboolean spice_source_remove(GMainContext *context, guint id)
+{
+    GSource *source;
+
+    g_return_val_if_fail(id > 0, FALSE);
+
+    source = g_main_context_find_source_by_id(context, id);
+    if (source == NULL) {
+        g_critical("Source ID %u was not found when attempting to remove it", id);
+        return FALSE;
+    }
+    g_source_destroy(source);
+
+    return TRUE;
+}
+
+/* Like g_idle_remove_by_data(), for a source attached to @context */
+G_GNUC_INTERNAL
+gboolean spice_idle_remove_by_data(GMainContext *context, gpointer data)
+{
+    GSource *source;
+
+    source = g_main_context_find_source_by_funcs_user_data(context, &g_idle_funcs, data);
+    if (source == NULL)
+        return FALSE;
+
+    g_source_destroy(source);
+    return TRUE;
+}
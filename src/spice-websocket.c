@@ -0,0 +1,410 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "spice-client.h"
+#include "spice-util.h"
+#include "spice-websocket.h"
+
+/*
+ * The SPICE byte stream is carried in binary frames, and their boundaries
+ * don't matter: fragmented and coalesced frames are all the same to us.
+ *
+ * Frame headers are read in a staging buffer, with whatever follows them
+ * in the same read. The rest of the payload of a frame goes straight from
+ * the transport to the caller's buffer, and is unmasked in place (servers
+ * don't mask their frames, but nothing forbids it).
+ *
+ * Sent frames must be masked, the header and the masked payload are put
+ * together so that each frame is a single write to the transport.
+ */
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_FIN 0x80
+#define WS_OPCODE_MASK 0x0f
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xa
+#define WS_MASKED 0x80
+#define WS_LENGTH_MASK 0x7f
+#define WS_LENGTH_16 126
+#define WS_LENGTH_64 127
+#define WS_CONTROL_MAX 125
+#define WS_HEADER_MAX 14
+
+/* bigger messages are sent as several frames */
+#define WS_FRAME_MAX (64 * 1024)
+#define WS_HANDSHAKE_MAX 8192
+
+void spice_websocket_init(SpiceWebSocket *ws, const SpiceWebSocketIO *io)
+{
+    memset(ws, 0, sizeof(*ws));
+    ws->io = *io;
+}
+
+void spice_websocket_clear(SpiceWebSocket *ws)
+{
+    g_clear_pointer(&ws->out, g_free);
+    ws->out_size = 0;
+}
+
+/* XORs @len bytes of @src with @mask, starting at @offset in the mask */
+static void ws_mask(guint8 *dst, const guint8 *src, gsize len,
+                    const guint8 mask[4], guint offset)
+{
+    guint32 mask32;
+    guint8 rotated[4];
+    gsize i = 0;
+    guint j;
+
+    for (j = 0; j < 4; j++)
+        rotated[j] = mask[(offset + j) % 4];
+    memcpy(&mask32, rotated, 4);
+
+    for (; i + 4 <= len; i += 4) {
+        guint32 word;
+
+        memcpy(&word, src + i, 4);
+        word ^= mask32;
+        memcpy(dst + i, &word, 4);
+    }
+    for (; i < len; i++)
+        dst[i] = src[i] ^ rotated[i % 4];
+}
+
+static gsize ws_staged(SpiceWebSocket *ws)
+{
+    return ws->staging_len - ws->staging_offset;
+}
+
+/* reads exactly @len bytes, through the staging buffer */
+static gboolean ws_read_staged(SpiceWebSocket *ws, guint8 *data, gsize len)
+{
+    while (len > 0) {
+        gsize n;
+
+        if (ws_staged(ws) == 0) {
+            gssize ret = ws->io.read(ws->io.user_data, ws->staging, sizeof(ws->staging));
+
+            if (ret <= 0)
+                return FALSE;
+            ws->staging_offset = 0;
+            ws->staging_len = ret;
+        }
+
+        n = MIN(len, ws_staged(ws));
+        memcpy(data, ws->staging + ws->staging_offset, n);
+        ws->staging_offset += n;
+        data += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean ws_send_frame(SpiceWebSocket *ws, guint8 opcode,
+                              const void *payload, gsize len)
+{
+    guint8 *p;
+    guint32 mask = g_random_int();
+
+    if (ws->out_size < WS_HEADER_MAX + len) {
+        ws->out_size = WS_HEADER_MAX + MAX(len, WS_CONTROL_MAX);
+        ws->out = g_realloc(ws->out, ws->out_size);
+    }
+
+    p = ws->out;
+    *p++ = WS_FIN | opcode;
+    if (len < WS_LENGTH_16) {
+        *p++ = WS_MASKED | len;
+    } else if (len <= G_MAXUINT16) {
+        *p++ = WS_MASKED | WS_LENGTH_16;
+        *p++ = len >> 8;
+        *p++ = len;
+    } else {
+        int i;
+
+        *p++ = WS_MASKED | WS_LENGTH_64;
+        for (i = 7; i >= 0; i--)
+            *p++ = (guint64)len >> (i * 8);
+    }
+    memcpy(p, &mask, 4);
+    ws_mask(p + 4, payload, len, p, 0);
+    p += 4 + len;
+
+    return ws->io.write(ws->io.user_data, ws->out, p - ws->out);
+}
+
+static void ws_close(SpiceWebSocket *ws, const guint8 *status, gsize len)
+{
+    if (ws->closed)
+        return;
+
+    ws->closed = TRUE;
+    ws_send_frame(ws, WS_OPCODE_CLOSE, status, len);
+}
+
+/* Reads the header of the next frame, and handles it if it is a control
+ * frame. FALSE when the connection is closed. */
+static gboolean ws_read_frame(SpiceWebSocket *ws)
+{
+    guint8 header[WS_HEADER_MAX];
+    guint8 control[WS_CONTROL_MAX];
+    guint8 opcode;
+    guint64 len;
+    int i;
+
+    if (!ws_read_staged(ws, header, 2))
+        return FALSE;
+
+    opcode = header[0] & WS_OPCODE_MASK;
+    ws->masked = (header[1] & WS_MASKED) != 0;
+    len = header[1] & WS_LENGTH_MASK;
+    if (len == WS_LENGTH_16) {
+        if (!ws_read_staged(ws, header + 2, 2))
+            return FALSE;
+        len = (header[2] << 8) | header[3];
+    } else if (len == WS_LENGTH_64) {
+        if (!ws_read_staged(ws, header + 2, 8))
+            return FALSE;
+        len = 0;
+        for (i = 0; i < 8; i++)
+            len = (len << 8) | header[2 + i];
+    }
+    if (ws->masked && !ws_read_staged(ws, ws->mask, 4))
+        return FALSE;
+    ws->mask_offset = 0;
+
+    switch (opcode) {
+    case WS_OPCODE_CONTINUATION:
+    case WS_OPCODE_BINARY:
+    case WS_OPCODE_TEXT:
+        ws->payload_left = len;
+        return TRUE;
+    case WS_OPCODE_CLOSE:
+    case WS_OPCODE_PING:
+    case WS_OPCODE_PONG:
+        break;
+    default:
+        g_warning("websocket: unknown opcode %u", opcode);
+        ws_close(ws, (const guint8 *)"\x03\xea", 2); /* 1002, protocol error */
+        return FALSE;
+    }
+
+    if (len > WS_CONTROL_MAX || !(header[0] & WS_FIN)) {
+        g_warning("websocket: invalid control frame");
+        ws_close(ws, (const guint8 *)"\x03\xea", 2);
+        return FALSE;
+    }
+    if (!ws_read_staged(ws, control, len))
+        return FALSE;
+    if (ws->masked)
+        ws_mask(control, control, len, ws->mask, 0);
+
+    switch (opcode) {
+    case WS_OPCODE_PING:
+        return ws_send_frame(ws, WS_OPCODE_PONG, control, len);
+    case WS_OPCODE_CLOSE:
+        SPICE_DEBUG("websocket: closed by the server");
+        /* echo the status code */
+        ws_close(ws, control, MIN(len, 2));
+        return FALSE;
+    default:
+        return TRUE;
+    }
+}
+
+/* coroutine context: reads at least 1 byte of payload, 0 on error or when
+ * the connection is closed */
+gssize spice_websocket_read(SpiceWebSocket *ws, void *data, gsize len)
+{
+    gssize n;
+
+    g_return_val_if_fail(len > 0, 0);
+
+    while (ws->payload_left == 0) {
+        if (ws->closed || !ws_read_frame(ws))
+            return 0;
+    }
+
+    n = MIN(len, ws->payload_left);
+    if (ws_staged(ws) > 0) {
+        n = MIN(n, ws_staged(ws));
+        memcpy(data, ws->staging + ws->staging_offset, n);
+        ws->staging_offset += n;
+    } else {
+        n = ws->io.read(ws->io.user_data, data, n);
+        if (n <= 0)
+            return 0;
+    }
+
+    if (ws->masked) {
+        ws_mask(data, data, n, ws->mask, ws->mask_offset);
+        ws->mask_offset = (ws->mask_offset + n) % 4;
+    }
+    ws->payload_left -= n;
+
+    return n;
+}
+
+/* TRUE if bytes were read from the transport and not returned yet */
+gboolean spice_websocket_pending(SpiceWebSocket *ws)
+{
+    return ws_staged(ws) > 0;
+}
+
+/* coroutine context: sends @data in binary frames */
+gboolean spice_websocket_write(SpiceWebSocket *ws, const void *data, gsize len)
+{
+    const guint8 *p = data;
+
+    if (ws->closed)
+        return FALSE;
+
+    while (len > 0) {
+        gsize n = MIN(len, WS_FRAME_MAX);
+
+        if (!ws_send_frame(ws, WS_OPCODE_BINARY, p, n))
+            return FALSE;
+        p += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gchar *ws_accept_key(const gchar *key)
+{
+    GChecksum *sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+    guint8 digest[20];
+    gsize digest_len = sizeof(digest);
+
+    g_checksum_update(sha1, (const guchar *)key, -1);
+    g_checksum_update(sha1, (const guchar *)WS_GUID, -1);
+    g_checksum_get_digest(sha1, digest, &digest_len);
+    g_checksum_free(sha1);
+
+    return g_base64_encode(digest, digest_len);
+}
+
+/* the value of the @name header of an HTTP @response, or NULL */
+static gchar *ws_http_header(gchar **lines, const gchar *name)
+{
+    gsize name_len = strlen(name);
+    guint i;
+
+    for (i = 1; lines[i] != NULL; i++) {
+        if (g_ascii_strncasecmp(lines[i], name, name_len) == 0 &&
+            lines[i][name_len] == ':')
+            return g_strstrip(g_strdup(lines[i] + name_len + 1));
+    }
+
+    return NULL;
+}
+
+/* coroutine context: upgrades the connection to a WebSocket */
+gboolean spice_websocket_handshake(SpiceWebSocket *ws, const gchar *host,
+                                   const gchar *path, GError **error)
+{
+    guint8 nonce[16];
+    gchar *key, *request, *expected = NULL, *accept = NULL;
+    GString *response = g_string_sized_new(512);
+    gchar **lines = NULL;
+    gchar *end = NULL;
+    gboolean ok = FALSE;
+    guint i;
+
+    for (i = 0; i < sizeof(nonce); i += 4) {
+        guint32 r = g_random_int();
+        memcpy(nonce + i, &r, 4);
+    }
+    key = g_base64_encode(nonce, sizeof(nonce));
+    request = g_strdup_printf("GET %s HTTP/1.1\r\n"
+                              "Host: %s\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: %s\r\n"
+                              "Sec-WebSocket-Version: 13\r\n"
+                              "Sec-WebSocket-Protocol: binary\r\n"
+                              "\r\n", path, host, key);
+    if (!ws->io.write(ws->io.user_data, request, strlen(request))) {
+        g_set_error_literal(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                            "Failed to send the websocket handshake");
+        goto end;
+    }
+
+    /* the frames following the response stay in the staging buffer */
+    while (end == NULL) {
+        gssize ret;
+
+        if (response->len >= WS_HANDSHAKE_MAX) {
+            g_set_error_literal(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                "The websocket handshake response is too big");
+            goto end;
+        }
+        ret = ws->io.read(ws->io.user_data, ws->staging, sizeof(ws->staging));
+        if (ret <= 0) {
+            g_set_error_literal(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                "Connection closed during the websocket handshake");
+            goto end;
+        }
+        g_string_append_len(response, (const gchar *)ws->staging, ret);
+        end = g_strstr_len(response->str, response->len, "\r\n\r\n");
+        if (end != NULL) {
+            gsize header_len = end + 4 - response->str;
+            gsize extra = response->len - header_len;
+
+            ws->staging_offset = ret - extra;
+            ws->staging_len = ret;
+            g_string_truncate(response, header_len - 4);
+        }
+    }
+
+    lines = g_strsplit(response->str, "\r\n", -1);
+    if (lines[0] == NULL ||
+        !g_str_has_prefix(lines[0], "HTTP/1.1 101")) {
+        g_set_error(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                    "Websocket upgrade refused: %s", lines[0] ? lines[0] : "");
+        goto end;
+    }
+
+    expected = ws_accept_key(key);
+    accept = ws_http_header(lines, "Sec-WebSocket-Accept");
+    if (g_strcmp0(accept, expected) != 0) {
+        g_set_error_literal(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                            "Invalid Sec-WebSocket-Accept in the handshake response");
+        goto end;
+    }
+
+    ok = TRUE;
+
+end:
+    g_strfreev(lines);
+    g_free(accept);
+    g_free(expected);
+    g_string_free(response, TRUE);
+    g_free(request);
+    g_free(key);
+    return ok;
+}
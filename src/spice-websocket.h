@@ -0,0 +1,69 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_WEBSOCKET_H__
+#define __SPICE_WEBSOCKET_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The transport below the WebSocket, in coroutine context: @read returns
+ * at least 1 byte, waiting for it if needed, or 0 on error or EOF, @write
+ * writes all of @data and returns FALSE on error. */
+typedef struct SpiceWebSocketIO {
+    gssize (*read)(gpointer user_data, void *data, gsize len);
+    gboolean (*write)(gpointer user_data, const void *data, gsize len);
+    gpointer user_data;
+} SpiceWebSocketIO;
+
+#define SPICE_WEBSOCKET_STAGING_SIZE 4096
+
+/* An RFC 6455 client, carrying a byte stream in binary frames */
+typedef struct SpiceWebSocket {
+    SpiceWebSocketIO io;
+
+    /* bytes read past a frame header, that belong to the next frames */
+    guint8 staging[SPICE_WEBSOCKET_STAGING_SIZE];
+    gsize staging_offset;
+    gsize staging_len;
+
+    /* the data frame being received */
+    guint64 payload_left;
+    guint8 mask[4];
+    gboolean masked;
+    guint mask_offset;
+
+    gboolean closed;
+
+    /* header and masked payload of the frames being sent */
+    guint8 *out;
+    gsize out_size;
+} SpiceWebSocket;
+
+void spice_websocket_init(SpiceWebSocket *ws, const SpiceWebSocketIO *io);
+void spice_websocket_clear(SpiceWebSocket *ws);
+
+gboolean spice_websocket_handshake(SpiceWebSocket *ws, const gchar *host,
+                                   const gchar *path, GError **error);
+gssize spice_websocket_read(SpiceWebSocket *ws, void *data, gsize len);
+gboolean spice_websocket_write(SpiceWebSocket *ws, const void *data, gsize len);
+gboolean spice_websocket_pending(SpiceWebSocket *ws);
+
+G_END_DECLS
+
+#endif /* __SPICE_WEBSOCKET_H__ */
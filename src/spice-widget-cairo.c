@@ -17,6 +17,8 @@
 */
 #include "config.h"
 
+#include <math.h>
+
 #include "spice-widget.h"
 #include "spice-widget-priv.h"
 #include "spice-gtk-session-priv.h"
@@ -50,17 +52,116 @@ int spice_cairo_image_create(SpiceDisplay *display)
     return 0;
 }
 
+static void scaled_destroy(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    g_clear_pointer(&d->canvas.scaled, cairo_surface_destroy);
+    g_clear_pointer(&d->canvas.scaled_damage, cairo_region_destroy);
+    d->canvas.scaled_s = 0;
+}
+
 G_GNUC_INTERNAL
 void spice_cairo_image_destroy(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
 
+    scaled_destroy(display);
     g_clear_pointer(&d->canvas.surface, cairo_surface_destroy);
     if (d->canvas.convert)
         g_clear_pointer(&d->canvas.data, g_free);
     d->canvas.convert = FALSE;
 }
 
+/*
+ * When the display is scaled, filtering the canvas for each draw is
+ * expensive, even for small areas. The canvas is scaled to a backbuffer
+ * instead, only where it changed, and draws are plain copies of the
+ * backbuffer.
+ *
+ * Adds the area @x, @y, @w, @h of the backbuffer to @damage, with a margin
+ * for the pixels around it whose filtering depends on the changed pixels.
+ */
+G_GNUC_INTERNAL
+void spice_cairo_scaled_damage_add(cairo_region_t *damage, double s,
+                                   int x, int y, int w, int h)
+{
+    int margin = ceil(s) + 1;
+    cairo_rectangle_int_t rect = {
+        .x = x - margin,
+        .y = y - margin,
+        .width = w + 2 * margin,
+        .height = h + 2 * margin,
+    };
+
+    cairo_region_union_rectangle(damage, &rect);
+}
+
+/* Scales the @damage areas of @source, from @src_x, @src_y, to @scaled */
+G_GNUC_INTERNAL
+void spice_cairo_scaled_update(cairo_surface_t *scaled, cairo_surface_t *source,
+                               double s, int src_x, int src_y,
+                               cairo_region_t *damage)
+{
+    cairo_t *cr;
+
+    if (cairo_region_is_empty(damage))
+        return;
+
+    cr = cairo_create(scaled);
+    gdk_cairo_region(cr, damage);
+    cairo_clip(cr);
+    cairo_scale(cr, s, s);
+    cairo_set_source_surface(cr, source, -src_x, -src_y);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+/* @x, @y, @w, @h: the area that changed, in window coordinates relative to
+ * the display */
+G_GNUC_INTERNAL
+void spice_cairo_image_invalidate(SpiceDisplay *display, int x, int y, int w, int h)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    if (d->canvas.scaled == NULL)
+        return;
+
+    spice_cairo_scaled_damage_add(d->canvas.scaled_damage, d->canvas.scaled_s,
+                                  x, y, w, h);
+}
+
+/* Returns the backbuffer, up to date, if the display is scaled */
+static cairo_surface_t *scaled_get(SpiceDisplay *display, double s, int w, int h)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    cairo_rectangle_int_t all = { 0, 0, w, h };
+
+    if (s == 1.0) {
+        scaled_destroy(display);
+        return NULL;
+    }
+
+    if (d->canvas.scaled == NULL || d->canvas.scaled_s != s ||
+        cairo_image_surface_get_width(d->canvas.scaled) != w ||
+        cairo_image_surface_get_height(d->canvas.scaled) != h) {
+        scaled_destroy(display);
+        d->canvas.scaled = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+        d->canvas.scaled_s = s;
+        d->canvas.scaled_damage = cairo_region_create_rectangle(&all);
+    }
+
+    cairo_region_intersect_rectangle(d->canvas.scaled_damage, &all);
+    spice_cairo_scaled_update(d->canvas.scaled, d->canvas.surface, s,
+                              d->canvas.convert ? 0 : d->area.x,
+                              d->canvas.convert ? 0 : d->area.y,
+                              d->canvas.scaled_damage);
+    cairo_region_subtract_rectangle(d->canvas.scaled_damage, &all);
+
+    return d->canvas.scaled;
+}
+
 G_GNUC_INTERNAL
 void spice_cairo_draw_event(SpiceDisplay *display, cairo_t *cr)
 {
@@ -106,13 +207,23 @@ void spice_cairo_draw_event(SpiceDisplay *display, cairo_t *cr)
 
     /* Draw the display */
     if (d->canvas.surface) {
+        cairo_surface_t *scaled = scaled_get(display, s, w, h);
+
         cairo_translate(cr, x, y);
         cairo_rectangle(cr, 0, 0, w, h);
-        cairo_scale(cr, s, s);
-        if (!d->canvas.convert)
-            cairo_translate(cr, -d->area.x, -d->area.y);
-        cairo_set_source_surface(cr, d->canvas.surface, 0, 0);
-        cairo_fill(cr);
+        if (scaled != NULL) {
+            cairo_set_source_surface(cr, scaled, 0, 0);
+            cairo_fill(cr);
+            cairo_scale(cr, s, s);
+            if (!d->canvas.convert)
+                cairo_translate(cr, -d->area.x, -d->area.y);
+        } else {
+            cairo_scale(cr, s, s);
+            if (!d->canvas.convert)
+                cairo_translate(cr, -d->area.x, -d->area.y);
+            cairo_set_source_surface(cr, d->canvas.surface, 0, 0);
+            cairo_fill(cr);
+        }
 
         if (d->time_to_inactivity < 30000) {
             cairo_translate(cr, 0, 0);
@@ -79,6 +79,10 @@ struct _SpiceDisplayPrivate {
         gpointer                data; /* converted if necessary to 32 bits */
         bool                    convert;
         cairo_surface_t         *surface;
+        /* @surface scaled to the window, and its areas that are out of date */
+        cairo_surface_t         *scaled;
+        double                  scaled_s;
+        cairo_region_t          *scaled_damage;
     } canvas;
     GdkRectangle            area;
     /* window border */
@@ -158,8 +162,20 @@ struct _SpiceDisplayPrivate {
 int      spice_cairo_image_create                 (SpiceDisplay *display);
 void     spice_cairo_image_destroy                (SpiceDisplay *display);
 void     spice_cairo_draw_event                   (SpiceDisplay *display, cairo_t *cr);
+void     spice_cairo_image_invalidate             (SpiceDisplay *display,
+                                                   int x, int y, int w, int h);
+void     spice_cairo_scaled_damage_add            (cairo_region_t *damage, double s,
+                                                   int x, int y, int w, int h);
+void     spice_cairo_scaled_update                (cairo_surface_t *scaled,
+                                                   cairo_surface_t *source,
+                                                   double s, int src_x, int src_y,
+                                                   cairo_region_t *damage);
 gboolean spice_cairo_is_scaled                    (SpiceDisplay *display);
 void     spice_display_get_scaling           (SpiceDisplay *display, double *s, int *x, int *y, int *w, int *h);
+void     spice_display_color_convert         (gint format,
+                                              guint32 *dest, gint dest_stride,
+                                              const guint16 *src, gint src_stride,
+                                              gint width, gint height);
 gboolean spice_egl_init                      (SpiceDisplay *display, GError **err);
 gboolean spice_egl_realize_display           (SpiceDisplay *display, GdkWindow *win,
                                               GError **err);
@@ -1289,12 +1289,42 @@ static void recalc_geometry(GtkWidget *widget)
 
 #define CONVERT_0555_TO_8888(s) (CONVERT_0555_TO_0888(s) | 0xff000000)
 
+/* Converts @width x @height 16 bits pixels of @format to 32 bits, the
+ * strides are in pixels */
+G_GNUC_INTERNAL
+void spice_display_color_convert(gint format,
+                                 guint32 *dest, gint dest_stride,
+                                 const guint16 *src, gint src_stride,
+                                 gint width, gint height)
+{
+    gint x, y;
+
+    if (format == SPICE_SURFACE_FMT_16_555) {
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                dest[x] = CONVERT_0555_TO_0888(src[x]);
+            }
+
+            dest += dest_stride;
+            src += src_stride;
+        }
+    } else if (format == SPICE_SURFACE_FMT_16_565) {
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                dest[x] = CONVERT_0565_TO_0888(src[x]);
+            }
+
+            dest += dest_stride;
+            src += src_stride;
+        }
+    }
+}
+
 static gboolean do_color_convert(SpiceDisplay *display, GdkRectangle *r)
 {
     SpiceDisplayPrivate *d = display->priv;
     guint32 *dest = d->canvas.data;
     guint16 *src = d->canvas.data_origin;
-    gint x, y;
 
     g_return_val_if_fail(r != NULL, false);
     g_return_val_if_fail(d->canvas.format == SPICE_SURFACE_FMT_16_555 ||
@@ -1303,25 +1333,8 @@ static gboolean do_color_convert(SpiceDisplay *display, GdkRectangle *r)
     src += (d->canvas.stride / 2) * r->y + r->x;
     dest += d->area.width * (r->y - d->area.y) + (r->x - d->area.x);
 
-    if (d->canvas.format == SPICE_SURFACE_FMT_16_555) {
-        for (y = 0; y < r->height; y++) {
-            for (x = 0; x < r->width; x++) {
-                dest[x] = CONVERT_0555_TO_0888(src[x]);
-            }
-
-            dest += d->area.width;
-            src += d->canvas.stride / 2;
-        }
-    } else if (d->canvas.format == SPICE_SURFACE_FMT_16_565) {
-        for (y = 0; y < r->height; y++) {
-            for (x = 0; x < r->width; x++) {
-                dest[x] = CONVERT_0565_TO_0888(src[x]);
-            }
-
-            dest += d->area.width;
-            src += d->canvas.stride / 2;
-        }
-    }
+    spice_display_color_convert(d->canvas.format, dest, d->area.width,
+                                src, d->canvas.stride / 2, r->width, r->height);
 
     return true;
 }
@@ -1366,6 +1379,7 @@ static gboolean draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
     if (egl_enabled(d) &&
         g_str_equal(gtk_stack_get_visible_child_name(d->stack), "draw-area")) {
         spice_egl_update_display(display);
+        spice_session_input_latency_painted(d->session);
         return false;
     }
 #endif
@@ -1375,6 +1389,7 @@ static gboolean draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
         return false;
 
     spice_cairo_draw_event(display, cr);
+    spice_session_input_latency_painted(d->session);
     update_mouse_pointer(display);
 
     return true;
@@ -2661,6 +2676,7 @@ static void invalidate(SpiceChannel *channel,
     x2 = ceil ((rect.x - d->area.x + rect.width) * s);
     y2 = ceil ((rect.y - d->area.y + rect.height) * s);
 
+    spice_cairo_image_invalidate(display, x1, y1, x2 - x1, y2 - y1);
     queue_draw_area(display,
                     display_x + x1, display_y + y1,
                     x2 - x1, y2 - y1);
@@ -0,0 +1,162 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "spice-xmit-queue.h"
+
+/* Head of a closed queue, pushing to it fails */
+static SpiceXmitLink xmit_queue_closed;
+#define XMIT_QUEUE_CLOSED (&xmit_queue_closed)
+
+/*
+ * The wakeup source has no file descriptor of its own: producers set its
+ * ready time, which is thread-safe and wakes up the main context through
+ * its own wakeup file descriptor (an eventfd on Linux). It is only done
+ * when the queue was empty, so that a burst of messages pushed from
+ * another thread results in a single dispatch.
+ */
+static gboolean xmit_queue_source_dispatch(GSource *source,
+                                           GSourceFunc callback,
+                                           gpointer user_data)
+{
+    /* before the callback, so that a push racing with it wakes us up again */
+    g_source_set_ready_time(source, -1);
+
+    if (callback == NULL)
+        return G_SOURCE_CONTINUE;
+
+    callback(user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs xmit_queue_source_funcs = {
+    .dispatch = xmit_queue_source_dispatch,
+};
+
+/* main context: @wakeup is called from @context */
+G_GNUC_INTERNAL void
+spice_xmit_queue_init(SpiceXmitQueue *queue, GMainContext *context,
+                      GSourceFunc wakeup, gpointer data)
+{
+    queue->head = NULL;
+    queue->source = g_source_new(&xmit_queue_source_funcs, sizeof(GSource));
+    g_source_set_priority(queue->source, G_PRIORITY_HIGH);
+    g_source_set_callback(queue->source, wakeup, data, NULL);
+    g_source_set_name(queue->source, "[spice-gtk] xmit queue");
+    g_source_attach(queue->source, context);
+}
+
+/* main context: the queue must be closed or empty */
+G_GNUC_INTERNAL void
+spice_xmit_queue_destroy(SpiceXmitQueue *queue)
+{
+    SpiceXmitLink *head = g_atomic_pointer_get(&queue->head);
+
+    g_warn_if_fail(head == NULL || head == XMIT_QUEUE_CLOSED);
+
+    if (queue->source != NULL) {
+        g_source_destroy(queue->source);
+        g_clear_pointer(&queue->source, g_source_unref);
+    }
+}
+
+/* any context: FALSE if the queue is closed, @link was not queued */
+G_GNUC_INTERNAL gboolean
+spice_xmit_queue_push(SpiceXmitQueue *queue, SpiceXmitLink *link)
+{
+    SpiceXmitLink *head;
+
+    do {
+        head = g_atomic_pointer_get(&queue->head);
+        if (head == XMIT_QUEUE_CLOSED)
+            return FALSE;
+        link->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&queue->head, head, link));
+
+    /* One wakeup is enough to empty the entire queue */
+    if (head == NULL)
+        g_source_set_ready_time(queue->source, 0);
+
+    return TRUE;
+}
+
+static SpiceXmitLink *xmit_queue_take(SpiceXmitQueue *queue, SpiceXmitLink *new_head)
+{
+    SpiceXmitLink *head, *prev = NULL;
+
+    do {
+        head = g_atomic_pointer_get(&queue->head);
+        if (head == XMIT_QUEUE_CLOSED)
+            return NULL;
+    } while (!g_atomic_pointer_compare_and_exchange(&queue->head, head, new_head));
+
+    /* the items were pushed in front of each other, restore their order */
+    while (head != NULL) {
+        SpiceXmitLink *next = head->next;
+        head->next = prev;
+        prev = head;
+        head = next;
+    }
+    return prev;
+}
+
+/* consumer: returns the queued items in the order they were pushed */
+G_GNUC_INTERNAL SpiceXmitLink *
+spice_xmit_queue_pop_all(SpiceXmitQueue *queue)
+{
+    return xmit_queue_take(queue, NULL);
+}
+
+/* any context */
+G_GNUC_INTERNAL gboolean
+spice_xmit_queue_is_empty(SpiceXmitQueue *queue)
+{
+    SpiceXmitLink *head = g_atomic_pointer_get(&queue->head);
+
+    return head == NULL || head == XMIT_QUEUE_CLOSED;
+}
+
+/* consumer: disallows pushing new items and returns the queued ones */
+G_GNUC_INTERNAL SpiceXmitLink *
+spice_xmit_queue_close(SpiceXmitQueue *queue)
+{
+    return xmit_queue_take(queue, XMIT_QUEUE_CLOSED);
+}
+
+/* consumer */
+G_GNUC_INTERNAL void
+spice_xmit_queue_open(SpiceXmitQueue *queue)
+{
+    g_atomic_pointer_compare_and_exchange(&queue->head, XMIT_QUEUE_CLOSED, NULL);
+}
+
+/* main context: exchanges the queued items (and whether the queues are
+ * closed), producers must not be pushing to either queue */
+G_GNUC_INTERNAL void
+spice_xmit_queue_swap(SpiceXmitQueue *a, SpiceXmitQueue *b)
+{
+    SpiceXmitLink *head = g_atomic_pointer_get(&a->head);
+
+    g_atomic_pointer_set(&a->head, g_atomic_pointer_get(&b->head));
+    g_atomic_pointer_set(&b->head, head);
+
+    if (!spice_xmit_queue_is_empty(a))
+        g_source_set_ready_time(a->source, 0);
+    if (!spice_xmit_queue_is_empty(b))
+        g_source_set_ready_time(b->source, 0);
+}
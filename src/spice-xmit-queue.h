@@ -0,0 +1,54 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_XMIT_QUEUE_H__
+#define __SPICE_XMIT_QUEUE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct SpiceXmitLink SpiceXmitLink;
+
+struct SpiceXmitLink {
+    SpiceXmitLink *next;
+};
+
+/* A multiple producers, single consumer queue. Items embed a SpiceXmitLink
+ * and can be pushed from any thread without locking. The consumer takes all
+ * the queued items at once, and is woken up in the main context by a single
+ * persistent source when the queue stops being empty. */
+typedef struct SpiceXmitQueue {
+    SpiceXmitLink *head; /* atomic, most recently pushed first */
+    GSource *source;
+} SpiceXmitQueue;
+
+void spice_xmit_queue_init(SpiceXmitQueue *queue, GMainContext *context,
+                           GSourceFunc wakeup, gpointer data);
+void spice_xmit_queue_destroy(SpiceXmitQueue *queue);
+
+gboolean spice_xmit_queue_push(SpiceXmitQueue *queue, SpiceXmitLink *link);
+SpiceXmitLink *spice_xmit_queue_pop_all(SpiceXmitQueue *queue);
+gboolean spice_xmit_queue_is_empty(SpiceXmitQueue *queue);
+
+SpiceXmitLink *spice_xmit_queue_close(SpiceXmitQueue *queue);
+void spice_xmit_queue_open(SpiceXmitQueue *queue);
+void spice_xmit_queue_swap(SpiceXmitQueue *a, SpiceXmitQueue *b);
+
+G_END_DECLS
+
+#endif /* __SPICE_XMIT_QUEUE_H__ */
@@ -46,6 +46,7 @@
 #endif
 
 #include "spice-session-priv.h"
+#include "spice-util-priv.h"
 #include "spice-client.h"
 #include "spice-marshal.h"
 #include "usb-device-manager-priv.h"
@@ -1122,7 +1123,8 @@ static int spice_usb_device_manager_hotplug_cb(libusb_context       *ctx,
     args->self = g_object_ref(self);
     args->device = libusb_ref_device(device);
     args->event = event;
-    g_idle_add(spice_usb_device_manager_hotplug_idle_cb, args);
+    spice_idle_add(spice_session_get_main_context(self->priv->session),
+                   spice_usb_device_manager_hotplug_idle_cb, args);
     return 0;
 }
 #endif // USE_USBREDIR
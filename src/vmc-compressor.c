@@ -0,0 +1,277 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+#include "vmc-compressor.h"
+
+/* Smaller payloads are not worth compressing */
+#define COMPRESS_THRESHOLD 1000
+/* Compressed buffers kept for reuse once their message was sent */
+#define MAX_FREE_BUFFERS 4
+/* A payload compresses poorly when it doesn't shrink by at least 1/8 */
+#define POOR_RATIO_NUM 7
+#define POOR_RATIO_DEN 8
+/* Consecutive poor payloads before compression is suspended */
+#define MAX_POOR_PAYLOADS 4
+/* Payloads skipped before trying again, doubled while it keeps failing */
+#define MIN_BACKOFF 16
+#define MAX_BACKOFF 1024
+
+typedef struct CompressBuffer {
+    SpiceVmcCompressor *compressor;
+    gsize size;
+    uint8_t data[];
+} CompressBuffer;
+
+struct SpiceVmcCompressor {
+    gint ref;
+
+    /* protects the fields below, written from the usbredir event thread */
+    GMutex lock;
+    GSList *free_buffers;
+    guint n_free_buffers;
+    guint poor_payloads;
+    guint backoff;
+    guint skip;
+    SpiceVmcCompressorStats stats;
+
+    /* coroutine context */
+    uint8_t *decompress_buf;
+    gsize decompress_buf_size;
+};
+
+G_GNUC_INTERNAL SpiceVmcCompressor *
+spice_vmc_compressor_new(void)
+{
+    SpiceVmcCompressor *compressor = g_new0(SpiceVmcCompressor, 1);
+
+    compressor->ref = 1;
+    compressor->backoff = MIN_BACKOFF;
+    g_mutex_init(&compressor->lock);
+
+    return compressor;
+}
+
+G_GNUC_INTERNAL SpiceVmcCompressor *
+spice_vmc_compressor_ref(SpiceVmcCompressor *compressor)
+{
+    g_atomic_int_inc(&compressor->ref);
+    return compressor;
+}
+
+G_GNUC_INTERNAL void
+spice_vmc_compressor_unref(SpiceVmcCompressor *compressor)
+{
+    if (compressor == NULL || !g_atomic_int_dec_and_test(&compressor->ref))
+        return;
+
+    g_slist_free_full(compressor->free_buffers, g_free);
+    g_mutex_clear(&compressor->lock);
+    g_free(compressor->decompress_buf);
+    g_free(compressor);
+}
+
+#ifdef USE_LZ4
+static CompressBuffer *compress_buffer_get(SpiceVmcCompressor *compressor, gsize size)
+{
+    CompressBuffer *buffer = NULL;
+
+    g_mutex_lock(&compressor->lock);
+    if (compressor->free_buffers != NULL) {
+        buffer = compressor->free_buffers->data;
+        compressor->free_buffers = g_slist_delete_link(compressor->free_buffers,
+                                                       compressor->free_buffers);
+        compressor->n_free_buffers--;
+    }
+    g_mutex_unlock(&compressor->lock);
+
+    if (buffer == NULL || buffer->size < size) {
+        g_free(buffer);
+        buffer = g_malloc(sizeof(CompressBuffer) + size);
+        buffer->size = size;
+    }
+    buffer->compressor = spice_vmc_compressor_ref(compressor);
+
+    return buffer;
+}
+#endif
+
+static void compress_buffer_put(CompressBuffer *buffer)
+{
+    SpiceVmcCompressor *compressor = buffer->compressor;
+
+    g_mutex_lock(&compressor->lock);
+    if (compressor->n_free_buffers < MAX_FREE_BUFFERS) {
+        compressor->free_buffers = g_slist_prepend(compressor->free_buffers, buffer);
+        compressor->n_free_buffers++;
+        buffer = NULL;
+    }
+    g_mutex_unlock(&compressor->lock);
+
+    g_free(buffer);
+    spice_vmc_compressor_unref(compressor);
+}
+
+/* any context: the free function of the compressed data, to pass to
+ * spice_marshaller_add_by_ref_full() with the opaque pointer returned by
+ * spice_vmc_compressor_compress() */
+G_GNUC_INTERNAL void
+spice_vmc_compressor_release(uint8_t *data G_GNUC_UNUSED, void *opaque)
+{
+    compress_buffer_put(opaque);
+}
+
+#ifdef USE_LZ4
+/* with the lock held: whether to try compressing the next payload */
+static gboolean compressor_should_try(SpiceVmcCompressor *compressor)
+{
+    if (compressor->skip == 0)
+        return TRUE;
+
+    compressor->skip--;
+    compressor->stats.skipped++;
+    return FALSE;
+}
+
+/* with the lock held: @out_size is 0 if the payload did not shrink */
+static void compressor_sample(SpiceVmcCompressor *compressor, int size, int out_size)
+{
+    compressor->stats.attempts++;
+
+    if (out_size > 0 &&
+        (gint64)out_size * POOR_RATIO_DEN < (gint64)size * POOR_RATIO_NUM) {
+        compressor->poor_payloads = 0;
+        compressor->backoff = MIN_BACKOFF;
+        return;
+    }
+
+    if (++compressor->poor_payloads < MAX_POOR_PAYLOADS)
+        return;
+
+    /* this was either the last of a sequence or the retry after a pause */
+    compressor->skip = compressor->backoff;
+    compressor->backoff = MIN(compressor->backoff * 2, MAX_BACKOFF);
+    compressor->poor_payloads = MAX_POOR_PAYLOADS - 1;
+}
+#endif
+
+/* any context: on success, @out holds the compressed payload until it is
+ * released with spice_vmc_compressor_release(@out, @out_opaque) */
+G_GNUC_INTERNAL gboolean
+spice_vmc_compressor_compress(SpiceVmcCompressor *compressor,
+                              const uint8_t *data, int size,
+                              uint8_t **out, int *out_size,
+                              gpointer *out_opaque)
+{
+#ifdef USE_LZ4
+    CompressBuffer *buffer;
+    gboolean attempt;
+    int bound, compressed_size;
+
+    if (size <= COMPRESS_THRESHOLD) {
+        /* Not enough data to compress */
+        return FALSE;
+    }
+    bound = LZ4_compressBound(size);
+    if (bound == 0) {
+        /* Invalid bound - data will not be compressed */
+        return FALSE;
+    }
+
+    g_mutex_lock(&compressor->lock);
+    attempt = compressor_should_try(compressor);
+    g_mutex_unlock(&compressor->lock);
+    if (!attempt)
+        return FALSE;
+
+    buffer = compress_buffer_get(compressor, bound);
+    compressed_size = LZ4_compress_default((const char*)data, (char*)buffer->data,
+                                           size, bound);
+    if (compressed_size >= size)
+        compressed_size = 0;
+
+    g_mutex_lock(&compressor->lock);
+    compressor_sample(compressor, size, compressed_size);
+    if (compressed_size > 0) {
+        compressor->stats.compressed++;
+        compressor->stats.bytes_in += size;
+        compressor->stats.bytes_out += compressed_size;
+    }
+    g_mutex_unlock(&compressor->lock);
+
+    if (compressed_size == 0) {
+        /* send the payload uncompressed */
+        compress_buffer_put(buffer);
+        return FALSE;
+    }
+
+    *out = buffer->data;
+    *out_size = compressed_size;
+    *out_opaque = buffer;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/* coroutine context: returns NULL on error, the data is valid until the
+ * next call */
+G_GNUC_INTERNAL const uint8_t *
+spice_vmc_compressor_decompress(SpiceVmcCompressor *compressor,
+                                const uint8_t *data, int size,
+                                int uncompressed_size)
+{
+#ifdef USE_LZ4
+    int decompressed_size;
+
+    g_return_val_if_fail(uncompressed_size > 0, NULL);
+
+    if (compressor->decompress_buf_size < (gsize)uncompressed_size) {
+        g_free(compressor->decompress_buf);
+        compressor->decompress_buf = g_malloc(uncompressed_size);
+        compressor->decompress_buf_size = uncompressed_size;
+    }
+
+    decompressed_size = LZ4_decompress_safe((const char*)data,
+                                            (char*)compressor->decompress_buf,
+                                            size, uncompressed_size);
+    if (decompressed_size != uncompressed_size) {
+        g_warning("Decompress Error decompressed_size=%d expected=%d",
+                  decompressed_size, uncompressed_size);
+        return NULL;
+    }
+
+    return compressor->decompress_buf;
+#else
+    return NULL;
+#endif
+}
+
+G_GNUC_INTERNAL void
+spice_vmc_compressor_get_stats(SpiceVmcCompressor *compressor,
+                               SpiceVmcCompressorStats *stats)
+{
+    g_mutex_lock(&compressor->lock);
+    *stats = compressor->stats;
+    g_mutex_unlock(&compressor->lock);
+}
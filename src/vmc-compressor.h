@@ -0,0 +1,58 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_VMC_COMPRESSOR_H__
+#define __SPICE_VMC_COMPRESSOR_H__
+
+#include <glib.h>
+#include <stdint.h>
+
+G_BEGIN_DECLS
+
+/* LZ4 compression of spicevmc data, with reusable buffers. The compressor
+ * samples how well the data compresses, and stops trying for a while when
+ * it doesn't shrink (encrypted or already compressed payloads). */
+typedef struct SpiceVmcCompressor SpiceVmcCompressor;
+
+typedef struct SpiceVmcCompressorStats {
+    guint64 attempts;     /* payloads that went through LZ4 */
+    guint64 compressed;   /* payloads sent compressed */
+    guint64 skipped;      /* payloads not tried because of poor ratios */
+    guint64 bytes_in;     /* uncompressed size of the compressed payloads */
+    guint64 bytes_out;    /* compressed size of the compressed payloads */
+} SpiceVmcCompressorStats;
+
+SpiceVmcCompressor *spice_vmc_compressor_new(void);
+SpiceVmcCompressor *spice_vmc_compressor_ref(SpiceVmcCompressor *compressor);
+void spice_vmc_compressor_unref(SpiceVmcCompressor *compressor);
+
+gboolean spice_vmc_compressor_compress(SpiceVmcCompressor *compressor,
+                                       const uint8_t *data, int size,
+                                       uint8_t **out, int *out_size,
+                                       gpointer *out_opaque);
+void spice_vmc_compressor_release(uint8_t *data, void *opaque);
+
+const uint8_t *spice_vmc_compressor_decompress(SpiceVmcCompressor *compressor,
+                                               const uint8_t *data, int size,
+                                               int uncompressed_size);
+
+void spice_vmc_compressor_get_stats(SpiceVmcCompressor *compressor,
+                                    SpiceVmcCompressorStats *stats);
+
+G_END_DECLS
+
+#endif /* __SPICE_VMC_COMPRESSOR_H__ */
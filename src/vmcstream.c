@@ -163,7 +163,7 @@ spice_vmc_input_stream_co_data(SpiceVmcInputStream *self,
         cb_data = g_new(complete_in_idle_cb_data , 1);
         cb_data->task = g_object_ref(self->task);
         cb_data->pos = self->pos;
-        g_idle_add(complete_in_idle_cb, cb_data);
+        spice_idle_add(g_task_get_context(cb_data->task), complete_in_idle_cb, cb_data);
 
         g_clear_object(&self->task);
     }
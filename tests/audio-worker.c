@@ -0,0 +1,210 @@
+#include "config.h"
+
+#include <glib.h>
+
+#include "spice-audio-worker.h"
+
+#define N_JOBS 1000
+
+typedef struct {
+    GMainLoop *loop;
+    guint received;
+    guint dropped;
+} OrderData;
+
+static void order_done(SpiceAudioJob *job, gpointer user_data)
+{
+    OrderData *data = user_data;
+
+    if (job->type == SPICE_AUDIO_JOB_MARK) {
+        g_main_loop_quit(data->loop);
+        return;
+    }
+
+    /* passed through without a codec, in the order they were pushed */
+    g_assert_nonnull(job->out);
+    g_assert_cmpuint(g_bytes_get_size(job->out), ==, sizeof(guint));
+    g_assert_cmpuint(*(const guint *)g_bytes_get_data(job->out, NULL), ==, job->tag);
+    g_assert_cmpuint(job->tag, ==, data->dropped + data->received);
+    data->received++;
+}
+
+static void test_audio_worker_order(void)
+{
+    OrderData data = { g_main_loop_new(NULL, FALSE), 0, 0 };
+    SpiceAudioWorker *worker;
+    guint i;
+
+    worker = spice_audio_worker_new("test-audio", SND_CODEC_DECODE, NULL,
+                                    order_done, &data);
+    for (i = 0; i < N_JOBS; i++) {
+        SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_DATA);
+
+        job->tag = i;
+        job->in = g_bytes_new(&i, sizeof(i));
+        spice_audio_worker_push(worker, job);
+        if (i == N_JOBS / 2 - 1) {
+            /* like a reset, the first half is never reported */
+            spice_audio_worker_drop_pending(worker);
+            data.dropped = N_JOBS / 2;
+        }
+    }
+    spice_audio_worker_push(worker, spice_audio_job_new(SPICE_AUDIO_JOB_MARK));
+
+    g_main_loop_run(data.loop);
+    g_assert_cmpuint(data.received, ==, N_JOBS / 2);
+
+    spice_audio_worker_free(worker);
+    g_main_loop_unref(data.loop);
+}
+
+/* ------------------------------------------------------------------ */
+
+#define TICK_MS 5
+#define PACKETS_PER_TICK 40
+#define RUN_TICKS 200
+
+typedef struct {
+    GMainLoop *loop;
+    SndCodec decoder;           /* NULL when decoding in the worker */
+    SpiceAudioWorker *worker;
+    GBytes *packet;
+    gint64 next_tick;
+    guint ticks;
+    gint64 max_lateness;
+    gint64 total_lateness;
+    guint decoded;
+} LatencyData;
+
+static void latency_done(SpiceAudioJob *job, gpointer user_data)
+{
+    LatencyData *data = user_data;
+
+    if (job->out != NULL)
+        data->decoded++;
+}
+
+/* stands for the display work of the main loop, that must not wait for
+ * the audio decoding */
+static gboolean latency_tick(gpointer user_data)
+{
+    LatencyData *data = user_data;
+    gint64 lateness = g_get_monotonic_time() - data->next_tick;
+    guint i;
+
+    data->max_lateness = MAX(data->max_lateness, lateness);
+    data->total_lateness += lateness;
+    data->next_tick += TICK_MS * 1000;
+
+    for (i = 0; i < PACKETS_PER_TICK; i++) {
+        if (data->worker != NULL) {
+            SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_DATA);
+
+            job->in = g_bytes_ref(data->packet);
+            spice_audio_worker_push(data->worker, job);
+        } else {
+            guint8 pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
+            int n = sizeof(pcm);
+
+            if (snd_codec_decode(data->decoder,
+                                 (guint8 *)g_bytes_get_data(data->packet, NULL),
+                                 g_bytes_get_size(data->packet),
+                                 pcm, &n) == SND_CODEC_OK)
+                data->decoded++;
+        }
+    }
+
+    if (++data->ticks == RUN_TICKS) {
+        g_main_loop_quit(data->loop);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static GBytes *opus_packet_new(void)
+{
+    SndCodec encoder = NULL;
+    gint16 pcm[SND_CODEC_MAX_FRAME_SIZE * 2];
+    guint8 packet[SND_CODEC_MAX_COMPRESSED_BYTES];
+    int frame_size, n = sizeof(packet);
+    int i;
+
+    g_assert_cmpint(snd_codec_create(&encoder, SPICE_AUDIO_DATA_MODE_OPUS,
+                                     SND_CODEC_OPUS_PLAYBACK_FREQ,
+                                     SND_CODEC_ENCODE), ==, SND_CODEC_OK);
+    frame_size = snd_codec_frame_size(encoder);
+    for (i = 0; i < frame_size; i++) {
+        /* a 440Hz sawtooth */
+        pcm[2 * i] = pcm[2 * i + 1] = (i * 440 % 48000) * 20000 / 48000 - 10000;
+    }
+    g_assert_cmpint(snd_codec_encode(encoder, (guint8 *)pcm, frame_size * 4,
+                                     packet, &n), ==, SND_CODEC_OK);
+    snd_codec_destroy(&encoder);
+
+    return g_bytes_new(packet, n);
+}
+
+static void latency_run(gboolean use_worker, GBytes *packet)
+{
+    LatencyData data = { g_main_loop_new(NULL, FALSE), NULL, NULL, packet, };
+    SndCodec decoder = NULL;
+
+    g_assert_cmpint(snd_codec_create(&decoder, SPICE_AUDIO_DATA_MODE_OPUS,
+                                     SND_CODEC_OPUS_PLAYBACK_FREQ,
+                                     SND_CODEC_DECODE), ==, SND_CODEC_OK);
+    if (use_worker) {
+        SpiceAudioJob *job = spice_audio_job_new(SPICE_AUDIO_JOB_CODEC);
+
+        data.worker = spice_audio_worker_new("test-audio", SND_CODEC_DECODE, NULL,
+                                             latency_done, &data);
+        job->codec = decoder;
+        spice_audio_worker_push(data.worker, job);
+    } else {
+        data.decoder = decoder;
+    }
+
+    data.next_tick = g_get_monotonic_time() + TICK_MS * 1000;
+    g_timeout_add(TICK_MS, latency_tick, &data);
+    g_main_loop_run(data.loop);
+
+    g_test_message("audio-worker/%s: %u packets decoded, main loop lateness "
+                   "%.2f ms on average, %.2f ms at most",
+                   use_worker ? "thread" : "inline", data.decoded,
+                   data.total_lateness / 1000.0 / RUN_TICKS,
+                   data.max_lateness / 1000.0);
+    g_test_minimized_result(data.max_lateness / 1e6, "audio-worker/%s max lateness",
+                            use_worker ? "thread" : "inline");
+
+    spice_audio_worker_free(data.worker);
+    snd_codec_destroy(&data.decoder);
+    g_main_loop_unref(data.loop);
+}
+
+static void test_audio_worker_latency(void)
+{
+    GBytes *packet;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+    if (!snd_codec_is_capable(SPICE_AUDIO_DATA_MODE_OPUS, SND_CODEC_OPUS_PLAYBACK_FREQ)) {
+        g_test_skip("no Opus support");
+        return;
+    }
+
+    packet = opus_packet_new();
+    latency_run(FALSE, packet);
+    latency_run(TRUE, packet);
+    g_bytes_unref(packet);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/audio-worker/order", test_audio_worker_order);
+    g_test_add_func("/audio-worker/latency", test_audio_worker_latency);
+
+    return g_test_run();
+}
@@ -0,0 +1,48 @@
+#ifndef TESTS_BENCHMARK_H_
+#define TESTS_BENCHMARK_H_
+
+#include <glib.h>
+
+/* Each measurement is the best of BENCHMARK_ROUNDS rounds of about
+ * BENCHMARK_ROUND_TIME seconds, so that the numbers of two runs can be
+ * compared */
+#define BENCHMARK_ROUNDS 5
+#define BENCHMARK_ROUND_TIME 0.1
+
+typedef void (*BenchmarkFunc)(gpointer user_data);
+
+/* Measures @func, that processes @bytes bytes, or none, in @ops operations
+ * per call, and reports the time per operation and the throughput */
+static inline void benchmark_run(const gchar *name, gsize bytes, guint ops,
+                                 BenchmarkFunc func, gpointer user_data)
+{
+    GTimer *timer = g_timer_new();
+    gdouble elapsed, best = G_MAXDOUBLE;
+    guint n, i, round;
+
+    /* once to warm up the caches, once to know how many calls take a round */
+    func(user_data);
+    g_timer_start(timer);
+    func(user_data);
+    elapsed = MAX(g_timer_elapsed(timer, NULL), 1e-9);
+    n = CLAMP(BENCHMARK_ROUND_TIME / elapsed, 1, G_MAXINT);
+
+    for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+        g_timer_start(timer);
+        for (i = 0; i < n; i++) {
+            func(user_data);
+        }
+        best = MIN(best, g_timer_elapsed(timer, NULL) / n);
+    }
+    g_timer_destroy(timer);
+
+    if (bytes > 0) {
+        g_test_message("%s: %.0f ns per op, %.1f MB/s",
+                       name, best * 1e9 / ops, bytes / best / 1e6);
+    } else {
+        g_test_message("%s: %.1f ns per op", name, best * 1e9 / ops);
+    }
+    g_test_minimized_result(best / ops, "%s", name);
+}
+
+#endif /* TESTS_BENCHMARK_H_ */
@@ -0,0 +1,234 @@
+#include <math.h>
+#include <string.h>
+
+#include "spice-widget-priv.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+
+static cairo_surface_t *source_new(void)
+{
+    cairo_surface_t *source = cairo_image_surface_create(CAIRO_FORMAT_RGB24, WIDTH, HEIGHT);
+    guint32 *data = (guint32 *)cairo_image_surface_get_data(source);
+    gint stride = cairo_image_surface_get_stride(source) / 4;
+    gint x, y;
+
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            data[y * stride + x] = g_test_rand_int();
+    cairo_surface_mark_dirty(source);
+
+    return source;
+}
+
+static void source_change(cairo_surface_t *source, const cairo_rectangle_int_t *rect)
+{
+    guint32 *data = (guint32 *)cairo_image_surface_get_data(source);
+    gint stride = cairo_image_surface_get_stride(source) / 4;
+    gint x, y;
+
+    cairo_surface_flush(source);
+    for (y = rect->y; y < rect->y + rect->height; y++)
+        for (x = rect->x; x < rect->x + rect->width; x++)
+            data[y * stride + x] = g_test_rand_int();
+    cairo_surface_mark_dirty(source);
+}
+
+static cairo_surface_t *scaled_new(double s)
+{
+    return cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                      floor(WIDTH * s + 0.5), floor(HEIGHT * s + 0.5));
+}
+
+static void scaled_update_all(cairo_surface_t *scaled, cairo_surface_t *source, double s)
+{
+    cairo_rectangle_int_t all = {
+        0, 0,
+        cairo_image_surface_get_width(scaled), cairo_image_surface_get_height(scaled)
+    };
+    cairo_region_t *damage = cairo_region_create_rectangle(&all);
+
+    spice_cairo_scaled_update(scaled, source, s, 0, 0, damage);
+    cairo_region_destroy(damage);
+}
+
+/* the same as invalidate() in the widget */
+static void scaled_damage_add(cairo_region_t *damage, double s,
+                              const cairo_rectangle_int_t *rect)
+{
+    int x1 = floor(rect->x * s);
+    int y1 = floor(rect->y * s);
+    int x2 = ceil((rect->x + rect->width) * s);
+    int y2 = ceil((rect->y + rect->height) * s);
+
+    spice_cairo_scaled_damage_add(damage, s, x1, y1, x2 - x1, y2 - y1);
+}
+
+static void assert_surfaces_equal(cairo_surface_t *a, cairo_surface_t *b)
+{
+    gint height = cairo_image_surface_get_height(a);
+    gint stride = cairo_image_surface_get_stride(a);
+    gint row_size = cairo_image_surface_get_width(a) * 4;
+    gint y;
+
+    cairo_surface_flush(a);
+    cairo_surface_flush(b);
+    g_assert_cmpint(height, ==, cairo_image_surface_get_height(b));
+    g_assert_cmpint(stride, ==, cairo_image_surface_get_stride(b));
+    for (y = 0; y < height; y++) {
+        g_assert_cmpmem(cairo_image_surface_get_data(a) + y * stride, row_size,
+                        cairo_image_surface_get_data(b) + y * stride, row_size);
+    }
+}
+
+static void test_cairo_scaling_incremental(gconstpointer data)
+{
+    const double s = *(const double *)data;
+    const cairo_rectangle_int_t changes[] = {
+        { 0, 0, 1, 1 },
+        { 100, 100, 32, 32 },
+        { 333, 77, 401, 3 },
+        { WIDTH - 17, HEIGHT - 9, 17, 9 },
+    };
+    cairo_surface_t *source = source_new();
+    cairo_surface_t *incremental = scaled_new(s);
+    cairo_surface_t *full = scaled_new(s);
+    cairo_region_t *damage = cairo_region_create();
+    guint i;
+
+    scaled_update_all(incremental, source, s);
+
+    for (i = 0; i < G_N_ELEMENTS(changes); i++) {
+        source_change(source, &changes[i]);
+        scaled_damage_add(damage, s, &changes[i]);
+    }
+    spice_cairo_scaled_update(incremental, source, s, 0, 0, damage);
+
+    /* only updating the damage gives the same result as scaling it all */
+    scaled_update_all(full, source, s);
+    assert_surfaces_equal(incremental, full);
+
+    cairo_region_destroy(damage);
+    cairo_surface_destroy(full);
+    cairo_surface_destroy(incremental);
+    cairo_surface_destroy(source);
+}
+
+/* A draw of @rect to the window, scaling the canvas like before */
+static void draw_direct(cairo_t *window, cairo_surface_t *source, double s,
+                        const cairo_rectangle_int_t *rect)
+{
+    cairo_save(window);
+    cairo_rectangle(window, rect->x, rect->y, rect->width, rect->height);
+    cairo_clip(window);
+    cairo_scale(window, s, s);
+    cairo_set_source_surface(window, source, 0, 0);
+    cairo_paint(window);
+    cairo_restore(window);
+}
+
+/* The same draw, updating the backbuffer first and copying it */
+static void draw_backbuffer(cairo_t *window, cairo_surface_t *source,
+                            cairo_surface_t *scaled, double s,
+                            cairo_region_t *damage, const cairo_rectangle_int_t *rect)
+{
+    cairo_rectangle_int_t all = {
+        0, 0,
+        cairo_image_surface_get_width(scaled), cairo_image_surface_get_height(scaled)
+    };
+
+    spice_cairo_scaled_update(scaled, source, s, 0, 0, damage);
+    cairo_region_subtract_rectangle(damage, &all);
+
+    cairo_save(window);
+    cairo_rectangle(window, rect->x, rect->y, rect->width, rect->height);
+    cairo_clip(window);
+    cairo_set_source_surface(window, scaled, 0, 0);
+    cairo_paint(window);
+    cairo_restore(window);
+}
+
+typedef struct {
+    const gchar *name;
+    cairo_rectangle_int_t damage; /* in the canvas */
+    guint redraws; /* how many times the window redraws it, once it changed */
+} DamagePattern;
+
+static void test_cairo_scaling_benchmark(void)
+{
+    const double s = 0.75;
+    const DamagePattern patterns[] = {
+        /* typing: a small area changes and is drawn once */
+        { "text", { 200, 300, 16, 20 }, 1 },
+        /* a video playing in a window */
+        { "video", { 320, 180, 640, 360 }, 1 },
+        /* a static screen, redrawn for overlapping windows, tooltips... */
+        { "expose", { 0, 0, WIDTH, HEIGHT }, 10 },
+    };
+    const guint n = 100;
+    cairo_surface_t *source = source_new();
+    cairo_surface_t *scaled = scaled_new(s);
+    cairo_surface_t *window_surface = scaled_new(s);
+    cairo_t *window = cairo_create(window_surface);
+    cairo_region_t *damage = cairo_region_create();
+    GTimer *timer = g_timer_new();
+    guint i, j, k;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        goto end;
+    }
+
+    scaled_update_all(scaled, source, s);
+    for (i = 0; i < G_N_ELEMENTS(patterns); i++) {
+        const DamagePattern *p = &patterns[i];
+        cairo_rectangle_int_t drawn = {
+            floor(p->damage.x * s), floor(p->damage.y * s),
+            ceil(p->damage.width * s), ceil(p->damage.height * s),
+        };
+        gdouble direct, backbuffer;
+
+        g_timer_start(timer);
+        for (j = 0; j < n; j++) {
+            for (k = 0; k < p->redraws; k++)
+                draw_direct(window, source, s, &drawn);
+        }
+        cairo_surface_flush(window_surface);
+        direct = g_timer_elapsed(timer, NULL);
+
+        g_timer_start(timer);
+        for (j = 0; j < n; j++) {
+            scaled_damage_add(damage, s, &p->damage);
+            for (k = 0; k < p->redraws; k++)
+                draw_backbuffer(window, source, scaled, s, damage, &drawn);
+        }
+        cairo_surface_flush(window_surface);
+        backbuffer = g_timer_elapsed(timer, NULL);
+
+        g_test_message("%s: %.1f us per update with a backbuffer, %.1f us before",
+                       p->name, backbuffer * 1e6 / n, direct * 1e6 / n);
+    }
+
+end:
+    g_timer_destroy(timer);
+    cairo_region_destroy(damage);
+    cairo_destroy(window);
+    cairo_surface_destroy(window_surface);
+    cairo_surface_destroy(scaled);
+    cairo_surface_destroy(source);
+}
+
+int main(int argc, char* argv[])
+{
+    static const double downscale = 0.75, upscale = 1.5;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/cairo-scaling/incremental/downscale", &downscale,
+                         test_cairo_scaling_incremental);
+    g_test_add_data_func("/cairo-scaling/incremental/upscale", &upscale,
+                         test_cairo_scaling_incremental);
+    g_test_add_func("/cairo-scaling/benchmark", test_cairo_scaling_benchmark);
+
+    return g_test_run();
+}
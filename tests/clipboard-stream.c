@@ -0,0 +1,159 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "spice-clipboard-stream.h"
+
+/* the pieces of clipboard data passed on, put back together */
+typedef struct {
+    SpiceClipboardStream stream;
+    GByteArray *data;
+    guint pieces;
+    guint selection;
+    guint type;
+    guint total;
+} Receiver;
+
+/* a VD_AGENT_CLIPBOARD message, the agent message header excluded */
+static GByteArray *clipboard_message_new(gboolean has_selection, guint8 selection,
+                                         guint32 type, gsize size)
+{
+    GByteArray *message = g_byte_array_new();
+    guint8 selection_header[4] = { selection, 0, 0, 0 };
+    VDAgentClipboard cb = { .type = type };
+    gsize i;
+
+    if (has_selection)
+        g_byte_array_append(message, selection_header, sizeof(selection_header));
+    g_byte_array_append(message, (const guint8 *)&cb, sizeof(cb));
+    for (i = 0; i < size; i++) {
+        guint8 c = i * 13 + 1;
+
+        g_byte_array_append(message, &c, 1);
+    }
+
+    return message;
+}
+
+static void receiver_init(Receiver *receiver, GByteArray *message, gboolean has_selection)
+{
+    memset(receiver, 0, sizeof(*receiver));
+    spice_clipboard_stream_init(&receiver->stream, message->len, has_selection);
+    receiver->data = g_byte_array_new();
+}
+
+static void receiver_feed(Receiver *receiver, const guint8 *data, gsize size)
+{
+    guint selection, type, total;
+
+    if (!spice_clipboard_stream_feed(&receiver->stream, &data, &size))
+        return;
+
+    spice_clipboard_stream_get_header(&receiver->stream, &selection, &type, &total);
+    if (receiver->pieces > 0) {
+        g_assert_cmpuint(selection, ==, receiver->selection);
+        g_assert_cmpuint(type, ==, receiver->type);
+        g_assert_cmpuint(total, ==, receiver->total);
+    }
+    receiver->selection = selection;
+    receiver->type = type;
+    receiver->total = total;
+    receiver->pieces++;
+    g_byte_array_append(receiver->data, data, size);
+}
+
+/* feeds @message in pieces of @chunk bytes */
+static void receiver_feed_message(Receiver *receiver, GByteArray *message, gsize chunk)
+{
+    gsize offset;
+
+    for (offset = 0; offset < message->len; offset += chunk)
+        receiver_feed(receiver, message->data + offset, MIN(chunk, message->len - offset));
+}
+
+static void test_clipboard_stream_chunks(void)
+{
+    const gsize size = 5000;
+    gsize chunk;
+    int has_selection;
+
+    for (has_selection = 0; has_selection <= 1; has_selection++) {
+        GByteArray *message = clipboard_message_new(has_selection,
+                                                    VD_AGENT_CLIPBOARD_SELECTION_PRIMARY,
+                                                    VD_AGENT_CLIPBOARD_IMAGE_PNG, size);
+        gsize header_size = message->len - size;
+
+        /* the header is split at every offset, the data in many pieces */
+        for (chunk = 1; chunk <= message->len; chunk = chunk < 64 ? chunk + 1 : chunk * 3) {
+            Receiver receiver;
+
+            receiver_init(&receiver, message, has_selection);
+            receiver_feed_message(&receiver, message, chunk);
+
+            g_assert_cmpuint(receiver.pieces, >, 0);
+            g_assert_cmpuint(receiver.selection, ==,
+                             has_selection ? VD_AGENT_CLIPBOARD_SELECTION_PRIMARY :
+                                             VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD);
+            g_assert_cmpuint(receiver.type, ==, VD_AGENT_CLIPBOARD_IMAGE_PNG);
+            g_assert_cmpuint(receiver.total, ==, size);
+            /* all the data, in order */
+            g_assert_cmpuint(receiver.data->len, ==, size);
+            g_assert_true(memcmp(receiver.data->data, message->data + header_size, size) == 0);
+            g_byte_array_unref(receiver.data);
+        }
+        g_byte_array_unref(message);
+    }
+}
+
+static void test_clipboard_stream_empty(void)
+{
+    GByteArray *message = clipboard_message_new(TRUE, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                 VD_AGENT_CLIPBOARD_UTF8_TEXT, 0);
+    Receiver receiver;
+    gsize chunk;
+
+    /* empty data is reported once, when the header is complete */
+    for (chunk = 1; chunk <= message->len; chunk++) {
+        receiver_init(&receiver, message, TRUE);
+        receiver_feed_message(&receiver, message, chunk);
+        /* and a piece without data after it is not reported */
+        receiver_feed(&receiver, message->data, 0);
+
+        g_assert_cmpuint(receiver.pieces, ==, 1);
+        g_assert_cmpuint(receiver.type, ==, VD_AGENT_CLIPBOARD_UTF8_TEXT);
+        g_assert_cmpuint(receiver.total, ==, 0);
+        g_assert_cmpuint(receiver.data->len, ==, 0);
+        g_byte_array_unref(receiver.data);
+    }
+
+    g_byte_array_unref(message);
+}
+
+static void test_clipboard_stream_truncated(void)
+{
+    GByteArray *message = clipboard_message_new(TRUE, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                 VD_AGENT_CLIPBOARD_UTF8_TEXT, 0);
+    Receiver receiver;
+
+    /* a message too short for its header has nothing to pass on */
+    g_byte_array_set_size(message, message->len - 1);
+    receiver_init(&receiver, message, TRUE);
+    receiver_feed_message(&receiver, message, 1);
+    receiver_feed_message(&receiver, message, message->len);
+    g_assert_cmpuint(receiver.pieces, ==, 0);
+
+    g_byte_array_unref(receiver.data);
+    g_byte_array_unref(message);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/clipboard-stream/chunks", test_clipboard_stream_chunks);
+    g_test_add_func("/clipboard-stream/empty", test_clipboard_stream_empty);
+    g_test_add_func("/clipboard-stream/truncated", test_clipboard_stream_truncated);
+
+    return g_test_run();
+}
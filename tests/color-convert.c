@@ -0,0 +1,79 @@
+#include "spice-widget-priv.h"
+#include "benchmark.h"
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+static void test_color_convert(void)
+{
+    const guint16 src[] = { 0x0000, 0xffff, 0xf800, 0x07e0, 0x001f, 0x7c00, 0x03e0 };
+    guint32 dest[G_N_ELEMENTS(src)];
+
+    spice_display_color_convert(SPICE_SURFACE_FMT_16_565, dest, 0,
+                                src, 0, 5, 1);
+    g_assert_cmphex(dest[0], ==, 0x000000);
+    g_assert_cmphex(dest[1], ==, 0xffffff);
+    g_assert_cmphex(dest[2], ==, 0xff0000);
+    g_assert_cmphex(dest[3], ==, 0x00ff00);
+    g_assert_cmphex(dest[4], ==, 0x0000ff);
+
+    spice_display_color_convert(SPICE_SURFACE_FMT_16_555, dest, 0,
+                                src, 0, G_N_ELEMENTS(src), 1);
+    g_assert_cmphex(dest[0], ==, 0x000000);
+    g_assert_cmphex(dest[4], ==, 0x0000ff);
+    g_assert_cmphex(dest[5], ==, 0xff0000);
+    g_assert_cmphex(dest[6], ==, 0x00ff00);
+}
+
+typedef struct {
+    gint format;
+    guint16 *src;
+    guint32 *dest;
+} ConvertData;
+
+static void convert_frame(gpointer user_data)
+{
+    ConvertData *data = user_data;
+
+    spice_display_color_convert(data->format, data->dest, WIDTH,
+                                data->src, WIDTH, WIDTH, HEIGHT);
+}
+
+static void test_color_convert_benchmark(void)
+{
+    GRand *rand = g_rand_new_with_seed(42);
+    ConvertData data = {
+        .src = g_new(guint16, WIDTH * HEIGHT),
+        .dest = g_new(guint32, WIDTH * HEIGHT),
+    };
+    guint i;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        goto end;
+    }
+
+    for (i = 0; i < WIDTH * HEIGHT; i++) {
+        data.src[i] = g_rand_int(rand);
+    }
+
+    data.format = SPICE_SURFACE_FMT_16_565;
+    benchmark_run("color-convert/565", WIDTH * HEIGHT * 2, 1, convert_frame, &data);
+    data.format = SPICE_SURFACE_FMT_16_555;
+    benchmark_run("color-convert/555", WIDTH * HEIGHT * 2, 1, convert_frame, &data);
+
+end:
+    g_free(data.src);
+    g_free(data.dest);
+    g_rand_free(rand);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/color-convert/formats", test_color_convert);
+    g_test_add_func("/color-convert/benchmark", test_color_convert_benchmark);
+
+    return g_test_run();
+}
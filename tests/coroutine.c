@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifndef G_OS_WIN32
+#include <sys/socket.h>
+#endif
 
 #include "coroutine.h"
+#include "gio-coroutine.h"
 
 static gpointer co_entry_check_self(gpointer data)
 {
@@ -120,6 +124,497 @@ static void test_coroutine_yield(void)
     g_test_assert_expected_messages();
 }
 
+/* A minimal object with a signal, to emit from coroutines */
+typedef struct { GObject parent; } TestEmitter;
+typedef struct { GObjectClass parent_class; } TestEmitterClass;
+
+static GType test_emitter_get_type(void);
+G_DEFINE_TYPE(TestEmitter, test_emitter, G_TYPE_OBJECT)
+
+static guint test_emitter_signal;
+
+static void test_emitter_init(TestEmitter *self G_GNUC_UNUSED)
+{
+}
+
+static void test_emitter_class_init(TestEmitterClass *klass)
+{
+    test_emitter_signal = g_signal_new("value", G_OBJECT_CLASS_TYPE(klass),
+                                       G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+                                       g_cclosure_marshal_VOID__INT,
+                                       G_TYPE_NONE, 1, G_TYPE_INT);
+}
+
+typedef struct {
+    GObject *emitter;
+    guint n_signals;
+    gboolean batched;
+    GArray *received;
+    guint destroyed;
+} EmitData;
+
+static void value_cb(GObject *emitter G_GNUC_UNUSED, gint value, gpointer user_data)
+{
+    EmitData *data = user_data;
+
+    g_assert(coroutine_self_is_main());
+    g_array_append_val(data->received, value);
+}
+
+static void emit_data_destroy(gpointer user_data)
+{
+    EmitData *data = user_data;
+
+    data->destroyed++;
+}
+
+static gpointer co_entry_emit(gpointer opaque)
+{
+    EmitData *data = opaque;
+    guint i;
+
+    for (i = 0; i < data->n_signals; i++) {
+        if (data->batched)
+            g_coroutine_signal_emit_batched(data->emitter, test_emitter_signal, 0,
+                                            data, emit_data_destroy, i);
+        else
+            g_coroutine_signal_emit(data->emitter, test_emitter_signal, 0, i);
+    }
+    g_coroutine_signal_batch_end(g_coroutine_self());
+
+    return NULL;
+}
+
+static gpointer co_entry_emit_mixed(gpointer opaque)
+{
+    EmitData *data = opaque;
+
+    g_coroutine_signal_emit_batched(data->emitter, test_emitter_signal, 0, NULL, NULL, 0);
+    g_coroutine_signal_emit_batched(data->emitter, test_emitter_signal, 0, NULL, NULL, 1);
+    g_coroutine_signal_emit(data->emitter, test_emitter_signal, 0, 2);
+    g_coroutine_signal_emit_batched(data->emitter, test_emitter_signal, 0, NULL, NULL, 3);
+    g_coroutine_signal_batch_end(g_coroutine_self());
+
+    return NULL;
+}
+
+/* runs the coroutine and the main context until all signals were emitted */
+static gdouble run_emit(EmitData *data, gpointer (*entry)(gpointer))
+{
+    GCoroutine co = {
+        .coroutine = {
+            .stack_size = 16 << 20,
+            .entry = entry,
+        },
+    };
+    GTimer *timer = g_timer_new();
+    gdouble elapsed;
+    gulong id;
+
+    id = g_signal_connect(data->emitter, "value", G_CALLBACK(value_cb), data);
+
+    coroutine_init(&co.coroutine);
+    coroutine_yieldto(&co.coroutine, data);
+    while (!co.coroutine.exited)
+        g_main_context_iteration(NULL, TRUE);
+    while (g_main_context_iteration(NULL, FALSE));
+
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    g_signal_handler_disconnect(data->emitter, id);
+
+    return elapsed;
+}
+
+static void emit_data_init(EmitData *data, guint n_signals, gboolean batched)
+{
+    data->emitter = g_object_new(test_emitter_get_type(), NULL);
+    data->n_signals = n_signals;
+    data->batched = batched;
+    data->received = g_array_new(FALSE, FALSE, sizeof(gint));
+    data->destroyed = 0;
+}
+
+static void emit_data_clear(EmitData *data)
+{
+    g_object_unref(data->emitter);
+    g_array_unref(data->received);
+}
+
+static void test_coroutine_signal_batched(void)
+{
+    EmitData data;
+    guint i;
+
+    /* more than fit in a single batch */
+    emit_data_init(&data, 1000, TRUE);
+    run_emit(&data, co_entry_emit);
+
+    g_assert_cmpuint(data.received->len, ==, 1000);
+    for (i = 0; i < data.received->len; i++)
+        g_assert_cmpint(g_array_index(data.received, gint, i), ==, i);
+    g_assert_cmpuint(data.destroyed, ==, 1000);
+    emit_data_clear(&data);
+
+    /* batched and synchronous signals are emitted in order */
+    emit_data_init(&data, 0, TRUE);
+    run_emit(&data, co_entry_emit_mixed);
+
+    g_assert_cmpuint(data.received->len, ==, 4);
+    for (i = 0; i < data.received->len; i++)
+        g_assert_cmpint(g_array_index(data.received, gint, i), ==, i);
+    emit_data_clear(&data);
+}
+
+static void test_coroutine_signal_benchmark(void)
+{
+    EmitData data;
+    gdouble sync, batched;
+    const guint n = 100000;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+
+    emit_data_init(&data, n, FALSE);
+    sync = run_emit(&data, co_entry_emit);
+    g_assert_cmpuint(data.received->len, ==, n);
+    emit_data_clear(&data);
+
+    emit_data_init(&data, n, TRUE);
+    batched = run_emit(&data, co_entry_emit);
+    g_assert_cmpuint(data.received->len, ==, n);
+    emit_data_clear(&data);
+
+    g_test_maximized_result(n / batched, "batched: %.0f signals/s", n / batched);
+    g_test_message("synchronous: %.0f signals/s", n / sync);
+}
+
+static gpointer co_entry_nop(gpointer data)
+{
+    return data;
+}
+
+static void test_coroutine_stack_pool(void)
+{
+    struct coroutine_stack_stats before, after;
+    struct coroutine co = {
+        .stack_size = 1 << 20,
+        .entry = co_entry_nop,
+    };
+
+    if (!WITH_UCONTEXT) {
+        g_test_skip("stacks are only pooled with ucontext coroutines");
+        return;
+    }
+
+    coroutine_init(&co);
+    coroutine_yieldto(&co, NULL);
+    g_assert_true(co.exited);
+
+    /* the next coroutine of the same size reuses the stack */
+    coroutine_stack_get_stats(&before);
+    g_assert_cmpuint(before.pooled, >, 0);
+    memset(&co, 0, sizeof(co));
+    co.stack_size = 1 << 20;
+    co.entry = co_entry_nop;
+    coroutine_init(&co);
+    coroutine_stack_get_stats(&after);
+    g_assert_cmpuint(after.reused, ==, before.reused + 1);
+    g_assert_cmpuint(after.allocated, ==, before.allocated);
+    coroutine_yieldto(&co, NULL);
+}
+
+#define STACK_USAGE_FRAME (64 << 10)
+
+static gsize co_stack_deep(guint depth)
+{
+    volatile guint8 frame[STACK_USAGE_FRAME / 4];
+
+    memset((guint8 *)frame, 0, sizeof(frame));
+    if (depth > 1)
+        return co_stack_deep(depth - 1) + frame[0];
+
+    return coroutine_stack_used(coroutine_self());
+}
+
+static gpointer co_entry_stack_used(gpointer data G_GNUC_UNUSED)
+{
+    return GSIZE_TO_POINTER(co_stack_deep(4));
+}
+
+static void test_coroutine_stack_used(void)
+{
+    struct coroutine co = {
+        .stack_size = 4 << 20,
+        .entry = co_entry_stack_used,
+    };
+    gsize used;
+
+    coroutine_init(&co);
+    used = GPOINTER_TO_SIZE(coroutine_yieldto(&co, NULL));
+    if (used == 0) {
+        g_test_skip("stack usage is not available");
+        return;
+    }
+    g_assert_cmpuint(used, >=, STACK_USAGE_FRAME);
+    g_assert_cmpuint(used, <, co.stack_size);
+}
+
+/* The statm size in pages of the resident set, 0 if unknown */
+static gsize get_rss(void)
+{
+    gchar *statm = NULL;
+    gsize rss = 0;
+
+    if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+        gchar **fields = g_strsplit(statm, " ", 3);
+
+        if (fields[0] != NULL && fields[1] != NULL)
+            rss = g_ascii_strtoull(fields[1], NULL, 10);
+        g_strfreev(fields);
+        g_free(statm);
+    }
+
+    return rss;
+}
+
+static gpointer co_entry_touch_stack(gpointer data G_GNUC_UNUSED)
+{
+    /* roughly what a channel does while linking */
+    co_stack_deep(2);
+    coroutine_yield(NULL);
+
+    return NULL;
+}
+
+#define BENCHMARK_CHANNELS 10
+
+static void test_coroutine_stack_benchmark(void)
+{
+    /* the channels of a session, connecting again and again */
+    const guint n_rounds = 100;
+    struct coroutine co[BENCHMARK_CHANNELS];
+    struct coroutine_stack_stats stats;
+    gsize rss_before, rss_after;
+    GTimer *timer;
+    guint i, j;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+
+    rss_before = get_rss();
+    timer = g_timer_new();
+    for (i = 0; i < n_rounds; i++) {
+        for (j = 0; j < BENCHMARK_CHANNELS; j++) {
+            memset(&co[j], 0, sizeof(co[j]));
+            co[j].stack_size = 16 << 20;
+            co[j].entry = co_entry_touch_stack;
+            coroutine_init(&co[j]);
+            coroutine_yieldto(&co[j], NULL);
+        }
+        for (j = 0; j < BENCHMARK_CHANNELS; j++)
+            coroutine_yieldto(&co[j], NULL);
+    }
+    g_timer_stop(timer);
+    rss_after = get_rss();
+    coroutine_stack_get_stats(&stats);
+
+    g_test_minimized_result(g_timer_elapsed(timer, NULL) * 1e6 / (n_rounds * BENCHMARK_CHANNELS),
+                            "coroutine bring-up: %.1f us",
+                            g_timer_elapsed(timer, NULL) * 1e6 / (n_rounds * BENCHMARK_CHANNELS));
+    g_test_message("stacks allocated: %u, reused: %u, pooled: %u",
+                   stats.allocated, stats.reused, stats.pooled);
+    g_test_message("resident set growth: %" G_GSIZE_FORMAT " pages",
+                   rss_after > rss_before ? rss_after - rss_before : 0);
+    g_timer_destroy(timer);
+}
+
+#ifndef G_OS_WIN32
+typedef struct {
+    GSocket *sock;
+    GSocket *peer;
+    guint n_waits;
+    gboolean oneshot;
+    guint woken;
+} SocketWaitData;
+
+static gboolean oneshot_wait_helper(GSocket *sock G_GNUC_UNUSED,
+                                    GIOCondition cond, gpointer data)
+{
+    coroutine_yieldto(data, &cond);
+    return FALSE;
+}
+
+/* how g_coroutine_socket_wait() used to wait, with a new source each time */
+static GIOCondition oneshot_socket_wait(GCoroutine *self, GSocket *sock, GIOCondition cond)
+{
+    GIOCondition *ret;
+    GSource *src;
+
+    src = g_socket_create_source(sock, cond | G_IO_HUP | G_IO_ERR | G_IO_NVAL, NULL);
+    g_source_set_callback(src, (GSourceFunc)oneshot_wait_helper, &self->coroutine, NULL);
+    g_source_attach(src, self->context);
+    ret = coroutine_yield(NULL);
+    g_source_unref(src);
+
+    return *ret;
+}
+
+static gpointer co_entry_socket_wait(gpointer opaque)
+{
+    SocketWaitData *data = opaque;
+    GCoroutine *self = g_coroutine_self();
+    guint i;
+
+    for (i = 0; i < data->n_waits; i++) {
+        GIOCondition cond;
+        gchar c;
+
+        if (data->oneshot)
+            cond = oneshot_socket_wait(self, data->sock, G_IO_IN);
+        else
+            cond = g_coroutine_socket_wait(self, data->sock, G_IO_IN);
+        g_assert_true(cond & G_IO_IN);
+        g_assert_cmpint(g_socket_receive(data->sock, &c, 1, NULL, NULL), ==, 1);
+        data->woken++;
+    }
+
+    return NULL;
+}
+
+static void socket_wait_data_init(SocketWaitData *data, guint n_waits, gboolean oneshot)
+{
+    GError *error = NULL;
+    int fds[2];
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    data->sock = g_socket_new_from_fd(fds[0], &error);
+    g_assert_no_error(error);
+    data->peer = g_socket_new_from_fd(fds[1], &error);
+    g_assert_no_error(error);
+    g_socket_set_blocking(data->sock, FALSE);
+    data->n_waits = n_waits;
+    data->oneshot = oneshot;
+    data->woken = 0;
+}
+
+static void socket_wait_data_clear(SocketWaitData *data)
+{
+    g_object_unref(data->sock);
+    g_object_unref(data->peer);
+}
+
+/* wakes the coroutine up once per iteration of the main context */
+static gdouble run_socket_wait(SocketWaitData *data)
+{
+    GCoroutine co = {
+        .coroutine = {
+            .stack_size = 16 << 20,
+            .entry = co_entry_socket_wait,
+        },
+    };
+    GTimer *timer = g_timer_new();
+    gdouble elapsed;
+
+    coroutine_init(&co.coroutine);
+    coroutine_yieldto(&co.coroutine, data);
+    while (!co.coroutine.exited) {
+        g_assert_cmpint(g_socket_send(data->peer, "x", 1, NULL, NULL), ==, 1);
+        g_main_context_iteration(NULL, TRUE);
+    }
+
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    g_coroutine_clear(&co);
+    g_assert_cmpuint(data->woken, ==, data->n_waits);
+
+    return elapsed;
+}
+
+static gpointer co_entry_socket_wakeup(gpointer opaque)
+{
+    SocketWaitData *data = opaque;
+    GCoroutine *self = g_coroutine_self();
+    GSource *poll_source;
+
+    /* woken up by g_coroutine_wakeup() */
+    g_assert_cmpint(g_coroutine_socket_wait(self, data->sock, G_IO_IN), ==, 0);
+    poll_source = self->poll_source;
+    g_assert_nonnull(poll_source);
+
+    /* and then by the socket, through the same source */
+    g_assert_true(g_coroutine_socket_wait(self, data->sock, G_IO_IN) & G_IO_IN);
+    g_assert_true(self->poll_source == poll_source);
+    g_assert_true(g_coroutine_socket_wait(self, data->sock, G_IO_OUT) & G_IO_OUT);
+    g_assert_true(self->poll_source == poll_source);
+    data->woken++;
+
+    return NULL;
+}
+
+static void test_coroutine_socket_wait(void)
+{
+    GCoroutine co = {
+        .coroutine = {
+            .stack_size = 16 << 20,
+            .entry = co_entry_socket_wakeup,
+        },
+    };
+    SocketWaitData data;
+
+    socket_wait_data_init(&data, 0, FALSE);
+
+    coroutine_init(&co.coroutine);
+    coroutine_yieldto(&co.coroutine, &data);
+    g_assert_cmpuint(co.wait_id, !=, 0);
+    g_coroutine_wakeup(&co);
+
+    /* nothing to read yet */
+    g_assert_false(g_main_context_iteration(NULL, FALSE));
+    g_assert_cmpint(g_socket_send(data.peer, "x", 1, NULL, NULL), ==, 1);
+    while (!co.coroutine.exited)
+        g_main_context_iteration(NULL, TRUE);
+    g_assert_cmpuint(data.woken, ==, 1);
+
+    /* once idle, the source doesn't poll the socket anymore */
+    g_assert_cmpint(g_socket_send(data.peer, "x", 1, NULL, NULL), ==, 1);
+    g_assert_false(g_main_context_iteration(NULL, FALSE));
+
+    g_coroutine_clear(&co);
+    g_assert_null(co.poll_source);
+    socket_wait_data_clear(&data);
+}
+
+static void test_coroutine_socket_wait_benchmark(void)
+{
+    const guint n = 100000;
+    SocketWaitData data;
+    gdouble persistent, oneshot;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+
+    socket_wait_data_init(&data, n, FALSE);
+    persistent = run_socket_wait(&data);
+    socket_wait_data_clear(&data);
+
+    socket_wait_data_init(&data, n, TRUE);
+    oneshot = run_socket_wait(&data);
+    socket_wait_data_clear(&data);
+
+    g_test_maximized_result(n / persistent, "persistent source: %.0f wakeups/s", n / persistent);
+    g_test_message("source per wait: %.0f wakeups/s", n / oneshot);
+    g_test_message("main context overhead: %.2f us per wakeup, was %.2f us",
+                   persistent * 1e6 / n, oneshot * 1e6 / n);
+}
+#endif
+
 int main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -127,6 +622,15 @@ int main(int argc, char* argv[])
     g_test_add_func("/coroutine/simple", test_coroutine_simple);
     g_test_add_func("/coroutine/two", test_coroutine_two);
     g_test_add_func("/coroutine/yield", test_coroutine_yield);
+    g_test_add_func("/coroutine/signal-batched", test_coroutine_signal_batched);
+    g_test_add_func("/coroutine/signal-benchmark", test_coroutine_signal_benchmark);
+    g_test_add_func("/coroutine/stack-pool", test_coroutine_stack_pool);
+    g_test_add_func("/coroutine/stack-used", test_coroutine_stack_used);
+    g_test_add_func("/coroutine/stack-benchmark", test_coroutine_stack_benchmark);
+#ifndef G_OS_WIN32
+    g_test_add_func("/coroutine/socket-wait", test_coroutine_socket_wait);
+    g_test_add_func("/coroutine/socket-wait-benchmark", test_coroutine_socket_wait_benchmark);
+#endif
 
     return g_test_run ();
 }
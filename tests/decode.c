@@ -0,0 +1,653 @@
+#include "config.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#include <zlib.h>
+
+#include "decode.h"
+#include "common/canvas_utils.h"
+#include "common/lz_common.h"
+#include "spice-channel-cache.h"
+#include "channel-cursor-priv.h"
+#include "benchmark.h"
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+/* Synthetic corpora, generated the same way on each run */
+typedef enum {
+    /* windows with text on a plain background */
+    IMAGE_DESKTOP,
+    /* gradients with noise, that barely compress */
+    IMAGE_PHOTO,
+} ImageKind;
+
+static const gchar *image_names[] = { "desktop", "photo" };
+
+static guint32 *image_new(ImageKind kind)
+{
+    guint32 *pixels = g_new(guint32, WIDTH * HEIGHT);
+    GRand *rand = g_rand_new_with_seed(42);
+    gint x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            guint32 *p = &pixels[y * WIDTH + x];
+
+            if (kind == IMAGE_PHOTO) {
+                *p = ((x * 255 / WIDTH) << 16 | (y * 255 / HEIGHT) << 8 |
+                      ((x + y) & 0xff)) ^ (g_rand_int(rand) & 0x070707);
+            } else if (x < 100 || x >= WIDTH - 100 || y < 80 || y >= HEIGHT - 80) {
+                *p = 0x3465a4;
+            } else if ((y - 80) % 20 < 12 && (x - 100) % 8 < 6) {
+                /* glyphs of random shape, a line of text after another */
+                *p = g_rand_int_range(rand, 0, 3) ? 0xffffff : 0x000000;
+            } else {
+                *p = 0xffffff;
+            }
+        }
+    }
+    g_rand_free(rand);
+
+    return pixels;
+}
+
+/* ---------------------------------------------------------------- */
+
+static void put_8(GByteArray *out, guint8 v)
+{
+    g_byte_array_append(out, &v, 1);
+}
+
+static void put_32(GByteArray *out, guint32 v)
+{
+    put_8(out, v >> 24);
+    put_8(out, v >> 16);
+    put_8(out, v >> 8);
+    put_8(out, v);
+}
+
+static void glz_put_literals(GByteArray *out, const guint32 *pixels, gint n)
+{
+    while (n > 0) {
+        gint i, count = MIN(n, MAX_COPY);
+
+        put_8(out, count - 1);
+        for (i = 0; i < count; i++) {
+            put_8(out, pixels[i]);
+            put_8(out, pixels[i] >> 8);
+            put_8(out, pixels[i] >> 16);
+        }
+        pixels += count;
+        n -= count;
+    }
+}
+
+/* a reference to the pixels @dist before, in the same image */
+static void glz_put_reference(GByteArray *out, guint32 dist, guint32 len)
+{
+    guint32 ofs = dist - 1;
+    gboolean long_ofs = ofs >= (1 << 12);
+
+    g_assert_cmpuint(ofs, <, 1 << 17);
+
+    put_8(out, (MIN(len, 7) << 5) | (long_ofs << 4) | (ofs & 0x0f));
+    if (len >= 7) {
+        len -= 7;
+        for (; len >= 255; len -= 255) {
+            put_8(out, 255);
+        }
+        put_8(out, len);
+    }
+    put_8(out, ofs >> 4);
+    put_8(out, long_ofs ? (ofs >> 12) & 0x1f : 0);
+}
+
+static guint32 match_length(const guint32 *pixels, gint pos, gint dist, gint total)
+{
+    gint len = 0;
+
+    while (pos + len < total &&
+           ((pixels[pos + len] ^ pixels[pos + len - dist]) & 0xffffff) == 0) {
+        len++;
+    }
+
+    return len;
+}
+
+/* A minimal GLZ encoder for RGB32 images that only refer to themselves: it
+ * emits runs, copies of the row above and literals */
+static GBytes *glz_encode(const guint32 *pixels, guint64 id)
+{
+    GByteArray *out = g_byte_array_new();
+    gint total = WIDTH * HEIGHT;
+    gint pos = 0, literals = 0;
+
+    put_32(out, LZ_MAGIC);
+    put_32(out, LZ_VERSION);
+    put_8(out, LZ_IMAGE_TYPE_RGB32 | (1 << LZ_IMAGE_TYPE_LOG)); /* top down */
+    put_32(out, WIDTH);
+    put_32(out, HEIGHT);
+    put_32(out, WIDTH * 4);
+    put_32(out, id >> 32);
+    put_32(out, id);
+    put_32(out, 0); /* the window only holds this image */
+
+    while (pos < total) {
+        guint32 run = pos >= 1 ? match_length(pixels, pos, 1, total) : 0;
+        guint32 up = pos >= WIDTH ? match_length(pixels, pos, WIDTH, total) : 0;
+
+        if (MAX(run, up) < 2) {
+            pos++;
+            continue;
+        }
+        glz_put_literals(out, pixels + literals, pos - literals);
+        glz_put_reference(out, up > run ? WIDTH : 1, MAX(run, up));
+        pos += MAX(run, up);
+        literals = pos;
+    }
+    glz_put_literals(out, pixels + literals, pos - literals);
+
+    return g_byte_array_free_to_bytes(out);
+}
+
+static GBytes *zlib_encode(const guint32 *pixels)
+{
+    uLongf size = compressBound(WIDTH * HEIGHT * 4);
+    guint8 *data = g_malloc(size);
+
+    g_assert_cmpint(compress2(data, &size, (const Bytef *)pixels,
+                              WIDTH * HEIGHT * 4, Z_DEFAULT_COMPRESSION), ==, Z_OK);
+
+    return g_bytes_new_take(data, size);
+}
+
+static GBytes *jpeg_encode(const guint32 *pixels)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    guint8 *row = g_malloc(WIDTH * 3);
+    unsigned char *data = NULL;
+    unsigned long size = 0;
+    GBytes *bytes;
+    gint x;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &data, &size);
+    cinfo.image_width = WIDTH;
+    cinfo.image_height = HEIGHT;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 80, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < HEIGHT) {
+        const guint32 *p = pixels + cinfo.next_scanline * WIDTH;
+
+        for (x = 0; x < WIDTH; x++) {
+            row[x * 3] = p[x] >> 16;
+            row[x * 3 + 1] = p[x] >> 8;
+            row[x * 3 + 2] = p[x];
+        }
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    bytes = g_bytes_new(data, size);
+    free(data);
+    g_free(row);
+
+    return bytes;
+}
+
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    SpiceGlzDecoderWindow *window;
+    SpiceGlzDecoder *decoder;
+    guint64 id;
+    guint8 *data;
+    pixman_image_t *decoded;
+} GlzData;
+
+static void glz_decode_one(gpointer user_data)
+{
+    GlzData *glz = user_data;
+    LzDecodeUsrData usr = { NULL, };
+    guint8 *id = glz->data + 21;
+    gint i;
+
+    /* each image gets a new id, the window releases the previous one */
+    for (i = 0; i < 8; i++) {
+        id[i] = glz->id >> (56 - 8 * i);
+    }
+    glz->id++;
+
+    glz->decoder->ops->decode(glz->decoder, glz->data, NULL, &usr);
+    if (glz->decoded != NULL)
+        pixman_image_unref(glz->decoded);
+    glz->decoded = usr.out_surface;
+}
+
+static void glz_data_init(GlzData *glz, GBytes *encoded)
+{
+    glz->window = glz_decoder_window_new();
+    glz->decoder = glz_decoder_new(glz->window);
+    glz->id = 0;
+    glz->data = g_memdup(g_bytes_get_data(encoded, NULL), g_bytes_get_size(encoded));
+    glz->decoded = NULL;
+}
+
+static void glz_data_clear(GlzData *glz)
+{
+    if (glz->decoded != NULL)
+        pixman_image_unref(glz->decoded);
+    glz_decoder_destroy(glz->decoder);
+    glz_decoder_window_destroy(glz->window);
+    g_free(glz->data);
+}
+
+static void assert_pixels_equal(const guint32 *decoded, gint stride, const guint32 *pixels)
+{
+    gint x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            g_assert_cmphex(decoded[y * stride + x] & 0xffffff, ==,
+                            pixels[y * WIDTH + x] & 0xffffff);
+        }
+    }
+}
+
+static void test_decode_glz(void)
+{
+    ImageKind kind;
+
+    for (kind = IMAGE_DESKTOP; kind <= IMAGE_PHOTO; kind++) {
+        guint32 *pixels = image_new(kind);
+        GBytes *encoded = glz_encode(pixels, 0);
+        GlzData glz;
+
+        glz_data_init(&glz, encoded);
+        glz_decode_one(&glz);
+        glz_decode_one(&glz);
+        g_assert_nonnull(glz.decoded);
+        g_assert_cmpint(pixman_image_get_width(glz.decoded), ==, WIDTH);
+        g_assert_cmpint(pixman_image_get_height(glz.decoded), ==, HEIGHT);
+        assert_pixels_equal(pixman_image_get_data(glz.decoded),
+                            pixman_image_get_stride(glz.decoded) / 4, pixels);
+
+        glz_data_clear(&glz);
+        g_bytes_unref(encoded);
+        g_free(pixels);
+    }
+}
+
+static void surface_destroyed(pixman_image_t *image G_GNUC_UNUSED, void *data)
+{
+    (*(guint *)data)++;
+}
+
+/* When the session connects again, the image ids start over, and the
+ * window must release the old images like the first time */
+static void test_decode_glz_window_clear(void)
+{
+    guint32 *pixels = image_new(IMAGE_DESKTOP);
+    GBytes *encoded = glz_encode(pixels, 0);
+    GlzData glz;
+    guint destroyed;
+    guint i, round;
+
+    glz_data_init(&glz, encoded);
+    for (round = 0; round < 2; round++) {
+        if (glz.decoded != NULL) {
+            pixman_image_unref(glz.decoded);
+            glz.decoded = NULL;
+        }
+        glz_decoder_window_clear(glz.window);
+        glz.id = 0;
+        destroyed = 0;
+        for (i = 0; i < 4; i++) {
+            glz_decode_one(&glz);
+            pixman_image_set_destroy_function(glz.decoded, surface_destroyed, &destroyed);
+        }
+        /* only the last image is still held, by the window and by us */
+        g_assert_cmpuint(destroyed, ==, 3);
+    }
+
+    glz_data_clear(&glz);
+    g_bytes_unref(encoded);
+    g_free(pixels);
+}
+
+typedef struct {
+    SpiceZlibDecoder *decoder;
+    GBytes *encoded;
+    guint32 *decoded;
+} ZlibData;
+
+static void zlib_decode_one(gpointer user_data)
+{
+    ZlibData *zlib = user_data;
+    gsize size;
+    guint8 *data = (guint8 *)g_bytes_get_data(zlib->encoded, &size);
+
+    zlib->decoder->ops->decode(zlib->decoder, data, size,
+                               (guint8 *)zlib->decoded, WIDTH * HEIGHT * 4);
+}
+
+static void test_decode_zlib(void)
+{
+    guint32 *pixels = image_new(IMAGE_DESKTOP);
+    ZlibData zlib = {
+        .decoder = zlib_decoder_new(),
+        .encoded = zlib_encode(pixels),
+        .decoded = g_new0(guint32, WIDTH * HEIGHT),
+    };
+
+    zlib_decode_one(&zlib);
+    g_assert_cmpmem(zlib.decoded, WIDTH * HEIGHT * 4, pixels, WIDTH * HEIGHT * 4);
+
+    zlib_decoder_destroy(zlib.decoder);
+    g_bytes_unref(zlib.encoded);
+    g_free(zlib.decoded);
+    g_free(pixels);
+}
+
+typedef struct {
+    SpiceJpegDecoder *decoder;
+    GBytes *encoded;
+    guint32 *decoded;
+    gint width, height;
+} JpegData;
+
+static void jpeg_decode_one(gpointer user_data)
+{
+    JpegData *jpeg = user_data;
+    gsize size;
+    guint8 *data = (guint8 *)g_bytes_get_data(jpeg->encoded, &size);
+
+    jpeg->decoder->ops->begin_decode(jpeg->decoder, data, size,
+                                     &jpeg->width, &jpeg->height);
+    if (jpeg->decoded == NULL)
+        jpeg->decoded = g_new0(guint32, jpeg->width * jpeg->height);
+    jpeg->decoder->ops->decode(jpeg->decoder, (guint8 *)jpeg->decoded,
+                               jpeg->width * 4, SPICE_BITMAP_FMT_32BIT);
+}
+
+static void test_decode_jpeg(void)
+{
+    guint32 *pixels = image_new(IMAGE_DESKTOP);
+    JpegData jpeg = {
+        .decoder = jpeg_decoder_new(),
+        .encoded = jpeg_encode(pixels),
+    };
+    gint i;
+
+    jpeg_decode_one(&jpeg);
+    g_assert_cmpint(jpeg.width, ==, WIDTH);
+    g_assert_cmpint(jpeg.height, ==, HEIGHT);
+    /* lossy, but the plain background is close to the original */
+    for (i = 0; i < 3; i++) {
+        gint decoded = (jpeg.decoded[0] >> (8 * i)) & 0xff;
+        gint original = (pixels[0] >> (8 * i)) & 0xff;
+
+        g_assert_cmpint(ABS(decoded - original), <=, 8);
+    }
+
+    jpeg_decoder_destroy(jpeg.decoder);
+    g_bytes_unref(jpeg.encoded);
+    g_free(jpeg.decoded);
+    g_free(pixels);
+}
+
+/* ---------------------------------------------------------------- */
+
+#define CURSOR_SIZE 64
+
+typedef struct {
+    SpiceCursorHeader hdr;
+    guint8 *data;
+    guint32 *converted;
+} CursorData;
+
+static void cursor_data_init(CursorData *cursor, guint16 type)
+{
+    GRand *rand = g_rand_new_with_seed(42);
+    gsize mask_size = CURSOR_SIZE / 8 * CURSOR_SIZE;
+    gsize size;
+    guint i;
+
+    memset(&cursor->hdr, 0, sizeof(cursor->hdr));
+    cursor->hdr.type = type;
+    cursor->hdr.width = CURSOR_SIZE;
+    cursor->hdr.height = CURSOR_SIZE;
+
+    switch (type) {
+    case SPICE_CURSOR_TYPE_MONO:
+        size = 2 * mask_size;
+        break;
+    case SPICE_CURSOR_TYPE_COLOR32:
+        size = CURSOR_SIZE * CURSOR_SIZE * 4 + mask_size;
+        break;
+    default:
+        size = CURSOR_SIZE * CURSOR_SIZE * 4;
+        break;
+    }
+    cursor->data = g_malloc(size);
+    for (i = 0; i < size; i++) {
+        cursor->data[i] = g_rand_int(rand);
+    }
+    cursor->converted = g_new0(guint32, CURSOR_SIZE * CURSOR_SIZE);
+    g_rand_free(rand);
+}
+
+static void cursor_data_clear(CursorData *cursor)
+{
+    g_free(cursor->data);
+    g_free(cursor->converted);
+}
+
+static void cursor_convert_one(gpointer user_data)
+{
+    CursorData *cursor = user_data;
+
+    spice_cursor_convert(&cursor->hdr, cursor->data, cursor->converted);
+}
+
+static void test_decode_cursor(void)
+{
+    CursorData cursor;
+    guint32 *pixels;
+    guint8 *mask;
+
+    cursor_data_init(&cursor, SPICE_CURSOR_TYPE_COLOR32);
+    pixels = (guint32 *)cursor.data;
+    mask = cursor.data + CURSOR_SIZE * CURSOR_SIZE * 4;
+    pixels[0] = 0xffffff;
+    pixels[1] = 0x112233;
+    mask[0] = 0x80;
+
+    g_assert_true(spice_cursor_convert(&cursor.hdr, cursor.data, cursor.converted));
+    /* inverted white is drawn with a pattern, the others are opaque RGBA */
+    g_assert_cmphex(cursor.converted[0], ==, 0x30505050);
+    g_assert_cmphex(cursor.converted[1], ==, 0xff332211);
+
+    cursor.hdr.type = 0xff;
+    g_assert_false(spice_cursor_convert(&cursor.hdr, cursor.data, cursor.converted));
+
+    cursor_data_clear(&cursor);
+}
+
+#define CACHE_ITEMS 1024
+
+static void cache_add_find_remove(gpointer user_data)
+{
+    display_cache *cache = user_data;
+    guint64 id;
+
+    for (id = 0; id < CACHE_ITEMS; id++) {
+        cache_add(cache, id, GSIZE_TO_POINTER(id + 1));
+    }
+    for (id = 0; id < CACHE_ITEMS; id++) {
+        g_assert(cache_find(cache, id) == GSIZE_TO_POINTER(id + 1));
+    }
+    for (id = 0; id < CACHE_ITEMS; id++) {
+        cache_remove(cache, id);
+    }
+}
+
+static void test_decode_cache(void)
+{
+    display_cache *cache = cache_image_new(NULL);
+    gboolean lossy;
+
+    cache_add_lossy(cache, 1, GSIZE_TO_POINTER(1), TRUE);
+    cache_add(cache, 1, GSIZE_TO_POINTER(2));
+    g_assert(cache_find_lossy(cache, 1, &lossy) == GSIZE_TO_POINTER(2));
+    g_assert_false(lossy);
+    /* images are reference counted */
+    g_assert_true(cache_remove(cache, 1));
+    g_assert_nonnull(cache_find(cache, 1));
+    g_assert_true(cache_remove(cache, 1));
+    g_assert_null(cache_find(cache, 1));
+
+    cache_add_find_remove(cache);
+    g_assert_cmpuint(g_hash_table_size(cache->table), ==, 0);
+
+    cache_free(cache);
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Recorded JPEG images, such as MJPEG stream frames, may be put in the
+ * directory given by SPICE_BENCHMARK_CORPUS */
+static void benchmark_jpeg_corpus(void)
+{
+    const gchar *path = g_getenv("SPICE_BENCHMARK_CORPUS");
+    const gchar *name;
+    GDir *dir;
+
+    if (path == NULL)
+        return;
+
+    dir = g_dir_open(path, 0, NULL);
+    if (dir == NULL) {
+        g_test_message("cannot open %s", path);
+        return;
+    }
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        gchar *filename, *contents, *label;
+        gsize size;
+        JpegData jpeg = { NULL, };
+
+        if (!g_str_has_suffix(name, ".jpg") && !g_str_has_suffix(name, ".jpeg"))
+            continue;
+
+        filename = g_build_filename(path, name, NULL);
+        if (g_file_get_contents(filename, &contents, &size, NULL)) {
+            jpeg.decoder = jpeg_decoder_new();
+            jpeg.encoded = g_bytes_new_take(contents, size);
+            label = g_strdup_printf("jpeg/%s", name);
+            jpeg_decode_one(&jpeg);
+            benchmark_run(label, jpeg.width * jpeg.height * 4, 1, jpeg_decode_one, &jpeg);
+            g_free(label);
+            jpeg_decoder_destroy(jpeg.decoder);
+            g_bytes_unref(jpeg.encoded);
+            g_free(jpeg.decoded);
+        }
+        g_free(filename);
+    }
+    g_dir_close(dir);
+}
+
+static void test_decode_benchmark(void)
+{
+    static const guint16 cursor_types[] = {
+        SPICE_CURSOR_TYPE_MONO, SPICE_CURSOR_TYPE_ALPHA, SPICE_CURSOR_TYPE_COLOR32,
+    };
+    static const gchar *cursor_names[] = { "mono", "alpha", "color32" };
+    const gsize image_size = WIDTH * HEIGHT * 4;
+    display_cache *cache;
+    ImageKind kind;
+    guint i;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+
+    for (kind = IMAGE_DESKTOP; kind <= IMAGE_PHOTO; kind++) {
+        guint32 *pixels = image_new(kind);
+        GBytes *encoded = glz_encode(pixels, 0);
+        GlzData glz;
+        ZlibData zlib = {
+            .decoder = zlib_decoder_new(),
+            .encoded = zlib_encode(pixels),
+            .decoded = g_new0(guint32, WIDTH * HEIGHT),
+        };
+        JpegData jpeg = {
+            .decoder = jpeg_decoder_new(),
+            .encoded = jpeg_encode(pixels),
+        };
+        gchar *name;
+
+        glz_data_init(&glz, encoded);
+        name = g_strdup_printf("glz/%s", image_names[kind]);
+        benchmark_run(name, image_size, 1, glz_decode_one, &glz);
+        g_free(name);
+        glz_data_clear(&glz);
+
+        name = g_strdup_printf("zlib/%s", image_names[kind]);
+        benchmark_run(name, image_size, 1, zlib_decode_one, &zlib);
+        g_free(name);
+
+        name = g_strdup_printf("jpeg/%s", image_names[kind]);
+        benchmark_run(name, image_size, 1, jpeg_decode_one, &jpeg);
+        g_free(name);
+
+        zlib_decoder_destroy(zlib.decoder);
+        g_bytes_unref(zlib.encoded);
+        g_free(zlib.decoded);
+        jpeg_decoder_destroy(jpeg.decoder);
+        g_bytes_unref(jpeg.encoded);
+        g_free(jpeg.decoded);
+        g_bytes_unref(encoded);
+        g_free(pixels);
+    }
+    benchmark_jpeg_corpus();
+
+    for (i = 0; i < G_N_ELEMENTS(cursor_types); i++) {
+        CursorData cursor;
+        gchar *name = g_strdup_printf("cursor/%s", cursor_names[i]);
+
+        cursor_data_init(&cursor, cursor_types[i]);
+        benchmark_run(name, CURSOR_SIZE * CURSOR_SIZE * 4, 1, cursor_convert_one, &cursor);
+        cursor_data_clear(&cursor);
+        g_free(name);
+    }
+
+    cache = cache_image_new(NULL);
+    benchmark_run("cache/add-find-remove", 0, 3 * CACHE_ITEMS, cache_add_find_remove, cache);
+    cache_free(cache);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/decode/glz", test_decode_glz);
+    g_test_add_func("/decode/glz/window-clear", test_decode_glz_window_clear);
+    g_test_add_func("/decode/zlib", test_decode_zlib);
+    g_test_add_func("/decode/jpeg", test_decode_jpeg);
+    g_test_add_func("/decode/cursor", test_decode_cursor);
+    g_test_add_func("/decode/cache", test_decode_cache);
+    g_test_add_func("/decode/benchmark", test_decode_benchmark);
+
+    return g_test_run();
+}
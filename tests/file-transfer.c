@@ -90,12 +90,15 @@ transfer_read_async_cb(GObject *source_object,
 {
     SpiceFileTransferTask *xfer_task;
     gssize count;
-    char *buffer;
+    GBytes *bytes = NULL;
     GError *error = NULL;
 
     xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
-    count = spice_file_transfer_task_read_finish(xfer_task, res, &buffer, &error);
+    count = spice_file_transfer_task_read_finish(xfer_task, res, &bytes, &error);
     g_assert_no_error(error);
+    g_assert_nonnull(bytes);
+    g_assert_cmpint(g_bytes_get_size(bytes), ==, count);
+    g_bytes_unref(bytes);
 
     if (count == 0) {
         spice_file_transfer_task_completed(xfer_task, NULL);
@@ -138,6 +141,82 @@ test_simple_transfer(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
     g_main_loop_run (f->loop);
 }
 
+/*******************************************************************************
+ * TEST EMPTY FILE TRANSFER
+ ******************************************************************************/
+static void
+f_setup_empty(Fixture *f, gconstpointer user_data)
+{
+    guint i;
+    GError *err = NULL;
+
+    f_setup(f, user_data);
+    for (i = 0; i < f->num_files; i++) {
+        gboolean success;
+
+        success = g_file_replace_contents (f->files[i], "", 0, NULL, FALSE,
+                                           G_FILE_CREATE_NONE, NULL, f->cancellable, &err);
+        g_assert_no_error(err);
+        g_assert_true(success);
+    }
+}
+
+static void
+transfer_empty_read_async_cb(GObject *source_object,
+                             GAsyncResult *res,
+                             gpointer user_data G_GNUC_UNUSED)
+{
+    SpiceFileTransferTask *xfer_task;
+    gssize count;
+    GBytes *bytes = NULL;
+    GError *error = NULL;
+
+    xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
+    count = spice_file_transfer_task_read_finish(xfer_task, res, &bytes, &error);
+    g_assert_no_error(error);
+    /* the single empty chunk the agent expects for an empty file */
+    g_assert_cmpint(count, ==, 0);
+    g_assert_nonnull(bytes);
+    g_assert_cmpuint(g_bytes_get_size(bytes), ==, 0);
+    g_assert_cmpuint(spice_file_transfer_task_get_total_bytes(xfer_task), ==, 0);
+    g_assert_false(spice_file_transfer_task_is_completed(xfer_task));
+    g_bytes_unref(bytes);
+
+    spice_file_transfer_task_completed(xfer_task, NULL);
+}
+
+static void
+transfer_empty_init_async_cb(GObject *obj, GAsyncResult *res, gpointer data G_GNUC_UNUSED)
+{
+    GFileInfo *info;
+    SpiceFileTransferTask *xfer_task;
+    GError *error = NULL;
+
+    xfer_task = SPICE_FILE_TRANSFER_TASK(obj);
+    info = spice_file_transfer_task_init_task_finish(xfer_task, res, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(info);
+    g_object_unref(info);
+
+    spice_file_transfer_task_read_async(xfer_task, transfer_empty_read_async_cb, NULL);
+}
+
+static void
+test_empty_transfer(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    f->xfer_tasks = spice_file_transfer_task_create_tasks(f->files, NULL, G_FILE_COPY_NONE, f->cancellable);
+    g_hash_table_iter_init(&iter, f->xfer_tasks);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        SpiceFileTransferTask *xfer_task = SPICE_FILE_TRANSFER_TASK(value);
+        g_signal_connect(xfer_task, "finished", G_CALLBACK(transfer_xfer_task_on_finished), f);
+        spice_file_transfer_task_init_task_async(xfer_task, transfer_empty_init_async_cb, NULL);
+    }
+    g_main_loop_run (f->loop);
+}
+
 /*******************************************************************************
  * TEST CANCEL ON INIT TASK
  ******************************************************************************/
@@ -202,13 +281,14 @@ transfer_cancelled_read_async_cb(GObject *source_object,
 {
     SpiceFileTransferTask *xfer_task;
     gssize count;
-    char *buffer;
+    GBytes *bytes = NULL;
     GError *error = NULL;
 
     xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
-    count = spice_file_transfer_task_read_finish(xfer_task, res, &buffer, &error);
+    count = spice_file_transfer_task_read_finish(xfer_task, res, &bytes, &error);
     g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
     g_assert_cmpint(count, ==, -1);
+    g_assert_null(bytes);
     g_clear_error(&error);
 
     transfer_xfer_task_on_finished(NULL, NULL, user_data);
@@ -295,13 +375,14 @@ transfer_agent_cancelled_read_async_cb(GObject *source_object,
 {
     SpiceFileTransferTask *xfer_task;
     gssize count;
-    char *buffer;
+    GBytes *bytes = NULL;
     GError *error = NULL;
 
     xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
-    count = spice_file_transfer_task_read_finish(xfer_task, res, &buffer, &error);
+    count = spice_file_transfer_task_read_finish(xfer_task, res, &bytes, &error);
     g_assert_error(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED);
     g_assert_cmpint(count, ==, -1);
+    g_assert_null(bytes);
     g_clear_error(&error);
 
     transfer_xfer_task_on_finished(NULL, NULL, user_data);
@@ -367,9 +448,10 @@ test_agent_cancel_on_read(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
  *     protocol with VD_AGENT_FILE_XFER_START. Agent responds with
  *     VD_AGENT_FILE_XFER_STATUS_CAN_SEND_DATA which starts the read IO using
  *     spice_file_transfer_task_read_async()
- * 4.) After the read is done, SpiceMainChannel does an async flush to the
- *     agent, using the buffer provided by SpiceFileTransferTask; The read IO
- *     will be kept going while SpiceMainChannel has agent tokens to use.
+ * 4.) After the read is done, SpiceMainChannel queues the GBytes provided by
+ *     SpiceFileTransferTask to the agent by reference and reads the next
+ *     chunk right away; The read IO is kept a few chunks ahead of what was
+ *     sent, while SpiceMainChannel has agent tokens to use.
  * 5-) After SpiceMainChannel sends enough data, it can always receive:
  *     - VD_AGENT_FILE_XFER_STATUS_CAN_SEND_DATA: to send more data;
  *     - VD_AGENT_FILE_XFER_STATUS_SUCCESS: all data was sent;
@@ -388,6 +470,10 @@ int main(int argc, char* argv[])
                Fixture, GUINT_TO_POINTER(SINGLE_FILE),
                f_setup, test_simple_transfer, f_teardown);
 
+    g_test_add("/spice-file-transfer-task/single/empty-transfer",
+               Fixture, GUINT_TO_POINTER(SINGLE_FILE),
+               f_setup_empty, test_empty_transfer, f_teardown);
+
     g_test_add("/spice-file-transfer-task/single/cancel/before-task-init",
                Fixture, GUINT_TO_POINTER(SINGLE_FILE),
                f_setup, test_cancel_before_task_init, f_teardown);
@@ -412,6 +498,10 @@ int main(int argc, char* argv[])
                Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
                f_setup, test_simple_transfer, f_teardown);
 
+    g_test_add("/spice-file-transfer-task/multiple/empty-transfer",
+               Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
+               f_setup_empty, test_empty_transfer, f_teardown);
+
     g_test_add("/spice-file-transfer-task/multiple/cancel/before-task-init",
                Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
                f_setup, test_cancel_before_task_init, f_teardown);
@@ -0,0 +1,99 @@
+#include "config.h"
+
+#include <glib.h>
+
+#include "spice-net-estimator.h"
+
+static void test_net_estimator_bandwidth(void)
+{
+    SpiceNetEstimator *estimator = spice_net_estimator_new();
+    guint i;
+
+    /* too short to tell anything */
+    spice_net_estimator_add_transfer(estimator, 1024, 10000);
+    spice_net_estimator_add_transfer(estimator, 1024 * 1024, 10);
+    g_assert_cmpuint(spice_net_estimator_get_bandwidth(estimator), ==, 0);
+
+    /* 1 MB in 100ms */
+    spice_net_estimator_add_transfer(estimator, 1000 * 1000, 100000);
+    g_assert_cmpuint(spice_net_estimator_get_bandwidth(estimator), ==, 80000);
+
+    /* then 10 times less */
+    for (i = 0; i < 50; i++) {
+        spice_net_estimator_add_transfer(estimator, 100 * 1000, 100000);
+    }
+    g_assert_cmpuint(spice_net_estimator_get_bandwidth(estimator), >=, 8000);
+    g_assert_cmpuint(spice_net_estimator_get_bandwidth(estimator), <, 8100);
+
+    spice_net_estimator_free(estimator);
+}
+
+static void test_net_estimator_jitter(void)
+{
+    SpiceNetEstimator *estimator = spice_net_estimator_new();
+    guint i;
+
+    /* a constant delay, whatever the clock offset, is no jitter */
+    for (i = 0; i < 10; i++) {
+        spice_net_estimator_add_delay(estimator, SPICE_NET_CLOCK_PING, -123456789);
+        spice_net_estimator_add_delay(estimator, SPICE_NET_CLOCK_MM_TIME, 5000);
+    }
+    g_assert_cmpuint(spice_net_estimator_get_jitter(estimator), ==, 0);
+
+    /* a delay alternating by 4ms */
+    for (i = 0; i < 200; i++) {
+        spice_net_estimator_add_delay(estimator, SPICE_NET_CLOCK_MM_TIME,
+                                      5000 + (i % 2) * 4000);
+    }
+    g_assert_cmpuint(spice_net_estimator_get_jitter(estimator), >, 3900);
+    g_assert_cmpuint(spice_net_estimator_get_jitter(estimator), <=, 4000);
+
+    /* a clock reset is not jitter */
+    spice_net_estimator_add_delay(estimator, SPICE_NET_CLOCK_MM_TIME,
+                                  60 * G_USEC_PER_SEC);
+    g_assert_cmpuint(spice_net_estimator_get_jitter(estimator), <=, 4000);
+
+    spice_net_estimator_free(estimator);
+}
+
+static void test_net_estimator_update(void)
+{
+    SpiceNetEstimator *estimator = spice_net_estimator_new();
+    gint64 now = 10 * G_USEC_PER_SEC;
+
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now), ==, 0);
+
+    /* the first estimate is reported right away, once */
+    spice_net_estimator_add_rtt(estimator, 20000);
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now), ==, SPICE_NET_RTT);
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now), ==, 0);
+
+    /* a small change is not reported */
+    spice_net_estimator_add_rtt(estimator, 28000);
+    g_assert_cmpuint(spice_net_estimator_get_rtt(estimator), ==, 21000);
+    now += 2 * G_USEC_PER_SEC;
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now), ==, 0);
+
+    /* a large one is, but not more than once per second */
+    spice_net_estimator_add_rtt(estimator, 100000);
+    spice_net_estimator_add_transfer(estimator, 1000 * 1000, 100000);
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now), ==,
+                     SPICE_NET_RTT | SPICE_NET_BANDWIDTH);
+    spice_net_estimator_add_rtt(estimator, 1000000);
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now + 1000), ==, 0);
+    g_assert_cmpuint(spice_net_estimator_update(estimator, now + G_USEC_PER_SEC), ==,
+                     SPICE_NET_RTT);
+
+    spice_net_estimator_free(estimator);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/net-estimator/bandwidth", test_net_estimator_bandwidth);
+    g_test_add_func("/net-estimator/jitter", test_net_estimator_jitter);
+    g_test_add_func("/net-estimator/update", test_net_estimator_update);
+
+    return g_test_run();
+}
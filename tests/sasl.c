@@ -0,0 +1,357 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#if HAVE_SASL
+#include "spice-sasl-layer.h"
+
+#define SERVICE "spice"
+#define REALM "localhost"
+#define USERNAME "spice"
+#define PASSWORD "sasl-layer-test"
+
+/* more than a batch, in each direction */
+#define N_MESSAGES 300
+
+/* A transport reading from and writing to memory */
+typedef struct {
+    GByteArray *in;
+    gsize in_offset;
+    gsize max_read; /* to split the packets in several reads */
+    GByteArray *out;
+    guint writes;
+} MemoryIO;
+
+/* the client and the server sides of an authenticated connection */
+typedef struct {
+    gchar *dir;
+    gchar *sasldb;
+    sasl_conn_t *client;
+    sasl_conn_t *server;
+} Fixture;
+
+static const gchar *sasldb_path;
+
+static int server_getopt(void *context, const char *plugin_name,
+                         const char *option, const char **result, unsigned *len)
+{
+    if (g_str_equal(option, "sasldb_path"))
+        *result = sasldb_path;
+    else if (g_str_equal(option, "auxprop_plugin"))
+        *result = "sasldb";
+    else if (g_str_equal(option, "mech_list"))
+        *result = "DIGEST-MD5";
+    else
+        return SASL_FAIL;
+
+    if (len)
+        *len = strlen(*result);
+    return SASL_OK;
+}
+
+static int client_simple(void *context, int id, const char **result, unsigned *len)
+{
+    *result = USERNAME;
+    if (len)
+        *len = strlen(*result);
+    return SASL_OK;
+}
+
+static int client_password(sasl_conn_t *conn, void *context, int id,
+                           sasl_secret_t **psecret)
+{
+    static sasl_secret_t *secret = NULL;
+
+    if (secret == NULL) {
+        secret = g_malloc0(sizeof(sasl_secret_t) + strlen(PASSWORD));
+        secret->len = strlen(PASSWORD);
+        memcpy(secret->data, PASSWORD, secret->len);
+    }
+    *psecret = secret;
+    return SASL_OK;
+}
+
+static int client_realm(void *context, int id, const char **availrealms,
+                        const char **result)
+{
+    *result = REALM;
+    return SASL_OK;
+}
+
+static const sasl_callback_t server_callbacks[] = {
+    { SASL_CB_GETOPT, (int (*)(void))server_getopt, NULL },
+    { SASL_CB_LIST_END, NULL, NULL },
+};
+
+static const sasl_callback_t client_callbacks[] = {
+    { SASL_CB_USER, (int (*)(void))client_simple, NULL },
+    { SASL_CB_AUTHNAME, (int (*)(void))client_simple, NULL },
+    { SASL_CB_PASS, (int (*)(void))client_password, NULL },
+    { SASL_CB_GETREALM, (int (*)(void))client_realm, NULL },
+    { SASL_CB_LIST_END, NULL, NULL },
+};
+
+static void set_security_props(sasl_conn_t *conn)
+{
+    sasl_security_properties_t secprops;
+
+    /* as the channel does without TLS */
+    memset(&secprops, 0, sizeof(secprops));
+    secprops.min_ssf = 56;
+    secprops.max_ssf = 100000;
+    secprops.maxbufsize = SPICE_SASL_MAX_BUFSIZE;
+    secprops.security_flags = SASL_SEC_NOANONYMOUS | SASL_SEC_NOPLAINTEXT;
+    g_assert_cmpint(sasl_setprop(conn, SASL_SEC_PROPS, &secprops), ==, SASL_OK);
+}
+
+/* authenticates the client with DIGEST-MD5, for a security layer */
+static gboolean fixture_authenticate(Fixture *f)
+{
+    const char *client_out = NULL, *server_out = NULL, *mech;
+    unsigned client_out_len = 0, server_out_len = 0;
+    const void *ssf;
+    int client_err, err;
+
+    f->dir = g_dir_make_tmp("spice-sasl-XXXXXX", NULL);
+    g_assert_nonnull(f->dir);
+    f->sasldb = g_build_filename(f->dir, "sasldb2", NULL);
+    sasldb_path = f->sasldb;
+
+    if (sasl_server_init(server_callbacks, "spice-gtk-test") != SASL_OK ||
+        sasl_client_init(NULL) != SASL_OK)
+        return FALSE;
+
+    g_assert_cmpint(sasl_server_new(SERVICE, REALM, REALM, NULL, NULL, NULL, 0,
+                                    &f->server), ==, SASL_OK);
+    g_assert_cmpint(sasl_client_new(SERVICE, REALM, NULL, NULL, client_callbacks, 0,
+                                    &f->client), ==, SASL_OK);
+    set_security_props(f->server);
+    set_security_props(f->client);
+
+    /* the secret of the user, in the sasldb of the test */
+    if (sasl_setpass(f->server, USERNAME, PASSWORD, strlen(PASSWORD),
+                     NULL, 0, SASL_SET_CREATE) != SASL_OK)
+        return FALSE;
+
+    client_err = sasl_client_start(f->client, "DIGEST-MD5", NULL,
+                                   &client_out, &client_out_len, &mech);
+    if (client_err != SASL_OK && client_err != SASL_CONTINUE)
+        return FALSE;
+    err = sasl_server_start(f->server, mech, client_out, client_out_len,
+                            &server_out, &server_out_len);
+    if (err == SASL_NOMECH)
+        return FALSE;
+    while (err == SASL_CONTINUE) {
+        client_err = sasl_client_step(f->client, server_out, server_out_len, NULL,
+                                      &client_out, &client_out_len);
+        g_assert_true(client_err == SASL_OK || client_err == SASL_CONTINUE);
+        err = sasl_server_step(f->server, client_out, client_out_len,
+                               &server_out, &server_out_len);
+    }
+    g_assert_cmpint(err, ==, SASL_OK);
+    /* the client checks the last answer of the server */
+    if (client_err == SASL_CONTINUE)
+        g_assert_cmpint(sasl_client_step(f->client, server_out, server_out_len, NULL,
+                                         &client_out, &client_out_len), ==, SASL_OK);
+
+    g_assert_cmpint(sasl_getprop(f->client, SASL_SSF, &ssf), ==, SASL_OK);
+    g_assert_cmpint(*(const sasl_ssf_t *)ssf, >=, 56);
+
+    return TRUE;
+}
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    if (!fixture_authenticate(f)) {
+        g_test_skip("DIGEST-MD5 with a sasldb is not available");
+        /* nothing to test without it */
+        if (f->client)
+            sasl_dispose(&f->client);
+    }
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    if (f->client)
+        sasl_dispose(&f->client);
+    if (f->server)
+        sasl_dispose(&f->server);
+    if (f->sasldb)
+        g_unlink(f->sasldb);
+    if (f->dir)
+        g_rmdir(f->dir);
+    g_free(f->sasldb);
+    g_free(f->dir);
+}
+
+static gssize memory_io_read(gpointer user_data, void *data, gsize len)
+{
+    MemoryIO *mio = user_data;
+    gsize n;
+
+    n = MIN(len, mio->in->len - mio->in_offset);
+    if (mio->max_read > 0)
+        n = MIN(n, mio->max_read);
+    memcpy(data, mio->in->data + mio->in_offset, n);
+    mio->in_offset += n;
+
+    return n;
+}
+
+static gboolean memory_io_write(gpointer user_data, const void *data, gsize len)
+{
+    MemoryIO *mio = user_data;
+
+    g_byte_array_append(mio->out, data, len);
+    mio->writes++;
+    return TRUE;
+}
+
+/* messages of all sizes, a few of them bigger than a batch, with their
+ * number in their contents */
+static GByteArray *message_new(guint n)
+{
+    gsize size = n % 50 == 7 ? SPICE_SASL_BATCH_SIZE + n : 1 + (n * 397) % 3000;
+    GByteArray *message = g_byte_array_sized_new(size);
+    gsize i;
+
+    g_byte_array_set_size(message, size);
+    for (i = 0; i < size; i++)
+        message->data[i] = (guint8)(n + i * 7);
+
+    return message;
+}
+
+static void test_sasl_layer_write(Fixture *f, gconstpointer user_data)
+{
+    MemoryIO mio = { NULL, 0, 0, g_byte_array_new(), 0 };
+    SpiceSaslLayerIO io = { memory_io_read, memory_io_write, &mio };
+    SpiceSaslLayer layer;
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *received = g_byte_array_new();
+    gsize offset;
+    guint n;
+
+    if (f->client == NULL)
+        return;
+
+    spice_sasl_layer_init(&layer, f->client, &io);
+    f->client = NULL;
+
+    /* written as the channel does with its queued messages */
+    spice_sasl_layer_begin_batch(&layer);
+    for (n = 0; n < N_MESSAGES; n++) {
+        GByteArray *message = message_new(n);
+
+        g_assert_true(spice_sasl_layer_write(&layer, message->data, message->len));
+        g_byte_array_append(expected, message->data, message->len);
+        g_byte_array_unref(message);
+    }
+    g_assert_true(spice_sasl_layer_end_batch(&layer));
+    g_assert_cmpuint(expected->len, >, 4 * SPICE_SASL_BATCH_SIZE);
+    /* the messages were encoded together */
+    g_assert_cmpuint(mio.writes, <, N_MESSAGES / 10);
+
+    /* and outside of a batch, each write goes out */
+    g_assert_true(spice_sasl_layer_write(&layer, "end", 3));
+    g_byte_array_append(expected, (const guint8 *)"end", 3);
+    g_assert_cmpuint(layer.pending->len, ==, 0);
+
+    /* the server decodes all of it, in order, in reads of any size */
+    for (offset = 0; offset < mio.out->len; ) {
+        gsize len = 1 + g_test_rand_int_range(0, 16384);
+        const char *output;
+        unsigned output_len;
+
+        len = MIN(mio.out->len - offset, len);
+        g_assert_cmpint(sasl_decode(f->server, (const char *)mio.out->data + offset, len,
+                                    &output, &output_len), ==, SASL_OK);
+        g_byte_array_append(received, (const guint8 *)output, output_len);
+        offset += len;
+    }
+    g_assert_cmpuint(received->len, ==, expected->len);
+    g_assert_true(memcmp(received->data, expected->data, expected->len) == 0);
+
+    spice_sasl_layer_clear(&layer);
+    g_byte_array_unref(received);
+    g_byte_array_unref(expected);
+    g_byte_array_unref(mio.out);
+}
+
+static void test_sasl_layer_read(Fixture *f, gconstpointer user_data)
+{
+    MemoryIO mio = { g_byte_array_new(), 0, 0, NULL, 0 };
+    SpiceSaslLayerIO io = { memory_io_read, memory_io_write, &mio };
+    SpiceSaslLayer layer;
+    GByteArray *expected = g_byte_array_new();
+    guint8 *received;
+    gsize offset;
+    guint n;
+
+    if (f->client == NULL)
+        return;
+
+    /* the server sends its messages in packets of up to 4 KiB */
+    for (n = 0; n < N_MESSAGES; n++) {
+        GByteArray *message = message_new(n);
+
+        for (offset = 0; offset < message->len; offset += 4096) {
+            const char *output;
+            unsigned output_len;
+
+            g_assert_cmpint(sasl_encode(f->server, (const char *)message->data + offset,
+                                        MIN(message->len - offset, 4096),
+                                        &output, &output_len), ==, SASL_OK);
+            g_byte_array_append(mio.in, (const guint8 *)output, output_len);
+        }
+        g_byte_array_append(expected, message->data, message->len);
+        g_byte_array_unref(message);
+    }
+    g_assert_cmpuint(expected->len, >, 4 * SPICE_SASL_BATCH_SIZE);
+
+    spice_sasl_layer_init(&layer, f->client, &io);
+    f->client = NULL;
+
+    /* the transport splits the packets, the reader asks for any size */
+    mio.max_read = 1000;
+    received = g_malloc(expected->len);
+    for (offset = 0; offset < expected->len; ) {
+        gsize len = 1 + g_test_rand_int_range(0, 8192);
+        gssize ret;
+
+        len = MIN(expected->len - offset, len);
+        ret = spice_sasl_layer_read(&layer, received + offset, len);
+
+        g_assert_cmpint(ret, >, 0);
+        g_assert_cmpint(ret, <=, len);
+        offset += ret;
+    }
+    g_assert_false(spice_sasl_layer_pending(&layer));
+    g_assert_cmpuint(mio.in_offset, ==, mio.in->len);
+    g_assert_true(memcmp(received, expected->data, expected->len) == 0);
+
+    /* the end of the transport */
+    g_assert_cmpint(spice_sasl_layer_read(&layer, received, 1), ==, 0);
+
+    spice_sasl_layer_clear(&layer);
+    g_free(received);
+    g_byte_array_unref(expected);
+    g_byte_array_unref(mio.in);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#if HAVE_SASL
+    g_test_add("/sasl/layer-write", Fixture, NULL,
+               fixture_setup, test_sasl_layer_write, fixture_teardown);
+    g_test_add("/sasl/layer-read", Fixture, NULL,
+               fixture_setup, test_sasl_layer_read, fixture_teardown);
+#endif
+
+    return g_test_run();
+}
@@ -1,5 +1,11 @@
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
 #include <spice-client.h>
 
+#include "spice-session-priv.h"
+#include "spice-memory-manager-priv.h"
+
 typedef struct {
     const gchar *port;
     const gchar *tls_port;
@@ -278,6 +284,394 @@ static void test_session_uri_ipv6_good(void)
     test_session_uri_good(tests, G_N_ELEMENTS(tests));
 }
 
+#define N_SESSION_THREADS 4
+
+/* Answers the link of the channels connecting to it, and denies their
+ * ticket */
+typedef struct {
+    GSocketListener *listener;
+    GCancellable *cancellable;
+    GThread *thread;
+    guint8 pub_key[SPICE_TICKET_PUBKEY_BYTES];
+    gsize ticket_size;
+    guint n_links;
+} StandInServer;
+
+static void stand_in_server_read(GInputStream *in, gpointer data, gsize size)
+{
+    GError *error = NULL;
+    gsize n = 0;
+
+    g_input_stream_read_all(in, data, size, &n, NULL, &error);
+    g_assert_no_error(error);
+    g_assert_cmpuint(n, ==, size);
+}
+
+static void stand_in_server_write(GOutputStream *out, gconstpointer data, gsize size)
+{
+    GError *error = NULL;
+
+    g_output_stream_write_all(out, data, size, NULL, NULL, &error);
+    g_assert_no_error(error);
+}
+
+static gpointer stand_in_server(gpointer user_data)
+{
+    StandInServer *server = user_data;
+    GSocketConnection *conn;
+
+    while ((conn = g_socket_listener_accept(server->listener, NULL,
+                                            server->cancellable, NULL)) != NULL) {
+        GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+        GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+        guint32 result = SPICE_LINK_ERR_PERMISSION_DENIED;
+        SpiceLinkReply reply = { 0, };
+        SpiceLinkHeader header;
+        guint8 *data;
+
+        stand_in_server_read(in, &header, sizeof(header));
+        g_assert_cmphex(header.magic, ==, SPICE_MAGIC);
+        g_assert_cmpuint(header.major_version, ==, SPICE_VERSION_MAJOR);
+        data = g_malloc(header.size);
+        stand_in_server_read(in, data, header.size);
+        g_free(data);
+
+        /* without the auth selection capability, the ticket comes right away */
+        header.minor_version = SPICE_VERSION_MINOR;
+        header.size = sizeof(reply);
+        reply.error = SPICE_LINK_ERR_OK;
+        memcpy(reply.pub_key, server->pub_key, sizeof(reply.pub_key));
+        reply.caps_offset = sizeof(reply);
+        stand_in_server_write(out, &header, sizeof(header));
+        stand_in_server_write(out, &reply, sizeof(reply));
+
+        data = g_malloc(server->ticket_size);
+        stand_in_server_read(in, data, server->ticket_size);
+        g_free(data);
+        stand_in_server_write(out, &result, sizeof(result));
+
+        g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+        g_object_unref(conn);
+        server->n_links++;
+    }
+
+    return NULL;
+}
+
+static gchar *stand_in_server_start(StandInServer *server)
+{
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    EVP_PKEY *key = NULL;
+    guint8 *der = server->pub_key;
+    GError *error = NULL;
+    guint16 port;
+
+    /* the ticket is encrypted with the 1024 bits RSA key of the server */
+    g_assert_cmpint(EVP_PKEY_keygen_init(key_ctx), ==, 1);
+    EVP_PKEY_CTX_set_rsa_keygen_bits(key_ctx, 1024);
+    g_assert_cmpint(EVP_PKEY_keygen(key_ctx, &key), ==, 1);
+    g_assert_cmpint(i2d_PUBKEY(key, NULL), ==, SPICE_TICKET_PUBKEY_BYTES);
+    i2d_PUBKEY(key, &der);
+    server->ticket_size = EVP_PKEY_size(key);
+    EVP_PKEY_free(key);
+    EVP_PKEY_CTX_free(key_ctx);
+
+    server->listener = g_socket_listener_new();
+    port = g_socket_listener_add_any_inet_port(server->listener, NULL, &error);
+    g_assert_no_error(error);
+    server->cancellable = g_cancellable_new();
+    server->n_links = 0;
+    server->thread = g_thread_new("stand-in server", stand_in_server, server);
+
+    return g_strdup_printf("%u", port);
+}
+
+static void stand_in_server_stop(StandInServer *server)
+{
+    g_cancellable_cancel(server->cancellable);
+    g_thread_join(server->thread);
+    g_socket_listener_close(server->listener);
+    g_object_unref(server->listener);
+    g_object_unref(server->cancellable);
+}
+
+typedef struct {
+    const gchar *port;
+    GThread *thread;
+    GThread *self;
+    GMainLoop *loop;
+    SpiceChannelEvent event;
+} SessionThread;
+
+static void session_thread_channel_event(SpiceChannel *channel,
+                                         SpiceChannelEvent event,
+                                         gpointer user_data)
+{
+    SessionThread *t = user_data;
+
+    /* the events are emitted from the session's own context and thread */
+    g_assert_true(g_thread_self() == t->self);
+    t->event = event;
+    g_main_loop_quit(t->loop);
+}
+
+static void session_thread_channel_new(SpiceSession *session,
+                                       SpiceChannel *channel,
+                                       gpointer user_data)
+{
+    g_signal_connect(channel, "channel-event",
+                     G_CALLBACK(session_thread_channel_event), user_data);
+}
+
+static gpointer session_thread(gpointer user_data)
+{
+    SessionThread *t = user_data;
+    GMainContext *context = g_main_context_new();
+    SpiceSession *session;
+
+    t->self = g_thread_self();
+    g_main_context_push_thread_default(context);
+    t->loop = g_main_loop_new(context, FALSE);
+
+    session = g_object_new(SPICE_TYPE_SESSION,
+                           "host", "127.0.0.1",
+                           "port", t->port,
+                           "main-context", context,
+                           NULL);
+    g_signal_connect(session, "channel-new",
+                     G_CALLBACK(session_thread_channel_new), t);
+    g_assert_true(spice_session_connect(session));
+    g_main_loop_run(t->loop);
+
+    spice_session_disconnect(session);
+    g_object_unref(session);
+    /* let the channels finish their cleanup in this context */
+    while (g_main_context_iteration(context, FALSE));
+
+    g_main_loop_unref(t->loop);
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+    return NULL;
+}
+
+static void test_session_threads(void)
+{
+    SessionThread threads[N_SESSION_THREADS];
+    StandInServer server;
+    gchar *port;
+    guint i;
+
+    /* the sessions link, and send their ticket concurrently */
+    port = stand_in_server_start(&server);
+
+    for (i = 0; i < N_SESSION_THREADS; i++) {
+        threads[i].port = port;
+        threads[i].event = SPICE_CHANNEL_NONE;
+        threads[i].thread = g_thread_new("session", session_thread, &threads[i]);
+    }
+    for (i = 0; i < N_SESSION_THREADS; i++) {
+        g_thread_join(threads[i].thread);
+        g_assert_cmpint(threads[i].event, ==, SPICE_CHANNEL_ERROR_AUTH);
+    }
+
+    stand_in_server_stop(&server);
+    g_assert_cmpuint(server.n_links, ==, N_SESSION_THREADS);
+    g_free(port);
+}
+
+static void input_latency_cb(SpiceSession *session, SpiceInputLatencyStage stage,
+                             gint64 latency, gpointer user_data)
+{
+    guint *emitted = user_data;
+
+    g_assert_cmpint(latency, >=, 0);
+    emitted[stage]++;
+}
+
+static guint input_latency_count(SpiceSession *session, SpiceInputLatencyStage stage)
+{
+    GArray *histogram = spice_session_get_input_latency(session, stage);
+    guint i, count = 0;
+
+    g_assert_cmpuint(histogram->len, ==, SPICE_INPUT_LATENCY_BUCKETS);
+    for (i = 0; i < histogram->len; i++)
+        count += g_array_index(histogram, guint, i);
+    g_array_unref(histogram);
+
+    return count;
+}
+
+static void test_session_input_latency(void)
+{
+    SpiceSession *session = spice_session_new();
+    guint emitted[SPICE_INPUT_LATENCY_PAINTED + 1] = { 0, };
+    guint i;
+
+    g_signal_connect(session, "input-latency", G_CALLBACK(input_latency_cb), emitted);
+
+    /* nothing is measured until it is enabled */
+    spice_session_input_latency_start(session);
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_RECEIVED);
+    g_assert_cmpuint(input_latency_count(session, SPICE_INPUT_LATENCY_RECEIVED), ==, 0);
+
+    g_object_set(session, "input-latency-tracking", TRUE, NULL);
+
+    /* nor display updates without input */
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_RECEIVED);
+    g_assert_cmpuint(input_latency_count(session, SPICE_INPUT_LATENCY_RECEIVED), ==, 0);
+
+    /* each stage is measured once, in order, for the first input */
+    spice_session_input_latency_start(session);
+    spice_session_input_latency_start(session);
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_INVALIDATED);
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_RECEIVED);
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_RECEIVED);
+    spice_session_input_latency_mark(session, SPICE_INPUT_LATENCY_INVALIDATED);
+    spice_session_input_latency_painted(session);
+    spice_session_input_latency_painted(session);
+
+    for (i = 0; i <= SPICE_INPUT_LATENCY_PAINTED; i++) {
+        g_assert_cmpuint(input_latency_count(session, i), ==, 1);
+        g_assert_cmpuint(emitted[i], ==, 1);
+    }
+
+    /* enabling it again resets the histograms */
+    g_object_set(session, "input-latency-tracking", FALSE, NULL);
+    g_object_set(session, "input-latency-tracking", TRUE, NULL);
+    g_assert_cmpuint(input_latency_count(session, SPICE_INPUT_LATENCY_PAINTED), ==, 0);
+
+    g_object_unref(session);
+}
+
+#define N_BUDGET_SESSIONS 4
+
+static guint64 memory_manager_get(const gchar *name)
+{
+    guint64 value;
+
+    g_object_get(spice_memory_manager_get(), name, &value, NULL);
+    return value;
+}
+
+/* sizes the caches as the main channel does on SPICE_MSG_MAIN_INIT */
+static guint64 session_size_caches(SpiceSession *session)
+{
+    gint cache_size, glz_window_size;
+
+    spice_session_set_caches_hints(session, 64 * 1024 * 1024, 1);
+    g_object_get(session,
+                 "cache-size", &cache_size,
+                 "glz-window-size", &glz_window_size,
+                 NULL);
+    g_assert_cmpint(glz_window_size, >=, 12 * 1024 * 1024);
+
+    return cache_size + glz_window_size;
+}
+
+static void test_session_memory_budget(void)
+{
+    SpiceMemoryManager *manager = spice_memory_manager_get();
+    SpiceSession *sessions[N_BUDGET_SESSIONS];
+    guint64 limit = 128 * 1024 * 1024, total = 0;
+    guint64 images = memory_manager_get("images");
+    pixman_image_t *image;
+    display_cache *cache;
+    guint n_sessions, i;
+    gint cache_size;
+
+    g_object_set(manager, "limit", limit, NULL);
+    g_object_get(manager, "sessions", &n_sessions, NULL);
+
+    for (i = 0; i < N_BUDGET_SESSIONS; i++)
+        sessions[i] = spice_session_new();
+    g_object_get(manager, "sessions", &i, NULL);
+    g_assert_cmpuint(i, ==, n_sessions + N_BUDGET_SESSIONS);
+
+    /* an explicit size is kept, the others shrink to share the limit */
+    g_object_set(sessions[0], "cache-size", 20 * 1024 * 1024, NULL);
+    for (i = 0; i < N_BUDGET_SESSIONS; i++)
+        total += session_size_caches(sessions[i]);
+    g_object_get(sessions[0], "cache-size", &cache_size, NULL);
+    g_assert_cmpint(cache_size, ==, 20 * 1024 * 1024);
+    g_assert_cmpuint(total, <=, limit);
+
+    /* the cached images are accounted until they leave the cache */
+    spice_session_get_caches(sessions[1], &cache, NULL);
+    image = pixman_image_create_bits(PIXMAN_a8r8g8b8, 64, 64, NULL, 0);
+    cache_add(cache, 1, spice_memory_image_ref(image));
+    g_assert_cmpuint(memory_manager_get("images"), ==, images + 64 * 64 * 4);
+    cache_clear(cache);
+    g_assert_cmpuint(memory_manager_get("images"), ==, images);
+    pixman_image_unref(image);
+
+    for (i = 0; i < N_BUDGET_SESSIONS; i++)
+        g_object_unref(sessions[i]);
+    g_object_get(manager, "sessions", &i, NULL);
+    g_assert_cmpuint(i, ==, n_sessions);
+
+    g_object_set(manager, "limit", (guint64)0, NULL);
+}
+
+#define N_SEQUENTIAL_SESSIONS 4
+
+static void test_session_memory_budget_sequential(void)
+{
+    SpiceMemoryManager *manager = spice_memory_manager_get();
+    SpiceSession *sessions[N_SEQUENTIAL_SESSIONS + 1];
+    guint64 sizes[N_SEQUENTIAL_SESSIONS + 1];
+    guint64 limit = 128 * 1024 * 1024, share, wanted, total = 0;
+    guint i;
+
+    /* the shares depend on the sessions alive */
+    g_object_get(manager, "sessions", &i, NULL);
+    if (i != 0) {
+        g_test_skip("other sessions are still alive");
+        return;
+    }
+
+    /* a lone session gets all it wants */
+    sessions[0] = spice_session_new();
+    wanted = session_size_caches(sessions[0]);
+    g_assert_cmpuint(wanted, >, limit / 2);
+    g_assert_cmpuint(wanted, <=, limit);
+    g_object_set(manager, "limit", limit, NULL);
+    g_assert_cmpuint(session_size_caches(sessions[0]), ==, wanted);
+
+    /* the next one gets what is left, until the first one connects again */
+    sessions[1] = spice_session_new();
+    sizes[1] = session_size_caches(sessions[1]);
+    g_assert_cmpuint(wanted + sizes[1], <=, limit);
+    share = (limit - memory_manager_get("surfaces")) / 2;
+    g_assert_cmpuint(session_size_caches(sessions[0]), ==, share);
+    g_assert_cmpuint(session_size_caches(sessions[1]), ==, share);
+    g_object_unref(sessions[0]);
+    g_object_unref(sessions[1]);
+
+    /* with the sessions to come known, each one gets its share right away */
+    g_object_set(manager, "expected-sessions", N_SEQUENTIAL_SESSIONS, NULL);
+    share = (limit - memory_manager_get("surfaces")) / N_SEQUENTIAL_SESSIONS;
+    for (i = 0; i < N_SEQUENTIAL_SESSIONS; i++) {
+        sessions[i] = spice_session_new();
+        sizes[i] = session_size_caches(sessions[i]);
+        g_assert_cmpuint(sizes[i], ==, share);
+        total += sizes[i];
+    }
+    g_assert_cmpuint(total, <=, limit);
+
+    /* an unexpected one gets the minimum sizes, which don't fit anymore */
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "memory limit exceeded*");
+    sessions[i] = spice_session_new();
+    sizes[i] = session_size_caches(sessions[i]);
+    g_test_assert_expected_messages();
+    g_assert_cmpuint(sizes[i], <, share);
+    g_assert_cmpuint(total + sizes[i], >, limit);
+
+    for (i = 0; i <= N_SEQUENTIAL_SESSIONS; i++)
+        g_object_unref(sessions[i]);
+
+    g_object_set(manager, "limit", (guint64)0, "expected-sessions", 0, NULL);
+}
+
 int main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -285,6 +679,10 @@ int main(int argc, char* argv[])
     g_test_add_func("/session/bad-uri", test_session_uri_bad);
     g_test_add_func("/session/good-ipv4-uri", test_session_uri_ipv4_good);
     g_test_add_func("/session/good-ipv6-uri", test_session_uri_ipv6_good);
+    g_test_add_func("/session/threads", test_session_threads);
+    g_test_add_func("/session/input-latency", test_session_input_latency);
+    g_test_add_func("/session/memory-budget", test_session_memory_budget);
+    g_test_add_func("/session/memory-budget-sequential", test_session_memory_budget_sequential);
 
     return g_test_run();
 }
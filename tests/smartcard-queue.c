@@ -0,0 +1,146 @@
+#include "config.h"
+
+#include <glib.h>
+
+#include "spice-smartcard-queue.h"
+
+#define MAX_IN_FLIGHT 8
+#define UNDEFINED_READER_ID 0xffffffff
+
+/* stands for the VSC messages of the smartcard channel */
+typedef struct {
+    SpiceSmartcardQueueItem item;
+    guint seq;
+} Message;
+
+static Message *message_new(guint32 reader_id, gboolean reader_add, guint seq)
+{
+    Message *message = g_new0(Message, 1);
+
+    message->item.reader_id = reader_add ? UNDEFINED_READER_ID : reader_id;
+    message->item.alone = reader_add;
+    message->seq = seq;
+
+    return message;
+}
+
+/* returns how many messages can be sent, checking that they come in order */
+static guint queue_send(SpiceSmartcardQueue *queue, guint *seq)
+{
+    Message *message;
+    guint sent = 0;
+
+    while ((message = (Message *)spice_smartcard_queue_pop_sendable(queue)) != NULL) {
+        g_assert_cmpuint(message->seq, ==, *seq);
+        (*seq)++;
+        sent++;
+    }
+
+    return sent;
+}
+
+static guint queue_answer(SpiceSmartcardQueue *queue, guint32 reader_id)
+{
+    Message *message = (Message *)spice_smartcard_queue_answered(queue, reader_id);
+    guint seq;
+
+    g_assert_nonnull(message);
+    seq = message->seq;
+    g_free(message);
+
+    return seq;
+}
+
+static void test_smartcard_queue_reader_add(void)
+{
+    SpiceSmartcardQueue queue;
+    guint seq = 0;
+
+    spice_smartcard_queue_init(&queue, MAX_IN_FLIGHT);
+
+    /* the readers are added one at a time */
+    spice_smartcard_queue_push(&queue, &message_new(0, TRUE, 0)->item);
+    spice_smartcard_queue_push(&queue, &message_new(0, TRUE, 1)->item);
+    spice_smartcard_queue_push(&queue, &message_new(0, FALSE, 2)->item);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+
+    /* the answer carries the id of the new reader */
+    g_assert_cmpuint(queue_answer(&queue, 0), ==, 0);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    g_assert_cmpuint(queue_answer(&queue, 1), ==, 1);
+
+    /* and nothing is sent along with an addition */
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    spice_smartcard_queue_push(&queue, &message_new(0, TRUE, 3)->item);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 0);
+    g_assert_cmpuint(queue_answer(&queue, 0), ==, 2);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+
+    spice_smartcard_queue_clear(&queue, g_free);
+    g_assert_null(spice_smartcard_queue_answered(&queue, 0));
+}
+
+static void test_smartcard_queue_max_in_flight(void)
+{
+    SpiceSmartcardQueue queue;
+    guint seq = 0, i;
+
+    spice_smartcard_queue_init(&queue, MAX_IN_FLIGHT);
+
+    for (i = 0; i < MAX_IN_FLIGHT + 2; i++)
+        spice_smartcard_queue_push(&queue, &message_new(i, FALSE, i)->item);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, MAX_IN_FLIGHT);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 0);
+
+    /* each answer lets the next one go */
+    g_assert_cmpuint(queue_answer(&queue, 0), ==, 0);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    g_assert_cmpuint(queue_answer(&queue, 1), ==, 1);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 0);
+
+    spice_smartcard_queue_clear(&queue, g_free);
+}
+
+static void test_smartcard_queue_out_of_order(void)
+{
+    SpiceSmartcardQueue queue;
+    guint seq = 0;
+
+    spice_smartcard_queue_init(&queue, MAX_IN_FLIGHT);
+
+    /* an ATR on reader 1, a card removal on reader 2, another on reader 1 */
+    spice_smartcard_queue_push(&queue, &message_new(1, FALSE, 0)->item);
+    spice_smartcard_queue_push(&queue, &message_new(2, FALSE, 1)->item);
+    spice_smartcard_queue_push(&queue, &message_new(1, FALSE, 2)->item);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 3);
+
+    /* the devices answer in another order, matched to the oldest command
+     * of their reader */
+    g_assert_cmpuint(queue_answer(&queue, 2), ==, 1);
+    g_assert_cmpuint(queue_answer(&queue, 1), ==, 0);
+    /* an answer for an unknown reader goes to the oldest command */
+    g_assert_cmpuint(queue_answer(&queue, 7), ==, 2);
+    g_assert_null(spice_smartcard_queue_answered(&queue, 1));
+
+    /* an addition waits for all the commands in flight */
+    spice_smartcard_queue_push(&queue, &message_new(1, FALSE, 3)->item);
+    spice_smartcard_queue_push(&queue, &message_new(0, TRUE, 4)->item);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    g_assert_cmpuint(queue_answer(&queue, 1), ==, 3);
+    g_assert_cmpuint(queue_send(&queue, &seq), ==, 1);
+    g_assert_cmpuint(queue_answer(&queue, 3), ==, 4);
+
+    spice_smartcard_queue_clear(&queue, g_free);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/smartcard-queue/reader-add", test_smartcard_queue_reader_add);
+    g_test_add_func("/smartcard-queue/max-in-flight", test_smartcard_queue_max_in_flight);
+    g_test_add_func("/smartcard-queue/out-of-order", test_smartcard_queue_out_of_order);
+
+    return g_test_run();
+}
@@ -0,0 +1,356 @@
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+#include <gio/gio.h>
+#include <gio/gnetworking.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "bio-gio.h"
+
+#define MAX_SIZE (64 * 1024)
+
+/* A request carries @send_size bytes, and is answered with @reply_size
+ * bytes, both filled with pattern(), so that the display channel, mostly
+ * receiving large messages, and the usbredir channel, exchanging small
+ * packets in both directions, can be replayed */
+typedef struct {
+    guint32 send_size;
+    guint32 reply_size;
+} Request;
+
+typedef struct {
+    SSL_CTX *ctx;
+    GSocket *listener;
+    guint16 port;
+    GThread *thread;
+} Server;
+
+typedef struct {
+    GSocketConnection *conn;
+    GSocket *sock;
+    SSL_CTX *ctx;
+    SSL *ssl;
+} Client;
+
+static void pattern(guint8 *data, gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = i % 251;
+    }
+}
+
+/* Waits for what the failed SSL call, that returned @ret, needs, returns
+ * FALSE if it failed for good */
+static gboolean tls_wait(SSL *ssl, GSocket *sock, int ret)
+{
+    GIOCondition cond;
+
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        cond = G_IO_IN;
+        break;
+    case SSL_ERROR_WANT_WRITE:
+        cond = G_IO_OUT;
+        break;
+    default:
+        return FALSE;
+    }
+    g_socket_condition_wait(sock, cond, NULL, NULL);
+    return TRUE;
+}
+
+static void tls_write_all(SSL *ssl, GSocket *sock, const guint8 *data, gsize len)
+{
+    while (len > 0) {
+        int ret = SSL_write(ssl, data, len);
+
+        if (ret > 0) {
+            data += ret;
+            len -= ret;
+        } else {
+            g_assert_true(tls_wait(ssl, sock, ret));
+        }
+    }
+}
+
+static gboolean tls_read_all(SSL *ssl, GSocket *sock, guint8 *data, gsize len)
+{
+    while (len > 0) {
+        int ret = SSL_read(ssl, data, len);
+
+        if (ret > 0) {
+            data += ret;
+            len -= ret;
+        } else if (!tls_wait(ssl, sock, ret)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gpointer server_thread(gpointer user_data)
+{
+    Server *server = user_data;
+    GSocket *sock = g_socket_accept(server->listener, NULL, NULL);
+    SSL *ssl = SSL_new(server->ctx);
+    BIO *bio = BIO_new_socket(g_socket_get_fd(sock), BIO_NOCLOSE);
+    guint8 *expected = g_malloc(MAX_SIZE);
+    guint8 *data = g_malloc(MAX_SIZE);
+    Request request;
+    int ret;
+
+    pattern(expected, MAX_SIZE);
+    g_socket_set_option(sock, IPPROTO_TCP, TCP_NODELAY, 1, NULL);
+    SSL_set_bio(ssl, bio, bio);
+    while ((ret = SSL_accept(ssl)) != 1) {
+        /* the client gives up when kTLS is not supported */
+        if (!tls_wait(ssl, sock, ret))
+            goto end;
+    }
+
+    while (tls_read_all(ssl, sock, (guint8 *)&request, sizeof(request))) {
+        g_assert_cmpuint(request.send_size, <=, MAX_SIZE);
+        g_assert_cmpuint(request.reply_size, <=, MAX_SIZE);
+        g_assert_true(tls_read_all(ssl, sock, data, request.send_size));
+        g_assert_cmpmem(data, request.send_size, expected, request.send_size);
+        tls_write_all(ssl, sock, expected, request.reply_size);
+    }
+
+end:
+    g_free(data);
+    g_free(expected);
+    SSL_free(ssl);
+    g_object_unref(sock);
+    return NULL;
+}
+
+static void server_start(Server *server)
+{
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, 0);
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    EVP_PKEY *key = NULL;
+    X509 *cert = X509_new();
+    X509_NAME *name;
+    GError *error = NULL;
+
+    /* a self-signed certificate, the client does not verify it */
+    g_assert_cmpint(EVP_PKEY_keygen_init(key_ctx), ==, 1);
+    EVP_PKEY_CTX_set_rsa_keygen_bits(key_ctx, 2048);
+    g_assert_cmpint(EVP_PKEY_keygen(key_ctx, &key), ==, 1);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const guchar *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    g_assert_cmpint(X509_sign(cert, key, EVP_sha256()), >, 0);
+
+    server->ctx = SSL_CTX_new(SSLv23_server_method());
+    g_assert_cmpint(SSL_CTX_use_certificate(server->ctx, cert), ==, 1);
+    g_assert_cmpint(SSL_CTX_use_PrivateKey(server->ctx, key), ==, 1);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(server->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    EVP_PKEY_CTX_free(key_ctx);
+
+    server->listener = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                    G_SOCKET_PROTOCOL_TCP, &error);
+    g_assert_no_error(error);
+    g_socket_bind(server->listener, address, TRUE, &error);
+    g_assert_no_error(error);
+    g_socket_listen(server->listener, &error);
+    g_assert_no_error(error);
+    g_object_unref(address);
+    g_object_unref(loopback);
+
+    address = g_socket_get_local_address(server->listener, &error);
+    g_assert_no_error(error);
+    server->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+    g_object_unref(address);
+
+    server->thread = g_thread_new("tls-server", server_thread, server);
+}
+
+static void server_stop(Server *server)
+{
+    g_thread_join(server->thread);
+    g_object_unref(server->listener);
+    SSL_CTX_free(server->ctx);
+}
+
+/* Connects through a kTLS capable socket BIO if @ktls, or through the GIO
+ * stream as without kTLS, returns FALSE if kTLS is not available */
+static gboolean client_connect(Client *client, guint16 port, gboolean ktls)
+{
+    GSocketClient *socket_client = g_socket_client_new();
+    GError *error = NULL;
+    BIO *bio;
+    int ret;
+
+    client->conn = g_socket_client_connect_to_host(socket_client, "127.0.0.1",
+                                                   port, NULL, &error);
+    g_assert_no_error(error);
+    g_object_unref(socket_client);
+    client->sock = g_socket_connection_get_socket(client->conn);
+    g_socket_set_option(client->sock, IPPROTO_TCP, TCP_NODELAY, 1, NULL);
+
+    client->ctx = SSL_CTX_new(SSLv23_method());
+    client->ssl = SSL_new(client->ctx);
+    if (ktls) {
+        bio = bio_new_ktls_socket(client->conn, client->ssl);
+    } else {
+        bio = bio_new_giostream(G_IO_STREAM(client->conn));
+    }
+    if (bio == NULL)
+        return FALSE;
+
+    SSL_set_bio(client->ssl, bio, bio);
+    while ((ret = SSL_connect(client->ssl)) != 1) {
+        g_assert_true(tls_wait(client->ssl, client->sock, ret));
+    }
+
+    return TRUE;
+}
+
+static void client_close(Client *client)
+{
+    SSL_shutdown(client->ssl);
+    g_io_stream_close(G_IO_STREAM(client->conn), NULL, NULL);
+    SSL_free(client->ssl);
+    SSL_CTX_free(client->ctx);
+    g_object_unref(client->conn);
+}
+
+static void client_request(Client *client, const guint8 *data,
+                           guint32 send_size, guint8 *reply, guint32 reply_size)
+{
+    Request request = { send_size, reply_size };
+
+    tls_write_all(client->ssl, client->sock, (guint8 *)&request, sizeof(request));
+    tls_write_all(client->ssl, client->sock, data, send_size);
+    g_assert_true(tls_read_all(client->ssl, client->sock, reply, reply_size));
+}
+
+static void test_tls_loopback(void)
+{
+    guint8 *expected = g_malloc(MAX_SIZE);
+    guint8 *reply = g_malloc(MAX_SIZE);
+    gboolean ktls;
+
+    pattern(expected, MAX_SIZE);
+    for (ktls = FALSE; ktls <= TRUE; ktls++) {
+        Server server;
+        Client client;
+        gboolean send, recv;
+        guint32 size;
+
+        server_start(&server);
+        if (!client_connect(&client, server.port, ktls)) {
+            g_test_message("kTLS is not supported by OpenSSL");
+            client_close(&client);
+            server_stop(&server);
+            continue;
+        }
+        if (bio_get_ktls(SSL_get_wbio(client.ssl), &send, &recv)) {
+            g_test_message("%s, kTLS send: %d, receive: %d",
+                           SSL_get_cipher_name(client.ssl), send, recv);
+        }
+
+        for (size = 1; size <= MAX_SIZE; size *= 4) {
+            memset(reply, 0, size);
+            client_request(&client, expected, size, reply, size);
+            g_assert_cmpmem(reply, size, expected, size);
+        }
+
+        client_close(&client);
+        server_stop(&server);
+    }
+
+    g_free(reply);
+    g_free(expected);
+}
+
+static void test_tls_benchmark(void)
+{
+    static const struct {
+        const gchar *name;
+        guint32 send_size;
+        guint32 reply_size;
+        gsize total;
+    } workloads[] = {
+        { "display", 0, MAX_SIZE, 256 * 1024 * 1024 },
+        { "usbredir", 512, 512, 16 * 1024 * 1024 },
+    };
+    guint8 *data = g_malloc(MAX_SIZE);
+    gboolean ktls;
+    guint i;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        g_free(data);
+        return;
+    }
+
+    pattern(data, MAX_SIZE);
+    for (ktls = FALSE; ktls <= TRUE; ktls++) {
+        for (i = 0; i < G_N_ELEMENTS(workloads); i++) {
+            const gchar *mode = ktls ? "ktls" : "gio";
+            Server server;
+            Client client;
+            gint64 start;
+            clock_t cpu_start;
+            gdouble elapsed, cpu;
+            gsize done, bytes = 0;
+
+            server_start(&server);
+            if (!client_connect(&client, server.port, ktls)) {
+                g_test_message("tls/%s: not supported", mode);
+                client_close(&client);
+                server_stop(&server);
+                continue;
+            }
+
+            start = g_get_monotonic_time();
+            cpu_start = clock();
+            for (done = 0; done < workloads[i].total;
+                 done += workloads[i].send_size + workloads[i].reply_size) {
+                client_request(&client, data, workloads[i].send_size,
+                               data, workloads[i].reply_size);
+                bytes += workloads[i].send_size + workloads[i].reply_size;
+            }
+            elapsed = (g_get_monotonic_time() - start) / 1e6;
+            /* the server thread is counted too, both ends use TLS */
+            cpu = (gdouble)(clock() - cpu_start) / CLOCKS_PER_SEC;
+
+            client_close(&client);
+            server_stop(&server);
+
+            g_test_message("tls/%s/%s: %.1f MB/s, %.0f%% CPU",
+                           mode, workloads[i].name,
+                           bytes / elapsed / 1e6, cpu / elapsed * 100);
+            g_test_maximized_result(bytes / elapsed / 1e6, "tls/%s/%s MB/s",
+                                    mode, workloads[i].name);
+        }
+    }
+
+    g_free(data);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/tls/loopback", test_tls_loopback);
+    g_test_add_func("/tls/benchmark", test_tls_benchmark);
+
+    return g_test_run();
+}
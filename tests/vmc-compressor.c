@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "vmc-compressor.h"
+
+#define PAYLOAD_SIZE 16384
+
+typedef struct {
+    SpiceVmcCompressor *compressor;
+    uint8_t *compressible;
+    uint8_t *random;
+} Fixture;
+
+static void fixture_setup(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    GRand *rand = g_rand_new_with_seed(42);
+    guint i;
+
+    f->compressor = spice_vmc_compressor_new();
+    f->compressible = g_malloc(PAYLOAD_SIZE);
+    f->random = g_malloc(PAYLOAD_SIZE);
+    for (i = 0; i < PAYLOAD_SIZE; i++) {
+        f->compressible[i] = (i / 64) % 7;
+        f->random[i] = g_rand_int(rand);
+    }
+    g_rand_free(rand);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    spice_vmc_compressor_unref(f->compressor);
+    g_free(f->compressible);
+    g_free(f->random);
+}
+
+/* compresses @data, releasing the output at once like a sent message */
+static gboolean compress(Fixture *f, const uint8_t *data, int size)
+{
+    uint8_t *out;
+    int out_size;
+    gpointer opaque;
+
+    if (!spice_vmc_compressor_compress(f->compressor, data, size,
+                                       &out, &out_size, &opaque))
+        return FALSE;
+
+    g_assert_cmpint(out_size, <, size);
+    spice_vmc_compressor_release(out, opaque);
+    return TRUE;
+}
+
+static void test_vmc_compressor_roundtrip(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    SpiceVmcCompressorStats stats;
+    const uint8_t *decompressed;
+    uint8_t *out, *reused;
+    int out_size;
+    gpointer opaque;
+
+    /* too small to bother */
+    g_assert_false(compress(f, f->compressible, 100));
+
+    g_assert_true(spice_vmc_compressor_compress(f->compressor, f->compressible, PAYLOAD_SIZE,
+                                                &out, &out_size, &opaque));
+    decompressed = spice_vmc_compressor_decompress(f->compressor, out, out_size, PAYLOAD_SIZE);
+    g_assert_nonnull(decompressed);
+    g_assert_cmpint(memcmp(decompressed, f->compressible, PAYLOAD_SIZE), ==, 0);
+    spice_vmc_compressor_release(out, opaque);
+
+    /* the released buffer is used for the next payload */
+    g_assert_true(spice_vmc_compressor_compress(f->compressor, f->compressible, PAYLOAD_SIZE,
+                                                &reused, &out_size, &opaque));
+    g_assert_true(reused == out);
+    /* and the decompression buffer too */
+    g_assert_true(spice_vmc_compressor_decompress(f->compressor, reused, out_size,
+                                                  PAYLOAD_SIZE) == decompressed);
+    spice_vmc_compressor_release(reused, opaque);
+
+    /* corrupted data */
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*Decompress Error*");
+    g_assert_null(spice_vmc_compressor_decompress(f->compressor, f->random, 100, PAYLOAD_SIZE));
+    g_test_assert_expected_messages();
+
+    spice_vmc_compressor_get_stats(f->compressor, &stats);
+    g_assert_cmpuint(stats.attempts, ==, 2);
+    g_assert_cmpuint(stats.compressed, ==, 2);
+    g_assert_cmpuint(stats.skipped, ==, 0);
+    g_assert_cmpuint(stats.bytes_in, ==, 2 * PAYLOAD_SIZE);
+    g_assert_cmpuint(stats.bytes_out, <, stats.bytes_in);
+}
+
+static void test_vmc_compressor_adaptive(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    SpiceVmcCompressorStats stats;
+    guint i, attempts = 0, skipped = 0;
+
+    /* random data doesn't compress, the attempts get less and less frequent */
+    for (i = 0; i < 1000; i++)
+        g_assert_false(compress(f, f->random, PAYLOAD_SIZE));
+
+    spice_vmc_compressor_get_stats(f->compressor, &stats);
+    g_assert_cmpuint(stats.compressed, ==, 0);
+    g_assert_cmpuint(stats.attempts + stats.skipped, ==, 1000);
+    g_assert_cmpuint(stats.attempts, <, 20);
+
+    /* compressible data is compressed again after the next retry */
+    for (i = 0; i < 1000 && !compress(f, f->compressible, PAYLOAD_SIZE); i++)
+        ;
+    g_assert_cmpuint(i, <, 1000);
+    for (i = 0; i < 100; i++)
+        g_assert_true(compress(f, f->compressible, PAYLOAD_SIZE));
+
+    spice_vmc_compressor_get_stats(f->compressor, &stats);
+    attempts = stats.attempts;
+    skipped = stats.skipped;
+
+    /* a single poor payload doesn't suspend compression */
+    g_assert_false(compress(f, f->random, PAYLOAD_SIZE));
+    g_assert_true(compress(f, f->compressible, PAYLOAD_SIZE));
+    spice_vmc_compressor_get_stats(f->compressor, &stats);
+    g_assert_cmpuint(stats.attempts, ==, attempts + 2);
+    g_assert_cmpuint(stats.skipped, ==, skipped);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef USE_LZ4
+    g_test_add("/vmc-compressor/roundtrip", Fixture, NULL,
+               fixture_setup, test_vmc_compressor_roundtrip, fixture_teardown);
+    g_test_add("/vmc-compressor/adaptive", Fixture, NULL,
+               fixture_setup, test_vmc_compressor_adaptive, fixture_teardown);
+#endif
+
+    return g_test_run();
+}
@@ -0,0 +1,363 @@
+#include <string.h>
+
+#include "spice-client.h"
+#include "spice-websocket.h"
+
+#define GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* A transport reading from and writing to memory */
+typedef struct {
+    GByteArray *in;
+    gsize in_offset;
+    gsize max_read; /* to split the input in small reads */
+    GByteArray *out;
+    gboolean handshake; /* answer the handshake on the first read */
+    const gchar *status;
+} MemoryIO;
+
+static gchar *accept_key(const gchar *key)
+{
+    GChecksum *sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+    guint8 digest[20];
+    gsize digest_len = sizeof(digest);
+
+    g_checksum_update(sha1, (const guchar *)key, -1);
+    g_checksum_update(sha1, (const guchar *)GUID, -1);
+    g_checksum_get_digest(sha1, digest, &digest_len);
+    g_checksum_free(sha1);
+
+    return g_base64_encode(digest, digest_len);
+}
+
+static void memory_io_answer_handshake(MemoryIO *mio)
+{
+    gchar *request = g_strndup((const gchar *)mio->out->data, mio->out->len);
+    gchar *key = strstr(request, "Sec-WebSocket-Key: ");
+    gchar *accept, *response;
+
+    g_assert_nonnull(key);
+    key += strlen("Sec-WebSocket-Key: ");
+    *strstr(key, "\r\n") = '\0';
+    accept = accept_key(key);
+    response = g_strdup_printf("%s\r\n"
+                               "Upgrade: websocket\r\n"
+                               "Connection: Upgrade\r\n"
+                               "Sec-WebSocket-Accept: %s\r\n"
+                               "\r\n", mio->status, accept);
+    /* before the frames already queued */
+    g_byte_array_prepend(mio->in, (const guint8 *)response, strlen(response));
+    g_byte_array_set_size(mio->out, 0);
+    mio->handshake = FALSE;
+
+    g_free(response);
+    g_free(accept);
+    g_free(request);
+}
+
+static gssize memory_io_read(gpointer user_data, void *data, gsize len)
+{
+    MemoryIO *mio = user_data;
+    gsize n;
+
+    if (mio->handshake)
+        memory_io_answer_handshake(mio);
+
+    n = MIN(len, mio->in->len - mio->in_offset);
+    if (mio->max_read > 0)
+        n = MIN(n, mio->max_read);
+    memcpy(data, mio->in->data + mio->in_offset, n);
+    mio->in_offset += n;
+
+    return n;
+}
+
+static gboolean memory_io_write(gpointer user_data, const void *data, gsize len)
+{
+    MemoryIO *mio = user_data;
+
+    g_byte_array_append(mio->out, data, len);
+    return TRUE;
+}
+
+static void memory_io_init(MemoryIO *mio, SpiceWebSocket *ws)
+{
+    SpiceWebSocketIO io = { memory_io_read, memory_io_write, mio };
+
+    memset(mio, 0, sizeof(*mio));
+    mio->in = g_byte_array_new();
+    mio->out = g_byte_array_new();
+    spice_websocket_init(ws, &io);
+}
+
+static void memory_io_clear(MemoryIO *mio, SpiceWebSocket *ws)
+{
+    spice_websocket_clear(ws);
+    g_byte_array_unref(mio->in);
+    g_byte_array_unref(mio->out);
+}
+
+/* appends a frame, as sent by a server */
+static void frame_append(GByteArray *buf, guint8 opcode, gboolean fin,
+                         const guint8 *mask, const guint8 *payload, gsize len)
+{
+    guint8 header[14];
+    gsize header_len = 2;
+    gsize i;
+
+    header[0] = (fin ? 0x80 : 0) | opcode;
+    header[1] = mask ? 0x80 : 0;
+    if (len < 126) {
+        header[1] |= len;
+    } else if (len <= G_MAXUINT16) {
+        header[1] |= 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        header_len = 4;
+    } else {
+        header[1] |= 127;
+        for (i = 0; i < 8; i++)
+            header[2 + i] = (guint64)len >> ((7 - i) * 8);
+        header_len = 10;
+    }
+    if (mask) {
+        memcpy(header + header_len, mask, 4);
+        header_len += 4;
+    }
+    g_byte_array_append(buf, header, header_len);
+    for (i = 0; i < len; i++) {
+        guint8 b = payload[i] ^ (mask ? mask[i % 4] : 0);
+        g_byte_array_append(buf, &b, 1);
+    }
+}
+
+/* decodes the frame sent by the client at *@offset in @buf */
+static guint8 frame_decode(GByteArray *buf, gsize *offset, GByteArray *payload)
+{
+    const guint8 *p = buf->data + *offset;
+    guint8 opcode = p[0] & 0x0f;
+    guint64 len = p[1] & 0x7f;
+    const guint8 *mask;
+    gsize i;
+
+    g_assert_true(p[0] & 0x80);
+    /* frames sent by the client are masked */
+    g_assert_true(p[1] & 0x80);
+    p += 2;
+    if (len == 126) {
+        len = (p[0] << 8) | p[1];
+        p += 2;
+    } else if (len == 127) {
+        len = 0;
+        for (i = 0; i < 8; i++)
+            len = (len << 8) | p[i];
+        p += 8;
+    }
+    mask = p;
+    p += 4;
+    g_assert_cmpuint(p + len - buf->data, <=, buf->len);
+
+    for (i = 0; i < len; i++) {
+        guint8 b = p[i] ^ mask[i % 4];
+        g_byte_array_append(payload, &b, 1);
+    }
+    *offset = p + len - buf->data;
+
+    return opcode;
+}
+
+static guint8 *data_new(gsize len)
+{
+    guint8 *data = g_malloc(len);
+    gsize i;
+
+    for (i = 0; i < len; i++)
+        data[i] = g_test_rand_int();
+
+    return data;
+}
+
+/* reads @len bytes with reads of at most @chunk bytes */
+static void read_all(SpiceWebSocket *ws, guint8 *data, gsize len, gsize chunk)
+{
+    gsize offset = 0;
+
+    while (offset < len) {
+        gssize n = spice_websocket_read(ws, data + offset, MIN(chunk, len - offset));
+
+        g_assert_cmpint(n, >, 0);
+        offset += n;
+    }
+}
+
+static void test_websocket_read(gconstpointer user_data)
+{
+    const gsize max_read = GPOINTER_TO_SIZE(user_data);
+    /* 7 and 16 bits lengths, and a 64 bits length fragmented */
+    const gsize lens[] = { 1, 125, 126, 300, 65535, 70000, 3 };
+    const guint8 mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    gsize total = 0, offset = 0;
+    guint8 *data, *received;
+    guint i;
+
+    memory_io_init(&mio, &ws);
+    mio.max_read = max_read;
+
+    for (i = 0; i < G_N_ELEMENTS(lens); i++)
+        total += lens[i];
+    data = data_new(total);
+    received = g_malloc(total);
+
+    for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+        gboolean continuation = i == G_N_ELEMENTS(lens) - 1;
+        gboolean fin = i != G_N_ELEMENTS(lens) - 2;
+
+        /* the server could mask its frames */
+        frame_append(mio.in, continuation ? 0x0 : 0x2, fin,
+                     i % 2 ? mask : NULL, data + offset, lens[i]);
+        offset += lens[i];
+    }
+
+    read_all(&ws, received, total, 1000);
+    g_assert_cmpmem(received, total, data, total);
+    g_assert_cmpuint(mio.in_offset, ==, mio.in->len);
+    g_assert_false(spice_websocket_pending(&ws));
+
+    g_free(received);
+    g_free(data);
+    memory_io_clear(&mio, &ws);
+}
+
+static void test_websocket_ping(void)
+{
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    GByteArray *pong = g_byte_array_new();
+    gsize offset = 0;
+    guint8 received[6];
+
+    memory_io_init(&mio, &ws);
+    frame_append(mio.in, 0x2, TRUE, NULL, (const guint8 *)"abc", 3);
+    frame_append(mio.in, 0x9, TRUE, NULL, (const guint8 *)"ping!", 5);
+    frame_append(mio.in, 0x2, TRUE, NULL, (const guint8 *)"def", 3);
+
+    /* the ping is answered, and is not part of the data */
+    read_all(&ws, received, sizeof(received), sizeof(received));
+    g_assert_cmpmem(received, sizeof(received), "abcdef", 6);
+
+    g_assert_cmpuint(frame_decode(mio.out, &offset, pong), ==, 0xa);
+    g_assert_cmpmem(pong->data, pong->len, "ping!", 5);
+    g_assert_cmpuint(offset, ==, mio.out->len);
+
+    g_byte_array_unref(pong);
+    memory_io_clear(&mio, &ws);
+}
+
+static void test_websocket_close(void)
+{
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    GByteArray *status = g_byte_array_new();
+    gsize offset = 0;
+    guint8 received[3];
+
+    memory_io_init(&mio, &ws);
+    frame_append(mio.in, 0x2, TRUE, NULL, (const guint8 *)"abc", 3);
+    frame_append(mio.in, 0x8, TRUE, NULL, (const guint8 *)"\x03\xe8" "bye", 5);
+
+    read_all(&ws, received, sizeof(received), sizeof(received));
+    g_assert_cmpint(spice_websocket_read(&ws, received, sizeof(received)), ==, 0);
+
+    /* the status code is echoed */
+    g_assert_cmpuint(frame_decode(mio.out, &offset, status), ==, 0x8);
+    g_assert_cmpmem(status->data, status->len, "\x03\xe8", 2);
+    g_assert_false(spice_websocket_write(&ws, "abc", 3));
+    g_assert_cmpuint(offset, ==, mio.out->len);
+
+    g_byte_array_unref(status);
+    memory_io_clear(&mio, &ws);
+}
+
+static void test_websocket_write(void)
+{
+    const gsize len = 200000;
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    GByteArray *sent = g_byte_array_new();
+    guint8 *data = data_new(len);
+    gsize offset = 0;
+    guint frames = 0;
+
+    memory_io_init(&mio, &ws);
+    g_assert_true(spice_websocket_write(&ws, data, 10));
+    g_assert_true(spice_websocket_write(&ws, data + 10, len - 10));
+
+    while (offset < mio.out->len) {
+        g_assert_cmpuint(frame_decode(mio.out, &offset, sent), ==, 0x2);
+        frames++;
+    }
+    g_assert_cmpmem(sent->data, sent->len, data, len);
+    /* big writes are split in several frames */
+    g_assert_cmpuint(frames, >, 2);
+
+    g_free(data);
+    g_byte_array_unref(sent);
+    memory_io_clear(&mio, &ws);
+}
+
+static void test_websocket_handshake(void)
+{
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    GError *error = NULL;
+    guint8 received[5];
+
+    memory_io_init(&mio, &ws);
+    mio.handshake = TRUE;
+    mio.status = "HTTP/1.1 101 Switching Protocols";
+    /* a frame coming with the response */
+    frame_append(mio.in, 0x2, TRUE, NULL, (const guint8 *)"hello", 5);
+
+    g_assert_true(spice_websocket_handshake(&ws, "localhost", "/?token=5900", &error));
+    g_assert_no_error(error);
+    g_assert_true(spice_websocket_pending(&ws));
+
+    read_all(&ws, received, sizeof(received), sizeof(received));
+    g_assert_cmpmem(received, sizeof(received), "hello", 5);
+
+    memory_io_clear(&mio, &ws);
+}
+
+static void test_websocket_handshake_refused(void)
+{
+    SpiceWebSocket ws;
+    MemoryIO mio;
+    GError *error = NULL;
+
+    memory_io_init(&mio, &ws);
+    mio.handshake = TRUE;
+    mio.status = "HTTP/1.1 403 Forbidden";
+
+    g_assert_false(spice_websocket_handshake(&ws, "localhost", "/", &error));
+    g_assert_error(error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED);
+    g_clear_error(&error);
+
+    memory_io_clear(&mio, &ws);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/websocket/read", GSIZE_TO_POINTER(0), test_websocket_read);
+    g_test_add_data_func("/websocket/read/small-reads", GSIZE_TO_POINTER(7),
+                         test_websocket_read);
+    g_test_add_func("/websocket/ping", test_websocket_ping);
+    g_test_add_func("/websocket/close", test_websocket_close);
+    g_test_add_func("/websocket/write", test_websocket_write);
+    g_test_add_func("/websocket/handshake", test_websocket_handshake);
+    g_test_add_func("/websocket/handshake/refused", test_websocket_handshake_refused);
+
+    return g_test_run();
+}
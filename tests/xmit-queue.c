@@ -0,0 +1,219 @@
+#include <glib.h>
+
+#include "spice-xmit-queue.h"
+
+#define N_PRODUCERS 4
+#define N_ITEMS 100000
+
+typedef struct {
+    SpiceXmitLink link;
+    guint producer;
+    guint seq;
+} Item;
+
+typedef struct {
+    SpiceXmitQueue queue;
+    GMainLoop *loop;
+    Item *items;
+    guint last_seq[N_PRODUCERS];
+    guint received;
+    guint wakeups;
+} Fixture;
+
+static void fixture_consume(Fixture *f)
+{
+    SpiceXmitLink *link = spice_xmit_queue_pop_all(&f->queue);
+
+    while (link != NULL) {
+        Item *item = (Item *)link;
+
+        link = link->next;
+        /* the items of a producer come out in the order they were pushed */
+        g_assert_cmpuint(item->seq, ==, f->last_seq[item->producer]);
+        f->last_seq[item->producer]++;
+        f->received++;
+    }
+}
+
+static gboolean wakeup_cb(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    f->wakeups++;
+    fixture_consume(f);
+    if (f->received == N_PRODUCERS * N_ITEMS)
+        g_main_loop_quit(f->loop);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void fixture_setup(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    guint i, j;
+
+    spice_xmit_queue_init(&f->queue, NULL, wakeup_cb, f);
+    f->loop = g_main_loop_new(NULL, FALSE);
+    f->items = g_new0(Item, N_PRODUCERS * N_ITEMS);
+    for (i = 0; i < N_PRODUCERS; i++) {
+        for (j = 0; j < N_ITEMS; j++) {
+            f->items[i * N_ITEMS + j].producer = i;
+            f->items[i * N_ITEMS + j].seq = j;
+        }
+    }
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    spice_xmit_queue_destroy(&f->queue);
+    g_main_loop_unref(f->loop);
+    g_free(f->items);
+}
+
+static void test_xmit_queue_order(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    guint i;
+
+    g_assert_true(spice_xmit_queue_is_empty(&f->queue));
+    g_assert_null(spice_xmit_queue_pop_all(&f->queue));
+
+    for (i = 0; i < 3; i++)
+        g_assert_true(spice_xmit_queue_push(&f->queue, &f->items[i].link));
+    g_assert_false(spice_xmit_queue_is_empty(&f->queue));
+
+    /* a single wakeup for the whole batch */
+    while (g_main_context_iteration(NULL, FALSE));
+    g_assert_cmpuint(f->wakeups, ==, 1);
+    g_assert_cmpuint(f->received, ==, 3);
+    g_assert_true(spice_xmit_queue_is_empty(&f->queue));
+}
+
+static void test_xmit_queue_close(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    SpiceXmitLink *link;
+
+    g_assert_true(spice_xmit_queue_push(&f->queue, &f->items[0].link));
+    g_assert_true(spice_xmit_queue_push(&f->queue, &f->items[1].link));
+
+    link = spice_xmit_queue_close(&f->queue);
+    g_assert_true(link == &f->items[0].link);
+    g_assert_true(link->next == &f->items[1].link);
+    g_assert_null(link->next->next);
+
+    g_assert_true(spice_xmit_queue_is_empty(&f->queue));
+    g_assert_false(spice_xmit_queue_push(&f->queue, &f->items[2].link));
+    g_assert_null(spice_xmit_queue_pop_all(&f->queue));
+
+    spice_xmit_queue_open(&f->queue);
+    g_assert_true(spice_xmit_queue_push(&f->queue, &f->items[2].link));
+    g_assert_true(spice_xmit_queue_pop_all(&f->queue) == &f->items[2].link);
+}
+
+typedef struct {
+    Fixture *f;
+    guint producer;
+    GMutex *lock;
+    GQueue *locked_queue;
+} Producer;
+
+static gpointer producer_thread(gpointer user_data)
+{
+    Producer *p = user_data;
+    Item *items = &p->f->items[p->producer * N_ITEMS];
+    guint i;
+
+    for (i = 0; i < N_ITEMS; i++) {
+        g_assert_true(spice_xmit_queue_push(&p->f->queue, &items[i].link));
+    }
+
+    return NULL;
+}
+
+static gdouble run_producers(Fixture *f, GThreadFunc func, GMutex *lock, GQueue *locked_queue)
+{
+    GThread *threads[N_PRODUCERS];
+    Producer producers[N_PRODUCERS];
+    GTimer *timer = g_timer_new();
+    gdouble elapsed;
+    guint i;
+
+    for (i = 0; i < N_PRODUCERS; i++) {
+        producers[i].f = f;
+        producers[i].producer = i;
+        producers[i].lock = lock;
+        producers[i].locked_queue = locked_queue;
+        threads[i] = g_thread_new("producer", func, &producers[i]);
+    }
+    if (locked_queue == NULL)
+        g_main_loop_run(f->loop);
+    for (i = 0; i < N_PRODUCERS; i++)
+        g_thread_join(threads[i]);
+
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+static void test_xmit_queue_contention(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    gdouble elapsed = run_producers(f, producer_thread, NULL, NULL);
+
+    g_assert_cmpuint(f->received, ==, N_PRODUCERS * N_ITEMS);
+    g_assert_cmpuint(f->wakeups, <=, f->received);
+    g_test_message("%u items from %u threads in %u wakeups, %.3f s",
+                   f->received, N_PRODUCERS, f->wakeups, elapsed);
+}
+
+/* The same producers, with the mutex and GQueue that were used before */
+static gpointer locked_producer_thread(gpointer user_data)
+{
+    Producer *p = user_data;
+    Item *items = &p->f->items[p->producer * N_ITEMS];
+    guint i;
+
+    for (i = 0; i < N_ITEMS; i++) {
+        g_mutex_lock(p->lock);
+        g_queue_push_tail(p->locked_queue, &items[i]);
+        g_mutex_unlock(p->lock);
+    }
+
+    return NULL;
+}
+
+static void test_xmit_queue_benchmark(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    GMutex lock;
+    GQueue locked_queue = G_QUEUE_INIT;
+    gdouble lockfree, locked;
+
+    if (!g_test_perf()) {
+        g_test_skip("run with -m perf");
+        return;
+    }
+
+    lockfree = run_producers(f, producer_thread, NULL, NULL);
+
+    g_mutex_init(&lock);
+    locked = run_producers(f, locked_producer_thread, &lock, &locked_queue);
+    g_assert_cmpuint(g_queue_get_length(&locked_queue), ==, N_PRODUCERS * N_ITEMS);
+    g_queue_clear(&locked_queue);
+    g_mutex_clear(&lock);
+
+    g_test_minimized_result(lockfree, "lock-free queue: %.3f s, %u wakeups", lockfree, f->wakeups);
+    g_test_message("mutex + GQueue: %.3f s", locked);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/xmit-queue/order", Fixture, NULL,
+               fixture_setup, test_xmit_queue_order, fixture_teardown);
+    g_test_add("/xmit-queue/close", Fixture, NULL,
+               fixture_setup, test_xmit_queue_close, fixture_teardown);
+    g_test_add("/xmit-queue/contention", Fixture, NULL,
+               fixture_setup, test_xmit_queue_contention, fixture_teardown);
+    g_test_add("/xmit-queue/benchmark", Fixture, NULL,
+               fixture_setup, test_xmit_queue_benchmark, fixture_teardown);
+
+    return g_test_run();
+}
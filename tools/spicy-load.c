@@ -0,0 +1,380 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Opens many sessions to the same server at once, each from its own thread
+ * and main context, and lets the library decode everything the server
+ * sends without any widget. At exit, it reports for each session:
+ *  - the bytes read and the resulting throughput,
+ *  - the display updates per second,
+ *  - the percentiles of the time spent handling the display messages
+ *    (drawing on the canvas, decoding GLZ/JPEG/... images and queueing
+ *    the video frames),
+ *  - the CPU time of the session thread and the resident set of the
+ *    process.
+ */
+#include "config.h"
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spice-client.h"
+#include "spice-common.h"
+#include "spice-cmdline.h"
+
+/* config */
+static gboolean version = FALSE;
+static gint n_sessions = 1;
+static gint duration = 0;
+static gboolean audio = FALSE;
+
+/* state */
+typedef struct {
+    guint id;
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    SpiceSession *session;
+
+    gboolean failed;
+    gint64 start;
+    gint64 end;
+    gint64 cpu_time;
+    guint64 read_bytes;
+    guint updates;
+    gsize rss; /* of the process, when the session ended */
+    GArray *handle_times; /* guint32, in microseconds */
+} LoadSession;
+
+static gint quitting;
+static void (*display_handle_msg)(SpiceChannel *channel, SpiceMsgIn *msg);
+
+/* ------------------------------------------------------------------ */
+static gint64 thread_cpu_time(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
+/* in kilobytes, 0 if unknown */
+static gsize process_rss(void)
+{
+    gchar *statm = NULL;
+    gsize rss = 0;
+
+    if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+        gchar **fields = g_strsplit(statm, " ", 3);
+
+        if (fields[0] != NULL && fields[1] != NULL)
+            rss = g_ascii_strtoull(fields[1], NULL, 10) * sysconf(_SC_PAGESIZE) / 1024;
+        g_strfreev(fields);
+        g_free(statm);
+    }
+
+    return rss;
+}
+
+/* coroutine context: wraps the message handler of the display channels */
+static void load_display_handle_msg(SpiceChannel *channel, SpiceMsgIn *msg)
+{
+    LoadSession *ls = g_object_get_data(G_OBJECT(channel), "spicy-load");
+    gint64 start = g_get_monotonic_time();
+    guint32 elapsed;
+
+    display_handle_msg(channel, msg);
+
+    if (ls == NULL)
+        return;
+    elapsed = MIN(g_get_monotonic_time() - start, G_MAXUINT32);
+    g_array_append_val(ls->handle_times, elapsed);
+}
+
+static void display_invalidate(SpiceChannel *channel,
+                               gint x, gint y, gint w, gint h,
+                               gpointer data)
+{
+    LoadSession *ls = data;
+
+    ls->updates++;
+}
+
+static void main_channel_event(SpiceChannel *channel, SpiceChannelEvent event,
+                               gpointer data)
+{
+    LoadSession *ls = data;
+
+    switch (event) {
+    case SPICE_CHANNEL_OPENED:
+        break;
+    default:
+        g_warning("session %u: main channel event: %u", ls->id, event);
+        ls->failed = (event != SPICE_CHANNEL_CLOSED);
+        g_main_loop_quit(ls->loop);
+    }
+}
+
+static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data)
+{
+    LoadSession *ls = data;
+
+    if (SPICE_IS_MAIN_CHANNEL(channel)) {
+        g_signal_connect(channel, "channel-event",
+                         G_CALLBACK(main_channel_event), ls);
+    }
+
+    if (SPICE_IS_DISPLAY_CHANNEL(channel)) {
+        g_object_set_data(G_OBJECT(channel), "spicy-load", ls);
+        g_signal_connect(channel, "display-invalidate",
+                         G_CALLBACK(display_invalidate), ls);
+    }
+
+    if (SPICE_IS_PLAYBACK_CHANNEL(channel) && !audio)
+        return;
+
+    spice_channel_connect(channel);
+}
+
+static gboolean check_quit(gpointer data)
+{
+    LoadSession *ls = data;
+
+    if (g_atomic_int_get(&quitting))
+        g_main_loop_quit(ls->loop);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean duration_elapsed(gpointer data)
+{
+    LoadSession *ls = data;
+
+    g_main_loop_quit(ls->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void attach_timeout(LoadSession *ls, GSource *source, GSourceFunc func)
+{
+    g_source_set_callback(source, func, ls, NULL);
+    g_source_attach(source, ls->context);
+    g_source_unref(source);
+}
+
+static gpointer session_thread(gpointer data)
+{
+    LoadSession *ls = data;
+    GList *iter, *list;
+    gint64 cpu_start;
+
+    g_main_context_push_thread_default(ls->context);
+
+    ls->session = g_object_new(SPICE_TYPE_SESSION,
+                               "main-context", ls->context,
+                               NULL);
+    g_signal_connect(ls->session, "channel-new",
+                     G_CALLBACK(channel_new), ls);
+    spice_cmdline_session_setup(ls->session);
+    if (audio)
+        spice_audio_get(ls->session, ls->context);
+
+    attach_timeout(ls, g_timeout_source_new(100), check_quit);
+    if (duration > 0)
+        attach_timeout(ls, g_timeout_source_new_seconds(duration), duration_elapsed);
+
+    cpu_start = thread_cpu_time();
+    ls->start = g_get_monotonic_time();
+    if (spice_session_connect(ls->session)) {
+        g_main_loop_run(ls->loop);
+    } else {
+        g_warning("session %u: spice_session_connect failed", ls->id);
+        ls->failed = TRUE;
+    }
+    ls->end = g_get_monotonic_time();
+    ls->cpu_time = thread_cpu_time() - cpu_start;
+    ls->rss = process_rss();
+
+    list = spice_session_get_channels(ls->session);
+    for (iter = list; iter; iter = iter->next) {
+        gulong total_read_bytes;
+
+        g_object_get(iter->data, "total-read-bytes", &total_read_bytes, NULL);
+        ls->read_bytes += total_read_bytes;
+    }
+    g_list_free(list);
+
+    spice_session_disconnect(ls->session);
+    g_clear_object(&ls->session);
+    /* let the channels finish their cleanup */
+    while (g_main_context_iteration(ls->context, FALSE));
+
+    g_main_context_pop_thread_default(ls->context);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+static gint compare_guint32(gconstpointer a, gconstpointer b)
+{
+    guint32 ua = *(const guint32 *)a, ub = *(const guint32 *)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+static guint32 percentile(GArray *sorted, guint p)
+{
+    if (sorted->len == 0)
+        return 0;
+
+    return g_array_index(sorted, guint32, (sorted->len - 1) * p / 100);
+}
+
+static void report(LoadSession *ls)
+{
+    gdouble seconds = MAX(ls->end - ls->start, 1) / (gdouble)G_USEC_PER_SEC;
+
+    g_array_sort(ls->handle_times, compare_guint32);
+    printf("%4u %s %8.1f %10.0f %8.1f %8u %6u %6u %6u %6u %8.2f\n",
+           ls->id, ls->failed ? "!" : " ", seconds,
+           ls->read_bytes / seconds / 1024, ls->updates / seconds,
+           ls->handle_times->len,
+           percentile(ls->handle_times, 50), percentile(ls->handle_times, 90),
+           percentile(ls->handle_times, 99), percentile(ls->handle_times, 100),
+           ls->cpu_time / (gdouble)G_USEC_PER_SEC);
+}
+
+static GOptionEntry app_entries[] = {
+    {
+        .long_name        = "sessions",
+        .short_name       = 'n',
+        .arg              = G_OPTION_ARG_INT,
+        .arg_data         = &n_sessions,
+        .description      = "Number of sessions to open at once (default 1)",
+        .arg_description  = "<n>",
+    },{
+        .long_name        = "duration",
+        .short_name       = 'd',
+        .arg              = G_OPTION_ARG_INT,
+        .arg_data         = &duration,
+        .description      = "Disconnect after this many seconds (default: on SIGINT)",
+        .arg_description  = "<seconds>",
+    },{
+        .long_name        = "audio",
+        .arg              = G_OPTION_ARG_NONE,
+        .arg_data         = &audio,
+        .description      = "Play back the audio, see SPICE_GST_AUDIOSINK",
+    },{
+        .long_name        = "version",
+        .arg              = G_OPTION_ARG_NONE,
+        .arg_data         = &version,
+        .description      = "Display version and quit",
+    },{
+        /* end of list */
+    }
+};
+
+static void
+signal_handler(int signum)
+{
+    g_atomic_int_set(&quitting, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+    SpiceChannelClass *display_class;
+    LoadSession *sessions;
+    gsize rss_start, rss_end = 0;
+    gint i;
+
+    signal(SIGINT, signal_handler);
+
+    /* parse opts */
+    context = g_option_context_new(NULL);
+    g_option_context_set_summary(context, "A Spice client opening many sessions at once, "
+                                 "to measure how the decoding scales.");
+    g_option_context_set_description(context, "Report bugs to " PACKAGE_BUGREPORT ".");
+    g_option_context_set_main_group(context, spice_cmdline_get_option_group());
+    g_option_context_add_main_entries(context, app_entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_print("option parsing failed: %s\n", error->message);
+        exit(1);
+    }
+
+    if (version) {
+        g_print("spicy-load " PACKAGE_VERSION "\n");
+        exit(0);
+    }
+
+    if (n_sessions < 1) {
+        g_print("invalid number of sessions: %d\n", n_sessions);
+        exit(1);
+    }
+
+    /* without a sink given, play the audio as fast as it comes */
+    if (audio)
+        g_setenv("SPICE_GST_AUDIOSINK",
+                 "appsrc name=\"appsrc\" ! fakesink name=\"audiosink\" sync=false", FALSE);
+
+    display_class = g_type_class_ref(SPICE_TYPE_DISPLAY_CHANNEL);
+    display_handle_msg = display_class->handle_msg;
+    display_class->handle_msg = load_display_handle_msg;
+
+    rss_start = process_rss();
+    sessions = g_new0(LoadSession, n_sessions);
+    for (i = 0; i < n_sessions; i++) {
+        LoadSession *ls = &sessions[i];
+        gchar *name = g_strdup_printf("session-%d", i);
+
+        ls->id = i;
+        ls->context = g_main_context_new();
+        ls->loop = g_main_loop_new(ls->context, FALSE);
+        ls->handle_times = g_array_new(FALSE, FALSE, sizeof(guint32));
+        ls->thread = g_thread_new(name, session_thread, ls);
+        g_free(name);
+    }
+
+    for (i = 0; i < n_sessions; i++) {
+        g_thread_join(sessions[i].thread);
+        rss_end = MAX(rss_end, sessions[i].rss);
+    }
+
+    printf("%4s %s %8s %10s %8s %8s %6s %6s %6s %6s %8s\n",
+           "id", " ", "time(s)", "read(kB/s)", "upd/s", "msgs",
+           "p50us", "p90us", "p99us", "maxus", "cpu(s)");
+    for (i = 0; i < n_sessions; i++)
+        report(&sessions[i]);
+    printf("resident set: %" G_GSIZE_FORMAT " kB at start, %" G_GSIZE_FORMAT
+           " kB while connected, %" G_GSIZE_FORMAT " kB per session\n",
+           rss_start, rss_end, rss_end > rss_start ? (rss_end - rss_start) / n_sessions : 0);
+
+    for (i = 0; i < n_sessions; i++) {
+        g_array_unref(sessions[i].handle_times);
+        g_main_loop_unref(sessions[i].loop);
+        g_main_context_unref(sessions[i].context);
+    }
+    g_free(sessions);
+    g_type_class_unref(display_class);
+    g_option_context_free(context);
+
+    return 0;
+}
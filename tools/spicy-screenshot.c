@@ -29,29 +29,16 @@ static gboolean version = FALSE;
 static SpiceSession  *session;
 static GMainLoop     *mainloop;
 
-enum SpiceSurfaceFmt d_format;
-gint                 d_width, d_height, d_stride;
-gpointer             d_data;
+/* the screen, in the layout of a PPM image */
+static guint8       *frame;
+static gint          frame_width, frame_height;
 
 /* ------------------------------------------------------------------ */
 
-static void primary_create(SpiceChannel *channel, gint format,
-                           gint width, gint height, gint stride,
-                           gint shmid, gpointer imgdata, gpointer data)
-{
-    SPICE_DEBUG("%s: %dx%d, format %d", __FUNCTION__, width, height, format);
-    d_format = format;
-    d_width  = width;
-    d_height = height;
-    d_stride = stride;
-    d_data   = imgdata;
-}
-
-static int write_ppm_32(void)
+static int write_ppm(void)
 {
     FILE *fp;
-    uint8_t *p;
-    int n;
+    gsize size = (gsize)frame_width * frame_height * 3;
 
     fp = fopen(outf,"w");
     if (NULL == fp) {
@@ -59,40 +46,64 @@ static int write_ppm_32(void)
 	return -1;
     }
     fprintf(fp, "P6\n%d %d\n255\n",
-            d_width, d_height);
-    n = d_width * d_height;
-    p = d_data;
-    while (n > 0) {
-#ifdef WORDS_BIGENDIAN
-        fputc(p[1], fp);
-        fputc(p[2], fp);
-        fputc(p[3], fp);
-#else
-        fputc(p[2], fp);
-        fputc(p[1], fp);
-        fputc(p[0], fp);
-#endif
-        p += 4;
-        n--;
+            frame_width, frame_height);
+    if (fwrite(frame, 1, size, fp) != size) {
+        fprintf(stderr, "%s: can't write %s: %s\n", g_get_prgname(), outf, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: can't write %s: %s\n", g_get_prgname(), outf, strerror(errno));
+        return -1;
     }
-    fclose(fp);
     return 0;
 }
 
+/* copies the areas that changed since the last update to the frame */
+static gboolean update_frame(SpiceDisplayChannel *channel)
+{
+    SpiceDisplayPrimary primary;
+    GArray *damage;
+    guint i;
+    gboolean ok = TRUE;
+
+    damage = spice_display_channel_take_damage(channel, &primary);
+    if (damage == NULL)
+        return FALSE;
+
+    if (frame == NULL || primary.width != frame_width || primary.height != frame_height) {
+        g_free(frame);
+        frame_width = primary.width;
+        frame_height = primary.height;
+        frame = g_malloc0((gsize)frame_width * frame_height * 3);
+        /* the whole surface is needed again */
+        g_array_set_size(damage, 1);
+        g_array_index(damage, SpiceDisplayRect, 0) = (SpiceDisplayRect) {
+            0, 0, frame_width, frame_height
+        };
+    }
+
+    for (i = 0; i < damage->len && ok; i++) {
+        ok = spice_display_channel_copy_primary(channel,
+                                                &g_array_index(damage, SpiceDisplayRect, i),
+                                                SPICE_DISPLAY_BUFFER_FORMAT_RGB24,
+                                                frame, frame_width * 3);
+    }
+    g_array_unref(damage);
+
+    return ok;
+}
+
 static void invalidate(SpiceChannel *channel,
                        gint x, gint y, gint w, gint h, gpointer *data)
 {
-    int rc;
+    int rc = -1;
+
+    if (update_frame(SPICE_DISPLAY_CHANNEL(channel)))
+        rc = write_ppm();
+    else
+        fprintf(stderr, "can't read the primary surface, or unsupported format\n");
 
-    switch (d_format) {
-    case SPICE_SURFACE_FMT_32_xRGB:
-        rc = write_ppm_32();
-        break;
-    default:
-        fprintf(stderr, "unsupported spice surface format %u\n", d_format);
-        rc = -1;
-        break;
-    }
     if (rc == 0)
         fprintf(stderr, "wrote screen shot to %s\n", outf);
     g_main_loop_quit(mainloop);
@@ -127,8 +138,6 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer *data)
     if (id != 0)
         return;
 
-    g_signal_connect(channel, "display-primary-create",
-                     G_CALLBACK(primary_create), NULL);
     g_signal_connect(channel, "display-invalidate",
                      G_CALLBACK(invalidate), NULL);
     spice_channel_connect(channel);
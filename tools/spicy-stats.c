@@ -23,6 +23,7 @@
 
 /* config */
 static gboolean version = FALSE;
+static gboolean input_latency = FALSE;
 
 /* state */
 static SpiceSession  *session;
@@ -60,6 +61,28 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer *data)
     spice_channel_connect(channel);
 }
 
+static void print_input_latency(void)
+{
+    static const char *stages[] = { "received", "invalidated", "painted" };
+    int stage;
+    guint i;
+
+    printf("input latency (ms):\n");
+    for (stage = SPICE_INPUT_LATENCY_RECEIVED; stage <= SPICE_INPUT_LATENCY_PAINTED; stage++) {
+        GArray *histogram = spice_session_get_input_latency(session, stage);
+
+        printf("%s:", stages[stage]);
+        for (i = 0; i < histogram->len; i++) {
+            if (i == histogram->len - 1)
+                printf(" >=%u: %u", 1u << (i - 1), g_array_index(histogram, guint, i));
+            else
+                printf(" <%u: %u", 1u << i, g_array_index(histogram, guint, i));
+        }
+        printf("\n");
+        g_array_unref(histogram);
+    }
+}
+
 /* ------------------------------------------------------------------ */
 
 static GOptionEntry app_entries[] = {
@@ -69,6 +92,12 @@ static GOptionEntry app_entries[] = {
         .arg_data         = &version,
         .description      = "Display version and quit",
     },
+    {
+        .long_name        = "input-latency",
+        .arg              = G_OPTION_ARG_NONE,
+        .arg_data         = &input_latency,
+        .description      = "Measure the input latency, and display its histograms",
+    },
     {
         /* end of list */
     }
@@ -109,6 +138,7 @@ int main(int argc, char *argv[])
     g_signal_connect(session, "channel-new",
                      G_CALLBACK(channel_new), NULL);
     spice_cmdline_session_setup(session);
+    g_object_set(session, "input-latency-tracking", input_latency, NULL);
 
     if (!spice_session_connect(session)) {
         fprintf(stderr, "spice_session_connect failed\n");
@@ -129,8 +159,22 @@ int main(int argc, char *argv[])
             printf("%s: %lu\n",
                    spice_channel_type_to_string(channel_type),
                    total_read_bytes);
+            if (SPICE_IS_SMARTCARD_CHANNEL(iter->data)) {
+                guint64 wait_time;
+                guint acked;
+
+                g_object_get(iter->data,
+                    "message-wait-time", &wait_time,
+                    "acked-messages", &acked,
+                    NULL);
+                if (acked > 0)
+                    printf("  %u commands, %.1f ms average wait\n",
+                           acked, wait_time / 1000.0 / acked);
+            }
         }
         g_list_free(list);
     }
+    if (input_latency)
+        print_input_latency();
     return 0;
 }